@@ -31,7 +31,7 @@ static int g_cpu_identified = 0;
 
 #define KLOGF_PREFIX "cpu: "
 
-_INIT static void cpu_set_common_features(u32 edx)
+_INIT static void cpu_set_common_features(u32 ecx, u32 edx)
 {
     g_cpufeatures.fpu = edx & 1;
     g_cpufeatures.vme = (edx >> 1) & 1;
@@ -56,6 +56,7 @@ _INIT static void cpu_set_common_features(u32 edx)
     g_cpufeatures.sse = (edx >> 25) & 1;
     g_cpufeatures.sse2 = (edx >> 26) & 1;
     g_cpufeatures.htt = (edx >> 28) & 1;
+    g_cpufeatures.pcid = (ecx >> 17) & 1;
 }
 
 _INIT static void cpu_handle_amd_cpuid()
@@ -84,7 +85,7 @@ _INIT static void cpu_handle_amd_cpuid()
         g_cpuinfo.model = f1eax.ext_model * 0x10 + f1eax.base_model;
     }
 
-    cpu_set_common_features(edx);
+    cpu_set_common_features(ecx, edx);
 }
 
 _INIT static void cpu_handle_intel_cpuid()
@@ -103,7 +104,7 @@ _INIT static void cpu_handle_intel_cpuid()
     g_cpuinfo.model = (f1eax.extended_model << 4) + f1eax.model_number;
     g_cpuinfo.stepping = f1eax.stepping_id;
 
-    cpu_set_common_features(edx);
+    cpu_set_common_features(ecx, edx);
     /* Intel specific features. */
     g_cpufeatures.psn = (edx >> 18) & 1;
     g_cpufeatures.ds = (edx >> 21) & 1;
@@ -237,6 +238,15 @@ _INIT void cpu_write_msr(u64 val, CPUMSR msr)
                      : "d"((u32)(val >> 32)), "a"((u32)val), "c"((u32)msr));
 }
 
+u64 cpu_read_cycle_counter()
+{
+    if (!cpu_has_feature(CPU_TSC))
+        return 0;
+    u32 hi, lo;
+    __asm__ volatile("rdtsc" : "=d"(hi), "=a"(lo));
+    return ((u64)hi << 32) | lo;
+}
+
 void cpu_suspend()
 {
     __asm__ volatile("hlt");
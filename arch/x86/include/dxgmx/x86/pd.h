@@ -30,13 +30,16 @@ typedef struct _ATTR_PACKED S_PageDirectoryEntry
     u8 accessed : 1;
     /* Must be 0. */
     u8 zero : 1;
-    /* 1 if the pages in this directory are 4MiB, 0 if they are 4KiB. */
+    /* 1 if this entry maps a 2MiB page directly, 0 if it points to a page
+     * table of 4KiB pages. */
     u8 page_size : 1;
-    /* Ignored. */
-    u8 ignored : 1;
+    /* 1 if the large page should be kept in the TLB between page dir flushes.
+     * Ignored if 'page_size' is not set. */
+    u8 global : 1;
     /* Free for use. */
     u8 unused : 3;
-    /* 4KiB aligned base address of the page table. */
+    /* 4KiB aligned base address of the page table, or 2MiB aligned base
+     * address of the page frame if 'page_size' is set. */
     u64 table_base : 50;
     /* Should be 0. */
     u8 reserved : 1;
@@ -81,7 +84,7 @@ void pde_set_pt_vaddr(ptr vaddr, pde_t* pde);
  * 'pde' The target pde.
  *
  * Returns:
- * The virtual address of the page table.
+ * The physical address of the page table, 0 if the pde maps a large page.
  */
 ptr pde_pt_paddr(pde_t* pde);
 
@@ -91,10 +94,29 @@ ptr pde_pt_paddr(pde_t* pde);
  * 'pde' The target pde.
  *
  * Returns:
- * The virtual address of the page table.
+ * The virtual address of the page table, NULL if the pde maps a large page.
  */
 pt_t* pde_pt_vaddr(pde_t* pde);
 
+/**
+ * Make the pde map a large page frame directly.
+ *
+ * 'paddr' The 2MiB aligned physical address of the frame.
+ * 'pde' The target pde.
+ */
+void pde_set_frame_paddr(ptr paddr, pde_t* pde);
+
+/**
+ * Get the address of the large page frame mapped by a pde.
+ *
+ * 'pde' The target pde.
+ *
+ * Returns:
+ * The physical address of the page frame, 0 if the pde doesn't map a large
+ * page.
+ */
+ptr pde_frame_paddr(pde_t* pde);
+
 /**
  * Get the pde in which 'vaddr' falls.
  *
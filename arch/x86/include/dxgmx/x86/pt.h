@@ -32,8 +32,12 @@ typedef struct _ATTR_PACKED S_PageTableEntry
     u8 pat_memtype : 1;
     /* 1 if the page should be kept in the TLB between page dir flushes. */
     u8 global : 1;
-    /* Free for use. */
-    u8 unused : 3;
+    /* Free for use. We use the first one for PAGE_COW, and the second one to
+     * mark non present entries whose page was swapped out. Those keep the
+     * rest of their flags, and frame_base holds the swap slot. */
+    u8 cow : 1;
+    u8 swapped : 1;
+    u8 unused : 1;
     /* 4KiB or 4MiB aligned address of the page frame. */
     u64 frame_base : 50;
     /* Should be 0 */
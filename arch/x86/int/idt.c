@@ -7,6 +7,7 @@
 #include <dxgmx/generated/kconfig.h>
 #include <dxgmx/interrupts.h>
 #include <dxgmx/panic.h>
+#include <dxgmx/proc/procm.h>
 #include <dxgmx/types.h>
 #include <dxgmx/x86/exceptions.h>
 #include <dxgmx/x86/gdt.h>
@@ -91,12 +92,23 @@ static _ATTR_USED bool idt_is_irq_spurious()
     return isr1 == 0 && isr2 == 0;
 }
 
+/* Runs right before returning from any interrupt, with the frame of whatever
+ * was interrupted. This is where userspace gets preempted. */
+static _ATTR_USED void idt_int_exit(InterruptFrame* frame)
+{
+    /* The kernel is not preemptible, it gets preempted once it's done and
+     * about to go back to userspace. */
+    if ((frame->xcs & 3) == 3)
+        procm_sched_preempt();
+}
+
 /* Generic interrupt exit. */
 // clang-format off
 __asm__(
     ".type int_common_exit, @function  \n"
     ".local int_common_exit            \n"
     "int_common_exit:                  \n"
+        "call idt_int_exit             \n"
         JUMP_OVER_SIZE_T_INT // jump over interrupt frame*
         POP_REGISTERS_INT
         JUMP_OVER_SIZE_T_INT // jump over code
@@ -8,6 +8,9 @@
 #include <dxgmx/x86/idt.h>
 #include <dxgmx/x86/pic.h>
 
+/* Interrupt enable flag. */
+#define EFLAGS_IF (1 << 9)
+
 _ATTR_ALWAYS_INLINE void interrupts_disable_irqs()
 {
     __asm__ volatile("cli");
@@ -18,6 +21,37 @@ _ATTR_ALWAYS_INLINE void interrupts_enable_irqs()
     __asm__ volatile("sti");
 }
 
+bool interrupts_disable_irqs_save()
+{
+    size_t flags;
+    __asm__ volatile("pushf       \n"
+                     "pop %0      \n"
+                     "cli         \n"
+                     : "=r"(flags)
+                     :
+                     : "memory");
+
+    return flags & EFLAGS_IF;
+}
+
+void interrupts_restore_irqs(bool enabled)
+{
+    if (enabled)
+        interrupts_enable_irqs();
+}
+
+void interrupts_wait_irq()
+{
+    /* sti only takes effect after the next instruction, so nothing can come in
+     * between it and hlt. */
+    __asm__ volatile("sti \n"
+                     "hlt \n"
+                     "cli \n"
+                     :
+                     :
+                     : "memory");
+}
+
 int interrupts_reqister_irq_isr(intn_t n, isr_t isr)
 {
     /* The only difference between x86isr_t and an isr_t is that x86isr_t has
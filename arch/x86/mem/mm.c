@@ -15,6 +15,7 @@
 #include <dxgmx/mem/dma.h>
 #include <dxgmx/mem/falloc.h>
 #include <dxgmx/mem/heap.h>
+#include <dxgmx/mem/mem_limits.h>
 #include <dxgmx/mem/mm.h>
 #include <dxgmx/mem/mregmap.h>
 #include <dxgmx/mem/pagefault.h>
@@ -30,6 +31,13 @@
 
 #define KLOGF_PREFIX "mm: "
 
+/* Mark the kernel's pages as global, so they survive page dir switches. */
+#define MM_GLOBAL_KERNEL_PAGES 1
+
+/* Range operations touching more pages than this flush the whole TLB once,
+ * instead of flushing every page. */
+#define MM_TLB_FLUSH_ALL_THRESHOLD 32
+
 #define PS2PDPT(_ps) ((pdpt_t*)(_ps->data))
 
 #define FOR_EACH_PTE_IN_RANGE(s, e, pt, pte)                                   \
@@ -41,6 +49,9 @@
         for (ptr _i = s; _i < e;                                               \
              _i += PAGESIZE, pte = pte_from_vaddr_abs(_i, g_pdpt))
 
+/* True if CR4.PGE is on, see mm_enable_global_pages(). */
+static bool g_global_pages;
+
 static void mm_tlb_flush_single(ptr vaddr)
 {
     __asm__ volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
@@ -74,6 +85,80 @@ static pte_t* pte_from_vaddr_abs(ptr vaddr, const pdpt_t* pdpt)
     return pt ? pte_from_vaddr(vaddr, pt) : NULL;
 }
 
+/* The kernel's page directory is shared by every paging struct (see
+ * mm_map_kernel_into_paging_struct_arch()), so anything mapped in there looks
+ * the same in every address space, and can be global. */
+static bool mm_is_global_vaddr(ptr vaddr)
+{
+    return g_global_pages && vaddr >= MEM_KERNEL_SPACE_VA_START;
+}
+
+/* Returns the pde for 'vaddr' if it maps a large page, NULL otherwise. */
+static pde_t* large_pde_from_vaddr_abs(ptr vaddr, const pdpt_t* pdpt)
+{
+    pde_t* pde = pde_from_vaddr_abs(vaddr, pdpt);
+    return pde && pde->present && pde->page_size ? pde : NULL;
+}
+
+static u16 mm_large_pde_flags(const pde_t* pde)
+{
+    u16 flags = PAGE_PRESENT | PAGE_R | PAGE_LARGE;
+    if (pde->writable)
+        flags |= PAGE_W;
+    if (!pde->exec_disable)
+        flags |= PAGE_X;
+    if (pde->user_access)
+        flags |= PAGE_USER;
+
+    return flags;
+}
+
+/* Turn the large page mapped by 'pde' into a page table that maps the same
+ * frames with the same permissions, so that single pages can be changed. */
+static int mm_split_large_page(ptr vaddr, pde_t* pde)
+{
+    pt_t* pt = mm_alloc_linear(sizeof(pt_t), PAGESIZE);
+    if (!pt)
+        return -ENOMEM;
+
+    pt_init(pt);
+
+    const ptr frame = pde_frame_paddr(pde);
+    for (size_t i = 0; i < LARGE_PAGESIZE / PAGESIZE; ++i)
+    {
+        pte_t* pte = &pt->entries[i];
+        pte_set_frame_paddr(frame + i * PAGESIZE, pte);
+        pte->present = true;
+        pte->writable = pde->writable;
+        pte->user_access = pde->user_access;
+        pte->writehrough = pde->writehrough;
+        pte->cache_disabled = pde->cache_disabled;
+        pte->exec_disable = pde->exec_disable;
+        pte->global = pde->global;
+    }
+
+    /* Only the low half of the pde changes, so the cpu never sees a half
+     * written entry, even if something in this range is touched from an
+     * interrupt. */
+    pde_t newpde = *pde;
+    newpde.page_size = false;
+    newpde.global = false;
+    pde_set_pt_vaddr((ptr)pt, &newpde);
+    *pde = newpde;
+
+    /* invlpg drops every TLB entry of the large page, not just the one for
+     * 'vaddr'. */
+    mm_tlb_flush_single(bytes_align_down64(vaddr, LARGE_PAGESIZE));
+    return 0;
+}
+
+/* Split the large page 'vaddr' falls in, if it does. */
+static int mm_split_large_page_at(ptr vaddr, const pdpt_t* pdpt)
+{
+    pde_t* pde = large_pde_from_vaddr_abs(vaddr, pdpt);
+    return pde ? mm_split_large_page(vaddr, pde) : 0;
+}
+
 static void mm_set_pte_and_pde_flags(pte_t* pte, pde_t* pde, u16 flags)
 {
     /* If a pde has higher privileges, we don't demote them, because some other
@@ -94,6 +179,44 @@ static void mm_set_pte_and_pde_flags(pte_t* pte, pde_t* pde, u16 flags)
      * anyway. */
     pde->user_access = !!(flags & PAGE_USER);
     pte->user_access = !!(flags & PAGE_USER);
+
+    pte->cow = !!(flags & PAGE_COW);
+}
+
+/* Mark everything the kernel has mapped so far as global, and turn on global
+ * pages. From now on, reloading cr3 on a context switch only flushes user
+ * pages from the TLB. */
+static _INIT void mm_enable_global_pages(PagingStruct* kps)
+{
+    pdpt_t* pdpt = PS2PDPT(kps);
+    pd_t* pd = pd_from_vaddr_abs(MEM_KERNEL_SPACE_VA_START, pdpt);
+    ASSERT(pd);
+
+    for (size_t i = 0; i < 512; ++i)
+    {
+        pde_t* pde = &pd->entries[i];
+        if (!pde->present)
+            continue;
+
+        if (pde->page_size)
+        {
+            pde->global = true;
+            continue;
+        }
+
+        pt_t* pt = pde_pt_vaddr(pde);
+        for (size_t k = 0; k < 512; ++k)
+        {
+            if (pt->entries[k].present)
+                pt->entries[k].global = true;
+        }
+    }
+
+    /* Toggling CR4.PGE flushes the whole TLB, global entries included. */
+    cpu_write_cr4(cpu_read_cr4() | CR4_PGE);
+    g_global_pages = true;
+
+    KLOGF(INFO, "Kernel pages are global.");
 }
 
 _INIT void mm_setup_paging_arch(PagingStruct* kps)
@@ -101,17 +224,35 @@ _INIT void mm_setup_paging_arch(PagingStruct* kps)
     /* Enable NXE bit. */
     cpu_write_msr(cpu_read_msr(MSR_EFER) | EFER_NXE, MSR_EFER);
     kps->data = (void*)mm_kpa2va(cpu_read_cr3());
+
+#ifdef MM_GLOBAL_KERNEL_PAGES
+    if (cpu_has_feature(CPU_PGE))
+        mm_enable_global_pages(kps);
+#endif
+
+    /* PCIDs would let us keep user pages in the TLB as well, but CR4.PCIDE can
+     * only be set in IA-32e mode. */
+    if (cpu_has_feature(CPU_PCID))
+        KLOGF(DEBUG, "PCID is supported, but unusable in 32 bit mode.");
 }
 
 ptr mm_va2pa_arch(ptr vaddr, const PagingStruct* ps)
 {
+    pde_t* pde = large_pde_from_vaddr_abs(vaddr, ps->data);
+    if (pde)
+        return pde_frame_paddr(pde) + vaddr % LARGE_PAGESIZE;
+
+    /* Swapped out pages hold a swap slot instead of a frame. */
     pte_t* pte = pte_from_vaddr_abs(vaddr, ps->data);
-    return pte ? (ptr)pte_frame_paddr(pte) + vaddr % PAGESIZE : (ptr)NULL;
+    if (!pte || pte->swapped)
+        return (ptr)NULL;
+
+    return (ptr)pte_frame_paddr(pte) + vaddr % PAGESIZE;
 }
 
 int mm_init_paging_struct_arch(PagingStruct* ps)
 {
-    ps->data = kmalloc_aligned(sizeof(pdpt_t), PAGESIZE);
+    ps->data = mm_alloc_linear(sizeof(pdpt_t), PAGESIZE);
     if (!ps->data)
     {
         pagingstruct_destroy(ps);
@@ -124,43 +265,48 @@ int mm_init_paging_struct_arch(PagingStruct* ps)
 
 void mm_destroy_paging_struct_arch(PagingStruct* ps)
 {
-    /* This is done in a really stupid way, but it works :) */
-    FOR_EACH_ELEM_IN_DARR (ps->allocated_pages, ps->allocated_pages_size, page)
+    pdpt_t* pdpt = PS2PDPT(ps);
+    if (!pdpt)
+        return;
+
+    FOR_EACH_TRACKED_PAGE (0, PROC_HIGH_ADDRESS, ps, page)
     {
-        pte_t* pte = pte_from_vaddr_abs(page->vaddr, ps->data);
+        /* Swap slots are let go of in mm_destroy_paging_struct(). */
+        pte_t* pte = pte_from_vaddr_abs(page, pdpt);
+        if (!pte->present)
+            continue;
+
+        const ptr frame = pte_frame_paddr(pte);
         pte_set_frame_paddr(0, pte);
         pte->present = false;
 
-        ffree_one(pte_frame_paddr(pte));
+        /* The zero frame is shared by everyone. */
+        if (frame != mm_zero_frame())
+            ffree_one(frame);
     }
 
-    pt_t* pt = NULL;
-    FOR_EACH_ELEM_IN_DARR (ps->allocated_pages, ps->allocated_pages_size, page)
+    /* Free the page tables and directories, except for the kernel's, which
+     * are shared by everyone. */
+    const pdpte_t* kpdpte = pdpte_from_vaddr(kimg_vaddr(), pdpt);
+    for (size_t i = 0; i < 4; ++i)
     {
-        pt_t* pttmp = pt_from_vaddr_abs(page->vaddr, ps->data);
-        if (pt == pttmp)
+        const pdpte_t* pdpte = &pdpt->entries[i];
+        pd_t* pd = pdpte_pd_vaddr(pdpte);
+        if (!pd || pdpte == kpdpte)
             continue;
 
-        pt = pttmp;
-        kfree(pt);
-    }
-
-    pd_t* pd = NULL;
-    FOR_EACH_ELEM_IN_DARR (ps->allocated_pages, ps->allocated_pages_size, page)
-    {
-        pd_t* pdtmp = pd_from_vaddr_abs(page->vaddr, ps->data);
-        if (pd == pdtmp)
-            continue;
+        for (size_t k = 0; k < 512; ++k)
+        {
+            pt_t* pt = pde_pt_vaddr(&pd->entries[k]);
+            if (pt)
+                kfree(pt);
+        }
 
-        pd = pdtmp;
         kfree(pd);
     }
 
-    if (ps->data)
-    {
-        kfree(ps->data);
-        ps->data = NULL;
-    }
+    kfree(ps->data);
+    ps->data = NULL;
 }
 
 int mm_map_kernel_into_paging_struct_arch(PagingStruct* ps)
@@ -190,50 +336,353 @@ void mm_load_paging_struct_arch(const PagingStruct* ps)
     cpu_write_cr3(new_cr3);
 }
 
-int mm_map_page_arch(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps)
+/* Returns the pde for 'vaddr', allocating the page directory if there isn't
+ * one. Returns NULL on out of memory. */
+static pde_t* mm_get_or_alloc_pde(ptr vaddr, pdpt_t* pdpt)
 {
-    pdpt_t* pdpt = PS2PDPT(ps);
-    ASSERT(pdpt);
-
     /* Get the page directory pointer table entry. */
     pdpte_t* pdpte = pdpte_from_vaddr(vaddr, pdpt);
     pd_t* pd = pdpte_pd_vaddr(pdpte);
     if (!pd)
     {
         /* There is no pagedir so we allocate it */
-        pd = kmalloc_aligned(sizeof(pd_t), PAGESIZE);
+        pd = mm_alloc_linear(sizeof(pd_t), PAGESIZE);
         if (!pd)
-            return -ENOMEM;
+            return NULL;
 
         pd_init(pd);
         pdpte_set_pd_vaddr((ptr)pd, pdpte);
     }
 
-    /* Get the page directory entry */
-    pde_t* pde = pde_from_vaddr(vaddr, pd);
+    pdpte->present = true;
+    return pde_from_vaddr(vaddr, pd);
+}
+
+/* Returns the page table 'vaddr' falls in, allocating it, or splitting the
+ * large page that's there. Returns NULL on out of memory. */
+static pt_t* mm_get_or_alloc_pt(ptr vaddr, pdpt_t* pdpt, pde_t** pde_out)
+{
+    pde_t* pde = mm_get_or_alloc_pde(vaddr, pdpt);
+    if (!pde)
+        return NULL;
+
+    if (pde->page_size && mm_split_large_page(vaddr, pde) < 0)
+        return NULL;
+
     pt_t* pt = pde_pt_vaddr(pde);
     if (!pt)
     {
         /* There is no page table, allocate it */
-        pt = kmalloc_aligned(sizeof(pt_t), PAGESIZE);
+        pt = mm_alloc_linear(sizeof(pt_t), PAGESIZE);
         if (!pt)
-            return -ENOMEM;
+            return NULL;
 
         pt_init(pt);
         pde_set_pt_vaddr((ptr)pt, pde);
     }
 
+    pde->present = true;
+    *pde_out = pde;
+    return pt;
+}
+
+/* Returns where the page table holding 'vaddr' ends, or 'end' if that comes
+ * first. */
+static ptr mm_pt_range_end(ptr vaddr, ptr end)
+{
+    const u64 pt_end =
+        bytes_align_down64(vaddr, LARGE_PAGESIZE) + LARGE_PAGESIZE;
+    return pt_end < end ? pt_end : end;
+}
+
+static void mm_tlb_flush_all(bool global)
+{
+    if (global && g_global_pages)
+    {
+        /* Reloading cr3 keeps global entries, toggling CR4.PGE does not. */
+        const size_t cr4 = cpu_read_cr4();
+        cpu_write_cr4(cr4 & ~CR4_PGE);
+        cpu_write_cr4(cr4);
+    }
+    else
+    {
+        cpu_write_cr3(cpu_read_cr3());
+    }
+}
+
+/* Flush [start, end) of 'ps' from the TLB, once a range operation is done with
+ * it. */
+static void mm_tlb_flush_range(ptr start, ptr end, const PagingStruct* ps)
+{
+    /* The kernel's part is shared by every paging struct, the rest can only be
+     * in the TLB if 'ps' is loaded. */
+    const bool kernel = end > MEM_KERNEL_SPACE_VA_START;
+    if (!kernel && mm_kva2pa((ptr)ps->data) != cpu_read_cr3())
+        return;
+
+    if ((end - start) / PAGESIZE > MM_TLB_FLUSH_ALL_THRESHOLD)
+    {
+        mm_tlb_flush_all(kernel);
+        return;
+    }
+
+    FOR_EACH_PAGE (start, end, page)
+        mm_tlb_flush_single(page);
+}
+
+int mm_map_page_arch(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps)
+{
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    pde_t* pde;
+    pt_t* pt = mm_get_or_alloc_pt(vaddr, pdpt, &pde);
+    if (!pt)
+        return -ENOMEM;
+
     /* Get the page table entry. */
     pte_t* pte = pte_from_vaddr(vaddr, pt);
     pte_set_frame_paddr(paddr, pte);
-
-    /* Everything is present */
-    pdpte->present = true;
-    pde->present = true;
     pte->present = true;
+    pte->swapped = false;
 
     /* Set flags */
     mm_set_pte_and_pde_flags(pte, pde, flags);
+    pte->global = mm_is_global_vaddr(vaddr);
+    mm_tlb_flush_single(vaddr);
+    return 0;
+}
+
+int mm_map_range_arch(
+    ptr start,
+    ptr end,
+    ptr paddr,
+    const ptr* frames,
+    u16 flags,
+    PagingStruct* ps)
+{
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    /* Only entries that were present before can be in the TLB. */
+    bool flush = false;
+    int st = 0;
+
+    ptr vaddr = start;
+    while (vaddr < end)
+    {
+        pde_t* pde;
+        pt_t* pt = mm_get_or_alloc_pt(vaddr, pdpt, &pde);
+        if (!pt)
+        {
+            st = -ENOMEM;
+            break;
+        }
+
+        /* Consecutive ptes all come out of the same page table. */
+        const ptr pt_end = mm_pt_range_end(vaddr, end);
+        for (; vaddr < pt_end; vaddr += PAGESIZE)
+        {
+            const size_t i = (vaddr - start) / PAGESIZE;
+            pte_t* pte = pte_from_vaddr(vaddr, pt);
+            flush |= pte->present;
+
+            pte_set_frame_paddr(frames ? frames[i] : paddr + i * PAGESIZE, pte);
+            pte->present = true;
+            pte->swapped = false;
+            mm_set_pte_and_pde_flags(pte, pde, flags);
+            pte->global = mm_is_global_vaddr(vaddr);
+        }
+    }
+
+    if (flush)
+        mm_tlb_flush_range(start, vaddr, ps);
+
+    return st;
+}
+
+static void mm_set_large_pde_flags(pde_t* pde, ptr vaddr, u16 flags)
+{
+    pde->writable = !!(flags & PAGE_W);
+    pde->exec_disable = !(flags & PAGE_X);
+    pde->user_access = !!(flags & PAGE_USER);
+    pde->global = mm_is_global_vaddr(vaddr);
+}
+
+int mm_map_large_page_arch(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps)
+{
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    pde_t* pde = mm_get_or_alloc_pde(vaddr, pdpt);
+    if (!pde)
+        return -ENOMEM;
+
+    pt_t* pt = pde_pt_vaddr(pde);
+    if (pt)
+    {
+        /* We can only take over the range if nothing in it is mapped. */
+        for (size_t i = 0; i < LARGE_PAGESIZE / PAGESIZE; ++i)
+        {
+            if (pt->entries[i].present)
+                return -EEXIST;
+        }
+    }
+
+    pde_t newpde = {0};
+    pde_set_frame_paddr(paddr, &newpde);
+    newpde.present = true;
+    mm_set_large_pde_flags(&newpde, vaddr, flags);
+    *pde = newpde;
+
+    mm_tlb_flush_single(vaddr);
+
+    /* The page table is not reachable anymore, now that the TLB is flushed. */
+    if (pt)
+        kfree(pt);
+
+    return 0;
+}
+
+static u16 mm_pte_flags(const pte_t* pte)
+{
+    u16 flags = PAGE_PRESENT | PAGE_R;
+    if (pte->writable)
+        flags |= PAGE_W;
+    if (!pte->exec_disable)
+        flags |= PAGE_X;
+    if (pte->user_access)
+        flags |= PAGE_USER;
+    if (pte->cow)
+        flags |= PAGE_COW;
+
+    return flags;
+}
+
+int mm_get_page_arch(
+    ptr vaddr, const PagingStruct* ps, ptr* frame_out, u16* flags_out)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    const pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    pde_t* pde = large_pde_from_vaddr_abs(vaddr, pdpt);
+    if (pde)
+    {
+        *frame_out = pde_frame_paddr(pde) + vaddr % LARGE_PAGESIZE;
+        *flags_out = mm_large_pde_flags(pde);
+        return 0;
+    }
+
+    pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
+    if (!pte || !pte->present)
+        return -ENOENT;
+
+    *frame_out = pte_frame_paddr(pte);
+    *flags_out = mm_pte_flags(pte);
+    return 0;
+}
+
+int mm_get_swapped_page_arch(
+    ptr vaddr, const PagingStruct* ps, size_t* slot_out, u16* flags_out)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    const pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    if (large_pde_from_vaddr_abs(vaddr, pdpt))
+        return -ENOENT;
+
+    pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
+    if (!pte || pte->present || !pte->swapped)
+        return -ENOENT;
+
+    *slot_out = pte->frame_base;
+    *flags_out = mm_pte_flags(pte) & ~PAGE_PRESENT;
+    return 0;
+}
+
+int mm_swap_out_page_arch(ptr vaddr, size_t slot, PagingStruct* ps)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    const pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    if (large_pde_from_vaddr_abs(vaddr, pdpt))
+        return -EINVAL;
+
+    pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
+    if (!pte || !pte->present)
+        return -ENOENT;
+
+    /* Everything but the frame stays, for when it's swapped back in. */
+    pte->present = false;
+    pte->swapped = true;
+    pte->frame_base = slot;
+    mm_tlb_flush_range(vaddr, vaddr + PAGESIZE, ps);
+    return 0;
+}
+
+int mm_map_swapped_page_arch(
+    ptr vaddr, size_t slot, u16 flags, PagingStruct* ps)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    pde_t* pde;
+    pt_t* pt = mm_get_or_alloc_pt(vaddr, pdpt, &pde);
+    if (!pt)
+        return -ENOMEM;
+
+    pte_t* pte = pte_from_vaddr(vaddr, pt);
+    const bool flush = pte->present;
+
+    mm_set_pte_and_pde_flags(pte, pde, flags);
+    pte->present = false;
+    pte->swapped = true;
+    pte->frame_base = slot;
+
+    if (flush)
+        mm_tlb_flush_range(vaddr, vaddr + PAGESIZE, ps);
+
+    return 0;
+}
+
+bool mm_test_and_clear_accessed_arch(ptr vaddr, PagingStruct* ps)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    const pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
+    if (!pte || !pte->present || !pte->accessed)
+        return false;
+
+    /* The cpu only sets the bit when it walks the page tables, so the TLB entry
+     * has to go for the next access to be noticed. */
+    pte->accessed = false;
+    mm_tlb_flush_range(vaddr, vaddr + PAGESIZE, ps);
+    return true;
+}
+
+int mm_unmap_page_arch(ptr vaddr, PagingStruct* ps)
+{
+    ASSERT(vaddr % PAGESIZE == 0);
+    const pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    int st = mm_split_large_page_at(vaddr, pdpt);
+    if (st < 0)
+        return st;
+
+    pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
+    if (!pte || !pte->present)
+        return -ENOENT;
+
+    /* Page tables are kept around, they are freed along with the paging
+     * struct. */
+    memset(pte, 0, sizeof(pte_t));
     mm_tlb_flush_single(vaddr);
     return 0;
 }
@@ -250,6 +699,18 @@ int mm_set_page_flags_arch(ptr vaddr, u16 flags, PagingStruct* ps)
         return -EINVAL;
 
     pde_t* pde = pde_from_vaddr(vaddr, pd);
+    if (pde->page_size && pde->present)
+    {
+        /* Nothing to do if the large page stays the same. */
+        const u16 mask = PAGE_ACCESS_MODE | PAGE_USER;
+        if ((mm_large_pde_flags(pde) & mask) == ((flags | PAGE_R) & mask))
+            return 0;
+
+        int st = mm_split_large_page(vaddr, pde);
+        if (st < 0)
+            return st;
+    }
+
     pt_t* pt = pde_pt_vaddr(pde);
     if (!pt)
         return -EINVAL;
@@ -270,17 +731,142 @@ int mm_rm_page_flags_arch(ptr vaddr, u16 flags, PagingStruct* ps)
     pdpt_t* pdpt = PS2PDPT(ps);
     ASSERT(pdpt);
 
+    int st = mm_split_large_page_at(vaddr, pdpt);
+    if (st < 0)
+        return st;
+
     pte_t* pte = pte_from_vaddr_abs(vaddr, pdpt);
     if (!pte)
         return -ENOENT;
 
     /* NOTE: We don't demote pde persmissions, should we? */
 
-    pte->exec_disable = !!(flags & PAGE_X);
-    pte->writable = !(flags & PAGE_W);
-    pte->user_access = !(flags & PAGE_USER);
-    pte->present = !(flags & PAGE_PRESENT);
+    /* Only touch what's being removed. */
+    if (flags & PAGE_X)
+        pte->exec_disable = true;
+    if (flags & PAGE_W)
+        pte->writable = false;
+    if (flags & PAGE_USER)
+        pte->user_access = false;
+    if (flags & PAGE_PRESENT)
+        pte->present = false;
     /* Non-read permissions are not a thing on x86, though they would be nice */
     mm_tlb_flush_single(vaddr);
     return 0;
+}
+
+/* Returns the pde of the large page that's completely inside [vaddr, end), or
+ * NULL. If there's a large page that's only partially inside, it's split, and
+ * 'st' is set if that fails. */
+static pde_t* mm_large_pde_in_range(ptr vaddr, ptr end, pdpt_t* pdpt, int* st)
+{
+    pde_t* pde = large_pde_from_vaddr_abs(vaddr, pdpt);
+    if (!pde)
+        return NULL;
+
+    if (vaddr % LARGE_PAGESIZE == 0 && end - vaddr >= LARGE_PAGESIZE)
+        return pde;
+
+    *st = mm_split_large_page(vaddr, pde);
+    return NULL;
+}
+
+int mm_protect_range_arch(ptr start, ptr end, u16 flags, PagingStruct* ps)
+{
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    bool flush = false;
+    int st = 0;
+
+    ptr vaddr = start;
+    while (vaddr < end && st == 0)
+    {
+        const ptr pt_end = mm_pt_range_end(vaddr, end);
+
+        pde_t* pde = mm_large_pde_in_range(vaddr, end, pdpt, &st);
+        if (pde)
+        {
+            mm_set_large_pde_flags(pde, vaddr, flags);
+            flush = true;
+            vaddr = pt_end;
+            continue;
+        }
+
+        pde = pde_from_vaddr_abs(vaddr, pdpt);
+        pt_t* pt = pde ? pde_pt_vaddr(pde) : NULL;
+        if (st < 0 || !pt)
+        {
+            /* Nothing mapped in here. */
+            vaddr = pt_end;
+            continue;
+        }
+
+        for (; vaddr < pt_end; vaddr += PAGESIZE)
+        {
+            /* Swapped out pages get the new flags when they come back. */
+            pte_t* pte = pte_from_vaddr(vaddr, pt);
+            if (!pte->present && !pte->swapped)
+                continue;
+
+            /* Pages shared copy-on-write only become writable once they have
+             * their own frame. */
+            u16 pageflags = flags;
+            if (pte->cow && (pageflags & PAGE_W))
+                pageflags = (pageflags & ~PAGE_W) | PAGE_COW;
+
+            mm_set_pte_and_pde_flags(pte, pde, pageflags);
+            flush = true;
+        }
+    }
+
+    if (flush)
+        mm_tlb_flush_range(start, end, ps);
+
+    return st;
+}
+
+int mm_unmap_range_arch(ptr start, ptr end, PagingStruct* ps)
+{
+    pdpt_t* pdpt = PS2PDPT(ps);
+    ASSERT(pdpt);
+
+    bool flush = false;
+    int st = 0;
+
+    ptr vaddr = start;
+    while (vaddr < end && st == 0)
+    {
+        const ptr pt_end = mm_pt_range_end(vaddr, end);
+
+        pde_t* pde = mm_large_pde_in_range(vaddr, end, pdpt, &st);
+        if (pde)
+        {
+            memset(pde, 0, sizeof(pde_t));
+            flush = true;
+            vaddr = pt_end;
+            continue;
+        }
+
+        pt_t* pt = pt_from_vaddr_abs(vaddr, pdpt);
+        if (st < 0 || !pt)
+        {
+            vaddr = pt_end;
+            continue;
+        }
+
+        /* Page tables are kept around, they are freed along with the paging
+         * struct. */
+        for (; vaddr < pt_end; vaddr += PAGESIZE)
+        {
+            pte_t* pte = pte_from_vaddr(vaddr, pt);
+            flush |= pte->present;
+            memset(pte, 0, sizeof(pte_t));
+        }
+    }
+
+    if (flush)
+        mm_tlb_flush_range(start, end, ps);
+
+    return st;
 }
\ No newline at end of file
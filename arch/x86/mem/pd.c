@@ -25,6 +25,9 @@ void pde_set_pt_vaddr(ptr vaddr, pde_t* pde)
 
 ptr pde_pt_paddr(pde_t* pde)
 {
+    if (pde->page_size)
+        return 0;
+
     return pde->table_base << 12;
 }
 
@@ -37,6 +40,20 @@ pt_t* pde_pt_vaddr(pde_t* pde)
     return (pt_t*)mm_kpa2va(ptpaddr);
 }
 
+void pde_set_frame_paddr(ptr paddr, pde_t* pde)
+{
+    pde->table_base = paddr >> 12;
+    pde->page_size = true;
+}
+
+ptr pde_frame_paddr(pde_t* pde)
+{
+    if (!pde->page_size)
+        return 0;
+
+    return pde->table_base << 12;
+}
+
 pde_t* pde_from_vaddr(ptr vaddr, pd_t* pd)
 {
     ptr off = vaddr / (PAGESIZE * 512 * 512) * 512;
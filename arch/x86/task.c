@@ -5,8 +5,11 @@
 
 #include <dxgmx/assert.h>
 #include <dxgmx/compiler_attrs.h>
+#include <dxgmx/string.h>
 #include <dxgmx/task/task.h>
+#include <dxgmx/todo.h>
 #include <dxgmx/x86/gdt.h>
+#include <dxgmx/x86/interrupt_frame.h>
 
 /* Switch between two tasks, this code was written with help from
  * https://wiki.osdev.org/Kernel_Multitasking, and also digging
@@ -73,6 +76,27 @@
                      "pop %rbx                         \n"                     \
                      "ret                              \n")
 
+/* What the CPU and the interrupt entry code leave on top of the kernel stack
+ * when interrupting userspace: the InterruptFrame, plus ss:esp since it's a
+ * cross privilege interrupt. */
+#define I686_USER_INT_FRAME_SIZE (sizeof(InterruptFrame) + 2 * sizeof(size_t))
+
+/* Where a forked task starts running, see task_init_forked(). The stack is
+ * pointing at a copy of the parent's interrupt frame, which we return from,
+ * just like the interrupt exit code does. */
+_ATTR_NAKED static void task_forked_entry()
+{
+    __asm__ volatile("pop %edi                         \n"
+                     "pop %esi                         \n"
+                     "pop %ebp                         \n"
+                     "pop %ebx                         \n"
+                     "pop %edx                         \n"
+                     "pop %ecx                         \n"
+                     "pop %eax                         \n"
+                     "add $4, %esp                     \n"
+                     "iretl                            \n");
+}
+
 int task_set_impending_stack_top(ptr sp)
 {
     tss_set_esp0(sp);
@@ -90,3 +114,55 @@ _ATTR_NAKED _CDECL void task_switch(TaskContext* prevctx, TaskContext* nextctx)
     I686_TASK_SWITCH(0);
 #endif
 }
+
+int task_init_forked(ptr kstack_top, ptr parent_kstack_top, TaskContext* ctx)
+{
+#ifdef CONFIG_64BIT
+    TODO_FATAL();
+#else
+    /* The parent is in the middle of a syscall, so it's user context sits at
+     * the top of it's kernel stack. */
+    InterruptFrame* frame =
+        (InterruptFrame*)(kstack_top - I686_USER_INT_FRAME_SIZE);
+    memcpy(
+        frame,
+        (void*)(parent_kstack_top - I686_USER_INT_FRAME_SIZE),
+        I686_USER_INT_FRAME_SIZE);
+
+    /* The child sees 0 as the return value. */
+    frame->xax = 0;
+
+    /* Lay out what I686_TASK_SWITCH pops off the stack. */
+    size_t* sp = (size_t*)(kstack_top - I686_USER_INT_FRAME_SIZE);
+    *--sp = (size_t)task_forked_entry;
+    *--sp = 0;   /* ebx */
+    *--sp = 0;   /* esi */
+    *--sp = 0;   /* edi */
+    *--sp = 0;   /* ebp */
+    *--sp = 0x2; /* eflags, interrupts stay off until iret. */
+
+    ctx->stack_ptr = (ptr)sp;
+#endif
+    return 0;
+}
+
+int task_init_kernel(ptr kstack_top, void (*entry)(), TaskContext* ctx)
+{
+#ifdef CONFIG_64BIT
+    TODO_FATAL();
+#else
+    /* Lay out what I686_TASK_SWITCH pops off the stack, it then returns right
+     * into 'entry', which sees a 0 return address of it's own. */
+    size_t* sp = (size_t*)kstack_top;
+    *--sp = 0;
+    *--sp = (size_t)entry;
+    *--sp = 0;   /* ebx */
+    *--sp = 0;   /* esi */
+    *--sp = 0;   /* edi */
+    *--sp = 0;   /* ebp */
+    *--sp = 0x2; /* eflags, interrupts off. */
+
+    ctx->stack_ptr = (ptr)sp;
+#endif
+    return 0;
+}
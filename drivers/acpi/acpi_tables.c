@@ -142,10 +142,12 @@ static ERR_OR(ptr) acpi_map_table(ptr hdr_paddr)
     ACPISDTHeader* hdr = (ACPISDTHeader*)res.value;
     if (hdr->len > MIN_MAP)
     {
-        res = dma_map_range(
-            hdr_paddr, hdr->len, PAGE_RW, procm_get_kernel_proc());
+        const size_t len = hdr->len;
+        dma_unmap_range(res.value, MIN_MAP, procm_get_kernel_proc());
+
+        res = dma_map_range(hdr_paddr, len, PAGE_RW, procm_get_kernel_proc());
         if (res.error)
-            return ERR(ptr, res.error); // FIXME: free the initial allocation
+            return ERR(ptr, res.error);
     }
 
 #undef MIN_MAP
@@ -0,0 +1,376 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/devfs.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/ksyms.h>
+#include <dxgmx/mem/dma.h>
+#include <dxgmx/mem/falloc.h>
+#include <dxgmx/mem/mm.h>
+#include <dxgmx/mem/pagefault.h>
+#include <dxgmx/mem/shrinker.h>
+#include <dxgmx/mem/swap.h>
+#include <dxgmx/mem/zram.h>
+#include <dxgmx/module.h>
+#include <dxgmx/posix/sys/stat.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/stdio.h>
+#include <dxgmx/string.h>
+#include <dxgmx/user.h>
+#include <stdarg.h>
+
+#define MODULE_NAME "meminfo"
+
+/* The whole report has to fit in here. */
+#define MEMINFO_BUFSIZE 4096
+/* Same for the kmalloc profile, one line per callsite. */
+#define MEMINFO_PROFILE_BUFSIZE (32 * 1024)
+/* Most pools a kmalloc heap can report. */
+#define MEMINFO_MAX_POOLS 8
+
+typedef struct S_MemInfoBuf
+{
+    char* buf;
+    size_t len;
+    size_t size;
+} MemInfoBuf;
+
+static void meminfo_printf(MemInfoBuf* mi, const char* fmt, ...)
+{
+    if (mi->len >= mi->size - 1)
+        return;
+
+    va_list list;
+    va_start(list, fmt);
+    int n = vsnprintf(mi->buf + mi->len, mi->size - mi->len, fmt, list);
+    va_end(list);
+
+    if (n < 0)
+        return;
+
+    mi->len += n;
+    if (mi->len > mi->size - 1)
+        mi->len = mi->size - 1;
+}
+
+/* Copy what the reader asked for out of the report and free it. */
+static ssize_t
+meminfo_copy_out(MemInfoBuf* mi, _USERPTR void* buf, size_t n, off_t off)
+{
+    if (off < 0 || (size_t)off >= mi->len)
+    {
+        kfree(mi->buf);
+        return 0;
+    }
+
+    if (n > mi->len - off)
+        n = mi->len - off;
+
+    int st = user_copy_to(buf, mi->buf + off, n);
+    kfree(mi->buf);
+
+    return st < 0 ? st : (ssize_t)n;
+}
+
+static void meminfo_falloc(MemInfoBuf* mi)
+{
+    meminfo_printf(mi, "FreeFrames: %zu\n", falloc_get_free_frames_count());
+
+    meminfo_printf(mi, "FreeBlocks:");
+    for (size_t order = 0; order <= FALLOC_MAX_ORDER; ++order)
+        meminfo_printf(mi, " %zu", falloc_get_free_blocks_count(order));
+    meminfo_printf(mi, "\n");
+
+    ZeroedFramesStats zf;
+    mm_get_zeroed_frames_stats(&zf);
+    meminfo_printf(mi, "ZeroedFrames: %zu/%zu\n", zf.count, zf.capacity);
+    meminfo_printf(mi, "ZeroedFramesHits: %zu\n", zf.hits);
+    meminfo_printf(mi, "ZeroedFramesMisses: %zu\n", zf.misses);
+}
+
+static void meminfo_kmalloc(MemInfoBuf* mi)
+{
+    meminfo_printf(mi, "KmallocDriver: %s\n", kmalloc_driver_name());
+
+    for (size_t id = 0; id < kmalloc_heap_count(); ++id)
+    {
+        KMallocStatistics stats;
+        if (kmalloc_get_statistics(id, &stats) == 0)
+        {
+            meminfo_printf(
+                mi,
+                "Heap%zuAllocations: %zu\n",
+                id,
+                stats.total_allocations - stats.total_frees);
+            meminfo_printf(
+                mi,
+                "Heap%zuAllocated: %zu\n",
+                id,
+                stats.total_allocated - stats.total_freed);
+            meminfo_printf(
+                mi,
+                "Heap%zuTotalAllocations: %zu\n",
+                id,
+                stats.total_allocations);
+        }
+
+        KMallocPoolStatistics pools[MEMINFO_MAX_POOLS];
+        ssize_t count =
+            kmalloc_get_pool_statistics(id, pools, MEMINFO_MAX_POOLS);
+        if (count > MEMINFO_MAX_POOLS)
+            count = MEMINFO_MAX_POOLS;
+
+        /* used/total chunks, largest free run in chunks */
+        for (ssize_t i = 0; i < count; ++i)
+        {
+            meminfo_printf(
+                mi,
+                "Heap%zuPool%zu: %zu/%zu %zu\n",
+                id,
+                pools[i].chunksize,
+                pools[i].used_chunks,
+                pools[i].chunks,
+                pools[i].largest_free_run);
+        }
+    }
+}
+
+static void meminfo_dma(MemInfoBuf* mi)
+{
+    const Process* kproc = procm_get_kernel_proc();
+    meminfo_printf(
+        mi,
+        "DMAPages: %zu/%zu\n",
+        dma_mapped_pages(kproc),
+        (size_t)kproc->dma_heap.pagespan);
+}
+
+static void meminfo_pagefaults(MemInfoBuf* mi)
+{
+    PageFaultStats stats;
+    pagefault_get_stats(&stats);
+
+    meminfo_printf(mi, "PageFaults: %zu\n", stats.total);
+    meminfo_printf(mi, "PageFaultsKernelHeap: %zu\n", stats.kernel_heap);
+    meminfo_printf(mi, "PageFaultsUser: %zu\n", stats.user);
+    meminfo_printf(mi, "PageFaultsCOW: %zu\n", stats.cow);
+    meminfo_printf(mi, "PageFaultsProtection: %zu\n", stats.protection);
+    meminfo_printf(mi, "PageFaultsBad: %zu\n", stats.bad);
+}
+
+static void meminfo_swap(MemInfoBuf* mi)
+{
+    SwapStats stats;
+    swap_get_stats(&stats);
+
+    meminfo_printf(
+        mi, "SwapBackend: %s\n", stats.backend ? stats.backend : "none");
+    meminfo_printf(mi, "SwapSlots: %zu/%zu\n", stats.free_slots, stats.slots);
+    meminfo_printf(mi, "SwapOuts: %zu\n", stats.swapped_out);
+    meminfo_printf(mi, "SwapIns: %zu\n", stats.swapped_in);
+    meminfo_printf(mi, "SwapErrors: %zu\n", stats.errors);
+
+    /* How long it takes to get a page back out of swap on a fault. */
+    const u64 avg = stats.swapped_in ? stats.swap_in_ns / stats.swapped_in : 0;
+    meminfo_printf(mi, "SwapInAvgNs: %llu\n", avg);
+    meminfo_printf(mi, "SwapInMaxNs: %llu\n", stats.swap_in_max_ns);
+
+    if (!stats.backend || strcmp(stats.backend, "zram") != 0)
+        return;
+
+    ZramStats zs;
+    zram_get_stats(&zs);
+
+    meminfo_printf(mi, "ZramPages: %zu\n", zs.pages);
+    meminfo_printf(mi, "ZramZeroPages: %zu\n", zs.zero_pages);
+    meminfo_printf(mi, "ZramIncompressible: %zu\n", zs.incompressible_pages);
+    meminfo_printf(mi, "ZramCompressed: %llu\n", zs.compressed_bytes);
+    meminfo_printf(mi, "ZramPool: %llu/%llu\n", zs.pool_used, zs.pool_size);
+    meminfo_printf(mi, "ZramPoolFull: %zu\n", zs.pool_full);
+
+    /* Zero pages take up no room, so they're left out of the ratio. In
+     * hundredths, there's no floating point in syscall context. */
+    const u64 stored = (u64)(zs.pages - zs.zero_pages) * PAGESIZE;
+    const u64 ratio =
+        zs.compressed_bytes ? stored * 100 / zs.compressed_bytes : 0;
+    meminfo_printf(mi, "ZramRatio: %llu.%02llu\n", ratio / 100, ratio % 100);
+}
+
+/* One line per shrinker: what it could free now, and what it has freed. */
+static void meminfo_shrinkers(MemInfoBuf* mi)
+{
+    for (const Shrinker* shrinker = shrinker_list(); shrinker;
+         shrinker = shrinker->next)
+    {
+        meminfo_printf(
+            mi,
+            "Shrinker %s: %zu %zu\n",
+            shrinker->name,
+            shrinker->count(),
+            shrinker->freed);
+    }
+}
+
+static int meminfo_vnode_open(VirtualNode* vnode, int flags)
+{
+    (void)vnode;
+    (void)flags;
+    return 0;
+}
+
+static ssize_t meminfo_vnode_read(
+    const VirtualNode* vnode, _USERPTR void* buf, size_t n, off_t off)
+{
+    (void)vnode;
+
+    MemInfoBuf mi = {
+        .buf = kmalloc(MEMINFO_BUFSIZE), .len = 0, .size = MEMINFO_BUFSIZE};
+    if (!mi.buf)
+        return -ENOMEM;
+
+    /* The report is put together on every read, so it's always up to date. */
+    meminfo_falloc(&mi);
+    meminfo_kmalloc(&mi);
+    meminfo_dma(&mi);
+    meminfo_pagefaults(&mi);
+    meminfo_swap(&mi);
+    meminfo_shrinkers(&mi);
+
+    return meminfo_copy_out(&mi, buf, n, off);
+}
+
+/* One line per callsite: symbol, allocations, frees, bytes, live bytes. */
+static ssize_t kmallocprof_vnode_read(
+    const VirtualNode* vnode, _USERPTR void* buf, size_t n, off_t off)
+{
+    (void)vnode;
+
+    ssize_t count = kmalloc_get_profile(NULL, 0);
+    if (count < 0)
+        return count;
+
+    KMallocProfileSite* sites = kmalloc(count * sizeof(KMallocProfileSite));
+    if (count && !sites)
+        return -ENOMEM;
+
+    /* Callsites that show up because of our own allocations are left out. */
+    kmalloc_get_profile(sites, count);
+
+    MemInfoBuf mi = {
+        .buf = kmalloc(MEMINFO_PROFILE_BUFSIZE),
+        .len = 0,
+        .size = MEMINFO_PROFILE_BUFSIZE};
+    if (!mi.buf)
+    {
+        if (sites)
+            kfree(sites);
+        return -ENOMEM;
+    }
+
+    for (ssize_t i = 0; i < count; ++i)
+    {
+        char name[49] = "???";
+        ptr symoff = 0;
+        const size_t len = ksyms_get_symbol_name(
+            sites[i].callsite, &symoff, name, sizeof(name) - 1);
+        if (len)
+            name[len] = '\0';
+
+        meminfo_printf(
+            &mi,
+            "%s+0x%zx %zu %zu %zu %zu\n",
+            name,
+            symoff,
+            sites[i].allocations,
+            sites[i].frees,
+            sites[i].bytes,
+            sites[i].live_bytes);
+    }
+
+    if (sites)
+        kfree(sites);
+
+    return meminfo_copy_out(&mi, buf, n, off);
+}
+
+static ssize_t meminfo_vnode_write(
+    VirtualNode* vnode, const _USERPTR void* buf, size_t n, off_t off)
+{
+    (void)vnode;
+    (void)buf;
+    (void)n;
+    (void)off;
+    return -EINVAL;
+}
+
+static int meminfo_vnode_ioctl(VirtualNode* vnode, int req, void* data)
+{
+    (void)vnode;
+    (void)req;
+    (void)data;
+    return -EINVAL;
+}
+
+static void* meminfo_vnode_mmap(
+    VirtualNode* vnode, void* addr, size_t len, int prot, int flags, off_t off)
+{
+    (void)vnode;
+    (void)addr;
+    (void)len;
+    (void)prot;
+    (void)flags;
+    (void)off;
+    return NULL;
+}
+
+static VirtualNodeOperations g_meminfo_vnode_ops = {
+    .open = meminfo_vnode_open,
+    .read = meminfo_vnode_read,
+    .write = meminfo_vnode_write,
+    .ioctl = meminfo_vnode_ioctl,
+    .mmap = meminfo_vnode_mmap};
+
+static VirtualNodeOperations g_kmallocprof_vnode_ops = {
+    .open = meminfo_vnode_open,
+    .read = kmallocprof_vnode_read,
+    .write = meminfo_vnode_write,
+    .ioctl = meminfo_vnode_ioctl,
+    .mmap = meminfo_vnode_mmap};
+
+static int meminfo_main()
+{
+    int st = devfs_register(
+        MODULE_NAME,
+        S_IFCHR | (S_IRUSR | S_IRGRP | S_IROTH),
+        0,
+        0,
+        &g_meminfo_vnode_ops,
+        NULL);
+    if (st < 0)
+        return st;
+
+    /* Reading it fails with -ENOSYS unless kmalloc is built with
+     * KMALLOC_PROFILE. */
+    st = devfs_register(
+        "kmallocprof",
+        S_IFCHR | (S_IRUSR | S_IRGRP | S_IROTH),
+        0,
+        0,
+        &g_kmallocprof_vnode_ops,
+        NULL);
+
+    return st < 0 ? st : 0;
+}
+
+static int meminfo_exit()
+{
+    return 0;
+}
+
+MODULE g_meminfo_module = {
+    .name = MODULE_NAME, .main = meminfo_main, .exit = meminfo_exit};
+
+#undef MODULE_NAME
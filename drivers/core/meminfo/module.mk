@@ -0,0 +1,2 @@
+
+MODULEOBJS += drivers/core/meminfo/meminfo.c.o
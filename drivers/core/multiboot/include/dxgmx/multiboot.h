@@ -18,6 +18,9 @@
 /* provide the kernel with info about the video  */
 #define MULTIBOOT_FLAG_VIDEO 0x4
 
+/* MultibootMBI::cmdline is valid */
+#define MULTIBOOT_INFO_CMDLINE 0x4
+
 #ifndef _ASM
 
 #include <dxgmx/compiler_attrs.h>
@@ -7,6 +7,7 @@
 #include <dxgmx/kimg.h>
 #include <dxgmx/multiboot.h>
 #include <dxgmx/panic.h>
+#include <dxgmx/string.h>
 #include <dxgmx/types.h>
 
 #define FLAGS                                                                  \
@@ -58,6 +59,13 @@ int multiboot_parse_info(KernelBootInfo* kbootinfo)
         kbootinfo->fb_bpp = mbi->fb.bpp;
     }
 
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE)
+    {
+        const char* cmdline = (const char*)(mbi->cmdline + kimg_map_offset());
+        strncpy(kbootinfo->cmdline, cmdline, KBOOT_CMDLINE_MAX - 1);
+        kbootinfo->cmdline[KBOOT_CMDLINE_MAX - 1] = '\0';
+    }
+
     MemoryRegionMap* mregmap = kbootinfo->mregmap;
     for (MultibootMMAP* mmap =
              (MultibootMMAP*)(mbi->mmap_base + kimg_map_offset());
@@ -13,7 +13,7 @@
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
 #include <dxgmx/module.h>
-#include <dxgmx/proc/procm.h>
+#include <dxgmx/proc/waitqueue.h>
 #include <dxgmx/ps2io.h>
 #include <dxgmx/serialio.h>
 #include <dxgmx/timekeep.h>
@@ -147,6 +147,8 @@ static u8 g_sequence_count;
 #define CACHED_EVENT_COUNT 64
 static InputEvent g_cached_events[CACHED_EVENT_COUNT];
 static size_t g_cached_event_idx;
+/* Readers waiting for an event to come in. */
+static WaitQueue g_event_waitqueue;
 
 static void ps2kbd_cache_event(const InputEvent* ev)
 {
@@ -154,6 +156,7 @@ static void ps2kbd_cache_event(const InputEvent* ev)
         g_cached_event_idx = 0;
 
     g_cached_events[g_cached_event_idx++] = *ev;
+    waitqueue_wake_all(&g_event_waitqueue);
 }
 
 static InputEvent* ps2kbd_earliest_event(const struct timespec* ts, size_t* idx)
@@ -308,17 +311,29 @@ ps2kbd_vnode_read(const VirtualNode* vnode, void* buf, size_t n, off_t)
 
     while (read < entries)
     {
-        size_t tmpidx = info->idx;
-        InputEvent* ev = ps2kbd_earliest_event(&info->time, &tmpidx);
-        if (!ev)
+        size_t tmpidx;
+        InputEvent* ev;
+        InputEvent tmpev;
+
+        /* Events are cached by the interrupt, sleep until there's one. */
+        const bool irqs = interrupts_disable_irqs_save();
+        while (true)
         {
-            procm_sched_yield();
-            continue;
+            tmpidx = info->idx;
+            ev = ps2kbd_earliest_event(&info->time, &tmpidx);
+            if (ev)
+                break;
+
+            waitqueue_wait(&g_event_waitqueue);
         }
 
-        info->time = ev->time;
+        /* Copy it out before the interrupt gets to overwrite it. */
+        tmpev = *ev;
+        interrupts_restore_irqs(irqs);
+
+        info->time = tmpev.time;
         info->idx = tmpidx;
-        user_copy_to(buf, ev, sizeof(InputEvent));
+        user_copy_to(buf, &tmpev, sizeof(InputEvent));
         ++read;
     }
 
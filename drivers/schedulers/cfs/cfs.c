@@ -0,0 +1,252 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/errno.h>
+#include <dxgmx/kboot.h>
+#include <dxgmx/klog.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/module.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/proc/sched.h>
+#include <dxgmx/stdlib.h>
+#include <dxgmx/utils/rbtree.h>
+
+#define KLOGF_PREFIX "cfs: "
+
+/* Completely fair scheduler. Every process keeps track of how long it has
+ * run for, scaled by it's weight, it's virtual runtime. Waiting processes are
+ * kept in a red-black tree ordered by virtual runtime, and the one that has
+ * run the least, the leftmost one, is always the next to go. The scheduler
+ * quantum is the period in which every runnable process gets to run once,
+ * split evenly between them, but no slice is shorter than the minimum
+ * granularity. */
+
+/* The weight of a process with no say in the matter. Processes don't have
+ * nice values (yet), so everyone has this weight. */
+#define CFS_NICE_0_WEIGHT 1024
+
+/* The shortest slice a process gets, no matter how many others are waiting.
+ * Can be changed with 'cfs_min_granularity=<us>'. */
+#define CFS_DEFAULT_MIN_GRANULARITY_US 1000
+
+typedef struct S_CfsEntry
+{
+    Process* proc;
+    RBNode node;
+    u64 vruntime;
+    u32 weight;
+    /* How long the process has been running for, since it was last picked. */
+    u64 ran_ns;
+    bool queued;
+} CfsEntry;
+
+static KMallocCache g_cfs_entry_cache = KMALLOC_CACHE_INIT("cfs", CfsEntry);
+
+static RBTree g_cfs_tree;
+/* The process that's running, it's not in the tree. NULL if everyone is
+ * blocked. */
+static CfsEntry* g_cfs_current;
+/* Queued processes, plus the current one. Blocked processes don't count. */
+static size_t g_cfs_nr_running;
+/* Never goes back, newcomers start here so they don't get to hog the CPU
+ * making up for the time they weren't around. */
+static u64 g_cfs_min_vruntime;
+static u64 g_cfs_min_granularity_ns;
+
+static bool cfs_less(const RBNode* a, const RBNode* b)
+{
+    return RBTREE_ENTRY(a, CfsEntry, node)->vruntime <
+           RBTREE_ENTRY(b, CfsEntry, node)->vruntime;
+}
+
+static void cfs_push(CfsEntry* entry)
+{
+    rbtree_insert(&entry->node, cfs_less, &g_cfs_tree);
+    entry->queued = true;
+}
+
+static void cfs_remove(CfsEntry* entry)
+{
+    rbtree_remove(&entry->node, &g_cfs_tree);
+    entry->queued = false;
+}
+
+static CfsEntry* cfs_first()
+{
+    RBNode* node = rbtree_first(&g_cfs_tree);
+    return node ? RBTREE_ENTRY(node, CfsEntry, node) : NULL;
+}
+
+static CfsEntry* cfs_pop()
+{
+    CfsEntry* entry = cfs_first();
+    if (entry)
+        cfs_remove(entry);
+
+    return entry;
+}
+
+static void cfs_update_min_vruntime()
+{
+    u64 min = g_cfs_current ? g_cfs_current->vruntime : (u64)-1;
+
+    const CfsEntry* first = cfs_first();
+    if (first && first->vruntime < min)
+        min = first->vruntime;
+
+    if (min != (u64)-1 && min > g_cfs_min_vruntime)
+        g_cfs_min_vruntime = min;
+}
+
+static u64 cfs_slice_ns()
+{
+    const u64 slice = procm_sched_quantum_ns() / g_cfs_nr_running;
+    return slice > g_cfs_min_granularity_ns ? slice : g_cfs_min_granularity_ns;
+}
+
+static Process* cfs_next_proc(Scheduler*)
+{
+    CfsEntry* cur = g_cfs_current;
+    if (cur)
+    {
+        /* Blocked processes are put back by cfs_wake(). */
+        if (cur->proc->state != PROC_BLOCKED)
+            cfs_push(cur);
+        else
+            --g_cfs_nr_running;
+    }
+
+    CfsEntry* next = cfs_pop();
+    g_cfs_current = next;
+    if (!next)
+        return NULL;
+
+    next->ran_ns = 0;
+    return next->proc;
+}
+
+static Process* cfs_current_proc(Scheduler*)
+{
+    return g_cfs_current ? g_cfs_current->proc : NULL;
+}
+
+static int cfs_reset(Scheduler*)
+{
+    if (!g_cfs_current)
+        g_cfs_current = cfs_pop();
+
+    return g_cfs_current ? 0 : -ENOENT;
+}
+
+static int cfs_enqueue(Scheduler*, Process* proc)
+{
+    CfsEntry* entry = kmalloc_cache_calloc(&g_cfs_entry_cache);
+    if (!entry)
+        return -ENOMEM;
+
+    entry->proc = proc;
+    entry->weight = CFS_NICE_0_WEIGHT;
+    entry->vruntime = g_cfs_min_vruntime;
+    proc->sched_data = entry;
+
+    cfs_push(entry);
+    ++g_cfs_nr_running;
+    return 0;
+}
+
+static void cfs_dequeue(Scheduler*, Process* proc)
+{
+    CfsEntry* entry = proc->sched_data;
+    if (entry->queued)
+    {
+        cfs_remove(entry);
+        --g_cfs_nr_running;
+    }
+
+    if (g_cfs_current == entry)
+    {
+        g_cfs_current = NULL;
+        --g_cfs_nr_running;
+    }
+
+    proc->sched_data = NULL;
+    kmalloc_cache_free(entry, &g_cfs_entry_cache);
+}
+
+static void cfs_wake(Scheduler*, Process* proc)
+{
+    CfsEntry* entry = proc->sched_data;
+    if (entry->queued || entry == g_cfs_current)
+        return;
+
+    /* Sleepers get some credit, so that a process that was waiting on input
+     * runs as soon as it gets it, but not so much that it can make up for all
+     * the time it spent asleep. */
+    const u64 credit = procm_sched_quantum_ns() / 2;
+    if (g_cfs_min_vruntime > credit &&
+        entry->vruntime < g_cfs_min_vruntime - credit)
+        entry->vruntime = g_cfs_min_vruntime - credit;
+
+    cfs_push(entry);
+    ++g_cfs_nr_running;
+}
+
+static bool cfs_tick(Scheduler*, u64 ns)
+{
+    CfsEntry* cur = g_cfs_current;
+    if (!cur)
+        return false;
+
+    /* Heavier processes age slower, so they get to run for longer. */
+    cur->vruntime += ns * CFS_NICE_0_WEIGHT / cur->weight;
+    cur->ran_ns += ns;
+    cfs_update_min_vruntime();
+
+    if (cur->ran_ns < cfs_slice_ns())
+        return false;
+
+    /* Only worth switching if there's someone else waiting. */
+    return g_cfs_tree.root != NULL;
+}
+
+static Scheduler g_cfs = {
+    .name = "cfs",
+    .priority = 150,
+    .next_proc = cfs_next_proc,
+    .current_proc = cfs_current_proc,
+    .reset = cfs_reset,
+    .enqueue = cfs_enqueue,
+    .dequeue = cfs_dequeue,
+    .wake = cfs_wake,
+    .tick = cfs_tick};
+
+/* See 'cfs_min_granularity'. */
+static u64 cfs_pick_min_granularity_ns()
+{
+    char value[16];
+    unsigned long us = 0;
+    if (kboot_cmdline_get("cfs_min_granularity", value, sizeof(value)) > 0)
+    {
+        if (strtoul(value, NULL, 10, &us) == 0 && us)
+            return (u64)us * 1000;
+
+        KLOGF(WARN, "Bad minimum granularity \"%s\", ignoring.", value);
+    }
+
+    return (u64)CFS_DEFAULT_MIN_GRANULARITY_US * 1000;
+}
+
+static int cfs_main()
+{
+    g_cfs_min_granularity_ns = cfs_pick_min_granularity_ns();
+    return procm_sched_register(&g_cfs);
+}
+
+static int cfs_exit()
+{
+    return procm_sched_unregister(&g_cfs);
+}
+
+MODULE g_cfs_module = {.name = "cfs", .main = cfs_main, .exit = cfs_exit};
@@ -0,0 +1 @@
+MODULEOBJS += drivers/schedulers/cfs/cfs.c.o
@@ -0,0 +1,253 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/errno.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/module.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/proc/sched.h>
+
+/* Multi-level feedback queue. Every level has it's own run queue, level 0
+ * being the most important one. A process that uses up it's whole quantum is
+ * moved one level down, where the quantum is twice as long. One that gives up
+ * the CPU before that, say waiting on I/O, is moved one level up. */
+
+#define MLFQ_LEVELS 8
+/* Every so often everyone is moved back to level 0, so that processes stuck
+ * on the lower levels don't starve. */
+#define MLFQ_BOOST_INTERVAL_NS 1000000000ULL
+
+typedef struct S_MlfqEntry
+{
+    Process* proc;
+    u8 level;
+    /* How long the process has been running for, since it was last picked. */
+    u64 used_ns;
+    bool queued;
+    struct S_MlfqEntry* prev;
+    struct S_MlfqEntry* next;
+} MlfqEntry;
+
+typedef struct S_MlfqQueue
+{
+    MlfqEntry* head;
+    MlfqEntry* tail;
+} MlfqQueue;
+
+static KMallocCache g_mlfq_entry_cache =
+    KMALLOC_CACHE_INIT("mlfq", MlfqEntry);
+
+static MlfqQueue g_mlfq_queues[MLFQ_LEVELS];
+/* Bit n is set if level n has anyone queued. */
+static u32 g_mlfq_nonempty;
+/* The process that's running, it's not in any queue. NULL if everyone is
+ * blocked. */
+static MlfqEntry* g_mlfq_current;
+static u64 g_mlfq_since_boost_ns;
+
+static void mlfq_push(MlfqEntry* entry)
+{
+    MlfqQueue* queue = &g_mlfq_queues[entry->level];
+
+    entry->next = NULL;
+    entry->prev = queue->tail;
+    if (queue->tail)
+        queue->tail->next = entry;
+    else
+        queue->head = entry;
+
+    queue->tail = entry;
+    entry->queued = true;
+    g_mlfq_nonempty |= 1 << entry->level;
+}
+
+static void mlfq_remove(MlfqEntry* entry)
+{
+    MlfqQueue* queue = &g_mlfq_queues[entry->level];
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        queue->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        queue->tail = entry->prev;
+
+    entry->queued = false;
+    if (!queue->head)
+        g_mlfq_nonempty &= ~(1 << entry->level);
+}
+
+/* Pop the head of the most important non-empty level. */
+static MlfqEntry* mlfq_pop()
+{
+    if (!g_mlfq_nonempty)
+        return NULL;
+
+    MlfqEntry* entry = g_mlfq_queues[__builtin_ctz(g_mlfq_nonempty)].head;
+    mlfq_remove(entry);
+    return entry;
+}
+
+static u64 mlfq_quantum_ns(const MlfqEntry* entry)
+{
+    return procm_sched_quantum_ns() << entry->level;
+}
+
+/* Move everyone queued back to level 0. Levels are spliced as a whole, so
+ * this doesn't depend on the number of processes. */
+static void mlfq_boost()
+{
+    MlfqQueue* top = &g_mlfq_queues[0];
+    for (size_t level = 1; level < MLFQ_LEVELS; ++level)
+    {
+        MlfqQueue* queue = &g_mlfq_queues[level];
+        if (!queue->head)
+            continue;
+
+        for (MlfqEntry* entry = queue->head; entry; entry = entry->next)
+            entry->level = 0;
+
+        queue->head->prev = top->tail;
+        if (top->tail)
+            top->tail->next = queue->head;
+        else
+            top->head = queue->head;
+
+        top->tail = queue->tail;
+        queue->head = queue->tail = NULL;
+    }
+
+    if (g_mlfq_nonempty)
+        g_mlfq_nonempty = 1;
+
+    if (g_mlfq_current)
+        g_mlfq_current->level = 0;
+}
+
+static Process* mlfq_next_proc(Scheduler*)
+{
+    MlfqEntry* cur = g_mlfq_current;
+    if (cur)
+    {
+        /* Used up the whole quantum, it's a CPU hog. */
+        if (cur->used_ns >= mlfq_quantum_ns(cur))
+        {
+            if (cur->level + 1 < MLFQ_LEVELS)
+                ++cur->level;
+        }
+        else if (cur->level > 0)
+        {
+            --cur->level;
+        }
+
+        /* Blocked processes are put back by mlfq_wake(). */
+        if (cur->proc->state != PROC_BLOCKED)
+            mlfq_push(cur);
+    }
+
+    MlfqEntry* next = mlfq_pop();
+    g_mlfq_current = next;
+    if (!next)
+        return NULL;
+
+    next->used_ns = 0;
+    return next->proc;
+}
+
+static Process* mlfq_current_proc(Scheduler*)
+{
+    return g_mlfq_current ? g_mlfq_current->proc : NULL;
+}
+
+static int mlfq_reset(Scheduler*)
+{
+    if (!g_mlfq_current)
+        g_mlfq_current = mlfq_pop();
+
+    return g_mlfq_current ? 0 : -ENOENT;
+}
+
+static int mlfq_enqueue(Scheduler*, Process* proc)
+{
+    MlfqEntry* entry = kmalloc_cache_calloc(&g_mlfq_entry_cache);
+    if (!entry)
+        return -ENOMEM;
+
+    /* Newcomers start out as important as it gets. */
+    entry->proc = proc;
+    entry->level = 0;
+    proc->sched_data = entry;
+
+    mlfq_push(entry);
+    return 0;
+}
+
+static void mlfq_dequeue(Scheduler*, Process* proc)
+{
+    MlfqEntry* entry = proc->sched_data;
+    if (entry->queued)
+        mlfq_remove(entry);
+
+    if (g_mlfq_current == entry)
+        g_mlfq_current = NULL;
+
+    proc->sched_data = NULL;
+    kmalloc_cache_free(entry, &g_mlfq_entry_cache);
+}
+
+static void mlfq_wake(Scheduler*, Process* proc)
+{
+    MlfqEntry* entry = proc->sched_data;
+    if (!entry->queued && entry != g_mlfq_current)
+        mlfq_push(entry);
+}
+
+static bool mlfq_tick(Scheduler*, u64 ns)
+{
+    g_mlfq_since_boost_ns += ns;
+    if (g_mlfq_since_boost_ns >= MLFQ_BOOST_INTERVAL_NS)
+    {
+        g_mlfq_since_boost_ns = 0;
+        mlfq_boost();
+    }
+
+    MlfqEntry* cur = g_mlfq_current;
+    if (!cur)
+        return false;
+
+    cur->used_ns += ns;
+    if (cur->used_ns < mlfq_quantum_ns(cur))
+        return false;
+
+    /* Only worth switching if there's someone else waiting. */
+    return g_mlfq_nonempty != 0;
+}
+
+static Scheduler g_mlfq = {
+    .name = "mlfq",
+    .priority = 200,
+    .next_proc = mlfq_next_proc,
+    .current_proc = mlfq_current_proc,
+    .reset = mlfq_reset,
+    .enqueue = mlfq_enqueue,
+    .dequeue = mlfq_dequeue,
+    .wake = mlfq_wake,
+    .tick = mlfq_tick};
+
+static int mlfq_main()
+{
+    return procm_sched_register(&g_mlfq);
+}
+
+static int mlfq_exit()
+{
+    return procm_sched_unregister(&g_mlfq);
+}
+
+MODULE g_mlfq_module = {
+    .name = "mlfq", .main = mlfq_main, .exit = mlfq_exit};
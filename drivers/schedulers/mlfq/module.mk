@@ -0,0 +1 @@
+MODULEOBJS += drivers/schedulers/mlfq/mlfq.c.o
@@ -12,24 +12,21 @@ static size_t g_current_proc_idx;
 
 static Process* ringsched_next_proc(Scheduler* sched)
 {
-    size_t newidx = g_current_proc_idx + 1;
-    while (true) // Possible infinite loop ? idk i'm drunk
-    {
-        if (newidx >= *sched->proc_count)
-        {
-            newidx = 0;
-            continue;
-        }
+    const size_t count = *sched->proc_count;
 
-        if ((*sched->procs)[newidx] == NULL)
-        {
-            ++newidx;
+    /* Go around the ring once, ending up back at the current process. */
+    for (size_t i = 1; i <= count; ++i)
+    {
+        const size_t newidx = (g_current_proc_idx + i) % count;
+        Process* proc = (*sched->procs)[newidx];
+        if (!proc || proc->state == PROC_BLOCKED)
             continue;
-        }
 
         g_current_proc_idx = newidx;
-        return (*sched->procs)[newidx];
+        return proc;
     }
+
+    return NULL;
 }
 
 static Process* ringsched_current_proc(Scheduler* sched)
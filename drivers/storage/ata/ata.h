@@ -7,6 +7,7 @@
 #define _DXGMX_X86_ATA_H
 
 #include <dxgmx/pci.h>
+#include <dxgmx/proc/waitqueue.h>
 #include <dxgmx/storage/blkdev.h>
 #include <dxgmx/types.h>
 
@@ -82,6 +83,20 @@
 #define ATA_CMD_IDENT_PACKET 0xA1
 #define ATA_CMD_IDENT 0xEC
 
+/* One of the IDE channels, each of which has up to two drives. */
+typedef struct S_AtaChannel
+{
+    /* The ATA I/O port base */
+    u16 portio;
+    /* Woken up by the channel's interrupt, which a drive raises once it's
+     * done with a command, or ready for the next sector. */
+    WaitQueue irq_waitqueue;
+    /* Set while one of the drives is in the middle of a transfer. The drives
+     * share the registers, so only one can be talked to at a time. */
+    bool busy;
+    WaitQueue busy_waitqueue;
+} AtaChannel;
+
 typedef struct S_AtaStorageDevice
 {
     /* The ATA I/O port base */
@@ -96,6 +111,7 @@ typedef struct S_AtaStorageDevice
     u8 dma : 1;
 
     PCIDevice* controller;
+    AtaChannel* channel;
 } AtaStorageDevice;
 
 ssize_t
@@ -6,9 +6,11 @@
 #include "ata.h"
 #include <dxgmx/assert.h>
 #include <dxgmx/errno.h>
+#include <dxgmx/interrupts.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
 #include <dxgmx/math.h>
+#include <dxgmx/mem/shrinker.h>
 #include <dxgmx/string.h>
 #include <dxgmx/timer.h>
 #include <dxgmx/types.h>
@@ -19,6 +21,9 @@
 #define ATA_READ_TIMEOUT_MS 200
 #define ATA_WRITE_TIMEOUT_MS 200
 #define ATA_FLUSH_SECTORS_TIMEOUT_MS 200
+/* Waits on the drive sleep until it's interrupt comes in, but check on it
+ * this often anyway in case it never does. */
+#define ATA_POLL_INTERVAL_NS 1000000
 
 /**
  * @brief Converts 'sectors' to internal ATAPIO sectors.
@@ -158,6 +163,9 @@ static bool atapio_flush_sectors(time_t timeout_ms, const BlockDevice* dev)
     /* Wait for the sectors to actually flush. */
     Timer t;
     timer_start(&t);
+
+    bool flushed = true;
+    const bool irqs = interrupts_disable_irqs_save();
     while (port_inb(ATA_REG_STATUS(atadev->portio)) & ATA_STATUS_BSY)
     {
         if (timer_elapsed_ms(&t) > timeout_ms)
@@ -166,11 +174,16 @@ static bool atapio_flush_sectors(time_t timeout_ms, const BlockDevice* dev)
                 ERR,
                 "[%s] Timed out trying to flush sectors to disk!",
                 dev->name);
-            return false;
+            flushed = false;
+            break;
         }
+
+        waitqueue_wait_timeout(
+            &atadev->channel->irq_waitqueue, ATA_POLL_INTERVAL_NS);
     }
 
-    return true;
+    interrupts_restore_irqs(irqs);
+    return flushed;
 }
 
 static bool atapio_wait_for_ready(time_t timeout_ms, const BlockDevice* dev)
@@ -179,18 +192,24 @@ static bool atapio_wait_for_ready(time_t timeout_ms, const BlockDevice* dev)
 
     Timer t;
     timer_start(&t);
+
+    bool ready = false;
+    const bool irqs = interrupts_disable_irqs_save();
     while (true)
     {
         if (timer_elapsed_ms(&t) > timeout_ms)
         {
             KLOGF(
                 ERR, "[%s] Timed out waiting for drive get ready!", dev->name);
-            return false;
+            break;
         }
 
         u8 status = port_inb(ATA_REG_STATUS(atadev->portio));
         if (!(status & ATA_STATUS_BSY) && (status & ATA_STATUS_DRQ))
+        {
+            ready = true;
             break;
+        }
 
         if ((status & ATA_STATUS_ERR) || (status & ATA_STATUS_DF))
         {
@@ -200,11 +219,38 @@ static bool atapio_wait_for_ready(time_t timeout_ms, const BlockDevice* dev)
             u8 error = port_inb(ATA_REG_ERR(atadev->portio));
 
             KLOGF(ERR, "[%s] Error - %s!", dev->name, ata_error_to_str(error));
-            return false;
+            break;
         }
+
+        /* The drive raises an interrupt once it's ready, sleep until then. */
+        waitqueue_wait_timeout(
+            &atadev->channel->irq_waitqueue, ATA_POLL_INTERVAL_NS);
     }
 
-    return true;
+    interrupts_restore_irqs(irqs);
+    return ready;
+}
+
+/* Get exclusive access to the drive's channel. Transfers sleep while waiting
+ * on the drive, so someone else might come along in the meantime. */
+static void atapio_lock_channel(const BlockDevice* dev)
+{
+    AtaChannel* channel = ((const AtaStorageDevice*)dev->extra)->channel;
+
+    const bool irqs = interrupts_disable_irqs_save();
+    while (channel->busy)
+        waitqueue_wait(&channel->busy_waitqueue);
+
+    channel->busy = true;
+    interrupts_restore_irqs(irqs);
+}
+
+static void atapio_unlock_channel(const BlockDevice* dev)
+{
+    AtaChannel* channel = ((const AtaStorageDevice*)dev->extra)->channel;
+
+    channel->busy = false;
+    waitqueue_wake_all(&channel->busy_waitqueue);
 }
 
 static _ATTR_ALWAYS_INLINE bool
@@ -217,8 +263,8 @@ atapio_is_valid_range(lba_t lba, sectorcnt_t sectors, const BlockDevice* dev)
     return (sectors <= dev->sector_count - lba);
 }
 
-ssize_t
-atapio_read(const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
+static ssize_t atapio_do_read(
+    const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
 {
     if (!atapio_is_valid_range(lba, sectors, dev))
     {
@@ -227,6 +273,7 @@ atapio_read(const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
     }
 
     const AtaStorageDevice* atadev = dev->extra;
+    u8* buf = dest;
 
     while (sectors)
     {
@@ -257,9 +304,11 @@ atapio_read(const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
                 the logic simpler, but that means we fuck up the
                 alignment of buf. */
                 u16 w = port_inw(ATA_REG_DATA(atadev->portio));
-                ((u8*)dest)[i * 2] = w;
-                ((u8*)dest)[i * 2 + 1] = (w >> 8) & 0xFF;
+                buf[i * 2] = w;
+                buf[i * 2 + 1] = (w >> 8) & 0xFF;
             }
+
+            buf += 512;
         }
 
         sectors -= workingsectors;
@@ -269,7 +318,7 @@ atapio_read(const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
     return sectors;
 }
 
-ssize_t atapio_write(
+static ssize_t atapio_do_write(
     const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, const void* src)
 {
     if (!atapio_is_valid_range(lba, sectors, dev))
@@ -279,6 +328,7 @@ ssize_t atapio_write(
     }
 
     const AtaStorageDevice* atadev = dev->extra;
+    const u8* buf = src;
 
     while (sectors)
     {
@@ -305,15 +355,17 @@ ssize_t atapio_write(
                 /* We could cast buf to an u16* which would make
                 the logic simpler, but that means we fuck up the
                 alignment of buf. */
-                u16 w = ((u8*)src)[i * 2 + 1];
+                u16 w = buf[i * 2 + 1];
                 w <<= 8;
-                w |= ((u8*)src)[i * 2];
+                w |= buf[i * 2];
 
                 port_outw(w, ATA_REG_DATA(atadev->portio));
 
                 /* Sleep just for good measure. ? */
                 nanosleep(&ts, NULL);
             }
+
+            buf += 512;
         }
 
         st = atapio_flush_sectors(ATA_FLUSH_SECTORS_TIMEOUT_MS, dev);
@@ -326,3 +378,26 @@ ssize_t atapio_write(
 
     return sectors;
 }
+
+ssize_t
+atapio_read(const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, void* dest)
+{
+    /* Swapping out from under a transfer would want the channel back. */
+    const bool nosleep = shrinker_nosleep_save();
+    atapio_lock_channel(dev);
+    const ssize_t st = atapio_do_read(dev, lba, sectors, dest);
+    atapio_unlock_channel(dev);
+    shrinker_nosleep_restore(nosleep);
+    return st;
+}
+
+ssize_t atapio_write(
+    const BlockDevice* dev, lba_t lba, sectorcnt_t sectors, const void* src)
+{
+    const bool nosleep = shrinker_nosleep_save();
+    atapio_lock_channel(dev);
+    const ssize_t st = atapio_do_write(dev, lba, sectors, src);
+    atapio_unlock_channel(dev);
+    shrinker_nosleep_restore(nosleep);
+    return st;
+}
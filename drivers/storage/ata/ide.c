@@ -26,13 +26,25 @@
 
 static BlockDeviceDriver g_ata_driver = {.init = NULL, .destroy = NULL};
 
+/* Primary and secondary channels. */
+static AtaChannel g_ata_channels[2];
+
+static void ata_channel_isr(AtaChannel* channel)
+{
+    /* Reading the status register acknowledges the interrupt. */
+    port_inb(ATA_REG_STATUS(channel->portio));
+    waitqueue_wake_all(&channel->irq_waitqueue);
+}
+
 static void ata_primary_isr()
 {
+    ata_channel_isr(&g_ata_channels[0]);
     interrupts_irq_done();
 }
 
 static void ata_secondary_isr()
 {
+    ata_channel_isr(&g_ata_channels[1]);
     interrupts_irq_done();
 }
 
@@ -158,6 +170,7 @@ static void ide_select_drive(bool master, u16 bus_io)
 static int ide_identify_drive(
     u16 bus_io,
     u16 bus_ctl,
+    AtaChannel* channel,
     PCIDevice* pcidev,
     bool master,
     BlockDeviceDriver* drv)
@@ -326,6 +339,7 @@ static int ide_identify_drive(
     }
 
     atadev->controller = pcidev;
+    atadev->channel = channel;
 
     ide_dump_drive_info(dev);
     blkdevm_enumerate_partitions(dev);
@@ -334,13 +348,17 @@ static int ide_identify_drive(
 }
 
 static int ide_enumerate_bus(
-    u16 bus_io, u16 bus_ctl, PCIDevice* dev, BlockDeviceDriver* drv)
+    u16 bus_io,
+    u16 bus_ctl,
+    AtaChannel* channel,
+    PCIDevice* dev,
+    BlockDeviceDriver* drv)
 {
     /* try master drive. */
-    ide_identify_drive(bus_io, bus_ctl, dev, true, drv);
+    ide_identify_drive(bus_io, bus_ctl, channel, dev, true, drv);
 
     /* try slave drive. */
-    ide_identify_drive(bus_io, bus_ctl, dev, false, drv);
+    ide_identify_drive(bus_io, bus_ctl, channel, dev, false, drv);
 
     return 0;
 }
@@ -370,11 +388,25 @@ static int ide_probe_pci_device(PCIDevice* dev)
     {
     }
 
+    g_ata_channels[0].portio = primary_bus_io;
+    g_ata_channels[1].portio = secondary_bus_io;
+
     interrupts_reqister_irq_isr(primary_interrupt_line, ata_primary_isr);
     interrupts_reqister_irq_isr(secondary_interrupt_line, ata_secondary_isr);
 
-    ide_enumerate_bus(primary_bus_io, primary_bus_ctl, dev, &g_ata_driver);
-    ide_enumerate_bus(secondary_bus_io, secondary_bus_ctl, dev, &g_ata_driver);
+    ide_enumerate_bus(
+        primary_bus_io,
+        primary_bus_ctl,
+        &g_ata_channels[0],
+        dev,
+        &g_ata_driver);
+
+    ide_enumerate_bus(
+        secondary_bus_io,
+        secondary_bus_ctl,
+        &g_ata_channels[1],
+        dev,
+        &g_ata_driver);
 
     return 0;
 }
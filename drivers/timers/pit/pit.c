@@ -9,6 +9,7 @@
 #include <dxgmx/interrupts.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/module.h>
+#include <dxgmx/proc/procm.h>
 #include <dxgmx/string.h>
 #include <dxgmx/timekeep.h>
 #include <dxgmx/x86/idt.h>
@@ -46,10 +47,12 @@
 
 static volatile struct timespec g_periodic_int_timespec;
 static size_t g_freq = 0;
+/* Nanoseconds between two interrupts. */
+static u32 g_period_ns = 0;
 
 static void pit_isr()
 {
-    g_periodic_int_timespec.tv_nsec += 1.f / g_freq * 1000000000;
+    g_periodic_int_timespec.tv_nsec += g_period_ns;
     while (g_periodic_int_timespec.tv_nsec >= 1000000000)
     {
         ++g_periodic_int_timespec.tv_sec;
@@ -57,11 +60,15 @@ static void pit_isr()
     }
 
     interrupts_irq_done();
+
+    /* Any preemption happens on the way out of the interrupt. */
+    procm_sched_tick(g_period_ns);
 }
 
 static void pit_enable_periodic_int()
 {
     g_freq = 4096;
+    g_period_ns = 1.f / g_freq * 1000000000;
     const u16 freqdiv = PIT_BASE_FREQ_HZ / g_freq;
 
     interrupts_disable_irqs();
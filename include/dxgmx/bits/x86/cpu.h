@@ -152,6 +152,8 @@ typedef enum E_CPUFeatureFlag
     CPU_SS = (1 << 26),
     /* Automatic thermal control circuit (TCC). */
     CPU_TM = (1 << 27),
+    /* Process context identifiers. */
+    CPU_PCID = (1 << 28),
 
     // ... more to come
 } CPUFeatureFlag;
@@ -207,6 +209,7 @@ typedef struct S_CPUFeatures
             u8 acpi : 1;
             u8 ss : 1;
             u8 tm : 1;
+            u8 pcid : 1;
         };
         u64 flags;
     };
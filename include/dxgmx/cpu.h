@@ -34,4 +34,10 @@ const CPUInfo* cpu_get_info();
 
 bool cpu_has_feature(CPUFeatureFlag flag);
 
+/**
+ * Returns the value of a free running counter that ticks once per CPU cycle,
+ * or 0 if the CPU doesn't have one.
+ */
+u64 cpu_read_cycle_counter();
+
 #endif // _DXGMX_CPU_H
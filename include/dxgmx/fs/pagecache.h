@@ -0,0 +1,84 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_FS_PAGECACHE_H
+#define _DXGMX_FS_PAGECACHE_H
+
+#include <dxgmx/fs/vnode.h>
+#include <dxgmx/types.h>
+
+/* Page frames holding the contents of a file, shared by everyone that maps said
+ * file. Each cached page frame is referenced by the cache itself (see
+ * falloc_ref()), so it outlives the mappings that use it. */
+typedef struct S_PageCache
+{
+    /* Page frame holding each page of the file, 0 if it's not cached. */
+    ptr* frames;
+    size_t frame_count;
+} PageCache;
+
+/**
+ * Find a cached page of a file.
+ *
+ * 'vnode' The file.
+ * 'idx' Index of the page in the file.
+ *
+ * Returns:
+ * The physical address of the page frame on success.
+ * 0 if the page is not cached.
+ */
+ptr pagecache_find(const VirtualNode* vnode, size_t idx);
+
+/**
+ * Cache a page of a file. The cache takes a reference to 'frame'.
+ *
+ * 'vnode' The file.
+ * 'idx' Index of the page in the file. Has to not be cached already.
+ * 'frame' The page frame holding the page's contents.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ * -EOVERFLOW if 'frame' has too many references.
+ */
+int pagecache_insert(VirtualNode* vnode, size_t idx, ptr frame);
+
+/**
+ * Forget the cached pages of a file that hold [off, off + n). Page frames that
+ * are still mapped somewhere stay there, with their old contents.
+ *
+ * 'vnode' The file.
+ * 'off' Offset into the file.
+ * 'n' Number of bytes.
+ */
+void pagecache_invalidate(VirtualNode* vnode, off_t off, size_t n);
+
+/**
+ * Forget all the cached pages of a file, and free the cache.
+ *
+ * 'vnode' The file.
+ */
+void pagecache_drop(VirtualNode* vnode);
+
+/**
+ * Returns:
+ * How many cached pages of 'vnode' are not mapped anywhere, which is how many
+ * page frames pagecache_shrink() could free.
+ */
+size_t pagecache_count_unused(const VirtualNode* vnode);
+
+/**
+ * Forget cached pages of a file that are not mapped anywhere, freeing their
+ * page frames. They're read back from the file the next time they're needed.
+ *
+ * 'vnode' The file.
+ * 'n' How many pages to forget at most.
+ *
+ * Returns:
+ * How many pages have been forgotten.
+ */
+size_t pagecache_shrink(VirtualNode* vnode, size_t n);
+
+#endif // !_DXGMX_FS_PAGECACHE_H
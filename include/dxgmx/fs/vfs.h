@@ -108,4 +108,13 @@ off_t vfs_lseek(fd_t fd, off_t offset, int whence, Process* proc);
  */
 int vfs_close(fd_t fd, Process* proc);
 
+/**
+ * Open all of a process' files on behalf of a forked process, with the same
+ * file descriptors.
+ * 'proc' The parent process.
+ * 'newproc' The forked process. It's file descriptor table has to be at least
+ * as big as the parent's, and have no open files.
+ */
+int vfs_fork_fds(const Process* proc, Process* newproc);
+
 #endif // !_DXGMX_FS_VFS_H
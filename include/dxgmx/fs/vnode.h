@@ -11,6 +11,7 @@
 
 struct S_FileSystem;
 struct S_VirtualNodeOperations;
+struct S_PageCache;
 
 /* Vnode is pending removal, and will be removed once all references to it are
  * closed. */
@@ -53,6 +54,9 @@ typedef struct S_VirtualNode
 
     const struct S_VirtualNodeOperations* ops;
 
+    /* Cached pages of this file, NULL if none are cached. See pagecache.h */
+    struct S_PageCache* pagecache;
+
     void* data;
 } VirtualNode;
 
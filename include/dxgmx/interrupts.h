@@ -27,6 +27,29 @@ void interrupts_disable_irqs();
 /* Enable all hardware interrupts. */
 void interrupts_enable_irqs();
 
+/**
+ * Disable all hardware interrupts, if they aren't already.
+ *
+ * Returns:
+ * true if they were enabled, pass this on to interrupts_restore_irqs().
+ */
+bool interrupts_disable_irqs_save();
+
+/**
+ * Put hardware interrupts back the way they were before
+ * interrupts_disable_irqs_save().
+ *
+ * 'enabled' What interrupts_disable_irqs_save() returned.
+ */
+void interrupts_restore_irqs(bool enabled);
+
+/**
+ * Enable hardware interrupts and suspend the CPU until one comes in. One that
+ * comes in right as interrupts are enabled is not missed. Interrupts are
+ * disabled again on return.
+ */
+void interrupts_wait_irq();
+
 /**
  * Register an ISR for an IRQ.
  *
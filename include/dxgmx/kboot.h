@@ -14,6 +14,8 @@
 #include <dxgmx/mem/mregmap.h>
 #include <dxgmx/types.h>
 
+#define KBOOT_CMDLINE_MAX 256
+
 typedef struct KernelBootInfo
 {
     bool has_fb;
@@ -23,10 +25,30 @@ typedef struct KernelBootInfo
     ptr fb_bpp;
 
     MemoryRegionMap* mregmap;
+
+    /* Null terminated command line given to us by the bootloader. Empty if the
+     * bootloader didn't give us one. */
+    char cmdline[KBOOT_CMDLINE_MAX];
 } KernelBootInfo;
 
 extern const KernelBootInfo ___kboot_info;
 
 void kbootinfo_parse();
 
+/**
+ * Look up an option in the kernel command line. Options are whitespace
+ * separated and are either of form 'opt' or 'opt=value'.
+ *
+ * 'opt' Name of the option.
+ * 'dest' Where to copy the option's value. Can be NULL if the caller only
+ * cares about the option being present. The value is always null terminated.
+ * 'n' Size of 'dest'.
+ *
+ * Returns:
+ * The length of the value (0 if it has none) on success.
+ * -ENOENT if 'opt' is not present.
+ * -ENAMETOOLONG if the value doesn't fit in 'dest'.
+ */
+int kboot_cmdline_get(const char* opt, char* dest, size_t n);
+
 #endif // !_DXGMX_KBOOT_H
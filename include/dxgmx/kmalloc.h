@@ -23,6 +23,71 @@ typedef struct S_KMallocStatistics
 
 } KMallocStatistics;
 
+/* How full one of a kmalloc driver's pools of fixed size chunks is. */
+typedef struct S_KMallocPoolStatistics
+{
+    size_t chunksize;
+    size_t chunks;
+    size_t used_chunks;
+    /* The longest run of free chunks, shows how fragmented the pool is. */
+    size_t largest_free_run;
+} KMallocPoolStatistics;
+
+/* Allocation traffic coming from a single place, see kmalloc_get_profile(). */
+typedef struct S_KMallocProfileSite
+{
+    /* The return address of the call into kmalloc. */
+    ptr callsite;
+    /* Allocations made from here, krealloc() counts as one. */
+    size_t allocations;
+    /* Frees made from here, krealloc() counts as one. */
+    size_t frees;
+    /* Bytes allocated from here, ever. */
+    size_t bytes;
+    /* Bytes allocated from here that are yet to be freed, from anywhere. */
+    size_t live_bytes;
+} KMallocProfileSite;
+
+/**
+ * A cache for objects of a single type. Freed objects are kept around (up to
+ * 'max_free' of them) and handed out again on the next allocation, without
+ * going through the kmalloc driver. Caches don't need to be initialized at
+ * runtime, just declare them with KMALLOC_CACHE_INIT().
+ */
+typedef struct S_KMallocCache
+{
+    /* Name of the cache, for statistics. */
+    const char* name;
+    /* Size and alignment of a single object. */
+    size_t objsize;
+    size_t alignment;
+    /* How many free objects we hold on to before giving them back to kmalloc.
+     */
+    size_t max_free;
+
+    /* Free objects, linked through their first word. */
+    void* freelist;
+    size_t free_count;
+
+    /* Number of objects currently handed out. */
+    size_t live;
+    /* Allocations served from the freelist. */
+    size_t hits;
+    /* Allocations that had to go through kmalloc. */
+    size_t misses;
+
+    bool registered;
+    struct S_KMallocCache* next;
+} KMallocCache;
+
+#define KMALLOC_CACHE_DEFAULT_MAX_FREE 64
+
+#define KMALLOC_CACHE_INIT(_name, _type)                                       \
+    {                                                                          \
+        .name = _name, .objsize = sizeof(_type), .alignment = _Alignof(_type), \
+        .max_free = KMALLOC_CACHE_DEFAULT_MAX_FREE                             \
+    }
+
 /**
  * Kmalloc implementation details.
  * All allocations made by a driver shall be inside the heap they are passed.
@@ -90,6 +155,16 @@ typedef struct S_KMallocDriver
      */
     void (*free)(void* addr, const Heap* heap);
 
+    /* KLOG driver specific statistics about 'heap'. Optional. */
+    void (*dump_statistics)(const Heap* heap);
+
+    /**
+     * Fill in up to 'n' 'pools' with how full the pools of 'heap' are. Returns
+     * how many pools 'heap' has. Optional.
+     */
+    size_t (*pool_statistics)(
+        const Heap* heap, KMallocPoolStatistics* pools, size_t n);
+
     /* Default alignment that should be used when allocating memeory with a
      * function that doesn't explicitly take in the alignnent, ex: kmalloc().
      * Must be a power of two.
@@ -106,31 +181,20 @@ int kmalloc_init();
 /* Registering a heap to kmalloc implies giving kmalloc full ownersip of the
  * memory range represented by said heap. No memory in that range is to be used
  * outside kmalloc/without the use of pointers returned by kmalloc, as it may be
- * overwritten/wrongly-interpreted by kmalloc. There is one restriction imposed
- * on a 'kernel heap': it's starting address needs to be
- * >= the end of the kernel image or inside the kernel image. This is done for
- * multiple reasons:
- *
- *  1: The kernel will make sure that it's heap is higher half mapped in the
- * same fashion that the kernel image is. This
- * basically means that the virtual mapping of everything kernel-related,
- * starting from the 3GiB going up to however big the kernel
- * heap is, is just a higher half mapping from 1MiB to however big the kernel
- * heap is.
- *
- * 2: If the heap is higher-half mapped, then n contiguous pages in virtual
- * space are also contiguous in physical space.
- *
- * 3: Translations from physical to virtual addresses become trivial (just add
- * the _kernel_map_offset to the physical address).
+ * overwritten/wrongly-interpreted by kmalloc. A 'kernel heap' has to live
+ * inside the kernel's part of the address space, but it's not required to be
+ * backed by contiguous physical memory: pages are mapped in on demand, from
+ * whatever page frames are free. Code that needs memory on which
+ * mm_kva2pa()/mm_kpa2va() are valid (paging structures) should use
+ * mm_alloc_linear().
  *
- * 4: This also helps mentally separate everything kernel related,
- * as the kernel itself is mapped at a high address, with nothing coming
- * after it (except it's heap, of course). This can be seen easily, just by
- * looking at an address and seeing if it's bigger than _kernel_map_offset.
+ * Returns the id of the heap on success, negative on error.
  */
 int kmalloc_register_heap(Heap heap);
 
+/* Make the heap with the given 'id' the one used by kmalloc(), kcalloc(),
+ * kmalloc_aligned() and krealloc(NULL, ...). kfree() and krealloc() always
+ * operate on the heap that owns the address. */
 int kmalloc_use_heap(size_t id);
 
 bool kmalloc_owns_va(ptr va);
@@ -146,6 +210,11 @@ void* kcalloc(size_t size);
  * bytes. */
 void* kmalloc_aligned(size_t size, size_t alignment);
 
+/* kmalloc_aligned() but the memory comes from the heap with the given 'id',
+ * instead of the active one. Returns NULL on failure or if 'id' is not a valid
+ * heap. */
+void* kmalloc_aligned_from_heap(size_t size, size_t alignment, size_t id);
+
 /* Kernel version of realloc. If 'addr' was returned by a call to
  * kmalloc_aligned(), then new address (if changed) is guaranteed to keep it's
  * alignemnt. */
@@ -154,6 +223,62 @@ void* krealloc(void* addr, size_t size);
 /* Kernel version of free. */
 void kfree(void* addr);
 
+/* Allocate an object from 'cache'. */
+void* kmalloc_cache_alloc(KMallocCache* cache);
+
+/* Allocate a zeroed out object from 'cache'. */
+void* kmalloc_cache_calloc(KMallocCache* cache);
+
+/* Give an object back to 'cache'. 'addr' must have been allocated from the
+ * same 'cache'. */
+void kmalloc_cache_free(void* addr, KMallocCache* cache);
+
+/* Returns how many heaps have been registered, heap ids go up to this. */
+size_t kmalloc_heap_count();
+
+/* Returns the name of the kmalloc driver in use. */
+const char* kmalloc_driver_name();
+
+/**
+ * Get the allocation statistics of the heap with the given 'id'.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if 'id' is not a valid heap.
+ * -ENOSYS if statistics are not being recorded.
+ */
+int kmalloc_get_statistics(size_t id, KMallocStatistics* stats);
+
+/**
+ * Get how full the pools of the heap with the given 'id' are, if the driver
+ * has any.
+ *
+ * 'id' The heap.
+ * 'pools' Where to put the statistics.
+ * 'n' How many entries 'pools' has room for.
+ *
+ * Returns:
+ * How many pools the heap has, which may be more than 'n'.
+ * -EINVAL if 'id' is not a valid heap.
+ */
+ssize_t kmalloc_get_pool_statistics(
+    size_t id, KMallocPoolStatistics* pools, size_t n);
+
 void kmalloc_dump_statistics();
 
+/**
+ * Get the allocation profile, when kmalloc is built with KMALLOC_PROFILE.
+ *
+ * 'sites' Where to put the callsites.
+ * 'n' How many entries 'sites' has room for.
+ *
+ * Returns:
+ * How many callsites were recorded, which may be more than 'n'.
+ * -ENOSYS if profiling is not enabled.
+ */
+ssize_t kmalloc_get_profile(KMallocProfileSite* sites, size_t n);
+
+/* KLOG every recorded callsite, with it's symbol. */
+void kmalloc_dump_profile();
+
 #endif //!_DXGMX_KMALLOC_H
@@ -17,7 +17,9 @@
  * of memory. The virtual starting address is not up to the caller, but instead
  * chosen internally by the algorithm. You can, however see the memory pool's
  * start and end bounds (proc's dma heap). This memory is of course suitable for
- * doing DMA and/or memory map hardware/
+ * doing DMA and/or memory map hardware/. Ranges spanning at least a large page
+ * are placed so that they can be mapped with large pages, see
+ * mm_map_large_page().
  *
  * 'paddr' The starting physical address.
  * 'n' How many bytes to map. (Will get page aligned, if not already).
@@ -31,4 +33,121 @@
  */
 ERR_OR(ptr) dma_map_range(ptr paddr, size_t n, u16 flags, Process* proc);
 
+/**
+ * Unmap a range previously mapped with dma_map_range(), giving it's virtual
+ * space back to the process' DMA heap. The physical memory is left alone.
+ *
+ * 'vaddr' The start of the virtual mapping, as returned by dma_map_range().
+ * 'n' How many bytes to unmap. (Will get page aligned, if not already).
+ * 'proc' The process that has the mapping.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if the range is not inside the process' DMA heap.
+ * -ENOMEM on out of memory.
+ */
+int dma_unmap_range(ptr vaddr, size_t n, Process* proc);
+
+/* A physically contiguous buffer suitable for DMA, that's mapped in the kernel
+ * DMA heap, see dma_alloc_coherent(). */
+typedef struct S_DMABuffer
+{
+    /* Where the kernel sees the buffer. */
+    ptr vaddr;
+    /* What to give to the device. */
+    ptr paddr;
+    /* Page aligned size of the buffer. */
+    size_t size;
+} DMABuffer;
+
+/**
+ * Allocate a zeroed, physically contiguous buffer that both the CPU and a
+ * device can access at the same time. DMA on x86 snoops the CPU caches, so the
+ * buffer is mapped cacheable.
+ *
+ * 'size' How many bytes to allocate. (Will get page aligned, if not already).
+ * 'buf' Filled in with where the buffer is.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if 'size' is 0.
+ * -ENOMEM on out of memory, or if there are no contiguous page frames.
+ */
+int dma_alloc_coherent(size_t size, DMABuffer* buf);
+
+/**
+ * Free a buffer allocated with dma_alloc_coherent().
+ *
+ * 'buf' The buffer.
+ */
+void dma_free_coherent(DMABuffer* buf);
+
+/* A physically contiguous piece of a buffer. */
+typedef struct S_DMASegment
+{
+    ptr paddr;
+    size_t size;
+} DMASegment;
+
+/* The physical pieces making up a virtually contiguous buffer, in order, see
+ * dma_build_sglist(). */
+typedef struct S_DMASGList
+{
+    DMASegment* segments;
+    size_t count;
+} DMASGList;
+
+/**
+ * Build a scatter-gather list for a buffer in kernel memory (such as memory
+ * from kmalloc()), whose pages can be anywhere in physical memory. Pages that
+ * are physically contiguous are merged into the same segment.
+ *
+ * 'buf' The buffer.
+ * 'size' The size of the buffer.
+ * 'max_segment' The maximum size of a segment, 0 for no limit. Has to be a
+ * multiple of PAGESIZE.
+ * 'sgl' The list to fill in. Has to be freed with dma_free_sglist().
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL on invalid arguments.
+ * -EFAULT if part of the buffer is not mapped.
+ * -ENOMEM on out of memory.
+ */
+int dma_build_sglist(
+    const void* buf, size_t size, size_t max_segment, DMASGList* sgl);
+
+/**
+ * Free a scatter-gather list built with dma_build_sglist().
+ *
+ * 'sgl' The list.
+ */
+void dma_free_sglist(DMASGList* sgl);
+
+/**
+ * Give a forked process the same DMA mappings as it's parent.
+ *
+ * 'proc' The parent process.
+ * 'newproc' The forked process, it's paging struct has to be initialized.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ */
+int dma_fork(const Process* proc, Process* newproc);
+
+/**
+ * Returns how many pages of the process' DMA heap are in use, out of
+ * 'proc->dma_heap.pagespan'.
+ */
+size_t dma_mapped_pages(const Process* proc);
+
+/**
+ * Free a process' DMA bookkeeping, once it's mappings are gone along with it's
+ * paging struct.
+ *
+ * 'proc' The process.
+ */
+void dma_destroy(Process* proc);
+
 #endif // !_DXGMX_MEM_DMA_H
@@ -11,22 +11,66 @@
 
 /* falloc stands for (page) Frame ALLOCator. */
 
+/* Blocks of up to 2^FALLOC_MAX_ORDER contiguous page frames can be allocated at
+ * once. */
+#define FALLOC_MAX_ORDER 10
+
+/**
+ * Get the number of bytes falloc needs for it's bookkeeping, for the given
+ * memory map. This is about 2 bytes and 2 bits per page frame, up to the end of
+ * the last memory region.
+ */
+size_t falloc_metadata_size(const MemoryRegionMap* mregmap);
+
 /**
  * Initializes the page frame allocator.
+ *
+ * 'mregmap' The available memory.
+ * 'metadata' falloc_metadata_size() bytes of mapped memory, to be owned by
+ * falloc from here on. If it's inside one of the regions in 'mregmap', the
+ * page frames backing it have to be reserved with falloc_range_at() right after
+ * this call.
+ *
  * Returns 0 on success, negative on error.
  */
-int falloc_init(const MemoryRegionMap* mregmap);
+int falloc_init(const MemoryRegionMap* mregmap, void* metadata);
+
+/**
+ * Tries to allocate 2^'order' contiguous page frames. The block is aligned on
+ * it's own size. If there's no free block, SHRINK_FRAMES shrinkers are run
+ * before giving up, see shrinker_run().
+ *
+ * 'order' The order of the block, <= FALLOC_MAX_ORDER.
+ *
+ * Returns:
+ * The physical address of the first page frame on success.
+ * 0 on failure.
+ */
+ptr falloc_pages(size_t order);
+
+/**
+ * Free a block of 2^'order' page frames allocated with falloc_pages(). 'order'
+ * has to be the one the block was allocated with.
+ *
+ * 'base' The physical address of the block.
+ * 'order' The order of the block.
+ */
+void ffree_pages(ptr base, size_t order);
 
 /**
  * Tries to allocate one 'user' pageframe.
- * This pageframe should not be used for the kernel heap, as it's not guaranteed
- * to be mapped in a higher-half fashion in the kernel page table. Kheap page
- * frames need to be allocated 'manually' using falloc_one_at() where we can
- * request frames that we can map in a higher half function overselvers.
  * Returns the page frame physical address on success, 0 on failure.
  */
 ptr falloc_one_user();
 
+/**
+ * Tries to allocate one pageframe for the kernel (kernel heap pages). Any free
+ * frame will do, since the kernel heap is not required to be physically
+ * contiguous.
+ * Returns the page frame physical address on success, 0 on failure.
+ */
+ptr falloc_one();
+
 /* Returns true if the pageframe at starting at 'base' is not
  * allocated.
  */
@@ -39,11 +83,51 @@ bool falloc_is_frame_available(ptr base);
  */
 int falloc_one_at(ptr base);
 
+/**
+ * Tries to allocate the 'n' page frames starting at physical address 'base'.
+ * Either all of them are allocated, or none are.
+ * Returns 0 on success,
+ * -ENOMEM if any of the requested pageframes is already allocated.
+ */
+int falloc_range_at(ptr base, size_t n);
+
+/**
+ * Free the 'n' page frames starting at 'base'. They don't have to have been
+ * allocated together, but all of them have to be allocated.
+ */
+void ffree_range(ptr base, size_t n);
+
+/**
+ * Add a reference to an allocated page frame, sharing it. A shared page frame
+ * is only freed once ffree_one() has been called once for every reference.
+ *
+ * 'base' The physical address of the page frame.
+ *
+ * Returns:
+ * 0 on success.
+ * -EOVERFLOW if the page frame has too many references.
+ */
+int falloc_ref(ptr base);
+
+/**
+ * Returns the number of references to the page frame at 'base', 0 if it's
+ * free.
+ */
+size_t falloc_refcount(ptr base);
+
 /**
  * Returns the number of page frames that are currently free.
  */
 size_t falloc_get_free_frames_count();
 
+/**
+ * Returns the number of free blocks of 2^'order' page frames.
+ */
+size_t falloc_get_free_blocks_count(size_t order);
+
+/* KLOG the number of free blocks of each order. */
+void falloc_dump_statistics();
+
 /* Free the pageframe starting at 'base'. */
 void ffree_one(ptr base);
 
@@ -6,14 +6,19 @@
 #ifndef _DXGMX_MEM_GALLOCATOR_H
 #define _DXGMX_MEM_GALLOCATOR_H
 
+#include <dxgmx/kmalloc.h>
 #include <dxgmx/mem/heap.h>
 
 int gallocator_init();
 int gallocator_init_heap(const Heap* heap);
 void* gallocator_alloc_aligned(size_t size, size_t alignment, const Heap* heap);
+void* gallocator_realloc(void* addr, size_t newsize, const Heap* heap);
 ssize_t gallocator_allocation_size(void* addr, const Heap* heap);
 ssize_t gallocator_allocation_alignment(void* addr, const Heap* heap);
 bool gallocator_is_valid_allocation(void* addr, const Heap* heap);
 void gallocator_free(void* addr, const Heap* heap);
+void gallocator_dump_statistics(const Heap* heap);
+size_t gallocator_pool_statistics(
+    const Heap* heap, KMallocPoolStatistics* pools, size_t n);
 
 #endif // !_DXGMX_MEM_GALLOCATOR_H
@@ -8,6 +8,7 @@
 
 #include <dxgmx/generated/kconfig.h>
 #include <dxgmx/mem/pagesize.h>
+#include <dxgmx/units.h>
 
 #ifdef CONFIG_32BIT
 #define MEM_KERNEL_SPACE_VA_START (3 * GIB)
@@ -20,6 +21,12 @@
  * end of the virtual address space. This portion of memory is to be used
  * exclusively through the kmalloc family of functions. */
 #define MEM_KERNEL_HEAP_PERC 80
+/* The first part of the kernel heap is the 'linear heap', which is mapped at
+ * boot, in a higher half fashion, and backed by contiguous physical memory.
+ * It's used for memory that needs to be translated with mm_kva2pa()/mm_kpa2va()
+ * (paging structures), see mm_alloc_linear(). It's rounded up to a whole
+ * page table. */
+#define MEM_KERNEL_LINEAR_HEAP_SIZE (4 * MIB)
 /* A percent of the aforementioned heap can not be used by kmalloc and is
  * reserved for dma. This percent is always taken from the end of the heap. */
 #define MEM_KERNEL_DMA_PERC 20
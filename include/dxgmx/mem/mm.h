@@ -7,6 +7,7 @@
 #define _DXGMX_MEM_MM_H
 
 #include <dxgmx/assert.h>
+#include <dxgmx/mem/pagefault.h>
 #include <dxgmx/mem/paging.h>
 #include <dxgmx/types.h>
 
@@ -17,6 +18,20 @@
 void mm_init();
 
 int mm_set_page_flags(ptr vaddr, u16 flags, PagingStruct* ps);
+
+/**
+ * Get the page frame and flags of a mapped page.
+ *
+ * 'vaddr' Page aligned virtual address.
+ * 'ps' The paging struct.
+ * 'frame' Where to put the page frame's physical address.
+ * 'flags' Where to put the page's flags. See PAGE_*.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOENT if 'vaddr' is not mapped.
+ */
+int mm_get_page(ptr vaddr, const PagingStruct* ps, ptr* frame, u16* flags);
 int mm_rm_page_flags(ptr vaddr, u16 flags, PagingStruct* ps);
 
 /**
@@ -35,8 +50,212 @@ int mm_rm_page_flags(ptr vaddr, u16 flags, PagingStruct* ps);
  * -ENOMEM on out of memory.
  */
 int mm_map_page(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps);
+
+/**
+ * Map a large page (LARGE_PAGESIZE bytes) to a physically contiguous range of
+ * page frames, with a single page directory entry and TLB entry. If the flags
+ * of a single page in it are changed later on, or a single page is remapped
+ * or unmapped, the large page is split back into normal pages.
+ *
+ * 'vaddr' The LARGE_PAGESIZE aligned start of the page.
+ * 'paddr' The LARGE_PAGESIZE aligned address of the first page frame.
+ * 'flags' Flags to apply to the page.
+ * 'ps' The target paging struct.
+ *
+ * Returns:
+ * 0 on sucess.
+ * -EEXIST if some page in the range is already mapped.
+ * -ENOMEM on out of memory.
+ */
+int mm_map_large_page(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps);
+
 int mm_new_user_page(ptr vaddr, u16 flags, PagingStruct*);
 
+/**
+ * Map the range [start, end) to the physically contiguous range of page frames
+ * starting at 'paddr'. Page tables are walked once per page table instead of
+ * once per page, parts that line up are mapped as large pages, and the TLB is
+ * flushed once at the end, if at all.
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' Page aligned end of the range.
+ * 'paddr' Page aligned address of the first page frame.
+ * 'flags' Flags to apply to the pages.
+ * 'ps' The target paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory, in which case part of the range may be mapped.
+ */
+int mm_map_range(ptr start, ptr end, ptr paddr, u16 flags, PagingStruct* ps);
+
+/**
+ * Change the flags of the mapped pages in [start, end), see mm_map_range() for
+ * how it's batched. Pages that aren't mapped are skipped, and pages that are
+ * copy-on-write stay that way.
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' Page aligned end of the range.
+ * 'flags' New flags of the pages.
+ * 'ps' The target paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory, if a large page had to be split.
+ */
+int mm_protect_range(ptr start, ptr end, u16 flags, PagingStruct* ps);
+
+/**
+ * Unmap the pages in [start, end), see mm_map_range() for how it's batched.
+ * Page frames are left alone, they are the caller's business.
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' Page aligned end of the range.
+ * 'ps' The target paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory, if a large page had to be split.
+ */
+int mm_unmap_range(ptr start, ptr end, PagingStruct* ps);
+
+/**
+ * Like mm_new_user_page() for every page in [start, end), but with page frames
+ * mapped in batches, see mm_map_range().
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ */
+int mm_new_user_range(ptr start, ptr end, u16 flags, PagingStruct* ps);
+
+/**
+ * Try to resolve a user memory pagefault, by swapping back in the page holding
+ * 'vaddr', or populating it if it's inside one of the lazily mapped areas of
+ * 'ps' (see pagingstruct_add_area()). Reads of untouched pages map the zero
+ * frame read-only, writes get a fresh zeroed frame, and writes to a page mapped
+ * to the zero frame replace it with a fresh zeroed frame. Pages of file backed
+ * areas are mapped out of the file's page cache, and read in if they're not
+ * cached yet. Faults on pages that are already mapped are only resolved if
+ * they come from a stale TLB entry, that is if the page allows the access.
+ *
+ * 'ps' has to be the currently loaded paging struct.
+ *
+ * 'vaddr' The faulting address.
+ * 'action' What caused the fault.
+ * 'ps' The paging struct.
+ *
+ * Returns:
+ * 0 if the fault was resolved.
+ * -EFAULT if 'vaddr' is not inside any area, or the access is not allowed.
+ * -ENOMEM on out of memory.
+ */
+int mm_handle_user_fault(ptr vaddr, PageFaultAction action, PagingStruct* ps);
+
+/**
+ * Try to resolve a write to a page that's shared copy-on-write (see PAGE_COW
+ * and mm_fork_paging_struct()). The page gets it's own copy of the frame,
+ * unless nobody else is using the frame anymore, in which case it's just made
+ * writable again.
+ *
+ * 'ps' has to be the currently loaded paging struct.
+ *
+ * 'vaddr' The faulting address.
+ * 'ps' The paging struct.
+ *
+ * Returns:
+ * 0 if the fault was resolved.
+ * -EFAULT if the page holding 'vaddr' is not copy-on-write.
+ * -ENOMEM on out of memory.
+ */
+int mm_handle_cow_fault(ptr vaddr, PagingStruct* ps);
+
+/**
+ * Copy a paging struct's user memory into another one, without copying any
+ * actual memory. Lazily mapped areas are copied, and every tracked page is
+ * mapped to the same frame in 'newps'. Writable pages are made copy-on-write
+ * in both paging structs.
+ *
+ * 'ps' The paging struct to copy.
+ * 'newps' An initialized paging struct, with no user memory of it's own. On
+ * failure it has to be destroyed with mm_destroy_paging_struct().
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ * -EOVERFLOW if a page frame is shared too many times.
+ */
+int mm_fork_paging_struct(PagingStruct* ps, PagingStruct* newps);
+
+/**
+ * Unmap the user memory in [start, end). Mapped pages are unmapped and their
+ * page frames freed, and lazily mapped areas are shrunk, split or removed so
+ * they don't cover the range anymore.
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' Page aligned end of the range.
+ * 'ps' The paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ */
+int mm_unmap_user_range(ptr start, ptr end, PagingStruct* ps);
+
+/**
+ * Get the zero frame, a page frame full of zeros that is shared by all
+ * lazily mapped pages that have only been read from. It's never to be written
+ * to or freed.
+ */
+ptr mm_zero_frame();
+
+/**
+ * Allocate a page frame that's full of zeros. Page frames zeroed ahead of time
+ * by mm_refill_zeroed_frames() are handed out first, falling back to zeroing
+ * a fresh one.
+ *
+ * Returns:
+ * The physical address of the page frame on success, free it with
+ * ffree_one().
+ * 0 on out of memory.
+ */
+ptr mm_alloc_zeroed_frame();
+
+/**
+ * Zero a few page frames ahead of time for mm_alloc_zeroed_frame(). Meant to be
+ * called when there's nothing else to do.
+ */
+void mm_refill_zeroed_frames();
+
+typedef struct S_ZeroedFramesStats
+{
+    /* How many zeroed page frames are ready. */
+    size_t count;
+    /* How many zeroed page frames can be kept around. */
+    size_t capacity;
+    /* How many calls to mm_alloc_zeroed_frame() got a ready page frame. */
+    size_t hits;
+    /* How many calls to mm_alloc_zeroed_frame() had to zero one. */
+    size_t misses;
+} ZeroedFramesStats;
+
+void mm_get_zeroed_frames_stats(ZeroedFramesStats* stats);
+
+/**
+ * Free up page frames by swapping out user pages, see swap_init(). Pages are
+ * picked clock style: every user page is looked at in turn, and the ones that
+ * have been accessed since the last time around get a second chance. Only
+ * anonymous pages that are not shared with anyone are swapped out. They're
+ * swapped back in when they fault, see mm_handle_user_fault(). This is the
+ * "swap" shrinker, run by falloc when it's out of page frames.
+ *
+ * 'n' How many page frames to try and free.
+ *
+ * Returns:
+ * How many page frames have been freed, 0 if swap is not enabled.
+ */
+size_t mm_reclaim_frames(size_t n);
+
 /**
  * Get the kernel's paging structure.
  *
@@ -80,10 +299,32 @@ ptr mm_kva2pa(ptr kva);
  */
 ptr mm_kpa2va(ptr pa);
 
+/**
+ * Allocate kernel memory that is backed by contiguous physical memory and
+ * mapped in a higher half fashion, meaning mm_kva2pa() and mm_kpa2va() are
+ * valid on it. This memory never page faults. Free it using kfree().
+ *
+ * 'size' How many bytes to allocate.
+ * 'alignment' The alignment of the allocation, must be a power of two.
+ *
+ * Returns:
+ * The address of the allocation on success.
+ * NULL if out of memory.
+ */
+void* mm_alloc_linear(size_t size, size_t alignment);
+
 int mm_init_paging_struct(PagingStruct*);
 void mm_destroy_paging_struct(PagingStruct*);
 int mm_map_kernel_into_paging_struct(PagingStruct*);
-void mm_load_paging_struct(const PagingStruct*);
+void mm_load_paging_struct(PagingStruct*);
 void mm_load_kernel_paging_struct();
 
+/**
+ * Get the paging struct that is currently loaded.
+ *
+ * Returns:
+ * A non-null pointer to the current paging structure.
+ */
+PagingStruct* mm_get_current_paging_struct();
+
 #endif //!_DXGMX_MEM_MM_H
@@ -21,6 +21,31 @@ typedef enum PageFaultAction
     PAGEFAULT_ACTION_EXEC
 } PageFaultAction;
 
+typedef struct S_PageFaultStats
+{
+    /* Every page fault. */
+    size_t total;
+    /* Kernel heap pages mapped on first touch. */
+    size_t kernel_heap;
+    /* Lazily mapped user pages. */
+    size_t user;
+    /* Copy-on-write pages that got copied or taken over. */
+    size_t cow;
+    /* Protection violations, that killed a process or were a bad user access
+     * from the kernel. */
+    size_t protection;
+    /* Accesses to memory that's not there. */
+    size_t bad;
+} PageFaultStats;
+
+/* Pick up the page fault options from the command line. */
+void pagefault_init();
+
+/* Turn KLOGing every page fault on or off. */
+void pagefault_set_verbose(bool verbose);
+
+void pagefault_get_stats(PageFaultStats* stats);
+
 ptr pagefault_handle(
     ptr faultaddr,
     ptr ip,
@@ -10,4 +10,12 @@
 #define PAGESIZE 4096
 #endif // !PAGESIZE
 
+/* Size of a large page, which is mapped by a single page directory entry, see
+ * mm_map_large_page(). This is what x86 PAE gives us. */
+#ifndef LARGE_PAGESIZE
+#define LARGE_PAGESIZE (512 * PAGESIZE)
+/* falloc order of a large page. */
+#define LARGE_PAGE_ORDER 9
+#endif // !LARGE_PAGESIZE
+
 #endif //_DXGMX_PAGING_PAGESIZE_H
@@ -20,6 +20,12 @@
 #define PAGE_USER BW_BIT(3)
 /* Page is mapped to physical memory */
 #define PAGE_PRESENT BW_BIT(4)
+/* Page is read-only because it's frame is shared after a fork. It gets it's
+ * own copy of the frame on the first write, see mm_handle_cow_fault(). */
+#define PAGE_COW BW_BIT(5)
+/* Page is part of a large page, see mm_map_large_page(). This is only ever
+ * reported by mm_get_page(), it's ignored when mapping. */
+#define PAGE_LARGE BW_BIT(6)
 
 #define PAGE_RW (PAGE_R | PAGE_W)
 #define PAGE_RX (PAGE_R | PAGE_X)
@@ -31,14 +37,70 @@ typedef struct S_Page
     ptr vaddr;
 } Page;
 
+struct S_VirtualNode;
+
+/* A range of user memory that is populated on demand, one page at a time, when
+ * it's first touched. */
+typedef struct S_PageArea
+{
+    /* Page aligned start and end of the area. */
+    ptr start;
+    ptr end;
+    /* Flags for the pages in this area. */
+    u16 flags;
+
+    /* The file mapped in this area, NULL if it's anonymous memory. The area
+     * holds a reference to it. */
+    struct S_VirtualNode* vnode;
+    /* Page aligned offset into 'vnode' that is mapped at 'start'. */
+    off_t off;
+    /* Pages are shared with everyone else that maps 'vnode'. Otherwise writes
+     * go to a private copy. */
+    bool shared;
+
+    struct S_PageArea* next;
+} PageArea;
+
+/* Tracked pages are kept in a radix tree keyed by the page's address. The top
+ * 2 bits pick a PageTrackNode, the next 9 bits a PageTrackLeaf, and the 9 bits
+ * after that a bit in said leaf. Which means a leaf covers the pages of one
+ * (PAE) page table, and a node those of one page directory. */
+#define PAGE_TRACK_ROOT_NODES 4
+#define PAGE_TRACK_NODE_LEAVES 512
+#define PAGE_TRACK_LEAF_PAGES 512
+
+/* Pages in one 2MiB range. */
+typedef struct S_PageTrackLeaf
+{
+    /* One bit per page, set if it's tracked. */
+    u64 bits[PAGE_TRACK_LEAF_PAGES / 64];
+    /* Number of set bits. */
+    u16 count;
+} PageTrackLeaf;
+
+/* Pages in one 1GiB range. */
+typedef struct S_PageTrackNode
+{
+    PageTrackLeaf* leaves[PAGE_TRACK_NODE_LEAVES];
+    /* Number of non-NULL leaves. */
+    u16 count;
+} PageTrackNode;
+
 typedef struct S_PagingStruct
 {
-    Page* allocated_pages;
-    size_t allocated_pages_size;
-    size_t allocated_pages_capacity;
+    /* Pages that are mapped to page frames we own. See
+     * pagingstruct_track_page(). */
+    PageTrackNode* tracked[PAGE_TRACK_ROOT_NODES];
+    size_t tracked_pages_count;
+
+    /* Areas that are mapped lazily, see mm_handle_user_fault(). */
+    PageArea* areas;
 
     /* Whatever architecture specific struct is being used. */
     void* data;
+
+    /* Next user paging struct, see mm_reclaim_frames(). */
+    struct S_PagingStruct* next;
 } PagingStruct;
 
 /**
@@ -53,8 +115,8 @@ typedef struct S_PagingStruct
 int pagingstruct_init(PagingStruct* ps);
 
 /**
- * Destroy a paging struct. Note that PagingStruct::data is not freed, that is
- * the caller's job.
+ * Destroy a paging struct, along with it's areas. Note that PagingStruct::data
+ * is not freed, that is the caller's job.
  *
  * 'ps' Non NULL paging struct.
  *
@@ -66,7 +128,7 @@ int pagingstruct_destroy(PagingStruct* ps);
 /**
  * Track an allocated page. Everytime we allocate a page we also track it's
  * address here. We do this so we don't have to walk the whole paging structure
- * when freeing them later on.
+ * when freeing them later on. This is O(1).
  *
  * 'page' The page to track. The page will be copied (local pointers are ok).
  * 'ps' Non NULL paging struct.
@@ -78,4 +140,119 @@ int pagingstruct_destroy(PagingStruct* ps);
  */
 int pagingstruct_track_page(const Page* page, PagingStruct* ps);
 
+/**
+ * Find the lowest tracked page in [start, end).
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' End of the range.
+ * 'ps' Non NULL paging struct.
+ * 'page' Where to put the address of the page.
+ *
+ * Returns:
+ * true if a page was found.
+ */
+bool pagingstruct_next_tracked_page(
+    ptr start, ptr end, const PagingStruct* ps, ptr* page);
+
+/* Iterate over the tracked pages in [_start, _end), in ascending order. Pages
+ * can be untracked while iterating. */
+#define FOR_EACH_TRACKED_PAGE(_start, _end, _ps, _page)                        \
+    for (ptr _page = _start;                                                   \
+         pagingstruct_next_tracked_page(_page, _end, _ps, &_page);             \
+         _page += PAGESIZE)
+
+/**
+ * Register an area of lazily mapped memory. Pages inside it are not mapped,
+ * they get mapped when they pagefault.
+ *
+ * 'start' Page aligned start of the area.
+ * 'end' Page aligned end of the area.
+ * 'flags' Flags for the pages in the area.
+ * 'ps' Non NULL paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if the area is not page aligned, empty, or overlaps another one.
+ * -ENOMEM on out of memory.
+ */
+int pagingstruct_add_area(ptr start, ptr end, u16 flags, PagingStruct* ps);
+
+/**
+ * Register an area of lazily mapped memory backed by a file, see
+ * pagingstruct_add_area(). The area takes a reference to 'vnode'.
+ *
+ * 'start' Page aligned start of the area.
+ * 'end' Page aligned end of the area.
+ * 'flags' Flags for the pages in the area.
+ * 'vnode' The file.
+ * 'off' Page aligned offset into the file, mapped at 'start'.
+ * 'shared' If the pages are shared with everyone else mapping 'vnode'.
+ * 'ps' Non NULL paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if the area is not page aligned, empty, or overlaps another one.
+ * -ENOMEM on out of memory.
+ */
+int pagingstruct_add_file_area(
+    ptr start,
+    ptr end,
+    u16 flags,
+    struct S_VirtualNode* vnode,
+    off_t off,
+    bool shared,
+    PagingStruct* ps);
+
+/**
+ * Remove the parts of any areas that fall inside [start, end). Areas may get
+ * shrunk or split in two. Pages that are already mapped are not touched.
+ *
+ * 'start' Page aligned start of the range.
+ * 'end' Page aligned end of the range.
+ * 'ps' Non NULL paging struct.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ */
+int pagingstruct_rm_areas(ptr start, ptr end, PagingStruct* ps);
+
+/**
+ * Find a free range of 'size' bytes between 'low' and 'high', that doesn't
+ * overlap any area or tracked page. The highest such range is picked.
+ *
+ * 'size' Page aligned size of the range.
+ * 'low' Page aligned lower bound.
+ * 'high' Page aligned upper bound.
+ * 'ps' Non NULL paging struct.
+ *
+ * Returns:
+ * The start of the range on success.
+ * 0 if there is no such range.
+ */
+ptr pagingstruct_find_free_range(
+    size_t size, ptr low, ptr high, const PagingStruct* ps);
+
+/**
+ * Stop tracking pages in [start, end). See pagingstruct_track_page(). Pages
+ * that are not tracked are ignored.
+ *
+ * 'start' Start of the range.
+ * 'end' End of the range.
+ * 'ps' Non NULL paging struct.
+ */
+void pagingstruct_untrack_range(ptr start, ptr end, PagingStruct* ps);
+
+/**
+ * Find the lazily mapped area holding 'vaddr'.
+ *
+ * 'vaddr' The virtual address.
+ * 'ps' Non NULL paging struct.
+ *
+ * Returns:
+ * The area on success.
+ * NULL if 'vaddr' is not inside any area.
+ */
+PageArea* pagingstruct_find_area(ptr vaddr, const PagingStruct* ps);
+
 #endif // !_DXGMX_MEM_PAGING_H
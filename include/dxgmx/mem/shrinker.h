@@ -0,0 +1,134 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_MEM_SHRINKER_H
+#define _DXGMX_MEM_SHRINKER_H
+
+#include <dxgmx/types.h>
+
+/* Shrinkers let subsystems give back memory they're holding on to but don't
+ * really need, before an allocation has to fail. They're run when falloc or
+ * kmalloc come up empty, and when the system is idle with free page frames
+ * below SHRINKER_LOW_WATERMARK, see shrinker_balance(). */
+
+/* What a shrinker frees. Freeing kmalloc memory never gives page frames back,
+ * and the other way around, so only shrinkers that can help are run. */
+#define SHRINK_FRAMES (1 << 0)
+#define SHRINK_KMALLOC (1 << 1)
+
+/* Free page frames below which shrinker_balance() starts shrinking, and how
+ * many it tries to get back to. */
+#define SHRINKER_LOW_WATERMARK 256
+#define SHRINKER_HIGH_WATERMARK 512
+
+typedef struct S_Shrinker
+{
+    const char* name;
+
+    /* What 'scan' frees, one of SHRINK_*. */
+    u8 kind;
+
+    /* How expensive it is to get back what has been freed. Cheaper shrinkers
+     * are run first. */
+    u8 cost;
+
+    /* Set if 'scan' may sleep, say waiting on I/O. Such shrinkers are skipped
+     * when there's no process to put to sleep, like on the idle task, see
+     * procm_sched_can_block(). */
+    bool sleeps;
+
+    /* Returns how many objects could be freed right now. For SHRINK_FRAMES
+     * shrinkers an object is a page frame. */
+    size_t (*count)();
+
+    /* Try and free 'n' objects. Returns how many have been freed. */
+    size_t (*scan)(size_t n);
+
+    /* How many objects this shrinker has freed so far. */
+    size_t freed;
+
+    /* Set by shrinker_register(). */
+    struct S_Shrinker* next;
+} Shrinker;
+
+/**
+ * Register a shrinker. The shrinker has to stay around until it's
+ * unregistered.
+ *
+ * 'shrinker' The shrinker.
+ *
+ * Returns:
+ * 0 on success.
+ * -EINVAL if the shrinker is missing it's callbacks or it's kind.
+ * -EEXIST if the shrinker is already registered.
+ */
+int shrinker_register(Shrinker* shrinker);
+
+/**
+ * Unregister a shrinker.
+ *
+ * 'shrinker' The shrinker.
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOENT if the shrinker is not registered.
+ */
+int shrinker_unregister(Shrinker* shrinker);
+
+/**
+ * Run shrinkers, cheapest first, until 'n' objects have been freed or there
+ * are no shrinkers left. Calls made while shrinkers are already running, say
+ * by a shrinker that allocates, do nothing. Shrinkers that sleep are only run
+ * if the caller can.
+ *
+ * 'kind' Which shrinkers to run, SHRINK_* flags.
+ * 'n' How many objects to free.
+ *
+ * Returns:
+ * How many objects have been freed.
+ */
+size_t shrinker_run(u8 kind, size_t n);
+
+/**
+ * Don't run shrinkers that sleep on behalf of the current process, until
+ * shrinker_nosleep_restore(). For code that holds on to something such a
+ * shrinker may need, say a disk in the middle of a transfer, which the swap
+ * shrinker would wait on forever. Calls nest, like
+ * interrupts_disable_irqs_save().
+ *
+ * Returns:
+ * What to pass to shrinker_nosleep_restore().
+ */
+bool shrinker_nosleep_save();
+
+/**
+ * Undo a shrinker_nosleep_save().
+ *
+ * 'nosleep' What shrinker_nosleep_save() returned.
+ */
+void shrinker_nosleep_restore(bool nosleep);
+
+/**
+ * Returns:
+ * true if free page frames are below SHRINKER_LOW_WATERMARK.
+ */
+bool shrinker_memory_low();
+
+/**
+ * If free page frames are below SHRINKER_LOW_WATERMARK, run SHRINK_FRAMES
+ * shrinkers to free a few of them. Calls keep freeing until free page frames
+ * are back at SHRINKER_HIGH_WATERMARK. Meant to be called when there's nothing
+ * else to do.
+ */
+void shrinker_balance();
+
+/**
+ * Returns:
+ * The first registered shrinker, follow 'next' for the rest. NULL if there are
+ * none.
+ */
+const Shrinker* shrinker_list();
+
+#endif // !_DXGMX_MEM_SHRINKER_H
@@ -0,0 +1,20 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_MEM_SLAB_H
+#define _DXGMX_MEM_SLAB_H
+
+#include <dxgmx/mem/heap.h>
+
+int slab_init();
+int slab_init_heap(const Heap* heap);
+void* slab_alloc_aligned(size_t size, size_t alignment, const Heap* heap);
+void* slab_realloc(void* addr, size_t newsize, const Heap* heap);
+ssize_t slab_allocation_size(void* addr, const Heap* heap);
+ssize_t slab_allocation_alignment(void* addr, const Heap* heap);
+bool slab_is_valid_allocation(void* addr, const Heap* heap);
+void slab_free(void* addr, const Heap* heap);
+
+#endif // !_DXGMX_MEM_SLAB_H
@@ -0,0 +1,123 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_MEM_SWAP_H
+#define _DXGMX_MEM_SWAP_H
+
+#include <dxgmx/types.h>
+
+/* Swap space is split into slots, each holding one swapped out page. A slot is
+ * reference counted, since a swapped out page stays swapped out in both paging
+ * structs after a fork, see mm_fork_paging_struct(). Where the pages actually
+ * go is up to the swap backend. */
+
+/* Every function is guaranteed to get a valid slot, which is never slot 0. */
+typedef struct S_SwapBackend
+{
+    /* Name of this backend, as picked with 'swap=<name>'. */
+    const char* name;
+
+    /* Set up the backend. Returns how many slots it has, or a negative errno
+     * if it can't be used. */
+    ssize_t (*init)();
+
+    /* Store the PAGESIZE bytes at 'src' in 'slot'. */
+    int (*write)(size_t slot, const void* src);
+
+    /* Read 'slot' back into the PAGESIZE bytes at 'dest'. */
+    int (*read)(size_t slot, void* dest);
+
+    /* Called once 'slot' is free again. Can be NULL. */
+    void (*release)(size_t slot);
+} SwapBackend;
+
+/**
+ * Pick a swap backend and start using it. The backend is "disk" (see
+ * MBR_SYSTEM_ID_LINUX_SWAP), unless the command line says otherwise with
+ * 'swap=<name>'. Swap stays off if the backend can't be used, or if "noswap"
+ * is on the command line. Block devices have to be enumerated by now.
+ */
+void swap_init();
+
+/**
+ * Returns:
+ * true if there is swap space to swap out to.
+ */
+bool swap_enabled();
+
+/**
+ * Allocate a free swap slot, with a reference count of 1.
+ *
+ * Returns:
+ * The slot on success.
+ * -ENOSPC if swap space is full.
+ * -ENODEV if swap is not enabled.
+ */
+ssize_t swap_alloc_slot();
+
+/**
+ * Grab another reference to a swap slot.
+ *
+ * 'slot' A slot returned by swap_alloc_slot().
+ *
+ * Returns:
+ * 0 on success.
+ * -EOVERFLOW if the slot is referenced too many times.
+ */
+int swap_ref_slot(size_t slot);
+
+/**
+ * Drop a reference to a swap slot. The slot is free once nobody references it.
+ *
+ * 'slot' A slot returned by swap_alloc_slot().
+ */
+void swap_free_slot(size_t slot);
+
+/**
+ * Write a page to a swap slot.
+ *
+ * 'slot' The target slot.
+ * 'src' PAGESIZE bytes to write.
+ *
+ * Returns:
+ * 0 on success.
+ * Other errnos come from the backend.
+ */
+int swap_write_page(size_t slot, const void* src);
+
+/**
+ * Read a page out of a swap slot.
+ *
+ * 'slot' The slot to read.
+ * 'dest' Where to put the PAGESIZE bytes.
+ *
+ * Returns:
+ * 0 on success.
+ * Other errnos come from the backend.
+ */
+int swap_read_page(size_t slot, void* dest);
+
+typedef struct S_SwapStats
+{
+    /* Name of the backend in use, NULL if swap is not enabled. */
+    const char* backend;
+    /* How many slots there are in total. */
+    size_t slots;
+    /* How many of them are free. */
+    size_t free_slots;
+    /* How many pages have been written to swap. */
+    size_t swapped_out;
+    /* How many pages have been read back. */
+    size_t swapped_in;
+    /* How many writes or reads failed. */
+    size_t errors;
+    /* Nanoseconds spent reading pages back, and the longest read. */
+    u64 swap_in_ns;
+    u64 swap_in_max_ns;
+} SwapStats;
+
+void swap_get_stats(SwapStats* stats);
+
+#endif // !_DXGMX_MEM_SWAP_H
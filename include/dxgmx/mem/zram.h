@@ -0,0 +1,39 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_MEM_ZRAM_H
+#define _DXGMX_MEM_ZRAM_H
+
+#include <dxgmx/types.h>
+
+/* The "zram" swap backend, see SwapBackend. Pages are LZ4 compressed into a
+ * pool of page frames that's set aside at boot, 'zram_size=<MiB>' big. */
+
+ssize_t zram_init();
+int zram_write_page(size_t slot, const void* src);
+int zram_read_page(size_t slot, void* dest);
+void zram_release_slot(size_t slot);
+
+typedef struct S_ZramStats
+{
+    /* How many pages are stored. */
+    size_t pages;
+    /* How many of them are all zeros, those take up no space. */
+    size_t zero_pages;
+    /* How many of them didn't compress well, and are stored as they are. */
+    size_t incompressible_pages;
+    /* Bytes the stored pages take up once compressed. */
+    u64 compressed_bytes;
+    /* Bytes of the pool in use, compressed pages are rounded up to chunks. */
+    u64 pool_used;
+    /* Size of the pool. */
+    u64 pool_size;
+    /* How many pages didn't fit in the pool. */
+    size_t pool_full;
+} ZramStats;
+
+void zram_get_stats(ZramStats* stats);
+
+#endif // !_DXGMX_MEM_ZRAM_H
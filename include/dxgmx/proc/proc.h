@@ -72,6 +72,13 @@ typedef struct S_Process
     TaskContext task_ctx;
 
     ProcessState state;
+
+    /* Shrinkers that sleep are not run on behalf of this process, see
+     * shrinker_nosleep_save(). */
+    bool shrink_nosleep;
+
+    /* Owned by the active scheduler, see Scheduler. */
+    void* sched_data;
 } Process;
 
 int proc_init(Process* proc);
@@ -86,6 +93,21 @@ int proc_create_kernel_stack(Process* targetproc);
 int proc_create_address_space(
     const char* path, Process* actingproc, Process* targetproc);
 
+/**
+ * Make 'newproc' a copy of 'proc', which has to be the current process, in the
+ * middle of a syscall. User memory is shared copy-on-write. File descriptors
+ * are not copied, see vfs_fork_fds().
+ *
+ * 'proc' The process to copy.
+ * 'newproc' A process initialized with proc_init(). On failure it has to be
+ * freed with proc_free().
+ *
+ * Returns:
+ * 0 on success.
+ * -ENOMEM on out of memory.
+ */
+int proc_fork(Process* proc, Process* newproc);
+
 _ATTR_NORETURN void proc_enter_initial(Process* proc);
 void proc_switch(Process* curproc, Process* nextproc);
 
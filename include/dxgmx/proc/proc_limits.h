@@ -18,7 +18,11 @@
 /* Size of a process' kernel stack. */
 #define PROC_KSTACK_SIZE (1 * PAGESIZE)
 
-/* Size of a process' stack. */
-#define PROC_STACK_SIZE (2 * PAGESIZE)
+/* Size of a process' stack. Stack pages are only mapped when touched, so this
+ * is just the upper limit. */
+#define PROC_STACK_SIZE (256 * KIB)
+
+/* mmap() places mappings between this and the stack, unless told otherwise. */
+#define PROC_MMAP_LOW_ADDRESS (1 * GIB)
 
 #endif // !_DXGMX_PROC_PROC_LIMITS_H
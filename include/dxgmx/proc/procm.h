@@ -48,6 +48,21 @@ pid_t procm_spawn_proc(
     const char** envp,
     Process* actingproc);
 
+/**
+ * Fork a process. The new process is a copy of 'proc' which shares it's memory
+ * copy-on-write, and it's added to the process queue. When it first runs, it
+ * returns from the same syscall as 'proc', with 0.
+ *
+ * 'proc' The process to fork, has to be the current process in the middle of
+ * a syscall.
+ *
+ * Returns:
+ * The pid of the new process on success.
+ * -ENOMEM on out of memory.
+ * -ENOSPC if no pid could be allocated.
+ */
+pid_t procm_fork(Process* proc);
+
 /* Mark a process as dead, letting it be reaped by the scheduler. */
 int procm_mark_dead(int st, Process* proc);
 
@@ -60,4 +75,66 @@ _ATTR_NORETURN void procm_sched_start();
 Process* procm_sched_current_proc();
 void procm_sched_yield();
 
+/**
+ * Returns:
+ * true once pid 1 is running. Until then there's no current process.
+ */
+bool procm_sched_started();
+
+/**
+ * Returns:
+ * true if there's a process the current context can put to sleep. That's not
+ * the case before the scheduler is started, or on the idle task.
+ */
+bool procm_sched_can_block();
+
+/**
+ * Put the current process in the PROC_BLOCKED state and give up the CPU,
+ * until someone calls procm_sched_wake() on it. Has to be called with
+ * interrupts disabled, usually through a WaitQueue, and only if
+ * procm_sched_can_block(). If nothing else can run, the idle task does,
+ * halting the CPU until an interrupt wakes someone up.
+ */
+void procm_sched_block();
+
+/**
+ * Make a PROC_BLOCKED process runnable again. Does nothing to processes that
+ * are not blocked. Safe to call from interrupt context.
+ *
+ * 'proc' The process.
+ */
+void procm_sched_wake(Process* proc);
+
+/**
+ * Account for a timer tick. Once the current process has used up it's
+ * quantum, or the scheduler says so (see Scheduler::tick), it's marked to be
+ * preempted. Called by the timer interrupt.
+ *
+ * 'ns' Nanoseconds since the last tick.
+ */
+void procm_sched_tick(u64 ns);
+
+/**
+ * Preempt the current process if it's been marked to be, see
+ * procm_sched_tick(). Called on the way out of an interrupt, only when going
+ * back to userspace, since the kernel itself can't be preempted. The
+ * interrupted context sits on the process' kernel stack, so it's returned to
+ * once the process is switched back to.
+ */
+void procm_sched_preempt();
+
+/**
+ * Returns:
+ * How long a process runs before it's preempted, in nanoseconds. Set with
+ * 'sched_quantum=<ms>' on the command line.
+ */
+u64 procm_sched_quantum_ns();
+
+/**
+ * Returns:
+ * How long the idle task has been running for, in nanoseconds, counted in
+ * timer ticks.
+ */
+u64 procm_sched_idle_ns();
+
 #endif // !_DXGMX_PROC_PROCM_H
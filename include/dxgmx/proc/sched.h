@@ -19,8 +19,34 @@ typedef struct Scheduler
     size_t* proc_count;
 
     Process* (*current_proc)(struct Scheduler* sched);
+
+    /* Pick the process to run next, which may be the current one. Processes
+     * in the PROC_BLOCKED state are never picked, until they're woken up.
+     * Returns NULL if there's nothing to run, in which case it's called again
+     * once an interrupt might have woken someone up. */
     Process* (*next_proc)(struct Scheduler* sched);
+
     int (*reset)(struct Scheduler* sched);
+
+    /* The hooks below are optional, and let a scheduler keep track of what
+     * happens to processes. */
+
+    /* 'proc' is being added to the process pool, and wants to run. Returns 0
+     * on success, if this fails 'proc' is not added. */
+    int (*enqueue)(struct Scheduler* sched, Process* proc);
+
+    /* 'proc' is about to be removed from the process pool, and freed. */
+    void (*dequeue)(struct Scheduler* sched, Process* proc);
+
+    /* 'proc' has been woken up, and is no longer PROC_BLOCKED. May be called
+     * from interrupt context. */
+    void (*wake)(struct Scheduler* sched, Process* proc);
+
+    /* Called on every timer tick, with the current process having been running
+     * for 'ns' more nanoseconds. Returns true if the current process should be
+     * preempted. If this is not set, processes are preempted once they've used
+     * up their quantum, see procm_sched_quantum_ns(). */
+    bool (*tick)(struct Scheduler* sched, u64 ns);
 } Scheduler;
 
 #endif // !_DXGMX_PROC_SCHED_H
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_PROC_WAITQUEUE_H
+#define _DXGMX_PROC_WAITQUEUE_H
+
+#include <dxgmx/types.h>
+
+/* Processes waiting on something, say a device, sleep on a wait queue,
+ * taking up no CPU time until whoever they're waiting on wakes them up, from
+ * kernel or interrupt context. Waiting goes like this:
+ *
+ * bool irqs = interrupts_disable_irqs_save();
+ * while (!condition)
+ *     waitqueue_wait(&wq);
+ * interrupts_restore_irqs(irqs);
+ *
+ * Interrupts are disabled so a wake up that comes in between checking the
+ * condition and going to sleep isn't missed. A zeroed out WaitQueue is
+ * empty. */
+
+typedef struct S_WaitQueue
+{
+    struct S_WaitQueueEntry* head;
+    struct S_WaitQueueEntry* tail;
+} WaitQueue;
+
+/**
+ * Put the current process to sleep on a wait queue, until it's woken up. Has
+ * to be called with interrupts disabled, which they still are on return. This
+ * may return without the thing being waited for having happened, so it should
+ * always be called in a loop. When there's no process to put to sleep, see
+ * procm_sched_can_block(), this waits for the next interrupt instead.
+ *
+ * 'wq' The wait queue.
+ */
+void waitqueue_wait(WaitQueue* wq);
+
+/**
+ * Like waitqueue_wait(), but wake up on our own after some time.
+ *
+ * 'wq' The wait queue. If NULL, only the timeout wakes us up.
+ * 'ns' The timeout in nanoseconds, rounded up to a timer tick.
+ *
+ * Returns:
+ * 0 if woken up.
+ * -ETIMEDOUT if the timeout ran out.
+ */
+int waitqueue_wait_timeout(WaitQueue* wq, u64 ns);
+
+/**
+ * Wake up everyone sleeping on a wait queue. Safe to call from interrupt
+ * context.
+ *
+ * 'wq' The wait queue.
+ *
+ * Returns:
+ * How many processes have been woken up.
+ */
+size_t waitqueue_wake_all(WaitQueue* wq);
+
+/**
+ * Wake up sleepers whose timeout ran out. Called on every timer tick, see
+ * procm_sched_tick().
+ *
+ * 'ns' Nanoseconds since the last tick.
+ */
+void waitqueue_tick(u64 ns);
+
+#endif // !_DXGMX_PROC_WAITQUEUE_H
@@ -72,6 +72,8 @@ typedef struct S_MountableBlockDevice
     sectorcnt_t sector_count;
     /* Size of one sector for this device. The same as parent->sectorsize. */
     size_t sectorsize;
+    /* Partition type, see Partition::type. */
+    u8 type;
 
     ssize_t (*read)(
         const struct S_MountableBlockDevice* blkdev,
@@ -127,4 +127,14 @@ blkdevm_find_mountable_blkdev_by_uuid(const char* uuid);
 const MountableBlockDevice*
 blkdevm_find_mountable_blkdev_by_name(const char* name);
 
+/**
+ * Find the first mountable block device with a given partition type.
+ *
+ * 'type' The partition type, see Partition::type.
+ *
+ * Returns:
+ * The block device, or NULL if there is none.
+ */
+const MountableBlockDevice* blkdevm_find_mountable_blkdev_by_type(u8 type);
+
 #endif // !_DXGMX_STORAGE_BLKDEVM_H
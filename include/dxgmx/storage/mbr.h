@@ -10,6 +10,9 @@
 #include <dxgmx/storage/blkdev.h>
 #include <dxgmx/types.h>
 
+/* MBRPartition::system_id of a Linux swap partition. */
+#define MBR_SYSTEM_ID_LINUX_SWAP 0x82
+
 typedef struct _ATTR_PACKED S_MBRPartition
 {
     u8 drive_attrs;
@@ -24,6 +24,9 @@ typedef struct S_Partition
     sectorcnt_t sector_count;
     char* suffix;
     char* uuid;
+    /* What the partition holds, as found in the partition table. For MBR
+     * that's the system id. */
+    u8 type;
 } Partition;
 
 /* Generic partition table struct. */
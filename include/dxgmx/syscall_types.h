@@ -33,6 +33,30 @@ typedef struct SyscallEntry
     _ATTR_USED SyscallEntry _g_##_name##_entry =                               \
         (SyscallEntry){.func = _g_##_name##_stub};
 
+#define SYSCALL_RETV_0(_ret, _name)                                            \
+    _ret _name();                                                              \
+    static syscall_ret_t _g_##_name##_stub(va_list* _list)                     \
+    {                                                                          \
+        va_end(*_list);                                                        \
+        return _name();                                                        \
+    }                                                                          \
+    _ATTR_SECTION(".syscalls")                                                 \
+    _ATTR_USED SyscallEntry _g_##_name##_entry =                               \
+        (SyscallEntry){.func = _g_##_name##_stub};
+
+#define SYSCALL_RETV_2(_ret, _name, _arg1, _arg2)                              \
+    _ret _name(_arg1, _arg2);                                                  \
+    static syscall_ret_t _g_##_name##_stub(va_list* _list)                     \
+    {                                                                          \
+        _arg1 _1 = va_arg(*_list, _arg1);                                      \
+        _arg2 _2 = va_arg(*_list, _arg2);                                      \
+        va_end(*_list);                                                        \
+        return _name(_1, _2);                                                  \
+    }                                                                          \
+    _ATTR_SECTION(".syscalls")                                                 \
+    _ATTR_USED SyscallEntry _g_##_name##_entry =                               \
+        (SyscallEntry){.func = _g_##_name##_stub};
+
 #define SYSCALL_RETV_3(_ret, _name, _arg1, _arg2, _arg3)                       \
     _ret _name(_arg1, _arg2, _arg3);                                           \
     static syscall_ret_t _g_##_name##_stub(va_list* _list)                     \
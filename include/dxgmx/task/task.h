@@ -18,4 +18,33 @@
 int task_set_impending_stack_top(ptr sp);
 void task_switch(TaskContext* prevct, TaskContext* nextctx);
 
+/**
+ * Prepare the kernel stack of a task forked off of another one that's in the
+ * middle of a syscall. The first time we task_switch() to it, it returns to
+ * userspace right where the other task made the syscall, with a return value
+ * of 0.
+ *
+ * 'kstack_top' The top of the new task's kernel stack.
+ * 'parent_kstack_top' The top of the other task's kernel stack.
+ * 'ctx' The new task's context.
+ *
+ * Returns:
+ * 0 on success.
+ */
+int task_init_forked(ptr kstack_top, ptr parent_kstack_top, TaskContext* ctx);
+
+/**
+ * Prepare the kernel stack of a task that only ever runs in the kernel. The
+ * first time we task_switch() to it, it starts running 'entry' with
+ * interrupts disabled. 'entry' must never return.
+ *
+ * 'kstack_top' The top of the task's kernel stack.
+ * 'entry' Where the task starts running.
+ * 'ctx' The task's context.
+ *
+ * Returns:
+ * 0 on success.
+ */
+int task_init_kernel(ptr kstack_top, void (*entry)(), TaskContext* ctx);
+
 #endif // !_DXGMX_TASK_TASK_H
@@ -20,6 +20,15 @@ typedef struct Bitmap
 #define BITMAP_NOT_INIT(bm) (bm.size == 0)
 
 int bitmap_init(size_t units, Bitmap* bm);
+void bitmap_destroy(Bitmap* bm);
 ssize_t bitmap_first_n_free_and_mark(size_t n, Bitmap* bm);
+/* Like bitmap_first_n_free_and_mark(), but the first unit of the run has to be
+ * 'off' modulo 'align'. */
+ssize_t bitmap_first_n_free_aligned_and_mark(
+    size_t n, size_t align, size_t off, Bitmap* bm);
+/* Mark the 'n' units starting at 'start' as free. */
+int bitmap_unmark(size_t start, size_t n, Bitmap* bm);
+/* Returns how many units are marked. */
+size_t bitmap_count_marked(const Bitmap* bm);
 
 #endif // !_DXGMX_UTILS_BITMAP_H
@@ -18,10 +18,12 @@ typedef struct HashTableEntry
 {
     hashtable_key_t key;
     hashtable_val_t value;
+    struct HashTableEntry* next;
 } HashTableEntry;
 
 typedef struct HashTableSlot
 {
+    /* Singly linked chain of entries. */
     HashTableEntry* entries;
     size_t entry_count;
 } HashTableSlot;
@@ -0,0 +1,50 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_UTILS_LZ4_H
+#define _DXGMX_UTILS_LZ4_H
+
+#include <dxgmx/types.h>
+
+/* LZ4 block format compression, without the frame format around it. */
+
+/* log2 of how many entries the match finder's hash table has. */
+#define LZ4_HASH_LOG 12
+/* Size of the scratch space lz4_compress() needs. */
+#define LZ4_WORKSPACE_SIZE ((1 << LZ4_HASH_LOG) * sizeof(u16))
+/* Biggest input lz4_compress() takes, matches are found by u16 positions. */
+#define LZ4_MAX_INPUT_SIZE 0xFFFF
+
+/**
+ * Compress a buffer into an LZ4 block.
+ *
+ * 'src' What to compress.
+ * 'n' How many bytes to compress, at most LZ4_MAX_INPUT_SIZE.
+ * 'dest' Where to put the block.
+ * 'cap' Size of 'dest'.
+ * 'workspace' LZ4_WORKSPACE_SIZE bytes of scratch space, u16 aligned.
+ *
+ * Returns:
+ * The size of the block on success.
+ * -ENOSPC if the block doesn't fit in 'cap' bytes.
+ */
+ssize_t lz4_compress(
+    const void* src, size_t n, void* dest, size_t cap, void* workspace);
+
+/**
+ * Decompress an LZ4 block.
+ *
+ * 'src' The block.
+ * 'n' Size of the block.
+ * 'dest' Where to put the decompressed data.
+ * 'cap' Size of 'dest'.
+ *
+ * Returns:
+ * How many bytes were decompressed on success.
+ * -EINVAL if the block is malformed, or doesn't fit in 'cap' bytes.
+ */
+ssize_t lz4_decompress(const void* src, size_t n, void* dest, size_t cap);
+
+#endif // !_DXGMX_UTILS_LZ4_H
@@ -0,0 +1,67 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#ifndef _DXGMX_UTILS_RBTREE_H
+#define _DXGMX_UTILS_RBTREE_H
+
+#include <dxgmx/types.h>
+
+/* Red-black tree. Nodes are embedded in whatever is being kept in the tree,
+ * so the tree itself never allocates, see RBTREE_ENTRY(). Nodes are ordered
+ * by a comparison function given on insertion, equal nodes are kept in the
+ * order they were inserted. */
+
+typedef struct S_RBNode
+{
+    struct S_RBNode* parent;
+    struct S_RBNode* left;
+    struct S_RBNode* right;
+    bool red;
+} RBNode;
+
+typedef struct S_RBTree
+{
+    RBNode* root;
+    /* The smallest node, kept around so rbtree_first() is O(1). */
+    RBNode* leftmost;
+} RBTree;
+
+/* Returns true if 'a' goes before 'b'. */
+typedef bool (*rbtree_less_t)(const RBNode* a, const RBNode* b);
+
+/* Get the struct '_type' that has '_node' as it's '_memb' member. */
+#define RBTREE_ENTRY(_node, _type, _memb)                                      \
+    ((_type*)((u8*)(_node) - OFFSETOF(_type, _memb)))
+
+/**
+ * Insert a node into a tree.
+ *
+ * 'node' The node, not in any tree.
+ * 'less' How nodes are ordered.
+ * 'tree' The tree.
+ */
+void rbtree_insert(RBNode* node, rbtree_less_t less, RBTree* tree);
+
+/**
+ * Remove a node from a tree.
+ *
+ * 'node' A node in 'tree'.
+ * 'tree' The tree.
+ */
+void rbtree_remove(RBNode* node, RBTree* tree);
+
+/**
+ * Returns:
+ * The smallest node in 'tree', NULL if it's empty.
+ */
+RBNode* rbtree_first(const RBTree* tree);
+
+/**
+ * Returns:
+ * The node that comes after 'node', NULL if it's the last one.
+ */
+RBNode* rbtree_next(const RBNode* node);
+
+#endif // !_DXGMX_UTILS_RBTREE_H
@@ -55,53 +55,69 @@ elfloader_load_from_file32(fd_t fd, Process* actingproc, Process* targetproc)
         if (phdr->type != PT_LOAD)
             continue;
 
+        /* Pages holding file contents are mapped and filled right away,
+         * pages that are all bss are mapped lazily. */
         const ptr aligned_start = bytes_align_down64(phdr->vaddr, PAGESIZE);
-        const size_t pagespan =
-            bytes_align_up64(
-                phdr->memsize + (phdr->vaddr - aligned_start), PAGESIZE) /
-            PAGESIZE;
+        const ptr file_end =
+            bytes_align_up64(phdr->vaddr + phdr->filesize, PAGESIZE);
+        const ptr mem_end =
+            bytes_align_up64(phdr->vaddr + phdr->memsize, PAGESIZE);
 
-        /* Map pages */
-        for (size_t i = 0; i < pagespan; ++i)
+        if (phdr->filesize)
         {
-            ptr vaddr = aligned_start + i * PAGESIZE;
             /* We force PAGE_W because we need to copy the code there, it is
              * cleared later if necessary. */
-            u16 flags = (phdr->flags & PAGE_ACCESS_MODE) | PAGE_W;
-
-            st = mm_new_user_page(vaddr, flags, targetproc->paging_struct);
+            st = mm_new_user_range(
+                aligned_start,
+                file_end,
+                (phdr->flags & PAGE_ACCESS_MODE) | PAGE_W,
+                targetproc->paging_struct);
             if (st < 0)
             {
                 kfree(phdrs32);
                 return st;
             }
-        }
 
-        if (phdr->filesize)
-        {
             st = elfloader_copy_section_from_file(fd, phdr, actingproc);
             if (st < 0)
             {
                 kfree(phdrs32);
                 return st;
             }
-        }
 
-        /* If memsize > filesize we pad the rest of the memory with zeros. */
-        if (phdr->memsize > phdr->filesize)
-        {
-            void* start = (void*)(phdr->vaddr + phdr->filesize);
-            memset(start, 0, phdr->memsize - phdr->filesize);
+            /* If memsize > filesize we pad the rest of the last file page
+             * with zeros. */
+            const ptr pad_start = phdr->vaddr + phdr->filesize;
+            const ptr pad_end = phdr->vaddr + phdr->memsize < file_end
+                                    ? phdr->vaddr + phdr->memsize
+                                    : file_end;
+            if (pad_end > pad_start)
+                memset((void*)pad_start, 0, pad_end - pad_start);
+
+            /* Remove the previously possibly forced PAGE_W. */
+            st = mm_protect_range(
+                aligned_start,
+                file_end,
+                (phdr->flags & PAGE_ACCESS_MODE) | PAGE_USER,
+                targetproc->paging_struct);
+            ASSERT(st == 0);
         }
 
-        /* Remove the previously possibly forced PAGE_W and set PAGE_USER. */
-        for (size_t i = 0; i < pagespan; ++i)
+        /* The rest is bss, which starts out zeroed. */
+        const ptr bss_start = phdr->filesize ? file_end : aligned_start;
+        if (mem_end > bss_start)
         {
-            ptr vaddr = aligned_start + i * PAGESIZE;
-            u16 flags = (phdr->flags & PAGE_ACCESS_MODE) | PAGE_USER;
+            st = pagingstruct_add_area(
+                bss_start,
+                mem_end,
+                (phdr->flags & PAGE_ACCESS_MODE) | PAGE_USER,
+                targetproc->paging_struct);
 
-            st = mm_set_page_flags(vaddr, flags, targetproc->paging_struct);
-            ASSERT(st == 0);
+            if (st < 0)
+            {
+                kfree(phdrs32);
+                return st;
+            }
         }
     }
 
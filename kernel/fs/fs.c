@@ -6,6 +6,7 @@
 #include <dxgmx/assert.h>
 #include <dxgmx/errno.h>
 #include <dxgmx/fs/fs.h>
+#include <dxgmx/fs/pagecache.h>
 #include <dxgmx/fs/path.h>
 #include <dxgmx/fs/vnode.h>
 #include <dxgmx/klog.h>
@@ -14,6 +15,8 @@
 #include <dxgmx/string.h>
 #include <dxgmx/todo.h>
 
+static KMallocCache g_vnode_cache = KMALLOC_CACHE_INIT("vnode", VirtualNode);
+
 /**
  * Lookup cached vnode for 'path' that is residing on 'fs'. If this function
  * returns NULL it means there is no *cached* vnode for this path. The
@@ -82,7 +85,7 @@ fs_lookup_vnode_cached_relative(const char* path, FileSystem* fs)
 
 VirtualNode* fs_new_vnode_cache(const char* name, FileSystem* fs)
 {
-    VirtualNode* new_vnode = kcalloc(sizeof(VirtualNode));
+    VirtualNode* new_vnode = kmalloc_cache_calloc(&g_vnode_cache);
     if (!new_vnode)
         return NULL;
 
@@ -91,14 +94,14 @@ VirtualNode* fs_new_vnode_cache(const char* name, FileSystem* fs)
     new_vnode->ops = fs->driver->vnode_ops;
     if (!new_vnode->name)
     {
-        kfree(new_vnode);
+        kmalloc_cache_free(new_vnode, &g_vnode_cache);
         return NULL;
     }
 
     if (linkedlist_add(new_vnode, &fs->vnode_ll) < 0)
     {
         kfree(new_vnode->name);
-        kfree(new_vnode);
+        kmalloc_cache_free(new_vnode, &g_vnode_cache);
         return NULL;
     }
 
@@ -108,9 +111,10 @@ VirtualNode* fs_new_vnode_cache(const char* name, FileSystem* fs)
 int fs_free_cached_vnode(VirtualNode* vnode, FileSystem* fs)
 {
     linkedlist_remove_by_data(vnode, &fs->vnode_ll);
+    pagecache_drop(vnode);
     kfree(vnode->name);
     vnode->name = NULL;
-    kfree(vnode);
+    kmalloc_cache_free(vnode, &g_vnode_cache);
     return 0;
 }
 
@@ -122,9 +126,10 @@ int fs_free_all_cached_vnodes(FileSystem* fs)
     do
     {
         VirtualNode* vnode = fs->vnode_ll.root->data;
+        pagecache_drop(vnode);
         kfree(vnode->name);
         vnode->name = NULL;
-        kfree(vnode);
+        kmalloc_cache_free(vnode, &g_vnode_cache);
     } while (linkedlist_remove_by_position(0, &fs->vnode_ll) == 0);
 
     return 0;
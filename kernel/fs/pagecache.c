@@ -0,0 +1,139 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/assert.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/fs/pagecache.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/mem/falloc.h>
+#include <dxgmx/mem/pagesize.h>
+#include <dxgmx/string.h>
+
+static KMallocCache g_pagecache_cache =
+    KMALLOC_CACHE_INIT("PageCache", PageCache);
+
+/* Make room for the page at 'idx'. */
+static int pagecache_enlarge(size_t idx, PageCache* cache)
+{
+    if (idx < cache->frame_count)
+        return 0;
+
+    /* Grow in steps, files are mostly mapped front to back. */
+    const size_t newcount = (idx + 16) & ~(size_t)15;
+
+    ptr* tmp = krealloc(cache->frames, newcount * sizeof(ptr));
+    if (!tmp)
+        return -ENOMEM;
+
+    memset(
+        tmp + cache->frame_count,
+        0,
+        (newcount - cache->frame_count) * sizeof(ptr));
+
+    cache->frames = tmp;
+    cache->frame_count = newcount;
+    return 0;
+}
+
+ptr pagecache_find(const VirtualNode* vnode, size_t idx)
+{
+    const PageCache* cache = vnode->pagecache;
+    if (!cache || idx >= cache->frame_count)
+        return 0;
+
+    return cache->frames[idx];
+}
+
+int pagecache_insert(VirtualNode* vnode, size_t idx, ptr frame)
+{
+    if (!vnode->pagecache)
+    {
+        vnode->pagecache = kmalloc_cache_calloc(&g_pagecache_cache);
+        if (!vnode->pagecache)
+            return -ENOMEM;
+    }
+
+    PageCache* cache = vnode->pagecache;
+    int st = pagecache_enlarge(idx, cache);
+    if (st < 0)
+        return st;
+
+    ASSERT(!cache->frames[idx]);
+
+    st = falloc_ref(frame);
+    if (st < 0)
+        return st;
+
+    cache->frames[idx] = frame;
+    return 0;
+}
+
+void pagecache_invalidate(VirtualNode* vnode, off_t off, size_t n)
+{
+    PageCache* cache = vnode->pagecache;
+    if (!cache || !n)
+        return;
+
+    const size_t end = (off + n + PAGESIZE - 1) / PAGESIZE;
+    for (size_t idx = off / PAGESIZE; idx < end && idx < cache->frame_count;
+         ++idx)
+    {
+        if (cache->frames[idx])
+        {
+            ffree_one(cache->frames[idx]);
+            cache->frames[idx] = 0;
+        }
+    }
+}
+
+void pagecache_drop(VirtualNode* vnode)
+{
+    PageCache* cache = vnode->pagecache;
+    if (!cache)
+        return;
+
+    pagecache_invalidate(vnode, 0, cache->frame_count * PAGESIZE);
+
+    kfree(cache->frames);
+    kmalloc_cache_free(cache, &g_pagecache_cache);
+    vnode->pagecache = NULL;
+}
+
+size_t pagecache_count_unused(const VirtualNode* vnode)
+{
+    const PageCache* cache = vnode->pagecache;
+    if (!cache)
+        return 0;
+
+    size_t count = 0;
+    for (size_t idx = 0; idx < cache->frame_count; ++idx)
+    {
+        if (cache->frames[idx] && falloc_refcount(cache->frames[idx]) == 1)
+            ++count;
+    }
+
+    return count;
+}
+
+size_t pagecache_shrink(VirtualNode* vnode, size_t n)
+{
+    PageCache* cache = vnode->pagecache;
+    if (!cache)
+        return 0;
+
+    size_t freed = 0;
+    for (size_t idx = 0; idx < cache->frame_count && freed < n; ++idx)
+    {
+        /* Only the cache is holding on to it. */
+        if (cache->frames[idx] && falloc_refcount(cache->frames[idx]) == 1)
+        {
+            ffree_one(cache->frames[idx]);
+            cache->frames[idx] = 0;
+            ++freed;
+        }
+    }
+
+    return freed;
+}
@@ -4,4 +4,5 @@ kernel/fs/vfs.c.o \
 kernel/fs/fs.c.o \
 kernel/fs/path.c.o \
 kernel/fs/vfs_fdt.c.o \
-kernel/fs/vnode.c.o
+kernel/fs/vnode.c.o \
+kernel/fs/pagecache.c.o
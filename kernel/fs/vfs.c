@@ -11,18 +11,23 @@
 #include <dxgmx/attrs.h>
 #include <dxgmx/errno.h>
 #include <dxgmx/fs/fd.h>
+#include <dxgmx/fs/pagecache.h>
 #include <dxgmx/fs/vfs.h>
 #include <dxgmx/fs/vfs_fdt.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
 #include <dxgmx/limits.h>
+#include <dxgmx/mem/dma.h>
+#include <dxgmx/mem/shrinker.h>
 #include <dxgmx/panic.h>
+#include <dxgmx/posix/sys/mman.h>
 #include <dxgmx/posix/sys/stat.h>
 #include <dxgmx/proc/procm.h>
 #include <dxgmx/stdio.h>
 #include <dxgmx/string.h>
 #include <dxgmx/todo.h>
 #include <dxgmx/types.h>
+#include <dxgmx/utils/bytes.h>
 #include <dxgmx/user.h>
 #include <dxgmx/utils/bitwise.h>
 
@@ -41,6 +46,43 @@ static size_t g_fs_driver_count = 0;
  * starting point, leaving all references dangling. */
 static LinkedList g_filesystems_ll;
 
+static size_t vfs_pagecache_shrinker_count()
+{
+    size_t count = 0;
+    FOR_EACH_ENTRY_IN_LL (g_filesystems_ll, FileSystem*, fs)
+    {
+        FOR_EACH_ENTRY_IN_LL (fs->vnode_ll, VirtualNode*, vnode)
+            count += pagecache_count_unused(vnode);
+    }
+
+    return count;
+}
+
+static size_t vfs_pagecache_shrinker_scan(size_t n)
+{
+    size_t freed = 0;
+    FOR_EACH_ENTRY_IN_LL (g_filesystems_ll, FileSystem*, fs)
+    {
+        FOR_EACH_ENTRY_IN_LL (fs->vnode_ll, VirtualNode*, vnode)
+        {
+            if (freed == n)
+                return freed;
+
+            freed += pagecache_shrink(vnode, n - freed);
+        }
+    }
+
+    return freed;
+}
+
+/* Unmapped cached pages are only a read away. */
+static Shrinker g_pagecache_shrinker = {
+    .name = "pagecache",
+    .kind = SHRINK_FRAMES,
+    .cost = 1,
+    .count = vfs_pagecache_shrinker_count,
+    .scan = vfs_pagecache_shrinker_scan};
+
 /**
  * Create a new fileystem
  * 'mntsrc' Non-NULL mount source.
@@ -195,6 +237,10 @@ _INIT int vfs_init()
 
     linkedlist_init(&g_filesystems_ll);
 
+    st = shrinker_register(&g_pagecache_shrinker);
+    if (st < 0)
+        panic("Failed to register the pagecache shrinker, %d.", st);
+
     st = vfs_mount("hdap0", "/", NULL, NULL, 0);
     if (st < 0)
         panic("Failed to mount / %d :(", st);
@@ -503,6 +549,9 @@ ssize_t vfs_write(fd_t fd, const void* _USERPTR buf, size_t n, Process* proc)
     if (wr < 0)
         return wr;
 
+    /* Whoever maps the file from now on reads the new contents. */
+    pagecache_invalidate(sysfd->vnode, sysfd->off, wr);
+
     sysfd->off += wr;
     return wr;
 }
@@ -562,6 +611,106 @@ int vfs_close(fd_t fd, Process* proc)
     return 0;
 }
 
+int vfs_fork_fds(const Process* proc, Process* newproc)
+{
+    ASSERT(newproc->fd_count >= proc->fd_count);
+
+    for (size_t fd = 0; fd < proc->fd_count; ++fd)
+    {
+        if (!proc->fds[fd])
+            continue;
+
+        FileDescriptor* sysfd = vfs_fdt_get_sysfd(fd, proc->pid);
+        ASSERT(sysfd);
+
+        FileDescriptor* newsysfd = vfs_fdt_new_sysfd(fd, newproc->pid);
+        if (!newsysfd)
+        {
+            /* Close the ones we managed to open. */
+            for (size_t i = 0; i < fd; ++i)
+            {
+                if (proc->fds[i])
+                    vfs_close(i, newproc);
+            }
+
+            return -ENOMEM;
+        }
+
+        /* Both processes share the same file, but have their own offsets. */
+        newsysfd->flags = sysfd->flags;
+        newsysfd->off = sysfd->off;
+        newsysfd->vnode = sysfd->vnode;
+        vnode_increase_refcount(newsysfd->vnode);
+        newproc->fds[fd] = true;
+    }
+
+    return 0;
+}
+
+/* Map a regular file, lazily. Pages come out of the file's page cache, see
+ * mm_handle_user_fault(). */
+static void* vfs_mmap_file(
+    VirtualNode* vnode,
+    ptr addr,
+    size_t len,
+    int prot,
+    int flags,
+    off_t off,
+    Process* proc)
+{
+    const bool shared = flags & MAP_SHARED;
+    if (!len || off < 0 || off % PAGESIZE || shared == !!(flags & MAP_PRIVATE))
+        return MAP_FAILED;
+
+    /* There's no writeback, so shared mappings are read-only. */
+    if (shared && (prot & PROT_WRITE))
+        return MAP_FAILED;
+
+    u16 pageflags = PAGE_USER;
+    pageflags |= prot & PROT_READ ? PAGE_R : 0;
+    pageflags |= prot & PROT_WRITE ? PAGE_W : 0;
+    pageflags |= prot & PROT_EXEC ? PAGE_X : 0;
+
+    len = bytes_align_up64(len, PAGESIZE);
+    PagingStruct* ps = proc->paging_struct;
+
+    if (flags & MAP_FIXED)
+    {
+        if (addr % PAGESIZE || addr < PROC_LOW_ADDRESS ||
+            addr > PROC_HIGH_ADDRESS - len)
+            return MAP_FAILED;
+
+        /* Pages that are already mapped, like the executable's, would never
+         * fault the file in, and sys_munmap() would free them. Device memory
+         * is unmapped by the DMA code. */
+        ptr page;
+        if (pagingstruct_next_tracked_page(addr, addr + len, ps, &page))
+            return MAP_FAILED;
+
+        const Heap* dma_heap = &proc->dma_heap;
+        const ptr dma_end = dma_heap->vaddr + dma_heap->pagespan * PAGESIZE;
+        if (addr < dma_end && addr + len > dma_heap->vaddr)
+            return MAP_FAILED;
+    }
+    else
+    {
+        /* Leave a guard page above, right below the stack. */
+        const ptr high = proc->stack_top - PROC_STACK_SIZE - PAGESIZE;
+        addr = pagingstruct_find_free_range(
+            len, PROC_MMAP_LOW_ADDRESS, high, ps);
+
+        if (!addr)
+            return MAP_FAILED;
+    }
+
+    int st = pagingstruct_add_file_area(
+        addr, addr + len, pageflags, vnode, off, shared, ps);
+    if (st < 0)
+        return MAP_FAILED;
+
+    return (void*)addr;
+}
+
 void* vfs_mmap(
     void* addr,
     size_t len,
@@ -575,8 +724,14 @@ void* vfs_mmap(
     if (!sysfd)
         return (void*)EBADF;
 
-    ASSERT(sysfd->vnode->ops->mmap);
-    return sysfd->vnode->ops->mmap(sysfd->vnode, addr, len, prot, flags, off);
+    VirtualNode* vnode = sysfd->vnode;
+    if (vnode->ops->mmap)
+        return vnode->ops->mmap(vnode, addr, len, prot, flags, off);
+
+    if (!(vnode->mode & S_IFREG) || !vnode->ops->read)
+        return MAP_FAILED;
+
+    return vfs_mmap_file(vnode, (ptr)addr, len, prot, flags, off, proc);
 }
 
 int sys_open(const char* path, int flags, mode_t mode)
@@ -604,3 +759,25 @@ void* sys_mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off)
     return vfs_mmap(
         addr, len, prot, flags, fd, off, procm_sched_current_proc());
 }
+
+int sys_munmap(void* addr, size_t len)
+{
+    const ptr start = (ptr)addr;
+    if (start % PAGESIZE || !len || start < PROC_LOW_ADDRESS ||
+        start >= PROC_HIGH_ADDRESS)
+        return -EINVAL;
+
+    len = bytes_align_up64(len, PAGESIZE);
+    if (len > PROC_HIGH_ADDRESS - start)
+        return -EINVAL;
+
+    Process* proc = procm_sched_current_proc();
+
+    /* Device memory mapped by a driver's mmap. */
+    const Heap* dma_heap = &proc->dma_heap;
+    if (start >= dma_heap->vaddr &&
+        start < dma_heap->vaddr + dma_heap->pagespan * PAGESIZE)
+        return dma_unmap_range(start, len, proc);
+
+    return mm_unmap_user_range(start, start + len, proc->paging_struct);
+}
@@ -9,6 +9,7 @@
 #include <dxgmx/utils/hashtable.h>
 
 static HashTable g_sys_fd_hashtable;
+static KMallocCache g_sysfd_cache = KMALLOC_CACHE_INIT("sysfd", FileDescriptor);
 
 static hashtable_key_t vfs_fdt_combo_to_hashkey(fd_t procfd, pid_t pid)
 {
@@ -22,7 +23,7 @@ int vfs_fdt_init()
 
 FileDescriptor* vfs_fdt_new_sysfd(fd_t procfd, pid_t pid)
 {
-    FileDescriptor* sysfd = kcalloc(sizeof(FileDescriptor));
+    FileDescriptor* sysfd = kmalloc_cache_calloc(&g_sysfd_cache);
     if (!sysfd)
         return NULL;
 
@@ -33,7 +34,7 @@ FileDescriptor* vfs_fdt_new_sysfd(fd_t procfd, pid_t pid)
 
     if (st < 0)
     {
-        kfree(sysfd);
+        kmalloc_cache_free(sysfd, &g_sysfd_cache);
         return NULL;
     }
 
@@ -58,5 +59,5 @@ void vfs_fdt_free_sysfd(FileDescriptor* sysfd)
 {
     hashtable_remove(
         vfs_fdt_combo_to_hashkey(sysfd->fd, sysfd->pid), &g_sys_fd_hashtable);
-    kfree(sysfd);
+    kmalloc_cache_free(sysfd, &g_sysfd_cache);
 }
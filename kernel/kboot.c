@@ -3,9 +3,12 @@
  * Distributed under the MIT license.
  */
 
+#include <dxgmx/ctype.h>
+#include <dxgmx/errno.h>
 #include <dxgmx/generated/kconfig.h>
 #include <dxgmx/kboot.h>
 #include <dxgmx/panic.h>
+#include <dxgmx/string.h>
 
 #if !defined(CONFIG_MULTIBOOT_BOOTLOADER)
 #error No boot spec has been configured! How should we boot?
@@ -39,3 +42,53 @@ void kbootinfo_parse()
 
     panic("Could not figure out the bootloader spec!");
 }
+
+int kboot_cmdline_get(const char* opt, char* dest, size_t n)
+{
+    const size_t optlen = strlen(opt);
+    const char* cur = ___kboot_info.cmdline;
+
+    while (*cur)
+    {
+        while (*cur && isspace(*cur))
+            ++cur;
+
+        const char* tokstart = cur;
+        while (*cur && !isspace(*cur))
+            ++cur;
+
+        const size_t toklen = cur - tokstart;
+        if (toklen < optlen || memcmp(tokstart, opt, optlen) != 0)
+            continue;
+
+        size_t vallen;
+        const char* val;
+        if (toklen == optlen)
+        {
+            val = "";
+            vallen = 0;
+        }
+        else if (tokstart[optlen] == '=')
+        {
+            val = tokstart + optlen + 1;
+            vallen = toklen - optlen - 1;
+        }
+        else
+        {
+            continue; /* Just a prefix of something else. */
+        }
+
+        if (dest)
+        {
+            if (vallen >= n)
+                return -ENAMETOOLONG;
+
+            memcpy(dest, val, vallen);
+            dest[vallen] = '\0';
+        }
+
+        return vallen;
+    }
+
+    return -ENOENT;
+}
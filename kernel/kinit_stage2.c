@@ -9,6 +9,7 @@
 #include <dxgmx/kboot.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/ksyms.h>
+#include <dxgmx/mem/swap.h>
 #include <dxgmx/module.h>
 #include <dxgmx/proc/procm.h>
 #include <dxgmx/syscalls.h>
@@ -74,6 +75,9 @@ _ATTR_NORETURN void kinit_stage2()
 
     mod_builtin_init_stage3();
 
+    /* Storage drivers have enumerated their partitions by now. */
+    swap_init();
+
     mod_builtin_dump_all();
 
     syscalls_init();
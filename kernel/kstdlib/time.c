@@ -3,10 +3,17 @@
  * Distributed under the MIT license.
  */
 
+#include <dxgmx/interrupts.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/proc/waitqueue.h>
 #include <dxgmx/time.h>
 #include <dxgmx/timer.h>
 #include <dxgmx/todo.h>
 
+/* Sleeps at least this long put the process to sleep, shorter ones are busy
+ * waited, since waking up only happens on timer ticks. */
+#define NANOSLEEP_BLOCK_MIN_NS 1000000
+
 char* asctime(const struct tm* timeptr)
 {
     (void)timeptr;
@@ -76,14 +83,25 @@ time_t time(time_t* timer)
 
 int nanosleep(const struct timespec* rqtp, struct timespec* rmtp)
 {
+    const u64 ns = (u64)rqtp->tv_sec * 1000000000 + rqtp->tv_nsec;
+
+    if (ns >= NANOSLEEP_BLOCK_MIN_NS && procm_sched_can_block())
+    {
+        const bool irqs = interrupts_disable_irqs_save();
+        waitqueue_wait_timeout(NULL, ns);
+        interrupts_restore_irqs(irqs);
+    }
+    else
+    {
 #define NANOSLEEP_SECS_OVERHEAD 0.015
-    const double secs =
-        rqtp->tv_sec + rqtp->tv_nsec / 1000000000.0 - NANOSLEEP_SECS_OVERHEAD;
-    Timer t;
-    timer_start(&t);
+        const double secs = rqtp->tv_sec + rqtp->tv_nsec / 1000000000.0 -
+                            NANOSLEEP_SECS_OVERHEAD;
+        Timer t;
+        timer_start(&t);
 
-    while (timer_elapsed_sec(&t) < secs)
-        ;
+        while (timer_elapsed_sec(&t) < secs)
+            ;
+    }
 
     if (rmtp)
     {
@@ -6,13 +6,38 @@
 #include <dxgmx/assert.h>
 #include <dxgmx/errno.h>
 #include <dxgmx/klog.h>
+#include <dxgmx/kmalloc.h>
 #include <dxgmx/mem/dma.h>
 #include <dxgmx/mem/falloc.h>
 #include <dxgmx/mem/mm.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/string.h>
 #include <dxgmx/utils/bytes.h>
 
 #define KLOGF_PREFIX "dma: "
 
+/* Reserve 'pages' pages of the DMA heap for mapping 'paddr'. Ranges that can
+ * hold at least a large page are placed so that they're aligned the same way
+ * as 'paddr', which lets dma_map_range() use large pages. Returns the index of
+ * the first page. */
+static ssize_t dma_reserve_vrange(ptr paddr, size_t pages, Process* proc)
+{
+    const size_t large_page_pages = LARGE_PAGESIZE / PAGESIZE;
+    if (pages >= large_page_pages)
+    {
+        const ptr heap_off = proc->dma_heap.vaddr % LARGE_PAGESIZE;
+        const size_t off =
+            (paddr % LARGE_PAGESIZE + LARGE_PAGESIZE - heap_off) / PAGESIZE;
+
+        const ssize_t start = bitmap_first_n_free_aligned_and_mark(
+            pages, large_page_pages, off, &proc->dma_bitmap);
+        if (start >= 0)
+            return start;
+    }
+
+    return bitmap_first_n_free_and_mark(pages, &proc->dma_bitmap);
+}
+
 ERR_OR(ptr) dma_map_range(ptr paddr, size_t n, u16 flags, Process* proc)
 {
     ASSERT(paddr % PAGESIZE == 0);
@@ -30,22 +55,232 @@ ERR_OR(ptr) dma_map_range(ptr paddr, size_t n, u16 flags, Process* proc)
     n = bytes_align_up64(n, PAGESIZE);
     const size_t pages = n / PAGESIZE;
 
-    const ssize_t start =
-        bitmap_first_n_free_and_mark(pages, &proc->dma_bitmap);
+    const ssize_t start = dma_reserve_vrange(paddr, pages, proc);
     if (start < 0)
         return ERR(ptr, -ENOMEM);
 
-    for (size_t i = 0; i < pages; ++i)
+    /* Large pages are used where the range lines up. */
+    const ptr vstart = proc->dma_heap.vaddr + start * PAGESIZE;
+    int st =
+        mm_map_range(vstart, vstart + n, paddr, flags, proc->paging_struct);
+    if (st < 0)
     {
-        int st = mm_map_page(
-            proc->dma_heap.vaddr + (start + i) * PAGESIZE,
-            paddr + i * PAGESIZE,
-            flags,
-            proc->paging_struct);
+        /* Some of it might have made it in. */
+        mm_unmap_range(vstart, vstart + n, proc->paging_struct);
+        bitmap_unmark(start, pages, &proc->dma_bitmap);
+        return ERR(ptr, st);
+    }
+
+    return VALUE(ptr, vstart);
+}
+
+int dma_unmap_range(ptr vaddr, size_t n, Process* proc)
+{
+    const ptr heap_start = proc->dma_heap.vaddr;
+    const ptr heap_end = heap_start + proc->dma_heap.pagespan * PAGESIZE;
+
+    n = bytes_align_up64(n, PAGESIZE);
+    if (BITMAP_NOT_INIT(proc->dma_bitmap) || vaddr % PAGESIZE || !n ||
+        vaddr < heap_start || vaddr >= heap_end || n > heap_end - vaddr)
+        return -EINVAL;
+
+    int st = mm_unmap_range(vaddr, vaddr + n, proc->paging_struct);
+    if (st < 0)
+        return st;
+
+    return bitmap_unmark(
+        (vaddr - heap_start) / PAGESIZE, n / PAGESIZE, &proc->dma_bitmap);
+}
+
+int dma_alloc_coherent(size_t size, DMABuffer* buf)
+{
+    if (!size)
+        return -EINVAL;
+
+    size = bytes_align_up64(size, PAGESIZE);
+    const size_t pages = size / PAGESIZE;
+
+    size_t order = 0;
+    while ((1UL << order) < pages)
+        ++order;
+
+    if (order > FALLOC_MAX_ORDER)
+        return -ENOMEM;
+
+    const ptr paddr = falloc_pages(order);
+    if (!paddr)
+        return -ENOMEM;
+
+    /* Give back what we don't need of the block. */
+    if ((1UL << order) > pages)
+        ffree_range(paddr + size, (1UL << order) - pages);
+
+    ERR_OR(ptr)
+    res = dma_map_range(paddr, size, PAGE_RW, procm_get_kernel_proc());
+    if (res.error)
+    {
+        ffree_range(paddr, pages);
+        return res.error;
+    }
+
+    memset((void*)res.value, 0, size);
+
+    buf->vaddr = res.value;
+    buf->paddr = paddr;
+    buf->size = size;
+    return 0;
+}
+
+void dma_free_coherent(DMABuffer* buf)
+{
+    if (!buf->size)
+        return;
+
+    int st = dma_unmap_range(buf->vaddr, buf->size, procm_get_kernel_proc());
+    ASSERT(st == 0);
+
+    ffree_range(buf->paddr, buf->size / PAGESIZE);
+    memset(buf, 0, sizeof(DMABuffer));
+}
+
+/* Returns the page frame behind the kernel page 'vaddr', or 0 if there's
+ * none. */
+static ptr dma_kernel_page_frame(ptr vaddr)
+{
+    PagingStruct* kps = mm_get_kernel_paging_struct();
+
+    ptr frame;
+    u16 flags;
+    if (mm_get_page(vaddr, kps, &frame, &flags) == 0)
+        return frame;
+
+    /* Kernel heap pages are mapped the first time they're touched, a buffer
+     * that's about to be read into may not have been yet. */
+    if (!kmalloc_owns_va(vaddr))
+        return 0;
+
+    (void)*(volatile u8*)vaddr;
+    return mm_get_page(vaddr, kps, &frame, &flags) == 0 ? frame : 0;
+}
+
+int dma_build_sglist(
+    const void* buf, size_t size, size_t max_segment, DMASGList* sgl)
+{
+    if (!buf || !size || max_segment % PAGESIZE)
+        return -EINVAL;
 
+    const ptr start = (ptr)buf;
+    const ptr end = start + size;
+    if (end < start)
+        return -EINVAL;
+
+    const ptr first_page = bytes_align_down64(start, PAGESIZE);
+    const size_t pages =
+        (bytes_align_up64(end, PAGESIZE) - first_page) / PAGESIZE;
+
+    /* Worst case every page is it's own segment. */
+    sgl->segments = kmalloc(pages * sizeof(DMASegment));
+    if (!sgl->segments)
+        return -ENOMEM;
+
+    sgl->count = 0;
+
+    for (ptr page = first_page; page < end; page += PAGESIZE)
+    {
+        const ptr frame = dma_kernel_page_frame(page);
+        if (!frame)
+        {
+            dma_free_sglist(sgl);
+            return -EFAULT;
+        }
+
+        /* Only part of the first and last pages may be in the buffer. */
+        const ptr chunk_start = page < start ? start : page;
+        const ptr chunk_end = page + PAGESIZE > end ? end : page + PAGESIZE;
+        const ptr paddr = frame + chunk_start % PAGESIZE;
+        const size_t chunk = chunk_end - chunk_start;
+
+        DMASegment* last =
+            sgl->count ? &sgl->segments[sgl->count - 1] : NULL;
+        if (last && last->paddr + last->size == paddr &&
+            (!max_segment || last->size + chunk <= max_segment))
+        {
+            last->size += chunk;
+            continue;
+        }
+
+        sgl->segments[sgl->count++] =
+            (DMASegment){.paddr = paddr, .size = chunk};
+    }
+
+    return 0;
+}
+
+void dma_free_sglist(DMASGList* sgl)
+{
+    if (sgl->segments)
+        kfree(sgl->segments);
+
+    sgl->segments = NULL;
+    sgl->count = 0;
+}
+
+int dma_fork(const Process* proc, Process* newproc)
+{
+    newproc->dma_heap = proc->dma_heap;
+    if (BITMAP_NOT_INIT(proc->dma_bitmap))
+        return 0;
+
+    int st = bitmap_init(proc->dma_heap.pagespan, &newproc->dma_bitmap);
+    if (st < 0)
+        return st;
+
+    u8* bitmap = newproc->dma_bitmap.start;
+    newproc->dma_bitmap = proc->dma_bitmap;
+    newproc->dma_bitmap.start = bitmap;
+    memcpy(bitmap, proc->dma_bitmap.start, proc->dma_bitmap.size);
+
+    /* Device memory is shared as is, there's nothing to copy-on-write. */
+    for (size_t i = 0; i < proc->dma_heap.pagespan; ++i)
+    {
+        if (!(bitmap[i / 8] & (1 << (i % 8))))
+            continue;
+
+        const ptr vaddr = proc->dma_heap.vaddr + i * PAGESIZE;
+
+        ptr frame;
+        u16 flags;
+        if (mm_get_page(vaddr, proc->paging_struct, &frame, &flags) < 0)
+            continue;
+
+        if ((flags & PAGE_LARGE) && vaddr % LARGE_PAGESIZE == 0)
+        {
+            st = mm_map_large_page(
+                vaddr, frame, flags, newproc->paging_struct);
+            if (st < 0)
+                return st;
+
+            i += LARGE_PAGESIZE / PAGESIZE - 1;
+            continue;
+        }
+
+        st = mm_map_page(vaddr, frame, flags, newproc->paging_struct);
         if (st < 0)
-            return ERR(ptr, st);
+            return st;
     }
 
-    return VALUE(ptr, proc->dma_heap.vaddr + start * PAGESIZE);
+    return 0;
+}
+
+size_t dma_mapped_pages(const Process* proc)
+{
+    if (BITMAP_NOT_INIT(proc->dma_bitmap))
+        return 0;
+
+    return bitmap_count_marked(&proc->dma_bitmap);
+}
+
+void dma_destroy(Process* proc)
+{
+    bitmap_destroy(&proc->dma_bitmap);
 }
@@ -10,66 +10,250 @@
 #include <dxgmx/mem/falloc.h>
 #include <dxgmx/mem/mm.h>
 #include <dxgmx/mem/pagesize.h>
+#include <dxgmx/mem/shrinker.h>
 #include <dxgmx/panic.h>
 #include <dxgmx/string.h>
 #include <dxgmx/todo.h>
 #include <dxgmx/types.h>
-#include <dxgmx/utils/bitwise.h>
+#include <dxgmx/units.h>
 #include <dxgmx/utils/bytes.h>
 
 #define KLOGF_PREFIX "falloc: "
 
 /**
- * This pageframe allocator is built with the kernel heap in mind.
- * The 'official' way of allocating page frames, is using falloc_one_user(). The
- * thing to keep in mind about this function is that it allocates it's frames
- * starting from the end of the bitmap, going backwards. This way the starting
- * frames (the ones that may get used by the kernel heap are left available).
- * This doesn't mean that they are guaranteed to be available through the whole
- * runtime of the kernel, the userspace may allocate a lot of pageframes which
- * may result in falloc_one_user() to start allocation frames that "belong" to
- * the kernel heap. A map of the free pageframes may look like this:
+ * This is a buddy allocator. Free memory is kept as blocks of 2^order
+ * contiguous page frames, aligned on their own size, for orders 0 through
+ * FALLOC_MAX_ORDER. Every order has a bitmap with one bit per block, which is
+ * set if said block is free. A block is only ever free at one order:
  *
- *                      'kernel heap (low-address) frames'
- *                                     |
- * [ x frames ] [ kernel image ] [ y frames ] --->           <--- [ z frames ]
- *       ^                                                             ^
- *  We should minimize these.                       'user (high-address) frames'
+ * order 2: [       1       ] [       0       ]
+ * order 1: [   0   ] [   0   ] [   0   ] [   1   ]
+ * order 0: [ 0 ] [ 0 ] [ 0 ] [ 0 ] [ 1 ] [ 0 ] [ 0 ] [ 0 ]
  *
- * Of course, in a real system we may have a lot of memory holes, but the point
- * still stands. The kernel is loaded at a low-ish address in memory, in hopes
- * of minimizing the number of "x frames" (frames before the kernel image).
- * falloc_one_user() tries allocating as many high-address frames as possible,
- * leaving the low-address frames, to be requested manually through
- * falloc_one_at().
+ * Here frames 0-3 are free as one order 2 block, frames 6-7 as an order 1 block
+ * and frame 4 as an order 0 block. Allocating splits the smallest big enough
+ * block in halves until it's the requested size, freeing merges a block with
+ * it's buddy (the other half of the block they were split from) for as long
+ * as the buddy is free too. Both take at most FALLOC_MAX_ORDER steps.
+ *
+ * Since page frames are not mapped anywhere, the allocator can't keep any
+ * state inside the free frames themselves, so finding a free block means
+ * looking for a set bit in that order's bitmap. On top of each bitmap sits a
+ * summary bitmap, with one bit per bitmap word, set if said word has any set
+ * bits. This way we skip over 64 words (4096 blocks) of nothing at a time.
+ * Each order also keeps a cursor to the first summary word that may have a
+ * set bit, so we don't rescan the same empty words every time.
+ *
+ * Allocated frames can be shared, see falloc_ref(). Every frame has a count of
+ * extra references next to the bitmaps, 0 meaning it has a single owner.
+ * Freeing a shared frame just drops a reference.
+ *
+ * The bitmaps and reference counts are sized after the highest page frame in
+ * the memory map, and live in memory given to falloc_init() by the caller, see
+ * falloc_metadata_size().
  */
 
-/* 1024 * 16 64-bit numbers are enough to hold the
-state of 1048576 4KiB pages which hold a total of 4GiB of memory. */
-#define PAGEFRAME_POOL_SIZE (1024 * 16)
+/* The highest frame number we can hold, 1048576 4KiB pages which hold a total
+ * of 4GiB of memory. */
+#define FALLOC_MAX_FRAMES (GIB / PAGESIZE * 4)
+
+/* We track frames in multiples of this, so every order has a whole number of
+ * bitmap words. */
+#define FALLOC_FRAMES_GRANULARITY ((size_t)64 << FALLOC_MAX_ORDER)
+
+/* Number of summary words for a bitmap of 'words' words. */
+#define FALLOC_SUMMARY_WORDS(words) (((words) + 63) / 64)
 
-/* MAYBE FIXME: This whole thing is 128 KiB of memory, which at the time of
- * writting, is about 1/3 of the kernel binary size... */
-static u64 g_pgframe_pool[PAGEFRAME_POOL_SIZE];
+typedef struct S_FAllocOrder
+{
+    /* This order's bitmap. */
+    u64* bitmap;
+    /* One bit per 'bitmap' word, set if said word is not 0. */
+    u64* summary;
+    /* Number of words in 'summary'. */
+    size_t summary_words;
+    /* Summary words before this one have no set bits. */
+    size_t cursor;
+    /* Number of free blocks of this order. */
+    size_t free_blocks;
+} FAllocOrder;
+
+static FAllocOrder g_orders[FALLOC_MAX_ORDER + 1];
+
+/* Extra references of each page frame, see falloc_ref(). */
+static u16* g_refs;
+
+/* Number of page frames we track. */
+static size_t g_pgframes_max = 0;
 static size_t g_pgframes_cnt = 0;
 
-static size_t g_pgframes_user_cursor = PAGEFRAME_POOL_SIZE - 1;
-static i8 g_pgframes_user_subcursor = 63;
+static _ATTR_ALWAYS_INLINE bool falloc_is_block_free(size_t block, size_t order)
+{
+    return (g_orders[order].bitmap[block / 64] >> (block % 64)) & 1;
+}
+
+static _ATTR_ALWAYS_INLINE void
+falloc_mark_block_free(size_t block, size_t order)
+{
+    FAllocOrder* o = &g_orders[order];
+    const size_t word = block / 64;
+
+    o->bitmap[word] |= (u64)1 << (block % 64);
+    o->summary[word / 64] |= (u64)1 << (word % 64);
+    ++o->free_blocks;
+
+    if (word / 64 < o->cursor)
+        o->cursor = word / 64;
+}
+
+static _ATTR_ALWAYS_INLINE void
+falloc_mark_block_used(size_t block, size_t order)
+{
+    FAllocOrder* o = &g_orders[order];
+    const size_t word = block / 64;
+
+    o->bitmap[word] &= ~((u64)1 << (block % 64));
+    if (!o->bitmap[word])
+        o->summary[word / 64] &= ~((u64)1 << (word % 64));
+
+    --o->free_blocks;
+}
+
+/* Find a free block of 'order'. Returns the block number, or -1 if there are
+ * none. */
+static ssize_t falloc_find_free_block(size_t order)
+{
+    FAllocOrder* o = &g_orders[order];
+    if (!o->free_blocks)
+        return -1;
+
+    for (; o->cursor < o->summary_words; ++o->cursor)
+    {
+        const u64 summary = o->summary[o->cursor];
+        if (summary)
+        {
+            const size_t word = o->cursor * 64 + __builtin_ctzll(summary);
+            return word * 64 + __builtin_ctzll(o->bitmap[word]);
+        }
+    }
+
+    /* free_blocks said otherwise. */
+    ASSERT_NOT_HIT();
+}
+
+/* Find the order at which the block holding 'frame' is free. Returns said
+ * order, or -1 if 'frame' is allocated. */
+static ssize_t falloc_find_free_order(size_t frame)
+{
+    for (size_t order = 0; order <= FALLOC_MAX_ORDER; ++order)
+    {
+        if (falloc_is_block_free(frame >> order, order))
+            return order;
+    }
+
+    return -1;
+}
+
+/* Give back the block starting at 'frame', merging it with it's buddies. */
+static void falloc_free_block(size_t frame, size_t order)
+{
+    size_t block = frame >> order;
+
+    for (; order < FALLOC_MAX_ORDER; ++order, block >>= 1)
+    {
+        const size_t buddy = block ^ 1;
+        if (!falloc_is_block_free(buddy, order))
+            break;
+
+        falloc_mark_block_used(buddy, order);
+    }
 
-/* Adds any complete PAGE_FRAME_SIZE sized frames from the given area. */
-static void pageframe_add_available(const MemoryRegion* region)
+    falloc_mark_block_free(block, order);
+}
+
+/* 'block' of 'order' was just taken out of the free bitmaps. Give back the
+ * parts of it that are outside the frame range [start, end). */
+static void
+falloc_give_back_outside(size_t block, size_t order, size_t start, size_t end)
 {
-    for (u64 frame = region->start; frame < region->start + region->size;
-         frame += PAGESIZE)
-        ffree_one(frame);
+    const size_t first = block << order;
+    const size_t last = first + ((size_t)1 << order);
+
+    if (last <= start || first >= end)
+    {
+        /* Completely outside. It's buddy is either used or partially used,
+         * so there is nothing to merge. */
+        falloc_mark_block_free(block, order);
+        return;
+    }
+
+    if (first >= start && last <= end)
+        return;
+
+    /* Partially inside, which means order > 0. */
+    falloc_give_back_outside(block * 2, order - 1, start, end);
+    falloc_give_back_outside(block * 2 + 1, order - 1, start, end);
+}
+
+/* Number of page frames to track for 'mregmap'. */
+static size_t falloc_frames_for_mregmap(const MemoryRegionMap* mregmap)
+{
+    u64 end = 0;
+    FOR_EACH_MEM_REGION (region, mregmap)
+    {
+        if (region->start + region->size > end)
+            end = region->start + region->size;
+    }
+
+    if (end > (u64)FALLOC_MAX_FRAMES * PAGESIZE)
+        end = (u64)FALLOC_MAX_FRAMES * PAGESIZE;
+
+    return bytes_align_up64(end / PAGESIZE, FALLOC_FRAMES_GRANULARITY);
 }
 
-_INIT int falloc_init(const MemoryRegionMap* mregmap)
+size_t falloc_metadata_size(const MemoryRegionMap* mregmap)
 {
-    memset(g_pgframe_pool, 0xFF, sizeof(g_pgframe_pool));
+    const size_t frames = falloc_frames_for_mregmap(mregmap);
+
+    size_t words = 0;
+    for (size_t order = 0; order <= FALLOC_MAX_ORDER; ++order)
+    {
+        const size_t bitmap_words = (frames >> order) / 64;
+        words += bitmap_words + FALLOC_SUMMARY_WORDS(bitmap_words);
+    }
+
+    return words * sizeof(u64) + frames * sizeof(u16);
+}
+
+_INIT int falloc_init(const MemoryRegionMap* mregmap, void* metadata)
+{
+    g_pgframes_max = falloc_frames_for_mregmap(mregmap);
+    memset(metadata, 0, falloc_metadata_size(mregmap));
+
+    u64* words = metadata;
+    for (size_t order = 0; order <= FALLOC_MAX_ORDER; ++order)
+    {
+        const size_t bitmap_words = (g_pgframes_max >> order) / 64;
+
+        g_orders[order].bitmap = words;
+        words += bitmap_words;
+        g_orders[order].summary = words;
+        g_orders[order].summary_words = FALLOC_SUMMARY_WORDS(bitmap_words);
+        words += FALLOC_SUMMARY_WORDS(bitmap_words);
+    }
+
+    g_refs = (u16*)words;
 
     FOR_EACH_MEM_REGION (area, mregmap)
-        pageframe_add_available(area);
+    {
+        u64 start = bytes_align_up64(area->start, PAGESIZE);
+        u64 end = bytes_align_down64(area->start + area->size, PAGESIZE);
+        if (end > (u64)g_pgframes_max * PAGESIZE)
+            end = (u64)g_pgframes_max * PAGESIZE;
+
+        if (start < end)
+            ffree_range(start, (end - start) / PAGESIZE);
+    }
 
     if (!g_pgframes_cnt)
         panic("falloc: No free page frames have been registered.");
@@ -82,74 +266,218 @@ _INIT int falloc_init(const MemoryRegionMap* mregmap)
         (size_t)bytes_to_human_readable(PAGESIZE, unit),
         unit);
 
+    falloc_dump_statistics();
+
     return 0;
 }
 
-/* Returns a free page's address */
-ptr falloc_one_user()
+/* falloc_pages(), without running shrinkers. */
+static ptr falloc_try_pages(size_t order)
 {
-    for (; g_pgframes_user_cursor >= 1; --g_pgframes_user_cursor)
+    /* Find the smallest free block that is big enough. */
+    size_t blockorder = order;
+    ssize_t block = -1;
+    for (; blockorder <= FALLOC_MAX_ORDER; ++blockorder)
     {
-        u64* pageframe_pool = &g_pgframe_pool[g_pgframes_user_cursor];
+        block = falloc_find_free_block(blockorder);
+        if (block >= 0)
+            break;
+    }
 
-        for (; g_pgframes_user_subcursor >= 0; --g_pgframes_user_subcursor)
-        {
-            if (!((*pageframe_pool >> g_pgframes_user_subcursor) & 1))
-            {
-                bw_set(pageframe_pool, g_pgframes_user_subcursor);
-                --g_pgframes_cnt;
-                return g_pgframes_user_cursor * 64 * PAGESIZE +
-                       g_pgframes_user_subcursor * PAGESIZE;
-            }
-        }
-        g_pgframes_user_subcursor = 63;
+    if (block < 0)
+        return 0;
+
+    falloc_mark_block_used(block, blockorder);
+
+    /* Split it, giving back the upper halves. */
+    for (; blockorder > order; --blockorder)
+    {
+        block <<= 1;
+        falloc_mark_block_free(block + 1, blockorder - 1);
+    }
+
+    g_pgframes_cnt -= 1 << order;
+    return (ptr)((size_t)block << order) * PAGESIZE;
+}
+
+ptr falloc_pages(size_t order)
+{
+    if (order > FALLOC_MAX_ORDER)
+        return 0;
+
+    ptr base = falloc_try_pages(order);
+    if (!base && shrinker_run(SHRINK_FRAMES, 1 << order))
+        base = falloc_try_pages(order);
+
+    return base;
+}
+
+void ffree_pages(ptr base, size_t order)
+{
+    ASSERT(base % (PAGESIZE << order) == 0);
+    ASSERT(order <= FALLOC_MAX_ORDER);
+
+    const size_t frame = base / PAGESIZE;
+    ASSERT(frame < g_pgframes_max);
+
+    /* Double free. */
+    if (falloc_find_free_order(frame) >= 0)
+        panic("falloc: Tried to free free page frame 0x%p!", (void*)base);
+
+    /* Someone else is still using it. */
+    if (g_refs[frame])
+    {
+        ASSERT(order == 0);
+        --g_refs[frame];
+        return;
     }
 
+    falloc_free_block(frame, order);
+    g_pgframes_cnt += 1 << order;
+}
+
+int falloc_range_at(ptr base, size_t n)
+{
+    ASSERT(base % PAGESIZE == 0);
+
+    const size_t start = base / PAGESIZE;
+    const size_t end = start + n;
+    if (end > g_pgframes_max || end < start)
+        return -ENOMEM;
+
+    /* Make sure the whole range is free before touching anything. We go over
+     * it a free block at a time. */
+    for (size_t frame = start; frame < end;)
+    {
+        ssize_t order = falloc_find_free_order(frame);
+        if (order < 0)
+            return -ENOMEM;
+
+        frame = ((frame >> order) + 1) << order;
+    }
+
+    for (size_t frame = start; frame < end;)
+    {
+        const size_t order = falloc_find_free_order(frame);
+        const size_t block = frame >> order;
+
+        falloc_mark_block_used(block, order);
+        falloc_give_back_outside(block, order, start, end);
+
+        frame = (block + 1) << order;
+    }
+
+    g_pgframes_cnt -= n;
     return 0;
 }
 
+void ffree_range(ptr base, size_t n)
+{
+    ASSERT(base % PAGESIZE == 0);
+
+    size_t frame = base / PAGESIZE;
+    const size_t end = frame + n;
+    ASSERT(end <= g_pgframes_max);
+
+    /* Give it back in blocks as big as their alignment allows. */
+    while (frame < end)
+    {
+        size_t order = 0;
+        while (order < FALLOC_MAX_ORDER && !(frame & (1 << order)) &&
+               frame + (2 << order) <= end)
+            ++order;
+
+        falloc_free_block(frame, order);
+        frame += 1 << order;
+    }
+
+    g_pgframes_cnt += n;
+}
+
+ptr falloc_one_user()
+{
+    return falloc_pages(0);
+}
+
+ptr falloc_one()
+{
+    return falloc_pages(0);
+}
+
 bool falloc_is_frame_available(ptr base)
 {
     ASSERT(base % PAGESIZE == 0);
 
-    u64 bit = base / PAGESIZE;
-    u16 i = bit / 64;
-    bit -= i * 64;
+    const size_t frame = base / PAGESIZE;
+    if (frame >= g_pgframes_max)
+        return false;
 
-    bool st = (g_pgframe_pool[i] >> bit) & 1;
-    return !st;
+    return falloc_find_free_order(frame) >= 0;
 }
 
 int falloc_one_at(ptr base)
 {
-    ASSERT(base % PAGESIZE == 0);
+    return falloc_range_at(base, 1);
+}
 
-    if (!falloc_is_frame_available(base))
-        return -ENOMEM;
+int falloc_ref(ptr base)
+{
+    ASSERT(base % PAGESIZE == 0);
 
-    u64 bit = base / PAGESIZE;
-    u16 i = bit / 64;
-    bit -= i * 64;
+    const size_t frame = base / PAGESIZE;
+    ASSERT(frame < g_pgframes_max);
+    ASSERT(falloc_find_free_order(frame) < 0);
 
-    bw_set(&g_pgframe_pool[i], bit);
+    if (g_refs[frame] == __UINT16_MAX__)
+        return -EOVERFLOW;
 
+    ++g_refs[frame];
     return 0;
 }
 
+size_t falloc_refcount(ptr base)
+{
+    ASSERT(base % PAGESIZE == 0);
+
+    const size_t frame = base / PAGESIZE;
+    if (frame >= g_pgframes_max || falloc_find_free_order(frame) >= 0)
+        return 0;
+
+    return g_refs[frame] + 1;
+}
+
 size_t falloc_get_free_frames_count()
 {
     return g_pgframes_cnt;
 }
 
-void ffree_one(ptr base)
+size_t falloc_get_free_blocks_count(size_t order)
 {
-    ASSERT(base % PAGESIZE == 0);
+    if (order > FALLOC_MAX_ORDER)
+        return 0;
 
-    u64 bit = base / PAGESIZE;
-    u16 i = bit / 64;
-    bit -= i * 64;
+    return g_orders[order].free_blocks;
+}
 
-    bw_clear(&g_pgframe_pool[i], bit);
+void falloc_dump_statistics()
+{
+    KLOGF(INFO, "Free blocks per order:");
+    for (size_t order = 0; order <= FALLOC_MAX_ORDER; ++order)
+    {
+        char unit[4];
+        size_t size = bytes_to_human_readable((u64)PAGESIZE << order, unit);
 
-    ++g_pgframes_cnt;
+        KLOGF(
+            INFO,
+            "-- %zu (%zu%s): %zu",
+            order,
+            size,
+            unit,
+            g_orders[order].free_blocks);
+    }
+}
+
+void ffree_one(ptr base)
+{
+    ffree_pages(base, 0);
 }
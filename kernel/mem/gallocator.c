@@ -7,7 +7,7 @@
 #include <dxgmx/errno.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
-#include <dxgmx/math.h>
+#include <dxgmx/mem/gallocator.h>
 #include <dxgmx/mem/pagesize.h>
 #include <dxgmx/string.h>
 #include <dxgmx/utils/bitwise.h>
@@ -15,29 +15,54 @@
 
 #define KLOGF_PREFIX "gallocator: "
 
+/* Record per-pool search statistics, see gallocator_dump_statistics(). */
+#define GALLOCATOR_RECORD_STATISTICS 1
+
 #define LO_POOL_CHUNK_SIZE 32
 #define MID_POOL_CHUNK_SIZE 64
 #define HI_POOL_CHUNK_SIZE 128
 
+/* Bitmaps are walked a whole machine word at a time. */
+typedef unsigned long bitword_t;
+#define BITWORD_BITS (sizeof(bitword_t) * 8)
+#define BITWORD_ONES ((bitword_t)-1)
+
+typedef struct S_GAllocatorPool
+{
+    /* One bit per chunk, set = used. */
+    bitword_t* bitmap;
+    size_t bitmap_words;
+
+    ptr start;
+    size_t chunks;
+    size_t chunksize;
+
+    /* Next-fit: chunk where the next search starts. */
+    size_t hint;
+
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    size_t allocations;
+    size_t failed_allocations;
+    /* Bitmap words looked at while searching. */
+    size_t words_scanned;
+#endif
+} GAllocatorPool;
+
 typedef struct S_GAllocatorHeapMeta
 {
 #define HEAP_SIGNATURE 0xDEAD5160
     u32 signature;
 
-    ptr lo_bitmap;
-    size_t lo_bitmap_size;
-    ptr lo_pool;
-    size_t lo_poolchunks;
-
-    ptr mid_bitmap;
-    size_t mid_bitmap_size;
-    ptr mid_pool;
-    size_t mid_poolchunks;
+    GAllocatorPool lo;
+    GAllocatorPool mid;
+    GAllocatorPool hi;
 
-    ptr hi_bitmap;
-    size_t hi_bitmap_size;
-    ptr hi_pool;
-    size_t hi_poolchunks;
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    /* Reallocations that were resolved without moving the allocation. */
+    size_t reallocs_in_place;
+    /* Reallocations that had to allocate, copy and free. */
+    size_t reallocs_moved;
+#endif
 } GAllocatorHeapMeta;
 
 typedef struct S_GAllocationMeta
@@ -49,20 +74,6 @@ typedef struct S_GAllocationMeta
     size_t alignment;
 } GAllocationMeta;
 
-typedef struct S_AllocationCtx
-{
-    ptr bitmapstart;
-    size_t bitmapsize;
-
-    ptr poolstart;
-    size_t poolchunks;
-
-    size_t chunksize;
-
-    ptr byte;
-    i8 bit;
-} AllocationCtx;
-
 /* lazy hack to make sure the metadata fits no matter the chunk size. We could
  * fix this by just allocating however many chunks we need to fit the
  * metadata... */
@@ -70,337 +81,195 @@ STATIC_ASSERT(
     sizeof(GAllocationMeta) <= LO_POOL_CHUNK_SIZE,
     "GAllocationMeta doesn't fit in the smallest chunk!");
 
-static void allocationctx_advance(size_t bits, AllocationCtx* alloc)
+static _ATTR_ALWAYS_INLINE size_t
+gallocator_chunks_for(size_t size, const GAllocatorPool* pool)
 {
-    while (bits >= 8)
-    {
-        ++alloc->byte;
-        bits -= 8;
-    }
-
-    if (alloc->bit + bits >= 8)
-    {
-        ++alloc->byte;
-        alloc->bit = alloc->bit + (bits - 8);
-    }
-    else
-    {
-        alloc->bit += bits;
-    }
+    return (size + pool->chunksize - 1) / pool->chunksize;
 }
 
-static ptr allocationctx_to_offset(const AllocationCtx* alloc)
+static GAllocatorPool*
+gallocator_pool_for_chunksize(size_t chunksize, GAllocatorHeapMeta* meta)
 {
-    return alloc->byte * 8 * alloc->chunksize + alloc->bit * alloc->chunksize;
-}
-
-static void addr_to_allocationctx_offset(ptr addr, AllocationCtx* alloc)
-{
-    addr -= alloc->poolstart;
-    size_t totalchunks = addr / alloc->chunksize;
-
-    alloc->byte = totalchunks / 8;
-    alloc->bit = totalchunks - alloc->byte * 8;
-}
-
-static bool is_allocationctx_inside_pool(const AllocationCtx* alloc)
-{
-    return allocationctx_to_offset(alloc) <
-           alloc->poolchunks * alloc->chunksize;
-}
-
-static bool check_bit(const AllocationCtx* alloc)
-{
-    u8 byte = ((u8*)alloc->bitmapstart)[alloc->byte];
-    return byte & (1 << alloc->bit);
-}
-
-static size_t gallocator_has_n_contiguous_bits(AllocationCtx alloc, size_t n)
-{
-    size_t foundbits = 0;
-
-    /* These should both be true as this function is called with a valid
-     * starting point. */
-    ASSERT(alloc.bit < 8);
-    ASSERT(is_allocationctx_inside_pool(&alloc));
-
-    while (alloc.byte < alloc.bitmapsize)
+    switch (chunksize)
     {
-        u8 byte = ((u8*)alloc.bitmapstart)[alloc.byte];
-
-        while (is_allocationctx_inside_pool(&alloc))
-        {
-            if ((byte & (1 << alloc.bit)) > 0)
-                goto done;
-
-            ++foundbits;
-            if (foundbits == n)
-                goto done;
-
-            if (alloc.bit == 7)
-            {
-                alloc.bit = 0;
-                break;
-            }
-            ++alloc.bit;
-        }
-        ++alloc.byte;
+    case LO_POOL_CHUNK_SIZE:
+        return &meta->lo;
+    case MID_POOL_CHUNK_SIZE:
+        return &meta->mid;
+    case HI_POOL_CHUNK_SIZE:
+        return &meta->hi;
+    default:
+        return NULL;
     }
-
-done:
-    /* We should find at least 1 bit since again, this function is called with
-     * a valid starting point */
-    ASSERT(foundbits > 0);
-    return foundbits;
 }
 
-static int gallocator_bitmap_set_bits(AllocationCtx alloc, size_t bits)
+/* Returns the index of the first chunk >= 'from' that is used (if 'used' is
+ * true) or free (if 'used' is false), or pool->chunks if there is none. */
+static size_t
+gallocator_find_chunk(size_t from, bool used, GAllocatorPool* pool)
 {
-    /* This function is called with a valid starting point. The following
-     * asserts are there as a sanity check. */
-    if (alloc.bit > 7 || !is_allocationctx_inside_pool(&alloc))
-        return -EINVAL;
-
-    {
-        AllocationCtx tmpalloc = alloc;
-        allocationctx_advance(bits, &tmpalloc);
-        if (!is_allocationctx_inside_pool(&tmpalloc))
-            return -EINVAL;
-    }
+    if (from >= pool->chunks)
+        return pool->chunks;
 
-    /* Mark the metadata chunk */
-    if (alloc.bit == 0)
-    {
-        if (alloc.byte == 0)
-            return 1; // There is no metadata chunk :(
+    size_t w = from / BITWORD_BITS;
+    bitword_t word = used ? pool->bitmap[w] : ~pool->bitmap[w];
+    /* Ignore the bits before 'from'. */
+    word &= BITWORD_ONES << (from % BITWORD_BITS);
 
-        ((u8*)alloc.bitmapstart)[alloc.byte - 1] |= (1 << 7);
-    }
-    else
-    {
-        ((u8*)alloc.bitmapstart)[alloc.byte] |= (1 << (alloc.bit - 1));
-    }
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    ++pool->words_scanned;
+#endif
 
-    // Mark the actual allocation
-    while (alloc.byte < alloc.bitmapsize)
+    while (!word)
     {
-        u8* byte = &((u8*)alloc.bitmapstart)[alloc.byte];
-        while (is_allocationctx_inside_pool(&alloc))
-        {
-            *byte |= (1 << alloc.bit);
-            --bits;
+        if (++w >= pool->bitmap_words)
+            return pool->chunks;
 
-            if (!bits)
-                return 0;
+        word = used ? pool->bitmap[w] : ~pool->bitmap[w];
 
-            if (alloc.bit == 7)
-            {
-                alloc.bit = 0;
-                break;
-            }
-            ++alloc.bit;
-        }
-        ++alloc.byte;
+#if GALLOCATOR_RECORD_STATISTICS == 1
+        ++pool->words_scanned;
+#endif
     }
 
-    ASSERT_NOT_HIT();
+    const size_t idx = w * BITWORD_BITS + __builtin_ctzl(word);
+    return idx < pool->chunks ? idx : pool->chunks;
 }
 
-static int gallocator_bitmap_clear_bits(AllocationCtx alloc, size_t bits)
+static void
+gallocator_mark_chunks(size_t start, size_t n, bool used, GAllocatorPool* pool)
 {
-    /* This function is called with a valid starting point. The following
-     * asserts are there as a sanity check. */
-    if (alloc.bit > 7 || !is_allocationctx_inside_pool(&alloc))
-        return -EINVAL;
-
-    {
-        AllocationCtx tmpalloc = alloc;
-        allocationctx_advance(bits, &tmpalloc);
-        if (!is_allocationctx_inside_pool(&tmpalloc))
-            return -EINVAL;
-    }
-
-    /* Mark the metadata chunk */
-    if (alloc.bit == 0)
-    {
-        if (alloc.byte == 0)
-            return 1; // There is no metadata chunk :(
-
-        ((u8*)alloc.bitmapstart)[alloc.byte - 1] &= ~(1 << 7);
-    }
-    else
+    while (n)
     {
-        ((u8*)alloc.bitmapstart)[alloc.byte] &= ~(1 << (alloc.bit - 1));
-    }
-
-    // Mark the actual allocation
-    while (alloc.byte < alloc.bitmapsize)
-    {
-        u8* byte = &((u8*)alloc.bitmapstart)[alloc.byte];
-        while (is_allocationctx_inside_pool(&alloc))
-        {
-            *byte &= ~(1 << alloc.bit);
-            --bits;
-
-            if (!bits)
-                return 0;
+        const size_t w = start / BITWORD_BITS;
+        const size_t bit = start % BITWORD_BITS;
+        const size_t count =
+            n < BITWORD_BITS - bit ? n : BITWORD_BITS - bit;
+
+        const bitword_t mask =
+            (count == BITWORD_BITS ? BITWORD_ONES
+                                   : (((bitword_t)1 << count) - 1))
+            << bit;
+
+        if (used)
+            pool->bitmap[w] |= mask;
+        else
+            pool->bitmap[w] &= ~mask;
 
-            if (alloc.bit == 7)
-            {
-                alloc.bit = 0;
-                break;
-            }
-            ++alloc.bit;
-        }
-        ++alloc.byte;
+        start += count;
+        n -= count;
     }
-
-    ASSERT_NOT_HIT();
 }
 
-static bool
-gallocator_find_start_aligned(size_t alignment, AllocationCtx* alloc)
+/**
+ * Find 'n' free chunks, starting the search at chunk 'from'. The first chunk
+ * has to be aligned on 'alignment' bytes and the chunk right before it also
+ * has to be free, since that's where the GAllocationMeta goes.
+ *
+ * Returns the index of the first chunk, or -ENOMEM.
+ */
+static ssize_t gallocator_find_free_chunks(
+    size_t from, size_t n, size_t alignment, GAllocatorPool* pool)
 {
-    ptr starting_address = alloc->poolstart + allocationctx_to_offset(alloc);
-
-    /* Find an aligned address */
-    if (starting_address % alignment)
+    /* Pools are aligned on their chunksize, so any alignment <= chunksize is
+     * free. For bigger alignments only every 'step' chunk starting from
+     * 'first' is good. */
+    size_t step = 1;
+    size_t first = 0;
+    if (alignment > pool->chunksize)
     {
-        starting_address = bytes_align_up64(starting_address, alignment);
-        ASSERT((starting_address % alignment) == 0); // sanity check
-
-        addr_to_allocationctx_offset(starting_address, alloc);
+        step = alignment / pool->chunksize;
+        first = (bytes_align_up64(pool->start, alignment) - pool->start) /
+                pool->chunksize;
     }
 
-    bool found = false;
-    while (alloc->byte < alloc->bitmapsize &&
-           is_allocationctx_inside_pool(alloc))
+    size_t pos = from;
+    while (pos < pool->chunks)
     {
-        /* Check if the starting chunk is free */
-        int ok = check_bit(alloc);
-
-        /* Check if the chunk before that is also free (used for metadata) */
-        AllocationCtx tmp = *alloc;
-        if (tmp.bit == 0)
-        {
-            if (tmp.byte == 0)
-                goto next;
+        /* Find the next run of free chunks: [runstart, runend) */
+        const size_t runstart = gallocator_find_chunk(pos, false, pool);
+        if (runstart >= pool->chunks)
+            break;
 
-            tmp.bit = 7;
-            --tmp.byte;
-        }
-        else
-        {
-            --tmp.bit;
-        }
+        const size_t runend = gallocator_find_chunk(runstart, true, pool);
 
-        ok += check_bit(&tmp);
+        /* runstart is reserved for the metadata. */
+        size_t idx = runstart + 1;
+        if (idx < first)
+            idx = first;
+        else if ((idx - first) % step)
+            idx += step - (idx - first) % step;
 
-        if (ok == 0)
-        {
-            found = true;
-            break;
-        }
+        if (idx + n <= runend)
+            return idx;
 
-    next:
-        allocationctx_advance(
-            ceil((double)alignment / alloc->chunksize), alloc);
+        pos = runend;
     }
 
-    return found;
+    return -ENOMEM;
 }
 
 static void* gallocator_do_alloc_aligned(
-    size_t size, size_t alignment, const GAllocatorHeapMeta* meta)
+    size_t size, size_t alignment, GAllocatorHeapMeta* meta)
 {
     /** Here is a rundown of how this allocator works:
      *  1: We find the optimum chunk size for the given size.
      *
-     *  2: We find a suitable (aligned) starting chunk. This starting chunk will
-     * also ensure sizeof(GAllocationMeta) size right before it's starting
-     * location.
+     *  2: We walk the pool's bitmap a word at a time, starting from where the
+     * last allocation ended (next-fit), looking for a run of free chunks that
+     * has an aligned chunk that can fit the allocation, with one more free
+     * chunk right before it for the GAllocationMeta. If we hit the end of the
+     * pool, we wrap around once.
      *
-     *  3: We check to see if the above starting chunk actually has our required
-     * number of chunks available. If not go back to step 2. *
+     *  3: We mark the bitmap corresponding to our chunksize.
      *
-     *  4: We mark the bitmap corresponding to our chunksize.
-     *
-     *  5: We put an GAllocationMeta struct right before this newly made
+     *  4: We put an GAllocationMeta struct right before this newly made
      * allocation.
      */
 
     // 1:
-    AllocationCtx alloc;
-    memset(&alloc, 0, sizeof(AllocationCtx));
-
+    GAllocatorPool* pool;
     if (size >= HI_POOL_CHUNK_SIZE)
-    {
-        alloc.chunksize = HI_POOL_CHUNK_SIZE;
-        alloc.poolstart = meta->hi_pool;
-        alloc.poolchunks = meta->hi_poolchunks;
-        alloc.bitmapstart = meta->hi_bitmap;
-        alloc.bitmapsize = meta->hi_bitmap_size;
-    }
+        pool = &meta->hi;
     else if (size >= MID_POOL_CHUNK_SIZE)
-    {
-        alloc.chunksize = MID_POOL_CHUNK_SIZE;
-        alloc.poolstart = meta->mid_pool;
-        alloc.poolchunks = meta->mid_poolchunks;
-        alloc.bitmapstart = meta->mid_bitmap;
-        alloc.bitmapsize = meta->mid_bitmap_size;
-    }
+        pool = &meta->mid;
     else
-    {
-        alloc.chunksize = LO_POOL_CHUNK_SIZE;
-        alloc.poolstart = meta->lo_pool;
-        alloc.poolchunks = meta->lo_poolchunks;
-        alloc.bitmapstart = meta->lo_bitmap;
-        alloc.bitmapsize = meta->lo_bitmap_size;
-    }
+        pool = &meta->lo;
 
-    size_t chunksneeded = ceil((double)size / alloc.chunksize);
+    const size_t chunksneeded = gallocator_chunks_for(size, pool);
 
     // 2:
-    bool ok = false;
-    while (gallocator_find_start_aligned(alignment, &alloc))
-    {
-        if (chunksneeded == 1)
-        {
-            ok = true;
-            break;
-        }
-
-        // 3:
-        size_t chunksfound =
-            gallocator_has_n_contiguous_bits(alloc, chunksneeded);
-
-        if (chunksfound == chunksneeded)
-        {
-            ok = true;
-            break;
-        }
-
-        /* If those weren't enough completely skip them. */
-        allocationctx_advance(chunksfound, &alloc);
-    }
+    ssize_t idx =
+        gallocator_find_free_chunks(pool->hint, chunksneeded, alignment, pool);
+    if (idx < 0 && pool->hint)
+        idx = gallocator_find_free_chunks(0, chunksneeded, alignment, pool);
 
     /* MAYBE TODO: We could go back to step 1 and use smaller (or even bigger)
      * chunk-sizes, to try to honor this request. */
-    if (!ok)
+    if (idx < 0)
+    {
+#if GALLOCATOR_RECORD_STATISTICS == 1
+        ++pool->failed_allocations;
+#endif
         return NULL;
+    }
 
-    // 4:
-    if (gallocator_bitmap_set_bits(alloc, chunksneeded) != 0)
-        return NULL;
+    // 3:
+    gallocator_mark_chunks(idx - 1, chunksneeded + 1, true, pool);
+    pool->hint = idx + chunksneeded;
+
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    ++pool->allocations;
+#endif
 
-    // 5:
-    void* addr = (void*)(alloc.poolstart + allocationctx_to_offset(&alloc));
+    // 4:
+    void* addr = (void*)(pool->start + idx * pool->chunksize);
 
     GAllocationMeta* allocmeta =
         (GAllocationMeta*)(addr - sizeof(GAllocationMeta));
     allocmeta->signature = ALLOCATION_SIGNATURE;
     allocmeta->size = size;
-    allocmeta->chunksize = alloc.chunksize;
+    allocmeta->chunksize = pool->chunksize;
     allocmeta->alignment = alignment;
 
     return addr;
@@ -428,86 +297,82 @@ int gallocator_init_heap(const Heap* heap)
 
     /* This is just a split that kind-of makes sense, but there is room for
      * improvement, especially with larger heaps. */
-    size_t lo_pool_size = heapsize / 4;
-    size_t mid_pool_size = heapsize / 4;
-    size_t hi_pool_size = heapsize / 2;
+    size_t lo_poolchunks = heapsize / 4 / LO_POOL_CHUNK_SIZE;
+    size_t mid_poolchunks = heapsize / 4 / MID_POOL_CHUNK_SIZE;
+    size_t hi_poolchunks = heapsize / 2 / HI_POOL_CHUNK_SIZE;
 
-    size_t lo_poolchunks = lo_pool_size / LO_POOL_CHUNK_SIZE;
-    size_t mid_poolchunks = mid_pool_size / MID_POOL_CHUNK_SIZE;
-    size_t hi_poolchunks = hi_pool_size / HI_POOL_CHUNK_SIZE;
+    /* Bitmaps are sized in whole words. */
+    const size_t lo_bitmap_words =
+        (lo_poolchunks + BITWORD_BITS - 1) / BITWORD_BITS;
+    const size_t mid_bitmap_words =
+        (mid_poolchunks + BITWORD_BITS - 1) / BITWORD_BITS;
+    const size_t hi_bitmap_words =
+        (hi_poolchunks + BITWORD_BITS - 1) / BITWORD_BITS;
 
-    size_t lo_bitmap_size = ceil(lo_poolchunks / 8.0);
-    size_t mid_bitmap_size = ceil(mid_poolchunks / 8.0);
-    size_t hi_bitmap_size = ceil(hi_poolchunks / 8.0);
+    heapsize -= (lo_bitmap_words + mid_bitmap_words + hi_bitmap_words) *
+                sizeof(bitword_t);
 
-    heapsize -= lo_bitmap_size + mid_bitmap_size + hi_bitmap_size;
-
-    lo_pool_size = heapsize / 4;
-    mid_pool_size = heapsize / 4;
-    hi_pool_size = heapsize / 2;
-
-    lo_poolchunks = lo_pool_size / LO_POOL_CHUNK_SIZE;
-    mid_poolchunks = mid_pool_size / MID_POOL_CHUNK_SIZE;
-    hi_poolchunks = hi_pool_size / HI_POOL_CHUNK_SIZE;
+    lo_poolchunks = heapsize / 4 / LO_POOL_CHUNK_SIZE;
+    mid_poolchunks = heapsize / 4 / MID_POOL_CHUNK_SIZE;
+    hi_poolchunks = heapsize / 2 / HI_POOL_CHUNK_SIZE;
 
     GAllocatorHeapMeta* meta = (GAllocatorHeapMeta*)heap->vaddr;
+    memset(meta, 0, sizeof(GAllocatorHeapMeta));
     meta->signature = HEAP_SIGNATURE;
 
-    meta->lo_poolchunks = lo_poolchunks;
-    meta->mid_poolchunks = mid_poolchunks;
-    meta->hi_poolchunks = hi_poolchunks;
+    meta->lo.chunksize = LO_POOL_CHUNK_SIZE;
+    meta->mid.chunksize = MID_POOL_CHUNK_SIZE;
+    meta->hi.chunksize = HI_POOL_CHUNK_SIZE;
+
+    meta->lo.chunks = lo_poolchunks;
+    meta->mid.chunks = mid_poolchunks;
+    meta->hi.chunks = hi_poolchunks;
 
-    meta->lo_bitmap_size = lo_bitmap_size;
-    meta->mid_bitmap_size = mid_bitmap_size;
-    meta->hi_bitmap_size = hi_bitmap_size;
+    meta->lo.bitmap_words = lo_bitmap_words;
+    meta->mid.bitmap_words = mid_bitmap_words;
+    meta->hi.bitmap_words = hi_bitmap_words;
 
-    const ptr bitmap_heap_start = heap->vaddr + metasize;
-    meta->lo_bitmap = bitmap_heap_start;
-    meta->mid_bitmap = bitmap_heap_start + lo_bitmap_size;
-    meta->hi_bitmap = bitmap_heap_start + lo_bitmap_size + mid_bitmap_size;
+    /* metasize is aligned on HI_POOL_CHUNK_SIZE, so the bitmaps are word
+     * aligned. */
+    meta->lo.bitmap = (bitword_t*)(heap->vaddr + metasize);
+    meta->mid.bitmap = meta->lo.bitmap + lo_bitmap_words;
+    meta->hi.bitmap = meta->mid.bitmap + mid_bitmap_words;
 
-    meta->hi_pool = meta->hi_bitmap + meta->hi_bitmap_size;
-    meta->mid_pool = meta->hi_pool + meta->hi_poolchunks * HI_POOL_CHUNK_SIZE;
-    meta->lo_pool = meta->mid_pool + meta->mid_poolchunks * MID_POOL_CHUNK_SIZE;
+    meta->hi.start = (ptr)(meta->hi.bitmap + hi_bitmap_words);
+    meta->mid.start = meta->hi.start + meta->hi.chunks * HI_POOL_CHUNK_SIZE;
+    meta->lo.start = meta->mid.start + meta->mid.chunks * MID_POOL_CHUNK_SIZE;
 
     /** Make sure all pools are aligned on their respective chunk sizes. This
      * helps when allocating aligned addresses. Also it's safe to shrink the
-     * pools, and leave the bitmaps the same size, because (I think) we check
-     * for both of these bounds everytime we walk a bitmap :)
+     * pools, and leave the bitmaps the same size, because searches never go
+     * past GAllocatorPool::chunks :)
      */
     {
-        ptr tmp_hi_pool = bytes_align_up64(meta->hi_pool, HI_POOL_CHUNK_SIZE);
+        ptr tmp_hi_pool = bytes_align_up64(meta->hi.start, HI_POOL_CHUNK_SIZE);
         ptr tmp_mid_pool =
-            bytes_align_up64(meta->mid_pool, MID_POOL_CHUNK_SIZE);
-        ptr tmp_lo_pool = bytes_align_up64(meta->lo_pool, LO_POOL_CHUNK_SIZE);
+            bytes_align_up64(meta->mid.start, MID_POOL_CHUNK_SIZE);
+        ptr tmp_lo_pool = bytes_align_up64(meta->lo.start, LO_POOL_CHUNK_SIZE);
 
         /* We subtract one cunk at most */
-        meta->hi_poolchunks -= (tmp_hi_pool != meta->hi_pool);
-        meta->mid_poolchunks -= (tmp_mid_pool != meta->mid_pool);
-        meta->lo_poolchunks -= (tmp_lo_pool != meta->lo_pool);
+        meta->hi.chunks -= (tmp_hi_pool != meta->hi.start);
+        meta->mid.chunks -= (tmp_mid_pool != meta->mid.start);
+        meta->lo.chunks -= (tmp_lo_pool != meta->lo.start);
 
-        meta->hi_pool = tmp_hi_pool;
-        meta->mid_pool = tmp_mid_pool;
-        meta->lo_pool = tmp_lo_pool;
+        meta->hi.start = tmp_hi_pool;
+        meta->mid.start = tmp_mid_pool;
+        meta->lo.start = tmp_lo_pool;
     }
 
     /* Early-development-trauma sanity check */
-    ASSERT(meta->lo_pool % LO_POOL_CHUNK_SIZE == 0);
-    ASSERT(meta->mid_pool % MID_POOL_CHUNK_SIZE == 0);
-    ASSERT(meta->hi_pool % HI_POOL_CHUNK_SIZE == 0);
+    ASSERT(meta->lo.start % LO_POOL_CHUNK_SIZE == 0);
+    ASSERT(meta->mid.start % MID_POOL_CHUNK_SIZE == 0);
+    ASSERT(meta->hi.start % HI_POOL_CHUNK_SIZE == 0);
 
+    KLOGF(DEBUG, "low chunks (%d): %zu", LO_POOL_CHUNK_SIZE, meta->lo.chunks);
     KLOGF(
-        DEBUG, "low chunks (%d): %zu", LO_POOL_CHUNK_SIZE, meta->lo_poolchunks);
+        DEBUG, "mid chunks (%d): %zu", MID_POOL_CHUNK_SIZE, meta->mid.chunks);
     KLOGF(
-        DEBUG,
-        "mid chunks (%d): %zu",
-        MID_POOL_CHUNK_SIZE,
-        meta->mid_poolchunks);
-    KLOGF(
-        DEBUG,
-        "high chunks (%d): %zu",
-        HI_POOL_CHUNK_SIZE,
-        meta->hi_poolchunks);
+        DEBUG, "high chunks (%d): %zu", HI_POOL_CHUNK_SIZE, meta->hi.chunks);
 
     return 0;
 }
@@ -521,6 +386,72 @@ void* gallocator_alloc_aligned(size_t size, size_t alignment, const Heap* heap)
     return gallocator_do_alloc_aligned(size, alignment, meta);
 }
 
+void* gallocator_realloc(void* addr, size_t newsize, const Heap* heap)
+{
+    GAllocatorHeapMeta* meta = (GAllocatorHeapMeta*)heap->vaddr;
+    if (meta->signature != HEAP_SIGNATURE)
+        return NULL;
+
+    GAllocationMeta* allocmeta = addr - sizeof(GAllocationMeta);
+    if (allocmeta->signature != ALLOCATION_SIGNATURE)
+        return NULL;
+
+    GAllocatorPool* pool =
+        gallocator_pool_for_chunksize(allocmeta->chunksize, meta);
+    ASSERT(pool);
+
+    const size_t oldsize = allocmeta->size;
+    const size_t idx = ((ptr)addr - pool->start) / pool->chunksize;
+    const size_t oldchunks = gallocator_chunks_for(oldsize, pool);
+    const size_t newchunks = gallocator_chunks_for(newsize, pool);
+
+    if (newchunks <= oldchunks)
+    {
+        /* Shrinking (or staying the same), give back the tail chunks. Freed
+         * memory is kept zeroed, just like gallocator_free() does. */
+        if (newchunks < oldchunks)
+            gallocator_mark_chunks(
+                idx + newchunks, oldchunks - newchunks, false, pool);
+
+        if (newsize < oldsize)
+            memset(addr + newsize, 0, oldsize - newsize);
+
+        allocmeta->size = newsize;
+#if GALLOCATOR_RECORD_STATISTICS == 1
+        ++meta->reallocs_in_place;
+#endif
+        return addr;
+    }
+
+    /* Growing, see if the chunks right after us are free. */
+    if (idx + newchunks <= pool->chunks &&
+        gallocator_find_chunk(idx + oldchunks, true, pool) >= idx + newchunks)
+    {
+        gallocator_mark_chunks(
+            idx + oldchunks, newchunks - oldchunks, true, pool);
+
+        allocmeta->size = newsize;
+#if GALLOCATOR_RECORD_STATISTICS == 1
+        ++meta->reallocs_in_place;
+#endif
+        return addr;
+    }
+
+    /* No luck, move it. */
+    void* newaddr =
+        gallocator_do_alloc_aligned(newsize, allocmeta->alignment, meta);
+    if (!newaddr)
+        return NULL;
+
+    memcpy(newaddr, addr, oldsize);
+    gallocator_free(addr, heap);
+
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    ++meta->reallocs_moved;
+#endif
+    return newaddr;
+}
+
 ssize_t gallocator_allocation_size(void* addr, const Heap* heap)
 {
     GAllocatorHeapMeta* meta = (GAllocatorHeapMeta*)heap->vaddr;
@@ -567,44 +498,123 @@ void gallocator_free(void* addr, const Heap* heap)
             "gallocator: Tried to kfree an invalid address (maybe free twice) 0x%p",
             addr);
 
-    AllocationCtx alloc;
-    alloc.chunksize = allocmeta->chunksize;
+    GAllocatorPool* pool =
+        gallocator_pool_for_chunksize(allocmeta->chunksize, meta);
+    ASSERT(pool);
+
+    const size_t idx = ((ptr)addr - pool->start) / pool->chunksize;
+    const size_t chunks = gallocator_chunks_for(allocmeta->size, pool);
+
+    /* Also frees the metadata chunk. */
+    gallocator_mark_chunks(idx - 1, chunks + 1, false, pool);
+
+    memset(
+        addr - sizeof(GAllocationMeta),
+        0,
+        allocmeta->size + sizeof(GAllocationMeta));
+}
+
+void gallocator_dump_statistics(const Heap* heap)
+{
+#if GALLOCATOR_RECORD_STATISTICS == 1
+    GAllocatorHeapMeta* meta = (GAllocatorHeapMeta*)heap->vaddr;
+    if (meta->signature != HEAP_SIGNATURE)
+        return;
 
-    switch (allocmeta->chunksize)
+    const GAllocatorPool* pools[] = {&meta->lo, &meta->mid, &meta->hi};
+    for (size_t i = 0; i < 3; ++i)
     {
-    case LO_POOL_CHUNK_SIZE:
-        alloc.bitmapstart = meta->lo_bitmap;
-        alloc.bitmapsize = meta->lo_bitmap_size;
-        alloc.poolstart = meta->lo_pool;
-        alloc.poolchunks = meta->lo_poolchunks;
-        break;
+        const GAllocatorPool* pool = pools[i];
+        KLOGF(
+            INFO,
+            "-- Pool %zu: %zu allocations, %zu failed, %zu words scanned (%zu per allocation)",
+            pool->chunksize,
+            pool->allocations,
+            pool->failed_allocations,
+            pool->words_scanned,
+            pool->allocations ? pool->words_scanned / pool->allocations : 0);
+    }
 
-    case MID_POOL_CHUNK_SIZE:
-        alloc.bitmapstart = meta->mid_bitmap;
-        alloc.bitmapsize = meta->mid_bitmap_size;
-        alloc.poolstart = meta->mid_pool;
-        alloc.poolchunks = meta->mid_poolchunks;
-        break;
+    KLOGF(
+        INFO,
+        "-- Reallocations: %zu in place, %zu moved",
+        meta->reallocs_in_place,
+        meta->reallocs_moved);
+#else
+    (void)heap;
+#endif
+}
 
-    case HI_POOL_CHUNK_SIZE:
-        alloc.bitmapstart = meta->hi_bitmap;
-        alloc.bitmapsize = meta->hi_bitmap_size;
-        alloc.poolstart = meta->hi_pool;
-        alloc.poolchunks = meta->hi_poolchunks;
-        break;
+/* Count the used chunks of 'pool' and find it's longest run of free chunks. */
+static void gallocator_pool_occupancy(
+    const GAllocatorPool* pool, KMallocPoolStatistics* stats)
+{
+    size_t used = 0;
+    size_t run = 0;
+    size_t largest_run = 0;
 
-    default:
-        ASSERT_NOT_HIT();
+    for (size_t chunk = 0; chunk < pool->chunks;)
+    {
+        const bitword_t word = pool->bitmap[chunk / BITWORD_BITS];
+        const size_t bits = pool->chunks - chunk < BITWORD_BITS
+                                ? pool->chunks - chunk
+                                : BITWORD_BITS;
+
+        /* Whole words are the common case. */
+        if (bits == BITWORD_BITS && (word == 0 || word == BITWORD_ONES))
+        {
+            if (word)
+            {
+                used += BITWORD_BITS;
+                run = 0;
+            }
+            else
+            {
+                run += BITWORD_BITS;
+            }
+        }
+        else
+        {
+            for (size_t bit = 0; bit < bits; ++bit)
+            {
+                if (word & ((bitword_t)1 << bit))
+                {
+                    ++used;
+                    run = 0;
+                }
+                else
+                {
+                    ++run;
+                    if (run > largest_run)
+                        largest_run = run;
+                }
+            }
+        }
+
+        if (run > largest_run)
+            largest_run = run;
+
+        chunk += bits;
     }
 
-    size_t chunks = ceil((double)allocmeta->size / allocmeta->chunksize);
+    stats->chunksize = pool->chunksize;
+    stats->chunks = pool->chunks;
+    stats->used_chunks = used;
+    stats->largest_free_run = largest_run;
+}
+
+size_t gallocator_pool_statistics(
+    const Heap* heap, KMallocPoolStatistics* pools, size_t n)
+{
+    GAllocatorHeapMeta* meta = (GAllocatorHeapMeta*)heap->vaddr;
+    if (meta->signature != HEAP_SIGNATURE)
+        return 0;
 
-    addr_to_allocationctx_offset((ptr)addr, &alloc);
+    const GAllocatorPool* heap_pools[] = {&meta->lo, &meta->mid, &meta->hi};
+    const size_t count = sizeof(heap_pools) / sizeof(heap_pools[0]);
 
-    ASSERT(gallocator_bitmap_clear_bits(alloc, chunks) == 0);
+    for (size_t i = 0; i < count && i < n; ++i)
+        gallocator_pool_occupancy(heap_pools[i], &pools[i]);
 
-    memset(
-        addr - sizeof(GAllocationMeta),
-        0,
-        allocmeta->size + sizeof(GAllocationMeta));
+    return count;
 }
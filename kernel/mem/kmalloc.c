@@ -6,12 +6,16 @@
 #include <dxgmx/assert.h>
 #include <dxgmx/attrs.h>
 #include <dxgmx/errno.h>
+#include <dxgmx/kboot.h>
 #include <dxgmx/kimg.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
+#include <dxgmx/ksyms.h>
 #include <dxgmx/math.h>
 #include <dxgmx/mem/gallocator.h>
 #include <dxgmx/mem/pagesize.h>
+#include <dxgmx/mem/shrinker.h>
+#include <dxgmx/mem/slab.h>
 #include <dxgmx/string.h>
 #include <dxgmx/todo.h>
 #include <dxgmx/utils/bitwise.h>
@@ -22,23 +26,207 @@
 /* KLOG informations about each kmalloc/free call. Very verbose! */
 #define KMALLOC_VERBOSE 0
 #define KMALLOC_RECORD_STATISTICS 1
+/* Record every kmalloc/krealloc/kfree against the address it was called from,
+ * see kmalloc_dump_profile(). */
+#define KMALLOC_PROFILE 0
 #define KMALLOC_MAX_HEAPS 4
+/* How many objects shrinkers are asked to free when an allocation fails. */
+#define KMALLOC_SHRINK_BATCH 64
+
+#if KMALLOC_PROFILE == 1
+#define KMALLOC_CALLER() ((ptr)__builtin_return_address(0))
+#else
+#define KMALLOC_CALLER() ((ptr)0)
+#endif
+
+/* All the drivers we know about. For now they are all baked into the kernel,
+ * see kmalloc_init(). */
+static const KMallocDriver g_drivers[] = {
+    {.name = "gallocator",
+     .priority = 1,
+     .default_alignment = _Alignof(max_align_t),
+     .init = gallocator_init,
+     .init_heap = gallocator_init_heap,
+     .alloc_aligned = gallocator_alloc_aligned,
+     .realloc = gallocator_realloc,
+     .allocation_size = gallocator_allocation_size,
+     .allocation_alignment = gallocator_allocation_alignment,
+     .is_valid_allocation = gallocator_is_valid_allocation,
+     .free = gallocator_free,
+     .pool_statistics = gallocator_pool_statistics,
+     .dump_statistics = gallocator_dump_statistics},
+    {.name = "slab",
+     .priority = 0,
+     .default_alignment = _Alignof(max_align_t),
+     .init = slab_init,
+     .init_heap = slab_init_heap,
+     .alloc_aligned = slab_alloc_aligned,
+     .realloc = slab_realloc,
+     .allocation_size = slab_allocation_size,
+     .allocation_alignment = slab_allocation_alignment,
+     .is_valid_allocation = slab_is_valid_allocation,
+     .free = slab_free}};
+#define KMALLOC_DRIVER_COUNT (sizeof(g_drivers) / sizeof(g_drivers[0]))
 
 /* The kmalloc driver. */
 static KMallocDriver g_driver;
 
+/* Caches that have been used at least once, for kmalloc_dump_statistics(). */
+static KMallocCache* g_caches;
+
+static size_t kmalloc_cache_shrinker_count();
+static size_t kmalloc_cache_shrinker_scan(size_t n);
+
+/* Caches refill on their own, so this is as cheap as it gets. */
+static Shrinker g_kmalloc_cache_shrinker = {
+    .name = "kmalloc_caches",
+    .kind = SHRINK_KMALLOC,
+    .cost = 0,
+    .count = kmalloc_cache_shrinker_count,
+    .scan = kmalloc_cache_shrinker_scan};
+
 static Heap g_heaps[KMALLOC_MAX_HEAPS];
 static size_t g_heap_count;
 
 static Heap* g_active_heap;
 
 #if KMALLOC_RECORD_STATISTICS == 1
-static KMallocStatistics g_statistics;
+/* One for each heap in g_heaps. */
+static KMallocStatistics g_statistics[KMALLOC_MAX_HEAPS];
 #endif
 
+#if KMALLOC_PROFILE == 1
+/* How many different callsites are recorded, as a power of two. */
+#define KMALLOC_PROFILE_SITES_LOG 9
+#define KMALLOC_PROFILE_SITES (1 << KMALLOC_PROFILE_SITES_LOG)
+/* How many live allocations can be tracked back to their callsite, as a power
+ * of two. */
+#define KMALLOC_PROFILE_LIVE_LOG 12
+#define KMALLOC_PROFILE_LIVE (1 << KMALLOC_PROFILE_LIVE_LOG)
+
+/* A live allocation, and the callsite it came from. */
+typedef struct S_KMallocProfileLive
+{
+    ptr addr;
+    size_t size;
+    KMallocProfileSite* site;
+} KMallocProfileLive;
+
+/* Both tables are open addressed, with linear probing. */
+static KMallocProfileSite g_profile_sites[KMALLOC_PROFILE_SITES];
+static size_t g_profile_site_count;
+static KMallocProfileLive g_profile_live[KMALLOC_PROFILE_LIVE];
+static size_t g_profile_live_count;
+/* Callsites and allocations that didn't fit in the tables. */
+static size_t g_profile_dropped;
+
+/* Hash 'key' into a table of 2^'log' entries. The top bits are the well mixed
+ * ones, the bottom bits keep the alignment of the key. */
+static size_t kmalloc_profile_hash(ptr key, size_t log)
+{
+    return ((u32)key * 2654435761u) >> (32 - log);
+}
+
+/* Find or add the entry for 'callsite'. Returns NULL if the table is full. */
+static KMallocProfileSite* kmalloc_profile_site(ptr callsite)
+{
+    size_t i = kmalloc_profile_hash(callsite, KMALLOC_PROFILE_SITES_LOG);
+    for (size_t probes = 0; probes < KMALLOC_PROFILE_SITES; ++probes)
+    {
+        KMallocProfileSite* site = &g_profile_sites[i];
+        if (site->callsite == callsite)
+            return site;
+
+        if (!site->callsite)
+        {
+            site->callsite = callsite;
+            ++g_profile_site_count;
+            return site;
+        }
+
+        i = (i + 1) & (KMALLOC_PROFILE_SITES - 1);
+    }
+
+    ++g_profile_dropped;
+    return NULL;
+}
+
+static void kmalloc_profile_alloc(ptr addr, size_t size, ptr callsite)
+{
+    KMallocProfileSite* site = kmalloc_profile_site(callsite);
+    if (!site)
+        return;
+
+    ++site->allocations;
+    site->bytes += size;
+
+    /* Keep some room, so that probing stays short. */
+    if (g_profile_live_count >= KMALLOC_PROFILE_LIVE / 4 * 3)
+    {
+        ++g_profile_dropped;
+        return;
+    }
+
+    size_t i = kmalloc_profile_hash(addr, KMALLOC_PROFILE_LIVE_LOG);
+    while (g_profile_live[i].addr)
+        i = (i + 1) & (KMALLOC_PROFILE_LIVE - 1);
+
+    g_profile_live[i] =
+        (KMallocProfileLive){.addr = addr, .size = size, .site = site};
+    ++g_profile_live_count;
+    site->live_bytes += size;
+}
+
+/* Remove the live allocation at 'i', shifting back the entries that probed
+ * past it. */
+static void kmalloc_profile_remove_live(size_t i)
+{
+    const size_t mask = KMALLOC_PROFILE_LIVE - 1;
+
+    for (size_t j = (i + 1) & mask; g_profile_live[j].addr;
+         j = (j + 1) & mask)
+    {
+        const size_t home = kmalloc_profile_hash(
+            g_profile_live[j].addr, KMALLOC_PROFILE_LIVE_LOG);
+
+        /* The entry at 'j' can stay if it's home is cyclically in (i, j]. */
+        const bool stays =
+            i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays)
+            continue;
+
+        g_profile_live[i] = g_profile_live[j];
+        i = j;
+    }
+
+    g_profile_live[i].addr = 0;
+    --g_profile_live_count;
+}
+
+static void kmalloc_profile_free(ptr addr, ptr callsite)
+{
+    KMallocProfileSite* site = kmalloc_profile_site(callsite);
+    if (site)
+        ++site->frees;
+
+    size_t i = kmalloc_profile_hash(addr, KMALLOC_PROFILE_LIVE_LOG);
+    for (; g_profile_live[i].addr; i = (i + 1) & (KMALLOC_PROFILE_LIVE - 1))
+    {
+        if (g_profile_live[i].addr != addr)
+            continue;
+
+        /* Live bytes are charged to whoever allocated. */
+        g_profile_live[i].site->live_bytes -= g_profile_live[i].size;
+        kmalloc_profile_remove_live(i);
+        return;
+    }
+}
+#endif // KMALLOC_PROFILE == 1
+
 static int kmalloc_check_driver(const KMallocDriver* drv)
 {
-    /* drv->realloc is optional, because I'm a dipshit. */
+    /* drv->realloc is optional, because I'm a dipshit. drv->dump_statistics
+     * is also optional. */
     bool valid =
         (drv->name && drv->init && drv->init_heap && drv->alloc_aligned &&
          drv->allocation_size && drv->allocation_alignment &&
@@ -52,15 +240,32 @@ static int kmalloc_check_driver(const KMallocDriver* drv)
     return 0;
 }
 
-/* kmalloc_aligned() that specifically takes in a heap. */
-static void*
-kmalloc_aligned_with_heap(size_t size, size_t alignment, Heap* heap)
+/* kmalloc_aligned() that specifically takes in a heap. 'caller' is where the
+ * allocation is recorded as coming from, see KMALLOC_PROFILE. */
+static void* kmalloc_aligned_with_heap(
+    size_t size, size_t alignment, Heap* heap, ptr caller)
 {
     void* addr = g_driver.alloc_aligned(size, alignment, heap);
+    if (!addr && shrinker_run(SHRINK_KMALLOC, KMALLOC_SHRINK_BATCH))
+        addr = g_driver.alloc_aligned(size, alignment, heap);
+
+#if KMALLOC_PROFILE == 1
+    if (addr)
+        kmalloc_profile_alloc(
+            (ptr)addr, g_driver.allocation_size(addr, heap), caller);
+#else
+    (void)caller;
+#endif
 
 #if KMALLOC_RECORD_STATISTICS == 1
-    ++g_statistics.total_allocations;
-    g_statistics.total_allocated += size;
+    /* We record what the driver says the allocation size is, since that's
+     * also what we record when freeing. Drivers are free to round up. */
+    if (addr)
+    {
+        KMallocStatistics* stats = &g_statistics[heap - g_heaps];
+        ++stats->total_allocations;
+        stats->total_allocated += g_driver.allocation_size(addr, heap);
+    }
 #endif
 
 #if KMALLOC_VERBOSE == 1
@@ -87,12 +292,19 @@ kmalloc_aligned_with_heap(size_t size, size_t alignment, Heap* heap)
 }
 
 /* kfree() that specifically takes in a heap. */
-static void kfree_with_heap(void* addr, Heap* heap)
+static void kfree_with_heap(void* addr, Heap* heap, ptr caller)
 {
+#if KMALLOC_PROFILE == 1
+    kmalloc_profile_free((ptr)addr, caller);
+#else
+    (void)caller;
+#endif
+
 #if KMALLOC_RECORD_STATISTICS == 1
     ssize_t size = g_driver.allocation_size(addr, heap);
-    ++g_statistics.total_frees;
-    g_statistics.total_freed += size;
+    KMallocStatistics* stats = &g_statistics[heap - g_heaps];
+    ++stats->total_frees;
+    stats->total_freed += size;
 #endif
 
     g_driver.free(addr, heap);
@@ -123,34 +335,59 @@ int kmalloc_use_heap(size_t id)
     return 0;
 }
 
-bool kmalloc_owns_va(ptr va)
+/* Find the heap 'va' belongs to. Returns NULL if it's not inside any heap. */
+static Heap* kmalloc_heap_for_va(ptr va)
 {
+    /* The active heap is the most likely owner. */
+    if (LIKELY(g_active_heap && heap_is_addr_inside(va, g_active_heap)))
+        return g_active_heap;
+
     for (size_t i = 0; i < g_heap_count; ++i)
     {
         if (heap_is_addr_inside(va, &g_heaps[i]))
-            return true;
+            return &g_heaps[i];
     }
 
-    return false;
+    return NULL;
+}
+
+bool kmalloc_owns_va(ptr va)
+{
+    return kmalloc_heap_for_va(va) != NULL;
+}
+
+/* Pick a driver. The highest priority one is used, unless the command line
+ * says otherwise with 'kmalloc=<driver name>'. */
+static _INIT const KMallocDriver* kmalloc_pick_driver()
+{
+    char name[16];
+    if (kboot_cmdline_get("kmalloc", name, sizeof(name)) >= 0)
+    {
+        for (size_t i = 0; i < KMALLOC_DRIVER_COUNT; ++i)
+        {
+            if (strcmp(g_drivers[i].name, name) == 0)
+                return &g_drivers[i];
+        }
+
+        KLOGF(WARN, "Unknown driver \"%s\", ignoring.", name);
+    }
+
+    const KMallocDriver* best = &g_drivers[0];
+    for (size_t i = 1; i < KMALLOC_DRIVER_COUNT; ++i)
+    {
+        if (g_drivers[i].priority > best->priority)
+            best = &g_drivers[i];
+    }
+
+    return best;
 }
 
 _INIT int kmalloc_init()
 {
-    /* For now the gallocator is the only one we have... Optimistically we would
-     * build allocators as modules, but right now we only have a single 'level'
-     * of modules that gets initialized long after kmalloc came online. */
-    g_driver = (KMallocDriver){
-        .name = "gallocator",
-        .priority = 1,
-        .default_alignment = _Alignof(max_align_t),
-        .init = gallocator_init,
-        .init_heap = gallocator_init_heap,
-        .alloc_aligned = gallocator_alloc_aligned,
-        .realloc = NULL, /* Let krealloc do it the 'dumb' way. */
-        .allocation_size = gallocator_allocation_size,
-        .allocation_alignment = gallocator_allocation_alignment,
-        .is_valid_allocation = gallocator_is_valid_allocation,
-        .free = gallocator_free};
+    /* Optimistically we would build allocators as modules, but right now we
+     * only have a single 'level' of modules that gets initialized long after
+     * kmalloc came online, so they are baked in and picked at boot. */
+    g_driver = *kmalloc_pick_driver();
 
     int st = kmalloc_check_driver(&g_driver);
     if (st < 0)
@@ -161,25 +398,13 @@ _INIT int kmalloc_init()
     if (st < 0)
         return st;
 
-    return 0;
-}
-
-void* kmalloc(size_t size)
-{
-    return kmalloc_aligned(size, g_driver.default_alignment);
-}
-
-void* kcalloc(size_t size)
-{
-    void* addr = kmalloc(size);
-    if (addr)
-        memset(addr, 0, size);
-
-    return addr;
+    KLOGF(INFO, "Using driver \"%s\".", g_driver.name);
+    return shrinker_register(&g_kmalloc_cache_shrinker);
 }
 
 /* Small note: all kmalloc functions basically boil down to this one. */
-void* kmalloc_aligned(size_t size, size_t alignment)
+static void*
+kmalloc_checked(size_t size, size_t alignment, Heap* heap, ptr caller)
 {
     if (!size)
         return NULL;
@@ -187,7 +412,7 @@ void* kmalloc_aligned(size_t size, size_t alignment)
     if (!bw_is_power_of_two(alignment))
         panic("kmalloc_aligned: alignment is not a power of two!");
 
-    void* addr = kmalloc_aligned_with_heap(size, alignment, g_active_heap);
+    void* addr = kmalloc_aligned_with_heap(size, alignment, heap, caller);
 
     /* Sanity check */
     ASSERT(((ptr)addr % alignment) == 0);
@@ -195,34 +420,100 @@ void* kmalloc_aligned(size_t size, size_t alignment)
     return addr;
 }
 
-void kfree(void* addr)
+/* kfree() on behalf of 'caller'. */
+static void kfree_checked(void* addr, ptr caller)
 {
     if (!addr)
         panic("kfree: Tried to kfree a NULL address!");
 
-    Heap* heap = g_active_heap;
-
-    if (!heap_is_addr_inside((ptr)addr, heap))
+    /* Allocations live on whatever heap was active when they were made, so
+     * the owner is not necessarily the active heap. */
+    Heap* heap = kmalloc_heap_for_va((ptr)addr);
+    if (!heap)
         panic("kfree: Tried to free an invalid address (0x%p)!", addr);
 
-    kfree_with_heap(addr, heap);
+    kfree_with_heap(addr, heap, caller);
 }
 
-void* krealloc(void* addr, size_t size)
+void* kmalloc(size_t size)
 {
-    if (!size)
+    return kmalloc_checked(
+        size, g_driver.default_alignment, g_active_heap, KMALLOC_CALLER());
+}
+
+void* kcalloc(size_t size)
+{
+    void* addr = kmalloc_checked(
+        size, g_driver.default_alignment, g_active_heap, KMALLOC_CALLER());
+    if (addr)
+        memset(addr, 0, size);
+
+    return addr;
+}
+
+void* kmalloc_aligned(size_t size, size_t alignment)
+{
+    return kmalloc_checked(size, alignment, g_active_heap, KMALLOC_CALLER());
+}
+
+void* kmalloc_aligned_from_heap(size_t size, size_t alignment, size_t id)
+{
+    if (id >= g_heap_count)
         return NULL;
 
-    Heap* heap = g_active_heap;
+    return kmalloc_checked(size, alignment, &g_heaps[id], KMALLOC_CALLER());
+}
 
-    if (addr && !heap_is_addr_inside((ptr)addr, heap))
+void kfree(void* addr)
+{
+    kfree_checked(addr, KMALLOC_CALLER());
+}
+
+void* krealloc(void* addr, size_t size)
+{
+    if (!size)
         return NULL;
 
     if (addr)
     {
+        Heap* heap = kmalloc_heap_for_va((ptr)addr);
+        if (!heap)
+            return NULL;
+
         /* If the driver implements 'realloc', we let it do it's thing. */
         if (g_driver.realloc)
-            return g_driver.realloc(addr, size, heap);
+        {
+#if KMALLOC_RECORD_STATISTICS == 1
+            /* The allocation changes size, and kfree() records whatever it's
+             * size is by then. */
+            const size_t oldsize = g_driver.allocation_size(addr, heap);
+#endif
+
+            void* ret = g_driver.realloc(addr, size, heap);
+            if (!ret && shrinker_run(SHRINK_KMALLOC, KMALLOC_SHRINK_BATCH))
+                ret = g_driver.realloc(addr, size, heap);
+
+#if KMALLOC_RECORD_STATISTICS == 1
+            if (ret)
+            {
+                KMallocStatistics* stats = &g_statistics[heap - g_heaps];
+                stats->total_allocated -= oldsize;
+                stats->total_allocated += g_driver.allocation_size(ret, heap);
+            }
+#endif
+
+#if KMALLOC_PROFILE == 1
+            if (ret)
+            {
+                kmalloc_profile_free((ptr)addr, KMALLOC_CALLER());
+                kmalloc_profile_alloc(
+                    (ptr)ret,
+                    g_driver.allocation_size(ret, heap),
+                    KMALLOC_CALLER());
+            }
+#endif
+            return ret;
+        }
 
         /* If not, we do it outselvers, but of course, since we don't know how
          * the driver works, it's gonna be a less-than-optimal solution. */
@@ -266,17 +557,158 @@ void* krealloc(void* addr, size_t size)
          * and free the old one. We don't free the old allocation first, to make
          * sure that if the new allocation fails, the old one is still valid, as
          * per spec. */
-        void* ret = kmalloc_aligned_with_heap(size, alignment, heap);
+        void* ret =
+            kmalloc_aligned_with_heap(size, alignment, heap, KMALLOC_CALLER());
         if (!ret)
             return NULL;
 
         memcpy(ret, addr, (prevsize < size) ? prevsize : size);
-        kfree_with_heap(addr, heap);
+        kfree_with_heap(addr, heap, KMALLOC_CALLER());
         return ret;
     }
 
     /* addr is null, so we treat this lile a simple kmalloc() call. */
-    return kmalloc_aligned_with_heap(size, g_driver.default_alignment, heap);
+    return kmalloc_aligned_with_heap(
+        size, g_driver.default_alignment, g_active_heap, KMALLOC_CALLER());
+}
+
+static void kmalloc_cache_register(KMallocCache* cache)
+{
+    cache->registered = true;
+    cache->next = g_caches;
+    g_caches = cache;
+}
+
+/* kmalloc_cache_alloc() on behalf of 'caller'. */
+static void* kmalloc_cache_alloc_for(KMallocCache* cache, ptr caller)
+{
+    if (UNLIKELY(!cache->registered))
+        kmalloc_cache_register(cache);
+
+    void* addr = cache->freelist;
+    if (addr)
+    {
+        cache->freelist = *(void**)addr;
+        --cache->free_count;
+        ++cache->hits;
+    }
+    else
+    {
+        /* Free objects hold the freelist link. */
+        const size_t size =
+            cache->objsize > sizeof(void*) ? cache->objsize : sizeof(void*);
+        const size_t alignment = cache->alignment > _Alignof(void*)
+                                     ? cache->alignment
+                                     : _Alignof(void*);
+
+        addr = kmalloc_checked(size, alignment, g_active_heap, caller);
+        if (!addr)
+            return NULL;
+
+        ++cache->misses;
+    }
+
+    ++cache->live;
+    return addr;
+}
+
+void* kmalloc_cache_alloc(KMallocCache* cache)
+{
+    return kmalloc_cache_alloc_for(cache, KMALLOC_CALLER());
+}
+
+void* kmalloc_cache_calloc(KMallocCache* cache)
+{
+    void* addr = kmalloc_cache_alloc_for(cache, KMALLOC_CALLER());
+    if (addr)
+        memset(addr, 0, cache->objsize);
+
+    return addr;
+}
+
+void kmalloc_cache_free(void* addr, KMallocCache* cache)
+{
+    if (!addr)
+        panic("kmalloc_cache_free: Tried to free a NULL address!");
+
+    ASSERT(cache->live > 0);
+    --cache->live;
+
+    if (cache->free_count >= cache->max_free)
+    {
+        kfree_checked(addr, KMALLOC_CALLER());
+        return;
+    }
+
+    *(void**)addr = cache->freelist;
+    cache->freelist = addr;
+    ++cache->free_count;
+}
+
+static size_t kmalloc_cache_shrinker_count()
+{
+    size_t count = 0;
+    for (const KMallocCache* cache = g_caches; cache; cache = cache->next)
+        count += cache->free_count;
+
+    return count;
+}
+
+/* Give the free objects held by caches back to kmalloc. */
+static size_t kmalloc_cache_shrinker_scan(size_t n)
+{
+    size_t freed = 0;
+    for (KMallocCache* cache = g_caches; cache && freed < n;
+         cache = cache->next)
+    {
+        while (cache->freelist && freed < n)
+        {
+            void* addr = cache->freelist;
+            cache->freelist = *(void**)addr;
+            --cache->free_count;
+
+            kfree_checked(addr, KMALLOC_CALLER());
+            ++freed;
+        }
+    }
+
+    return freed;
+}
+
+size_t kmalloc_heap_count()
+{
+    return g_heap_count;
+}
+
+const char* kmalloc_driver_name()
+{
+    return g_driver.name;
+}
+
+int kmalloc_get_statistics(size_t id, KMallocStatistics* stats)
+{
+    if (id >= g_heap_count)
+        return -EINVAL;
+
+#if KMALLOC_RECORD_STATISTICS == 1
+    *stats = g_statistics[id];
+    return 0;
+#else
+    (void)stats;
+    return -ENOSYS;
+#endif
+}
+
+ssize_t kmalloc_get_pool_statistics(
+    size_t id, KMallocPoolStatistics* pools, size_t n)
+{
+    if (id >= g_heap_count)
+        return -EINVAL;
+
+    if (!g_driver.pool_statistics)
+        return 0;
+
+    return g_driver.pool_statistics(&g_heaps[id], pools, n);
 }
 
 void kmalloc_dump_statistics()
@@ -284,25 +716,107 @@ void kmalloc_dump_statistics()
 #if KMALLOC_RECORD_STATISTICS == 1
     KLOGF(INFO, "Statistics:");
 
-    KLOGF(
-        INFO, "-- Total allocations made: %zu", g_statistics.total_allocations);
+    KMallocStatistics total = {0};
+    for (size_t i = 0; i < g_heap_count; ++i)
+    {
+        total.total_allocations += g_statistics[i].total_allocations;
+        total.total_frees += g_statistics[i].total_frees;
+        total.total_allocated += g_statistics[i].total_allocated;
+        total.total_freed += g_statistics[i].total_freed;
+    }
+
+    KLOGF(INFO, "-- Total allocations made: %zu", total.total_allocations);
 
     char hr_unit[4];
-    size_t hr_total =
-        bytes_to_human_readable(g_statistics.total_allocated, hr_unit);
+    size_t hr_total = bytes_to_human_readable(total.total_allocated, hr_unit);
 
     KLOGF(INFO, "-- Total allocated memory: %zu %s", hr_total, hr_unit);
 
-    size_t current_allocations =
-        g_statistics.total_allocations - g_statistics.total_frees;
-    size_t current_allocated =
-        g_statistics.total_allocated - g_statistics.total_freed;
+    size_t current_allocations = total.total_allocations - total.total_frees;
+    size_t current_allocated = total.total_allocated - total.total_freed;
 
     KLOGF(INFO, "-- Current allocations: %zu", current_allocations);
 
     hr_total = bytes_to_human_readable(current_allocated, hr_unit);
     KLOGF(INFO, "-- Currently allocated memory: %zu %s", hr_total, hr_unit);
+
+    for (KMallocCache* cache = g_caches; cache; cache = cache->next)
+    {
+        KLOGF(
+            INFO,
+            "-- Cache \"%s\": %zu live, %zu cached, %zu hits, %zu misses",
+            cache->name,
+            cache->live,
+            cache->free_count,
+            cache->hits,
+            cache->misses);
+    }
+
+    if (g_driver.dump_statistics)
+    {
+        for (size_t i = 0; i < g_heap_count; ++i)
+        {
+            KLOGF(INFO, "-- Heap %zu (%s):", i, g_driver.name);
+            g_driver.dump_statistics(&g_heaps[i]);
+        }
+    }
 #else
     KLOGF(WARN, "Statistics are not enabled!");
 #endif
 }
+
+ssize_t kmalloc_get_profile(KMallocProfileSite* sites, size_t n)
+{
+#if KMALLOC_PROFILE == 1
+    size_t found = 0;
+    for (size_t i = 0; i < KMALLOC_PROFILE_SITES && found < n; ++i)
+    {
+        if (g_profile_sites[i].callsite)
+            sites[found++] = g_profile_sites[i];
+    }
+
+    return g_profile_site_count;
+#else
+    (void)sites;
+    (void)n;
+    return -ENOSYS;
+#endif
+}
+
+void kmalloc_dump_profile()
+{
+#if KMALLOC_PROFILE == 1
+    KLOGF(
+        INFO,
+        "Profile: %zu callsites, %zu live allocations, %zu dropped:",
+        g_profile_site_count,
+        g_profile_live_count,
+        g_profile_dropped);
+
+    for (size_t i = 0; i < KMALLOC_PROFILE_SITES; ++i)
+    {
+        const KMallocProfileSite* site = &g_profile_sites[i];
+        if (!site->callsite)
+            continue;
+
+        char name[49] = "???";
+        ptr offset = 0;
+        const size_t len = ksyms_get_symbol_name(
+            site->callsite, &offset, name, sizeof(name) - 1);
+        if (len)
+            name[len] = '\0';
+
+        KLOGF(
+            INFO,
+            "-- [%s] + 0x%zx: %zu allocs, %zu frees, %zu bytes, %zu live",
+            name,
+            offset,
+            site->allocations,
+            site->frees,
+            site->bytes,
+            site->live_bytes);
+    }
+#else
+    KLOGF(WARN, "Profiling is not enabled!");
+#endif
+}
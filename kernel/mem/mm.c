@@ -5,29 +5,92 @@
 
 #include <dxgmx/attrs.h>
 #include <dxgmx/errno.h>
+#include <dxgmx/fs/pagecache.h>
 #include <dxgmx/kboot.h>
 #include <dxgmx/kimg.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
+#include <dxgmx/math.h>
 #include <dxgmx/mem/falloc.h>
 #include <dxgmx/mem/mem_limits.h>
 #include <dxgmx/mem/mm.h>
 #include <dxgmx/mem/pagefault.h>
+#include <dxgmx/mem/shrinker.h>
+#include <dxgmx/mem/swap.h>
 #include <dxgmx/proc/procm.h>
 #include <dxgmx/string.h>
 #include <dxgmx/utils/bytes.h>
 
 #define KLOGF_PREFIX "mm: "
 
+/* How many page frames mm_new_user_range() allocates and maps at once. */
+#define MM_NEW_USER_RANGE_BATCH 32
+
 #define BOOTSTRAP_HEAP_SIZE (200 * KIB)
 static _ATTR_ALIGNED(PAGESIZE) u8
     g_bootstrap_heap_space[BOOTSTRAP_HEAP_SIZE] = {0};
 static Heap g_bootstrap_heap = {
     .vaddr = (ptr)g_bootstrap_heap_space,
     .pagespan = BOOTSTRAP_HEAP_SIZE / PAGESIZE};
+static int g_bootstrap_heap_id = -1;
+/* See MEM_KERNEL_LINEAR_HEAP_SIZE */
+static int g_linear_heap_id = -1;
 
 static MemoryRegionMap* g_sys_mregmap;
 static PagingStruct g_kernel_paging_struct;
+static PagingStruct* g_current_paging_struct = &g_kernel_paging_struct;
+
+/* See mm_zero_frame(). */
+static ptr g_zero_frame;
+
+/* How many zeroed page frames are kept around, see mm_alloc_zeroed_frame(). */
+#define MM_ZEROED_FRAMES_POOL_SIZE 64
+/* How many page frames a call to mm_refill_zeroed_frames() zeroes at most, so
+ * that it doesn't hold on to the CPU for too long. */
+#define MM_ZEROED_FRAMES_REFILL_BATCH 8
+
+static ptr g_zeroed_frames[MM_ZEROED_FRAMES_POOL_SIZE];
+static size_t g_zeroed_frames_count;
+static size_t g_zeroed_frames_hits;
+static size_t g_zeroed_frames_misses;
+/* A kernel page through which page frames are zeroed and copied, since they're
+ * not mapped anywhere in the kernel. It's mapped back to it's own frame when
+ * not in use. There's only one, so it must never be held across anything that
+ * can sleep, someone else would remap it in the meantime. */
+static _ATTR_ALIGNED(PAGESIZE) u8 g_frame_window[PAGESIZE];
+
+/* User paging structs, which is where mm_reclaim_frames() looks for pages to
+ * swap out. */
+static PagingStruct* g_user_paging_structs;
+/* The reclaim clock hand, pages are looked at in the order of their paging
+ * struct and address. */
+static PagingStruct* g_reclaim_ps;
+static ptr g_reclaim_vaddr;
+/* Reclaiming may end up back in falloc, don't go in circles. */
+static bool g_reclaiming;
+
+static size_t mm_zeroed_frames_shrinker_count();
+static size_t mm_zeroed_frames_shrinker_scan(size_t n);
+static size_t mm_swap_shrinker_count();
+
+/* Zeroed page frames are only a head start, giving them back costs nothing
+ * but the time to zero them again. */
+static Shrinker g_zeroed_frames_shrinker = {
+    .name = "zeroed_frames",
+    .kind = SHRINK_FRAMES,
+    .cost = 0,
+    .count = mm_zeroed_frames_shrinker_count,
+    .scan = mm_zeroed_frames_shrinker_scan};
+
+/* Swapped out pages have to be read back when they fault, so this goes last.
+ * Writing them out may have to wait on the swap device. */
+static Shrinker g_swap_shrinker = {
+    .name = "swap",
+    .kind = SHRINK_FRAMES,
+    .cost = 2,
+    .sleeps = true,
+    .count = mm_swap_shrinker_count,
+    .scan = mm_reclaim_frames};
 
 extern void mm_setup_paging_arch(PagingStruct* kps);
 extern void pagefault_setup_arch();
@@ -40,8 +103,29 @@ extern void mm_load_paging_struct_arch(const PagingStruct* ps);
 extern int mm_map_kernel_into_paging_struct_arch(PagingStruct* ps);
 
 extern int mm_map_page_arch(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps);
+extern int
+mm_map_large_page_arch(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps);
+extern int mm_map_range_arch(
+    ptr start,
+    ptr end,
+    ptr paddr,
+    const ptr* frames,
+    u16 flags,
+    PagingStruct* ps);
+extern int
+mm_protect_range_arch(ptr start, ptr end, u16 flags, PagingStruct* ps);
+extern int mm_unmap_range_arch(ptr start, ptr end, PagingStruct* ps);
+extern int mm_get_page_arch(
+    ptr vaddr, const PagingStruct* ps, ptr* frame_out, u16* flags_out);
+extern int mm_unmap_page_arch(ptr vaddr, PagingStruct* ps);
 extern int mm_set_page_flags_arch(ptr vaddr, u16 flags, PagingStruct* ps);
 extern int mm_rm_page_flags_arch(ptr vaddr, u16 flags, PagingStruct* ps);
+extern int mm_get_swapped_page_arch(
+    ptr vaddr, const PagingStruct* ps, size_t* slot_out, u16* flags_out);
+extern int mm_swap_out_page_arch(ptr vaddr, size_t slot, PagingStruct* ps);
+extern int
+mm_map_swapped_page_arch(ptr vaddr, size_t slot, u16 flags, PagingStruct* ps);
+extern bool mm_test_and_clear_accessed_arch(ptr vaddr, PagingStruct* ps);
 
 static _INIT void mm_setup_sys_mregmap()
 {
@@ -101,59 +185,72 @@ static _INIT void mm_setup_dma(ptr dma_start, size_t dma_size)
     procm_get_kernel_proc()->dma_heap = dmaheap;
 }
 
-static _INIT void mm_setup_kmalloc(ptr kheap_start, size_t kheap_size)
+/* Map the pages in [start, end) to the frames right below them, in a higher
+ * half fashion. Everything up to the first large page boundary after the
+ * kernel image is already mapped by the early boot code. Whole large pages
+ * are mapped as such, the rest need page tables, which come from the
+ * bootstrap heap, see mm_alloc_linear(). */
+static _INIT void mm_map_linear_range(ptr start, ptr end)
 {
-    Heap kheap = {.vaddr = kheap_start, .pagespan = kheap_size / PAGESIZE};
-    {
-        char unit[4];
-        KLOGF(
-            DEBUG,
-            "kheap start: 0x%p, max size: %zu%s.",
-            (void*)kheap.vaddr,
-            (size_t)bytes_to_human_readable(kheap.pagespan * PAGESIZE, unit),
-            unit);
-    }
+    PagingStruct* kps = &g_kernel_paging_struct;
+    const ptr premapped_end =
+        bytes_align_up64(kimg_vaddr() + kimg_size(), LARGE_PAGESIZE);
 
+    if (start < premapped_end)
+        start = premapped_end;
+
+    if (start < end &&
+        mm_map_range(start, end, mm_kva2pa(start), PAGE_RW, kps) < 0)
+        panic("Failed to map 0x%p-0x%p!", (void*)start, (void*)end);
+}
+
+/* Map and zero the linear heap, whose page frames are the ones right below it.
+ */
+static _INIT void mm_map_linear_heap(const Heap* heap)
+{
+    const ptr heap_end = heap->vaddr + heap->pagespan * PAGESIZE;
+
+    /* This is one falloc call for the whole thing. */
+    if (falloc_range_at(mm_kva2pa(heap->vaddr), heap->pagespan) < 0)
+        panic("Page frames of the linear heap are taken!");
+
+    mm_map_linear_range(heap->vaddr, heap_end);
+    memset((void*)heap->vaddr, 0, heap->pagespan * PAGESIZE);
+}
+
+/* The bootstrap heap is baked into the kernel image, so it's usable before
+ * anything else is set up. The page tables needed to map the falloc metadata
+ * and the linear heap come from here. */
+static _INIT void mm_setup_bootstrap_heap()
+{
     if (kmalloc_init() < 0)
         panic("Failed to initialize kmalloc!");
 
-    /* The heap situation (at least on x86 PAE since that's the only config
-     * this bitch runs on) is kind of tricky. The kernel is mapped in increments
-     * of 2MiBs since that's how much a page table holds. The kernel heap starts
-     * right after the kernel image + the other stuff the bootloader put there
-     * and spans off to the end of the virtual address space minus dma. That
-     * most often means that the kernel heap is not completely mapped, as should
-     * be the case. Depending on the kmalloc implementation this may or may not
-     * cause problems. If kmalloc returns an unmapped address and in the attempt
-     * of trying to map said address kmalloc is called once again and returns
-     * yet another unmapped address we're kind of dead. The situation gets even
-     * harder if the kernel occupies almost or even all of the 2x MiBs it
-     * has, in such cases kmalloc is left with no available space to even try to
-     * bootstrap itself. A solution I spent a weekend on trying to get to work
-     * but ultimately failed is switch to an "emergency heap" in case of 2
-     * nested kernel heap pagefaults. This doesn't quite click into place as I
-     * would've liked it to, because mm_map_page_arch is called twice (nested)
-     * and can overwrite a pagetable it just allocated using the
-     * emergency heap. Right now we use a bootstrap heap that is baked into the
-     * kernel, that way it's guaranteed to be mapped and we consume the entirety
-     * of it in mapping part of the actual heap. This has problems, but it's
-     * better than what we had before
-     */
-
-    int bootstrap_heap_id = kmalloc_register_heap(g_bootstrap_heap);
-    if (bootstrap_heap_id < 0)
-        panic("kmalloc failed to register emergency heap!");
+    g_bootstrap_heap_id = kmalloc_register_heap(g_bootstrap_heap);
+    if (g_bootstrap_heap_id < 0)
+        panic("kmalloc failed to register bootstrap heap!");
 
-    kmalloc_use_heap(bootstrap_heap_id);
+    kmalloc_use_heap(g_bootstrap_heap_id);
+}
 
-    int kheap_id = kmalloc_register_heap(kheap);
-    if (kheap_id < 0)
-        panic("kmalloc failed to register kernel heap!");
+/* Returns true if the physical range [start, start + size) is completely
+ * inside one of the system's memory regions. */
+static _INIT bool mm_is_range_available(u64 start, u64 size)
+{
+    FOR_EACH_MEM_REGION (region, g_sys_mregmap)
+    {
+        if (start >= region->start &&
+            start + size <= region->start + region->size)
+            return true;
+    }
 
-    // kmalloc_use_heap(kheap_id);
+    return false;
 }
 
-static _INIT int mm_setup_vm_allocation()
+/* The frame allocator keeps it's metadata right after the kernel image, sized
+ * after the system's memory map. Returns where said metadata ends, which is
+ * where the kernel heaps start. */
+static _INIT ptr mm_setup_falloc()
 {
     /* FIXME: an initramfs may be coming which means this shit will not fly. We
      * should get this info during early boot */
@@ -162,31 +259,113 @@ static _INIT int mm_setup_vm_allocation()
     /* sanity check */
     ASSERT(kernel_vend % PAGESIZE == 0);
 
-    /* Make sure the kernel heap is zeroed out. We always start mapping
-    memory from 0 to where ever the kernel end is, in 2 MiB increments
-    (whole Page tables). Let's say the kernel starts at 1 MiB and is around
-    ~324 KiB the rest of ~700 KiB are considered kernel heap, and are still
-    mapped. Note that new kernel heap pages allocated when a pagefault
-    happens are automatically zeroed out. */
-    /* FIXME: The 2MiB increment may not always be true. Find a way to get this
-     * information */
-    const size_t sz = bytes_align_up64(kernel_vend, 0x200'000) - kernel_vend;
-    memset((void*)kernel_vend, 0, sz);
+    const size_t size =
+        bytes_align_up64(falloc_metadata_size(g_sys_mregmap), PAGESIZE);
+
+    if (!mm_is_range_available(mm_kva2pa(kernel_vend), size))
+        panic("No memory for the page frame allocator!");
+
+    mm_map_linear_range(kernel_vend, kernel_vend + size);
+
+    falloc_init(g_sys_mregmap, (void*)kernel_vend);
+
+    if (falloc_range_at(mm_kva2pa(kernel_vend), size / PAGESIZE) < 0)
+        panic("Failed to reserve the page frame allocator's metadata!");
+
+    {
+        char unit[4];
+        KLOGF(
+            DEBUG,
+            "falloc metadata: 0x%p, size: %zu%s.",
+            (void*)kernel_vend,
+            (size_t)bytes_to_human_readable(size, unit),
+            unit);
+    }
+
+    return kernel_vend + size;
+}
 
-    /* Mark these pages in falloc */
-    for (size_t i = 0; i < sz / PAGESIZE; ++i)
+static _INIT void mm_setup_kmalloc(
+    ptr linear_heap_start,
+    size_t linear_heap_size,
+    ptr kheap_start,
+    size_t kheap_size)
+{
+    Heap linear_heap = {
+        .vaddr = linear_heap_start, .pagespan = linear_heap_size / PAGESIZE};
+    Heap kheap = {.vaddr = kheap_start, .pagespan = kheap_size / PAGESIZE};
     {
-        ptr paddr = mm_kva2pa(kernel_vend + i * PAGESIZE);
-        falloc_one_at(paddr);
+        char unit[4];
+        KLOGF(
+            DEBUG,
+            "linear heap start: 0x%p, size: %zu%s.",
+            (void*)linear_heap.vaddr,
+            (size_t)bytes_to_human_readable(
+                linear_heap.pagespan * PAGESIZE, unit),
+            unit);
+        KLOGF(
+            DEBUG,
+            "kheap start: 0x%p, max size: %zu%s.",
+            (void*)kheap.vaddr,
+            (size_t)bytes_to_human_readable(kheap.pagespan * PAGESIZE, unit),
+            unit);
     }
 
-    const size_t kernel_hole_size = MEM_KERNEL_SPACE_VA_END - kernel_vend;
+    /* The heap situation (at least on x86 PAE since that's the only config
+     * this bitch runs on) is kind of tricky. Pages of the kernel heap are
+     * mapped on demand, when they pagefault, and mapping a page may need a new
+     * page table, which needs memory. If that memory came from the kernel heap
+     * itself, it could pagefault as well, and kmalloc would be called while
+     * it's in the middle of another allocation on the same heap. On top of
+     * that, paging structures need to be translated with
+     * mm_kva2pa()/mm_kpa2va(), so they must live in linearly mapped memory.
+     *
+     * So there are 3 heaps:
+     * - The bootstrap heap, baked into the kernel image, see
+     * mm_setup_bootstrap_heap().
+     * - The linear heap, which is completely mapped here, before kmalloc ever
+     * touches it. Paging structures come from here, see mm_alloc_linear().
+     * - The kernel heap, which is what kmalloc() uses. Its pages are backed by
+     * any free page frame, so we don't run out of kernel memory until we run
+     * out of RAM. A pagefault in here can only allocate from the linear heap,
+     * which never faults. */
+
+    mm_map_linear_heap(&linear_heap);
+
+    int linear_heap_id = kmalloc_register_heap(linear_heap);
+    if (linear_heap_id < 0)
+        panic("kmalloc failed to register linear heap!");
+
+    g_linear_heap_id = linear_heap_id;
+
+    int kheap_id = kmalloc_register_heap(kheap);
+    if (kheap_id < 0)
+        panic("kmalloc failed to register kernel heap!");
+
+    kmalloc_use_heap(kheap_id);
+}
+
+static _INIT int mm_setup_vm_allocation(ptr heaps_start)
+{
+    /* The linear heap is rounded up to a whole large page, so that the kernel
+     * heap starts on one, see pagefault_handle_absent_kernel_heap(). */
+    const ptr linear_heap_start = heaps_start;
+    const size_t linear_heap_size =
+        bytes_align_up64(
+            heaps_start + MEM_KERNEL_LINEAR_HEAP_SIZE, LARGE_PAGESIZE) -
+        heaps_start;
+
+    const size_t kernel_hole_size = MEM_KERNEL_SPACE_VA_END - heaps_start;
 
-    const ptr kheap_start = kernel_vend;
     /* MAYBE FIXME: We might waste a bit of memory here */
-    const size_t kheap_size = bytes_align_down64(
+    const size_t heaps_size = bytes_align_down64(
         kernel_hole_size / 100 * MEM_KERNEL_HEAP_PERC, PAGESIZE);
-    mm_setup_kmalloc(kernel_vend, kheap_size);
+    ASSERT(heaps_size > linear_heap_size);
+
+    const ptr kheap_start = linear_heap_start + linear_heap_size;
+    const size_t kheap_size = heaps_size - linear_heap_size;
+    mm_setup_kmalloc(
+        linear_heap_start, linear_heap_size, kheap_start, kheap_size);
 
     procm_spawn_kernel_proc();
 
@@ -198,6 +377,18 @@ static _INIT int mm_setup_vm_allocation()
     return 0;
 }
 
+static _INIT void mm_setup_zero_frame()
+{
+    /* Coming from the linear heap we know both where it is in physical memory,
+     * and that it's never going anywhere. */
+    void* zero_page = mm_alloc_linear(PAGESIZE, PAGESIZE);
+    if (!zero_page)
+        panic("Failed to allocate the zero frame!");
+
+    memset(zero_page, 0, PAGESIZE);
+    g_zero_frame = mm_kva2pa((ptr)zero_page);
+}
+
 static _INIT void mm_enforce_ksections_perms()
 {
     PagingStruct* kps = &g_kernel_paging_struct;
@@ -247,6 +438,7 @@ _INIT void mm_init()
     mm_setup_paging_arch(&g_kernel_paging_struct);
 
     /* Start getting pagefaults. */
+    pagefault_init();
     pagefault_setup_arch();
 
     /* Enforce permissions for all kernel sections. */
@@ -255,10 +447,19 @@ _INIT void mm_init()
     /* Setup the system memory map */
     mm_setup_sys_mregmap();
 
+    /* Paging structures need to come from somewhere while we set up the rest.
+     */
+    mm_setup_bootstrap_heap();
+
     /* Initialize the frame allocator, depends on the system memory map. */
-    falloc_init(g_sys_mregmap);
+    const ptr heaps_start = mm_setup_falloc();
+
+    mm_setup_vm_allocation(heaps_start);
 
-    mm_setup_vm_allocation();
+    mm_setup_zero_frame();
+
+    shrinker_register(&g_zeroed_frames_shrinker);
+    shrinker_register(&g_swap_shrinker);
 }
 
 int mm_init_paging_struct(PagingStruct* ps)
@@ -274,11 +475,38 @@ int mm_init_paging_struct(PagingStruct* ps)
         return st;
     }
 
+    ps->next = g_user_paging_structs;
+    g_user_paging_structs = ps;
     return 0;
 }
 
 void mm_destroy_paging_struct(PagingStruct* ps)
 {
+    for (PagingStruct** it = &g_user_paging_structs; *it; it = &(*it)->next)
+    {
+        if (*it == ps)
+        {
+            *it = ps->next;
+            break;
+        }
+    }
+
+    /* Move the clock hand out of the way. */
+    if (g_reclaim_ps == ps)
+    {
+        g_reclaim_ps = ps->next;
+        g_reclaim_vaddr = 0;
+    }
+
+    /* The arch code only knows about page frames. */
+    FOR_EACH_TRACKED_PAGE (0, PROC_HIGH_ADDRESS, ps, page)
+    {
+        size_t slot;
+        u16 flags;
+        if (mm_get_swapped_page_arch(page, ps, &slot, &flags) == 0)
+            swap_free_slot(slot);
+    }
+
     mm_destroy_paging_struct_arch(ps);
     pagingstruct_destroy(ps);
 }
@@ -288,14 +516,328 @@ int mm_map_kernel_into_paging_struct(PagingStruct* ps)
     return mm_map_kernel_into_paging_struct_arch(ps);
 }
 
-void mm_load_paging_struct(const PagingStruct* ps)
+void mm_load_paging_struct(PagingStruct* ps)
 {
     mm_load_paging_struct_arch(ps);
+    g_current_paging_struct = ps;
 }
 
 void mm_load_kernel_paging_struct()
 {
-    mm_load_paging_struct_arch(&g_kernel_paging_struct);
+    mm_load_paging_struct(&g_kernel_paging_struct);
+}
+
+PagingStruct* mm_get_current_paging_struct()
+{
+    return g_current_paging_struct;
+}
+
+/* Map 'frame' at the frame window. Returns the window, or NULL on failure. */
+static void* mm_map_frame_window(ptr frame)
+{
+    PagingStruct* kps = &g_kernel_paging_struct;
+    if (mm_map_page_arch((ptr)g_frame_window, frame, PAGE_RW, kps) < 0)
+        return NULL;
+
+    return g_frame_window;
+}
+
+/* Map the frame window back to it's own frame, so that we don't leave an alias
+ * of some other frame around. */
+static void mm_unmap_frame_window()
+{
+    const ptr window = (ptr)g_frame_window;
+    mm_map_page_arch(
+        window, mm_kva2pa(window), PAGE_RW, &g_kernel_paging_struct);
+}
+
+/* Zero 'frame' through the frame window. Returns 0 on success. */
+static int mm_zero_frame_through_window(ptr frame)
+{
+    void* window = mm_map_frame_window(frame);
+    if (!window)
+        return -ENOMEM;
+
+    memset(window, 0, PAGESIZE);
+    mm_unmap_frame_window();
+    return 0;
+}
+
+/* Copy 'frame' to 'dest' through the frame window. Returns 0 on success. */
+static int mm_copy_from_frame(void* dest, ptr frame)
+{
+    void* window = mm_map_frame_window(frame);
+    if (!window)
+        return -ENOMEM;
+
+    memcpy(dest, window, PAGESIZE);
+    mm_unmap_frame_window();
+    return 0;
+}
+
+/* Copy 'src' to 'frame' through the frame window. Returns 0 on success. */
+static int mm_copy_to_frame(ptr frame, const void* src)
+{
+    void* window = mm_map_frame_window(frame);
+    if (!window)
+        return -ENOMEM;
+
+    memcpy(window, src, PAGESIZE);
+    mm_unmap_frame_window();
+    return 0;
+}
+
+/* If 'ps' is still around and the page at 'vaddr' is still mapped to 'frame'
+ * with 'flags', by 'ps' alone, with mm_try_swap_out_page() holding the only
+ * other reference to it. */
+static bool
+mm_page_still_maps(ptr vaddr, ptr frame, u16 flags, PagingStruct* ps)
+{
+    PagingStruct* it = g_user_paging_structs;
+    while (it && it != ps)
+        it = it->next;
+
+    ptr curframe;
+    u16 curflags;
+    return it && mm_get_page_arch(vaddr, ps, &curframe, &curflags) == 0 &&
+           curframe == frame && curflags == flags &&
+           falloc_refcount(frame) == 2;
+}
+
+/* Swap out the page at 'vaddr' if it's anonymous, not shared with anyone and
+ * hasn't been accessed since the last time we looked at it. */
+static int mm_try_swap_out_page(ptr vaddr, PagingStruct* ps)
+{
+    ptr frame;
+    u16 flags;
+    if (mm_get_page_arch(vaddr, ps, &frame, &flags) < 0)
+        return -ENOENT;
+
+    /* Shared frames would have to be swapped out of everyone using them, and
+     * the page cache holds a reference to file backed ones. */
+    if (!(flags & PAGE_USER) || (flags & PAGE_LARGE) ||
+        frame == g_zero_frame || falloc_refcount(frame) != 1)
+        return -EBUSY;
+
+    /* Second chance. */
+    if (mm_test_and_clear_accessed_arch(vaddr, ps))
+        return -EAGAIN;
+
+    const ssize_t slot = swap_alloc_slot();
+    if (slot < 0)
+        return slot;
+
+    /* Writing to swap may sleep, and the owner may run in the meantime, so the
+     * page stays mapped until it's been written out. It's made copy-on-write,
+     * and we hold on to the frame, so that a write gets it's own copy instead
+     * of changing what's being written out. */
+    int st = falloc_ref(frame);
+    if (st < 0)
+    {
+        swap_free_slot(slot);
+        return st;
+    }
+
+    const u16 cowflags =
+        (flags & PAGE_W) ? (flags & ~PAGE_W) | PAGE_COW : flags;
+    if (cowflags != flags)
+        mm_set_page_flags_arch(vaddr, cowflags, ps);
+
+    /* Same goes for the frame window, so this goes through a bounce page. */
+    void* bounce = kmalloc(PAGESIZE);
+    st = bounce ? mm_copy_from_frame(bounce, frame) : -ENOMEM;
+    if (st == 0)
+        st = swap_write_page(slot, bounce);
+
+    if (bounce)
+        kfree(bounce);
+
+    /* The owner may have written to the page, forked, remapped it or gone
+     * away altogether, in which case the page is not ours to swap out
+     * anymore. */
+    const bool unchanged = mm_page_still_maps(vaddr, frame, cowflags, ps);
+    if (unchanged)
+        mm_set_page_flags_arch(vaddr, flags, ps);
+
+    if (st == 0 && unchanged)
+        st = mm_swap_out_page_arch(vaddr, slot, ps);
+    else if (st == 0)
+        st = -EAGAIN;
+
+    if (st < 0)
+    {
+        swap_free_slot(slot);
+        ffree_one(frame);
+        return st;
+    }
+
+    /* Both the page's reference and ours. */
+    ffree_one(frame);
+    ffree_one(frame);
+    return 0;
+}
+
+size_t mm_reclaim_frames(size_t n)
+{
+    if (g_reclaiming || !swap_enabled())
+        return 0;
+
+    g_reclaiming = true;
+
+    /* Enough steps to go around the clock twice, the first time around may
+     * only clear accessed bits. Moving on to the next paging struct is a step
+     * too, so that we stop even if nothing is tracked. */
+    size_t steps = 0;
+    for (PagingStruct* ps = g_user_paging_structs; ps; ps = ps->next)
+        steps += ps->tracked_pages_count + 1;
+
+    steps *= 2;
+
+    size_t reclaimed = 0;
+    while (reclaimed < n && steps--)
+    {
+        PagingStruct* ps = g_reclaim_ps;
+        if (!ps)
+        {
+            ps = g_user_paging_structs;
+            g_reclaim_vaddr = 0;
+            if (!ps)
+                break;
+        }
+
+        ptr page;
+        if (!pagingstruct_next_tracked_page(
+                g_reclaim_vaddr, PROC_HIGH_ADDRESS, ps, &page))
+        {
+            g_reclaim_ps = ps->next;
+            g_reclaim_vaddr = 0;
+            continue;
+        }
+
+        g_reclaim_ps = ps;
+        g_reclaim_vaddr = page + PAGESIZE;
+
+        if (mm_try_swap_out_page(page, ps) == 0)
+            ++reclaimed;
+    }
+
+    g_reclaiming = false;
+    return reclaimed;
+}
+
+static size_t mm_swap_shrinker_count()
+{
+    if (!swap_enabled())
+        return 0;
+
+    size_t count = 0;
+    for (PagingStruct* ps = g_user_paging_structs; ps; ps = ps->next)
+        count += ps->tracked_pages_count;
+
+    return count;
+}
+
+/* Bring back the page at 'vaddr' out of swap slot 'slot', with 'flags'. */
+static int mm_swap_in_page(ptr vaddr, size_t slot, u16 flags, PagingStruct* ps)
+{
+    ptr frame = falloc_one_user();
+    if (!frame)
+        return -ENOMEM;
+
+    /* Reading from swap may sleep, same as in mm_try_swap_out_page(). The
+     * bounce page is faulted in up front, not in the middle of the read. */
+    void* bounce = kmalloc(PAGESIZE);
+    if (bounce)
+        memset(bounce, 0, PAGESIZE);
+
+    int st = bounce ? swap_read_page(slot, bounce) : -ENOMEM;
+    if (st == 0)
+        st = mm_copy_to_frame(frame, bounce);
+
+    if (bounce)
+        kfree(bounce);
+
+    if (st == 0)
+        st = mm_map_page_arch(vaddr, frame, flags, ps);
+
+    if (st < 0)
+    {
+        ffree_one(frame);
+        return st;
+    }
+
+    /* The page is already tracked. */
+    swap_free_slot(slot);
+    return 0;
+}
+
+ptr mm_alloc_zeroed_frame()
+{
+    if (g_zeroed_frames_count)
+    {
+        ++g_zeroed_frames_hits;
+        return g_zeroed_frames[--g_zeroed_frames_count];
+    }
+
+    ++g_zeroed_frames_misses;
+
+    ptr frame = falloc_one_user();
+    if (!frame)
+        return 0;
+
+    if (mm_zero_frame_through_window(frame) < 0)
+    {
+        ffree_one(frame);
+        return 0;
+    }
+
+    return frame;
+}
+
+void mm_refill_zeroed_frames()
+{
+    /* Don't take page frames that shrinkers are trying to give back. */
+    if (shrinker_memory_low())
+        return;
+
+    for (size_t i = 0; i < MM_ZEROED_FRAMES_REFILL_BATCH &&
+                       g_zeroed_frames_count < MM_ZEROED_FRAMES_POOL_SIZE;
+         ++i)
+    {
+        ptr frame = falloc_one_user();
+        if (!frame)
+            return;
+
+        if (mm_zero_frame_through_window(frame) < 0)
+        {
+            ffree_one(frame);
+            return;
+        }
+
+        g_zeroed_frames[g_zeroed_frames_count++] = frame;
+    }
+}
+
+static size_t mm_zeroed_frames_shrinker_count()
+{
+    return g_zeroed_frames_count;
+}
+
+static size_t mm_zeroed_frames_shrinker_scan(size_t n)
+{
+    size_t freed = 0;
+    for (; freed < n && g_zeroed_frames_count; ++freed)
+        ffree_one(g_zeroed_frames[--g_zeroed_frames_count]);
+
+    return freed;
+}
+
+void mm_get_zeroed_frames_stats(ZeroedFramesStats* stats)
+{
+    stats->count = g_zeroed_frames_count;
+    stats->capacity = MM_ZEROED_FRAMES_POOL_SIZE;
+    stats->hits = g_zeroed_frames_hits;
+    stats->misses = g_zeroed_frames_misses;
 }
 
 PagingStruct* mm_get_kernel_paging_struct()
@@ -303,6 +845,21 @@ PagingStruct* mm_get_kernel_paging_struct()
     return &g_kernel_paging_struct;
 }
 
+void* mm_alloc_linear(size_t size, size_t alignment)
+{
+    void* addr = NULL;
+    if (g_linear_heap_id >= 0)
+        addr = kmalloc_aligned_from_heap(size, alignment, g_linear_heap_id);
+
+    /* The bootstrap heap lives inside the kernel image, so it's linearly
+     * mapped too. It's used while the linear heap is being set up, and as a
+     * last resort if the linear heap runs out. */
+    if (!addr && g_bootstrap_heap_id >= 0)
+        addr = kmalloc_aligned_from_heap(size, alignment, g_bootstrap_heap_id);
+
+    return addr;
+}
+
 ptr mm_kpa2va(ptr pa)
 {
     return pa + kimg_map_offset();
@@ -316,11 +873,135 @@ int mm_map_page(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps)
     return mm_map_page_arch(vaddr, paddr, flags, ps);
 }
 
+int mm_map_large_page(ptr vaddr, ptr paddr, u16 flags, PagingStruct* ps)
+{
+    ASSERT(vaddr % LARGE_PAGESIZE == 0);
+    ASSERT(paddr % LARGE_PAGESIZE == 0);
+
+    return mm_map_large_page_arch(vaddr, paddr, flags, ps);
+}
+
+int mm_map_range(ptr start, ptr end, ptr paddr, u16 flags, PagingStruct* ps)
+{
+    ASSERT(start % PAGESIZE == 0);
+    ASSERT(end % PAGESIZE == 0);
+    ASSERT(paddr % PAGESIZE == 0);
+
+    ptr vaddr = start;
+    while (vaddr < end)
+    {
+        const ptr pa = paddr + (vaddr - start);
+        if (vaddr % LARGE_PAGESIZE == 0 && pa % LARGE_PAGESIZE == 0 &&
+            end - vaddr >= LARGE_PAGESIZE)
+        {
+            int st = mm_map_large_page_arch(vaddr, pa, flags, ps);
+            if (st == 0)
+            {
+                vaddr += LARGE_PAGESIZE;
+                continue;
+            }
+            else if (st != -EEXIST)
+            {
+                return st;
+            }
+        }
+
+        /* Normal pages up until where the next large page could go. */
+        const u64 next_large = bytes_align_down64(vaddr, LARGE_PAGESIZE) +
+                               LARGE_PAGESIZE;
+        const ptr chunk_end = next_large < end ? next_large : end;
+
+        int st = mm_map_range_arch(vaddr, chunk_end, pa, NULL, flags, ps);
+        if (st < 0)
+            return st;
+
+        vaddr = chunk_end;
+    }
+
+    return 0;
+}
+
+int mm_protect_range(ptr start, ptr end, u16 flags, PagingStruct* ps)
+{
+    ASSERT(start % PAGESIZE == 0);
+    ASSERT(end % PAGESIZE == 0);
+
+    return mm_protect_range_arch(start, end, flags, ps);
+}
+
+int mm_unmap_range(ptr start, ptr end, PagingStruct* ps)
+{
+    ASSERT(start % PAGESIZE == 0);
+    ASSERT(end % PAGESIZE == 0);
+
+    return mm_unmap_range_arch(start, end, ps);
+}
+
+int mm_new_user_range(ptr start, ptr end, u16 flags, PagingStruct* ps)
+{
+    ASSERT(start % PAGESIZE == 0);
+    ASSERT(end % PAGESIZE == 0);
+
+    ptr frames[MM_NEW_USER_RANGE_BATCH];
+    for (ptr vaddr = start; vaddr < end;)
+    {
+        size_t pages = (end - vaddr) / PAGESIZE;
+        if (pages > MM_NEW_USER_RANGE_BATCH)
+            pages = MM_NEW_USER_RANGE_BATCH;
+
+        const ptr batch_end = vaddr + pages * PAGESIZE;
+
+        for (size_t i = 0; i < pages; ++i)
+        {
+            frames[i] = mm_alloc_zeroed_frame();
+            if (frames[i])
+                continue;
+
+            while (i--)
+                ffree_one(frames[i]);
+
+            return -ENOMEM;
+        }
+
+        int st = mm_map_range_arch(
+            vaddr, batch_end, 0, frames, flags | PAGE_USER, ps);
+        if (st < 0)
+        {
+            /* Some of the batch might have made it in. */
+            mm_unmap_range_arch(vaddr, batch_end, ps);
+            for (size_t i = 0; i < pages; ++i)
+                ffree_one(frames[i]);
+
+            return st;
+        }
+
+        for (ptr page = vaddr; page < batch_end; page += PAGESIZE)
+        {
+            Page trackedpage = {.vaddr = page};
+            st = pagingstruct_track_page(&trackedpage, ps);
+            if (st < 0)
+            {
+                /* Same as above, plus whatever made it into the tracker. */
+                mm_unmap_range_arch(vaddr, batch_end, ps);
+                pagingstruct_untrack_range(vaddr, page, ps);
+                for (size_t i = 0; i < pages; ++i)
+                    ffree_one(frames[i]);
+
+                return st;
+            }
+        }
+
+        vaddr = batch_end;
+    }
+
+    return 0;
+}
+
 int mm_new_user_page(ptr vaddr, u16 flags, PagingStruct* ps)
 {
     ASSERT(vaddr % PAGESIZE == 0);
 
-    ptr paddr = falloc_one_user();
+    ptr paddr = mm_alloc_zeroed_frame();
     if (!paddr)
         return -ENOMEM;
 
@@ -339,6 +1020,378 @@ int mm_new_user_page(ptr vaddr, u16 flags, PagingStruct* ps)
     return st;
 }
 
+/* Map a fresh zeroed frame at 'vaddr'. The page may already be mapped to the
+ * zero frame, in which case it's already tracked. */
+static int
+mm_new_zeroed_user_page(ptr vaddr, u16 flags, bool track, PagingStruct* ps)
+{
+    ptr frame = mm_alloc_zeroed_frame();
+    if (!frame)
+        return -ENOMEM;
+
+    int st = mm_map_page_arch(vaddr, frame, flags | PAGE_USER, ps);
+    if (st < 0)
+    {
+        ffree_one(frame);
+        return st;
+    }
+
+    if (track)
+    {
+        Page page = {.vaddr = vaddr};
+        st = pagingstruct_track_page(&page, ps);
+        if (st < 0)
+        {
+            mm_unmap_page_arch(vaddr, ps);
+            ffree_one(frame);
+            return st;
+        }
+    }
+
+    return 0;
+}
+
+/* Read the page at 'idx' of 'vnode' into a new page frame mapped at 'vaddr',
+ * and put it in the page cache. Returns the cached page frame, with a
+ * reference held for the caller, or 0 on failure. */
+static ptr mm_read_file_page(
+    ptr vaddr, VirtualNode* vnode, size_t idx, PagingStruct* ps)
+{
+    ptr frame = falloc_one_user();
+    if (!frame)
+        return 0;
+
+    /* Read it through the user address, since 'ps' is loaded. */
+    if (mm_map_page_arch(vaddr, frame, PAGE_RW | PAGE_USER, ps) < 0)
+    {
+        ffree_one(frame);
+        return 0;
+    }
+
+    /* The tail of the last page is zeroed. */
+    const off_t off = (off_t)idx * PAGESIZE;
+    const size_t n = min(vnode->size - off, (size_t)PAGESIZE);
+    memset((void*)vaddr + n, 0, PAGESIZE - n);
+
+    if (vnode->ops->read(vnode, (void*)vaddr, n, off) != (ssize_t)n)
+    {
+        mm_unmap_page_arch(vaddr, ps);
+        ffree_one(frame);
+        return 0;
+    }
+
+    /* Reading may sleep, and someone else may have faulted in the same page
+     * in the meantime. Theirs is the one that stays. */
+    const ptr cached = pagecache_find(vnode, idx);
+    if (cached)
+    {
+        mm_unmap_page_arch(vaddr, ps);
+        ffree_one(frame);
+        return falloc_ref(cached) == 0 ? cached : 0;
+    }
+
+    if (pagecache_insert(vnode, idx, frame) < 0)
+    {
+        mm_unmap_page_arch(vaddr, ps);
+        ffree_one(frame);
+        return 0;
+    }
+
+    return frame;
+}
+
+/* Map a page of a file backed area, out of the page cache. */
+static int mm_handle_file_fault(
+    ptr vaddr, bool write, const PageArea* area, PagingStruct* ps)
+{
+    VirtualNode* vnode = area->vnode;
+    const size_t idx = (vaddr - area->start + area->off) / PAGESIZE;
+
+    /* Past the end of the file. */
+    if ((off_t)idx * PAGESIZE >= (off_t)vnode->size)
+        return -EFAULT;
+
+    /* Private pages are shared with the cache until they're written to. */
+    u16 flags = area->flags | PAGE_USER;
+    if (!area->shared && (flags & PAGE_W))
+        flags = (flags & ~PAGE_W) | PAGE_COW;
+
+    ptr frame = pagecache_find(vnode, idx);
+    if (!frame)
+    {
+        frame = mm_read_file_page(vaddr, vnode, idx, ps);
+        if (!frame)
+            return -ENOMEM;
+    }
+    else if (falloc_ref(frame) < 0)
+    {
+        return -ENOMEM;
+    }
+
+    /* We're holding one reference, the cache the other. */
+    int st = mm_map_page_arch(vaddr, frame, flags, ps);
+    if (st < 0)
+    {
+        ffree_one(frame);
+        return st;
+    }
+
+    Page page = {.vaddr = vaddr};
+    st = pagingstruct_track_page(&page, ps);
+    if (st < 0)
+    {
+        /* The cache keeps it's own reference. */
+        mm_unmap_page_arch(vaddr, ps);
+        ffree_one(frame);
+        return st;
+    }
+
+    /* Don't wait for the write to fault again. */
+    if (write && (flags & PAGE_COW))
+        return mm_handle_cow_fault(vaddr, ps);
+
+    return 0;
+}
+
+int mm_handle_user_fault(ptr vaddr, PageFaultAction action, PagingStruct* ps)
+{
+    ASSERT(ps == g_current_paging_struct);
+
+    const ptr page = bytes_align_down64(vaddr, PAGESIZE);
+    const bool write = action == PAGEFAULT_ACTION_WRITE;
+    const bool exec = action == PAGEFAULT_ACTION_EXEC;
+
+    /* Swapped out pages don't need to be inside an area, they come back the
+     * way they were. If the access isn't allowed it just faults again. */
+    size_t slot;
+    u16 swapflags;
+    if (mm_get_swapped_page_arch(page, ps, &slot, &swapflags) == 0)
+        return mm_swap_in_page(page, slot, swapflags, ps);
+
+    const PageArea* area = pagingstruct_find_area(vaddr, ps);
+    if (!area)
+        return -EFAULT;
+
+    if ((write && !(area->flags & PAGE_W)) || (exec && !(area->flags & PAGE_X)))
+        return -EFAULT;
+
+    ptr frame;
+    u16 flags;
+    if (mm_get_page_arch(page, ps, &frame, &flags) == 0)
+    {
+        /* First write to a page that has only been read from. */
+        if (write && frame == g_zero_frame)
+            return mm_new_zeroed_user_page(page, area->flags, false, ps);
+
+        /* The page allows the access, so it was a stale TLB entry. Anything
+         * else is a real protection fault, like an instruction fetch from a
+         * no-execute page, or a write to a copy-on-write page, which is left
+         * to mm_handle_cow_fault(). */
+        if ((write && !(flags & PAGE_W)) || (exec && !(flags & PAGE_X)))
+            return -EFAULT;
+
+        return 0;
+    }
+
+    if (area->vnode)
+        return mm_handle_file_fault(page, write, area, ps);
+
+    if (write)
+        return mm_new_zeroed_user_page(page, area->flags, true, ps);
+
+    /* Reads don't need their own frame (yet). */
+    int st = mm_map_page_arch(
+        page, g_zero_frame, (area->flags & ~PAGE_W) | PAGE_USER, ps);
+    if (st < 0)
+        return st;
+
+    Page trackedpage = {.vaddr = page};
+    st = pagingstruct_track_page(&trackedpage, ps);
+    if (st < 0)
+        mm_unmap_page_arch(page, ps);
+
+    return st;
+}
+
+int mm_handle_cow_fault(ptr vaddr, PagingStruct* ps)
+{
+    ASSERT(ps == g_current_paging_struct);
+
+    const ptr page = bytes_align_down64(vaddr, PAGESIZE);
+
+    ptr frame;
+    u16 flags;
+    if (mm_get_page_arch(page, ps, &frame, &flags) < 0 || !(flags & PAGE_COW))
+        return -EFAULT;
+
+    const u16 newflags = (flags & ~(PAGE_COW | PAGE_PRESENT)) | PAGE_W;
+
+    /* Everyone else has already made their own copy, or is gone. */
+    if (falloc_refcount(frame) == 1)
+        return mm_set_page_flags_arch(page, newflags, ps);
+
+    ptr newframe = falloc_one_user();
+    if (!newframe)
+        return -ENOMEM;
+
+    /* Page frames are not mapped in the kernel, so we go through a bounce
+     * buffer, using the user address for both the old and the new frame. */
+    void* bounce = kmalloc(PAGESIZE);
+    if (!bounce)
+    {
+        ffree_one(newframe);
+        return -ENOMEM;
+    }
+
+    memcpy(bounce, (void*)page, PAGESIZE);
+
+    int st = mm_map_page_arch(page, newframe, newflags, ps);
+    if (st < 0)
+    {
+        kfree(bounce);
+        ffree_one(newframe);
+        return st;
+    }
+
+    memcpy((void*)page, bounce, PAGESIZE);
+    kfree(bounce);
+
+    /* Drop our reference to the shared frame. The page is already tracked. */
+    ffree_one(frame);
+    return 0;
+}
+
+/* Share a swapped out page with 'newps'. Whoever swaps it in first gets their
+ * own frame, so it doesn't need to be copy-on-write. */
+static int
+mm_fork_swapped_page(ptr vaddr, PagingStruct* ps, PagingStruct* newps)
+{
+    size_t slot;
+    u16 flags;
+    if (mm_get_swapped_page_arch(vaddr, ps, &slot, &flags) < 0)
+        return 0;
+
+    int st = swap_ref_slot(slot);
+    if (st < 0)
+        return st;
+
+    Page trackedpage = {.vaddr = vaddr};
+    st = mm_map_swapped_page_arch(vaddr, slot, flags, newps);
+    if (st == 0)
+        st = pagingstruct_track_page(&trackedpage, newps);
+
+    if (st < 0)
+        swap_free_slot(slot);
+
+    return st;
+}
+
+int mm_fork_paging_struct(PagingStruct* ps, PagingStruct* newps)
+{
+    for (const PageArea* area = ps->areas; area; area = area->next)
+    {
+        int st = pagingstruct_add_file_area(
+            area->start,
+            area->end,
+            area->flags,
+            area->vnode,
+            area->off,
+            area->shared,
+            newps);
+        if (st < 0)
+            return st;
+    }
+
+    FOR_EACH_TRACKED_PAGE (0, PROC_HIGH_ADDRESS, ps, page)
+    {
+        ptr frame;
+        u16 flags;
+        if (mm_get_page_arch(page, ps, &frame, &flags) < 0)
+        {
+            int st = mm_fork_swapped_page(page, ps, newps);
+            if (st < 0)
+                return st;
+
+            continue;
+        }
+
+        /* Writable pages become read-only in both paging structs, and get
+         * copied by whoever writes to them first. */
+        if (flags & PAGE_W)
+        {
+            flags = (flags & ~PAGE_W) | PAGE_COW;
+            mm_set_page_flags_arch(page, flags, ps);
+        }
+
+        /* The zero frame is never freed, so it's not reference counted. */
+        const bool shared = frame != g_zero_frame;
+        if (shared)
+        {
+            int st = falloc_ref(frame);
+            if (st < 0)
+                return st;
+        }
+
+        Page trackedpage = {.vaddr = page};
+        int st = mm_map_page_arch(page, frame, flags, newps);
+        if (st == 0)
+            st = pagingstruct_track_page(&trackedpage, newps);
+
+        if (st < 0)
+        {
+            if (shared)
+                ffree_one(frame);
+
+            return st;
+        }
+    }
+
+    return 0;
+}
+
+int mm_unmap_user_range(ptr start, ptr end, PagingStruct* ps)
+{
+    ASSERT(start % PAGESIZE == 0);
+    ASSERT(end % PAGESIZE == 0);
+
+    int st = pagingstruct_rm_areas(start, end, ps);
+    if (st < 0)
+        return st;
+
+    /* The frames are let go of first, since we can't find them after
+     * unmapping. Nothing can grab them before the range is unmapped. */
+    FOR_EACH_TRACKED_PAGE (start, end, ps, page)
+    {
+        ptr frame;
+        size_t slot;
+        u16 flags;
+        if (mm_get_page_arch(page, ps, &frame, &flags) == 0)
+        {
+            if (frame != g_zero_frame)
+                ffree_one(frame);
+        }
+        else if (mm_get_swapped_page_arch(page, ps, &slot, &flags) == 0)
+        {
+            swap_free_slot(slot);
+        }
+    }
+
+    /* One TLB flush for the whole thing. */
+    st = mm_unmap_range_arch(start, end, ps);
+    pagingstruct_untrack_range(start, end, ps);
+    return st;
+}
+
+ptr mm_zero_frame()
+{
+    return g_zero_frame;
+}
+
+int mm_get_page(ptr vaddr, const PagingStruct* ps, ptr* frame, u16* flags)
+{
+    return mm_get_page_arch(vaddr, ps, frame, flags);
+}
+
 int mm_set_page_flags(ptr va, u16 flags, PagingStruct* ps)
 {
     return mm_set_page_flags_arch(va, flags, ps);
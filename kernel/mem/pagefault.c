@@ -3,6 +3,9 @@
  * Distributed under the MIT license.
  */
 
+#include <dxgmx/attrs.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/kboot.h>
 #include <dxgmx/kimg.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
@@ -10,13 +13,23 @@
 #include <dxgmx/mem/mm.h>
 #include <dxgmx/mem/pagefault.h>
 #include <dxgmx/panic.h>
+#include <dxgmx/proc/procm.h>
 #include <dxgmx/string.h>
+#include <dxgmx/units.h>
 #include <dxgmx/user.h>
 #include <dxgmx/utils/bytes.h>
 
 #define KLOGF_PREFIX "pagefault: "
 
-#define PAGEFAULT_VERBOSE 1
+/* KLOG every page fault. Very verbose! Can be turned on from the command line
+ * with 'pagefault_verbose', or with pagefault_set_verbose(). */
+static bool g_pagefault_verbose;
+
+static PageFaultStats g_pagefault_stats;
+
+/* Kernel heap faults map whole large pages as long as there are more free page
+ * frames than this, see pagefault_map_kernel_heap_large_page(). */
+#define KHEAP_LARGE_PAGE_MIN_FREE_FRAMES (16 * MIB / PAGESIZE)
 
 #define ACTION_TO_MSG(_action, _msg)                                           \
     if (_action == PAGEFAULT_ACTION_EXEC)                                      \
@@ -26,9 +39,74 @@
     else                                                                       \
         _msg = "r";
 
-static void pagefault_handle_prot_fault(
-    ptr faultaddr, u8 ring, PageFaultAction action, ptr ip)
+/* The current process touched memory it's not supposed to. */
+static void pagefault_kill_current_proc(
+    ptr faultaddr, PageFaultAction action, const char* reason, ptr ip)
+{
+    Process* proc = procm_sched_current_proc();
+
+    const char* action_msg = NULL;
+    ACTION_TO_MSG(action, action_msg);
+
+    KLOGF(
+        ERR,
+        "Process %d: %s @ 0x%p (%s) ip(0x%p), killing.",
+        proc->pid,
+        reason,
+        (void*)faultaddr,
+        action_msg,
+        (void*)ip);
+
+    procm_mark_dead(-EFAULT, proc);
+    procm_sched_yield();
+    panic("procm_sched_yield() returned execution to a dead process!");
+}
+
+/* Lazily mapped user memory. This can be hit from ring 0 as well, when the
+ * kernel touches user memory. Returns true if the fault was resolved. */
+static bool pagefault_resolve_user(ptr faultaddr, PageFaultAction action)
+{
+    if (faultaddr >= PROC_HIGH_ADDRESS)
+        return false;
+
+    int st = mm_handle_user_fault(
+        faultaddr, action, mm_get_current_paging_struct());
+
+    if (st == -ENOMEM)
+        KLOGF(ERR, "Out of memory mapping user page 0x%p!", (void*)faultaddr);
+
+    return st == 0;
+}
+
+/* Writes to pages that are shared copy-on-write after a fork. This can be hit
+ * from ring 0 as well, when the kernel writes to user memory. Returns true if
+ * the fault was resolved. */
+static bool pagefault_resolve_cow(ptr faultaddr, PageFaultAction action)
+{
+    if (faultaddr >= PROC_HIGH_ADDRESS || action != PAGEFAULT_ACTION_WRITE)
+        return false;
+
+    int st = mm_handle_cow_fault(faultaddr, mm_get_current_paging_struct());
+    if (st == -ENOMEM)
+        KLOGF(ERR, "Out of memory copying user page 0x%p!", (void*)faultaddr);
+
+    return st == 0;
+}
+
+static ptr pagefault_handle_prot_fault(
+    ptr faultaddr, u8 ring, PageFaultAction action, ptr ip, bool user_access)
 {
+    if (pagefault_resolve_cow(faultaddr, action))
+    {
+        ++g_pagefault_stats.cow;
+        return ip;
+    }
+
+    ++g_pagefault_stats.protection;
+
+    if (user_access)
+        return (ptr)user_access_fault_stub;
+
     if (ring == 0)
     {
         const char* action_msg = NULL;
@@ -42,48 +120,65 @@ static void pagefault_handle_prot_fault(
     }
     else
     {
-        // FIXME: implement actual process protection violation
-        const char* action_msg = NULL;
-        ACTION_TO_MSG(action, action_msg);
+        pagefault_kill_current_proc(
+            faultaddr, action, "protection violation", ip);
+    }
 
-        panic(
-            "User page protection violation at: 0x%p (%s), ip: 0x%p",
-            (void*)faultaddr,
-            action_msg,
-            (void*)ip);
+    return ip;
+}
+
+/* Back the whole large page 'faultaddr' falls in with one large page frame,
+ * if it's completely inside the kernel heap and none of it is mapped yet. The
+ * kernel heap never gives memory back, so this just means fewer TLB misses
+ * for kmalloc'd memory. Returns true if the large page was mapped. */
+static bool pagefault_map_kernel_heap_large_page(ptr faultaddr)
+{
+    const ptr page = bytes_align_down64(faultaddr, LARGE_PAGESIZE);
+    if (!kmalloc_owns_va(page) || !kmalloc_owns_va(page + LARGE_PAGESIZE - 1))
+        return false;
+
+    /* Don't eat up the last large page frames just for the heap. */
+    if (falloc_get_free_frames_count() <
+        KHEAP_LARGE_PAGE_MIN_FREE_FRAMES + LARGE_PAGESIZE / PAGESIZE)
+        return false;
+
+    const ptr frame = falloc_pages(LARGE_PAGE_ORDER);
+    if (!frame)
+        return false;
+
+    int st = mm_map_large_page(
+        page, frame, PAGE_RW, mm_get_kernel_paging_struct());
+    if (st < 0)
+    {
+        ffree_pages(frame, LARGE_PAGE_ORDER);
+        return false;
     }
+
+    // Kernel heap pages are zereod out
+    memset((void*)page, 0, LARGE_PAGESIZE);
+    return true;
 }
 
 static void pagefault_handle_absent_kernel_heap(ptr faultaddr)
 {
+    if (pagefault_map_kernel_heap_large_page(faultaddr))
+        return;
+
     const ptr aligned_faultaddr = bytes_align_down64(faultaddr, PAGESIZE);
-    const ptr frame = aligned_faultaddr - kimg_map_offset();
 
-    /* We may have other available page frames, other than the one we requested,
-     * but using those will break the promise that the kernel heap is contiguous
-     * in both virtual & physical memory. */
-    int st = falloc_one_at(frame);
-    if (st < 0)
+    /* The kernel heap doesn't need to be contiguous in physical memory, so any
+     * frame will do. Kernel heap pages are zeroed out. */
+    const ptr frame = mm_alloc_zeroed_frame();
+    if (!frame)
         panic("Kernel out of memory!");
 
-    /** mm_new_page may call kmalloc which is very risky, as we are already in a
-     * spot where we don't have *some* memory mapped. Ideally we could keep
-     * track of how many recursive page faults happen and maybe have some sort
-     * of backup cache of PageTables as a last case scenario. This works right
-     * now, as the allocator implementation puts the biggest chunks of
-     * memory (the chunks used for allocating stuff >= 128bytes) at the
-     * start of the heap, which is most likely mapped. */
-
-    /* !!! NOTE FOR WHEN THIS BITES ME IN THE ASS LATER: If this fails
-     * the kernel will panic with a "Kernel out of memory" :)
-     */
-    st = mm_map_page(
+    /* mm_map_page may need to allocate a page table. Those come from the linear
+     * heap (see mm_alloc_linear()), which is always mapped, so we can't end up
+     * back in here. */
+    int st = mm_map_page(
         aligned_faultaddr, frame, PAGE_RW, mm_get_kernel_paging_struct());
     if (st < 0)
         panic("Kernel out of virtual memory!");
-
-    // Kernel heap pages are zereod out
-    memset((void*)aligned_faultaddr, 0, PAGESIZE);
 }
 
 static void pagefault_handle_absent_kernel_bogus(ptr faultaddr)
@@ -99,37 +194,43 @@ static void pagefault_handle_absent_kernel_bogus(ptr faultaddr)
     panic("Kernel tried mapping a weird page: 0x%p", (void*)faultaddr);
 }
 
-static void handle_absent_user(ptr faultaddr)
+static void
+handle_absent_user(ptr faultaddr, PageFaultAction action, ptr ip)
 {
-    panic("Page fault in ring 3 @ 0x%p!", (void*)faultaddr);
+    pagefault_kill_current_proc(faultaddr, action, "bad access", ip);
 }
 
-static void pagefault_handle_absent(ptr faultaddr, u8 ring)
+static void
+pagefault_handle_absent(ptr faultaddr, u8 ring, PageFaultAction action, ptr ip)
 {
     if (ring == 0)
     {
         if (kmalloc_owns_va(faultaddr))
+        {
+            ++g_pagefault_stats.kernel_heap;
             pagefault_handle_absent_kernel_heap(faultaddr);
+        }
         else
+        {
+            ++g_pagefault_stats.bad;
             pagefault_handle_absent_kernel_bogus(faultaddr);
+        }
     }
     else
     {
-        handle_absent_user(faultaddr);
+        ++g_pagefault_stats.bad;
+        handle_absent_user(faultaddr, action, ip);
     }
 }
 
-ptr pagefault_handle(
+static void pagefault_log(
     ptr faultaddr,
     ptr ip,
     u8 ring,
     PageFaultReason reason,
-    PageFaultAction action)
+    PageFaultAction action,
+    bool user_access)
 {
-    const bool user_access =
-        ip >= kimg_useraccess_start() && ip < kimg_useraccess_end();
-
-#ifdef PAGEFAULT_VERBOSE
     const char* action_msg = NULL;
     ACTION_TO_MSG(action, action_msg);
 
@@ -149,23 +250,63 @@ ptr pagefault_handle(
         (void*)ip,
         user_access ? " (.useraccess)" : "",
         kmalloc_owns_va(faultaddr) ? " (.kheap)" : "");
-#endif // PAGEFAULT_VERBOSE
+}
 
-    if (reason == PAGEFAULT_REASON_PROT_FAULT)
+_INIT void pagefault_init()
+{
+    if (kboot_cmdline_get("pagefault_verbose", NULL, 0) >= 0)
+        g_pagefault_verbose = true;
+}
+
+void pagefault_set_verbose(bool verbose)
+{
+    g_pagefault_verbose = verbose;
+}
+
+void pagefault_get_stats(PageFaultStats* stats)
+{
+    *stats = g_pagefault_stats;
+}
+
+ptr pagefault_handle(
+    ptr faultaddr,
+    ptr ip,
+    u8 ring,
+    PageFaultReason reason,
+    PageFaultAction action)
+{
+    const bool user_access =
+        ip >= kimg_useraccess_start() && ip < kimg_useraccess_end();
+
+    ++g_pagefault_stats.total;
+
+    if (UNLIKELY(g_pagefault_verbose))
+        pagefault_log(faultaddr, ip, ring, reason, action, user_access);
+
+    /* Reads of untouched pages, first writes and writes to pages mapped to
+     * the zero frame all end up here. */
+    if (pagefault_resolve_user(faultaddr, action))
     {
-        if (user_access)
-            return (ptr)user_access_fault_stub;
+        ++g_pagefault_stats.user;
+        return ip;
+    }
 
-        pagefault_handle_prot_fault(faultaddr, ring, action, ip);
+    if (reason == PAGEFAULT_REASON_PROT_FAULT)
+    {
+        return pagefault_handle_prot_fault(
+            faultaddr, ring, action, ip, user_access);
     }
     else
     {
         /* We might user fault when trying to access an unmapped kheap page. In
          * which case we want to map it. */
         if (user_access && !kmalloc_owns_va(faultaddr))
+        {
+            ++g_pagefault_stats.bad;
             return (ptr)user_access_fault_stub;
+        }
 
-        pagefault_handle_absent(faultaddr, ring);
+        pagefault_handle_absent(faultaddr, ring, action, ip);
     }
 
     return ip;
@@ -3,7 +3,9 @@
  * Distributed under the MIT license.
  */
 
+#include <dxgmx/assert.h>
 #include <dxgmx/errno.h>
+#include <dxgmx/fs/vnode.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
 #include <dxgmx/mem/paging.h>
@@ -12,76 +14,323 @@
 
 #define KLOGF_PREFIX "paging: "
 
-static int pagingstruct_enlarge_allocated_pages(PagingStruct* ps)
+static KMallocCache g_area_cache = KMALLOC_CACHE_INIT("PageArea", PageArea);
+
+static KMallocCache g_track_node_cache =
+    KMALLOC_CACHE_INIT("PageTrackNode", PageTrackNode);
+static KMallocCache g_track_leaf_cache =
+    KMALLOC_CACHE_INIT("PageTrackLeaf", PageTrackLeaf);
+
+/* 2 + 9 + 9 bits of page number, see PageTrackNode. */
+#define TRACK_LEAF_SPAN ((u64)PAGE_TRACK_LEAF_PAGES * PAGESIZE)
+#define TRACK_NODE_SPAN (TRACK_LEAF_SPAN * PAGE_TRACK_NODE_LEAVES)
+#define TRACK_NODE_IDX(_vaddr) ((_vaddr) / TRACK_NODE_SPAN)
+#define TRACK_LEAF_IDX(_vaddr)                                                 \
+    (((_vaddr) / TRACK_LEAF_SPAN) % PAGE_TRACK_NODE_LEAVES)
+#define TRACK_BIT_IDX(_vaddr) (((_vaddr) / PAGESIZE) % PAGE_TRACK_LEAF_PAGES)
+
+/* Stop tracking 'vaddr', which has to be tracked, freeing the leaf and node if
+ * they end up empty. */
+static void pagingstruct_untrack_page(ptr vaddr, PagingStruct* ps)
 {
-    /* just an arbitray number for now */
-    size_t newcap = ps->allocated_pages_capacity + 20;
+    PageTrackNode** nodeslot = &ps->tracked[TRACK_NODE_IDX(vaddr)];
+    PageTrackLeaf** leafslot = &(*nodeslot)->leaves[TRACK_LEAF_IDX(vaddr)];
+    PageTrackLeaf* leaf = *leafslot;
+    const size_t bit = TRACK_BIT_IDX(vaddr);
 
-    Page* tmp = krealloc(ps->allocated_pages, newcap * sizeof(Page));
-    if (!tmp)
-        return -ENOMEM;
+    leaf->bits[bit / 64] &= ~((u64)1 << (bit % 64));
+    --ps->tracked_pages_count;
 
-    memset(tmp + ps->allocated_pages_capacity, 0, 20 * sizeof(Page));
+    if (--leaf->count)
+        return;
 
-    ps->allocated_pages = tmp;
-    ps->allocated_pages_capacity = newcap;
+    kmalloc_cache_free(leaf, &g_track_leaf_cache);
+    *leafslot = NULL;
 
-    return 0;
+    if (--(*nodeslot)->count)
+        return;
+
+    kmalloc_cache_free(*nodeslot, &g_track_node_cache);
+    *nodeslot = NULL;
 }
 
 int pagingstruct_init(PagingStruct* ps)
 {
     memset(ps, 0, sizeof(PagingStruct));
-
-    int st = pagingstruct_enlarge_allocated_pages(ps);
-
-    return st;
+    return 0;
 }
 
 int pagingstruct_destroy(PagingStruct* ps)
 {
-    if (ps->allocated_pages)
+    for (size_t i = 0; i < PAGE_TRACK_ROOT_NODES; ++i)
     {
-        kfree(ps->allocated_pages);
-        ps->allocated_pages = NULL;
+        PageTrackNode* node = ps->tracked[i];
+        if (!node)
+            continue;
+
+        for (size_t k = 0; k < PAGE_TRACK_NODE_LEAVES; ++k)
+        {
+            if (node->leaves[k])
+                kmalloc_cache_free(node->leaves[k], &g_track_leaf_cache);
+        }
+
+        kmalloc_cache_free(node, &g_track_node_cache);
+        ps->tracked[i] = NULL;
     }
 
-    ps->allocated_pages_capacity = 0;
-    ps->allocated_pages_size = 0;
+    ps->tracked_pages_count = 0;
+
+    while (ps->areas)
+    {
+        PageArea* next = ps->areas->next;
+        if (ps->areas->vnode)
+            vnode_decrease_refcount(ps->areas->vnode);
+
+        kmalloc_cache_free(ps->areas, &g_area_cache);
+        ps->areas = next;
+    }
 
     return 0;
 }
 
 int pagingstruct_track_page(const Page* page, PagingStruct* ps)
 {
-    if (ps->allocated_pages_size == ps->allocated_pages_capacity)
+    const ptr vaddr = page->vaddr;
+    ASSERT(TRACK_NODE_IDX(vaddr) < PAGE_TRACK_ROOT_NODES);
+
+    PageTrackNode** nodeslot = &ps->tracked[TRACK_NODE_IDX(vaddr)];
+    if (!*nodeslot)
+    {
+        *nodeslot = kmalloc_cache_calloc(&g_track_node_cache);
+        if (!*nodeslot)
+            return -ENOMEM;
+    }
+
+    PageTrackNode* node = *nodeslot;
+    PageTrackLeaf** leafslot = &node->leaves[TRACK_LEAF_IDX(vaddr)];
+    if (!*leafslot)
+    {
+        *leafslot = kmalloc_cache_calloc(&g_track_leaf_cache);
+        if (!*leafslot)
+        {
+            /* Don't leave an empty node behind. */
+            if (!node->count)
+            {
+                kmalloc_cache_free(node, &g_track_node_cache);
+                *nodeslot = NULL;
+            }
+
+            return -ENOMEM;
+        }
+
+        ++node->count;
+    }
+
+    PageTrackLeaf* leaf = *leafslot;
+    const size_t bit = TRACK_BIT_IDX(vaddr);
+    const u64 mask = (u64)1 << (bit % 64);
+
+    if (leaf->bits[bit / 64] & mask)
+        panic("paging: Tried to track a page twice (0x%p).", (void*)vaddr);
+
+    leaf->bits[bit / 64] |= mask;
+    ++leaf->count;
+    ++ps->tracked_pages_count;
+
+    return 0;
+}
+
+bool pagingstruct_next_tracked_page(
+    ptr start, ptr end, const PagingStruct* ps, ptr* page)
+{
+    /* Wide enough to not wrap around when skipping past the last node. */
+    u64 vaddr = start;
+
+    while (vaddr < end && TRACK_NODE_IDX(vaddr) < PAGE_TRACK_ROOT_NODES)
+    {
+        const PageTrackNode* node = ps->tracked[TRACK_NODE_IDX(vaddr)];
+        if (!node)
+        {
+            vaddr = (TRACK_NODE_IDX(vaddr) + 1) * TRACK_NODE_SPAN;
+            continue;
+        }
+
+        const u64 leaf_start = vaddr - vaddr % TRACK_LEAF_SPAN;
+        const PageTrackLeaf* leaf = node->leaves[TRACK_LEAF_IDX(vaddr)];
+        if (!leaf)
+        {
+            vaddr = leaf_start + TRACK_LEAF_SPAN;
+            continue;
+        }
+
+        const size_t bit = TRACK_BIT_IDX(vaddr);
+        for (size_t word = bit / 64; word < PAGE_TRACK_LEAF_PAGES / 64; ++word)
+        {
+            u64 bits = leaf->bits[word];
+            /* Ignore the pages before 'vaddr' in the first word. */
+            if (word == bit / 64)
+                bits &= ~(u64)0 << (bit % 64);
+
+            if (!bits)
+                continue;
+
+            const u64 found =
+                leaf_start + (word * 64 + __builtin_ctzll(bits)) * PAGESIZE;
+
+            if (found >= end)
+                return false;
+
+            *page = found;
+            return true;
+        }
+
+        vaddr = leaf_start + TRACK_LEAF_SPAN;
+    }
+
+    return false;
+}
+
+void pagingstruct_untrack_range(ptr start, ptr end, PagingStruct* ps)
+{
+    FOR_EACH_TRACKED_PAGE (start, end, ps, page)
+        pagingstruct_untrack_page(page, ps);
+}
+
+int pagingstruct_add_area(ptr start, ptr end, u16 flags, PagingStruct* ps)
+{
+    return pagingstruct_add_file_area(start, end, flags, NULL, 0, false, ps);
+}
+
+int pagingstruct_add_file_area(
+    ptr start,
+    ptr end,
+    u16 flags,
+    VirtualNode* vnode,
+    off_t off,
+    bool shared,
+    PagingStruct* ps)
+{
+    if (start % PAGESIZE || end % PAGESIZE || off % PAGESIZE || start >= end)
+        return -EINVAL;
+
+    for (PageArea* area = ps->areas; area; area = area->next)
     {
-        int st = pagingstruct_enlarge_allocated_pages(ps);
-        if (st < 0)
-            return st;
+        if (start < area->end && end > area->start)
+            return -EINVAL;
     }
 
-    /* We store tracked pages in ascending order. This helps with freeing them
-     * on X86 at least. (Plus the fact that I'm a dipshit my freeing code is
-     * trash) */
+    PageArea* area = kmalloc_cache_alloc(&g_area_cache);
+    if (!area)
+        return -ENOMEM;
+
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->vnode = vnode;
+    area->off = off;
+    area->shared = shared;
+    area->next = ps->areas;
+    ps->areas = area;
 
-    size_t idx;
-    for (idx = 0; idx < ps->allocated_pages_size; ++idx)
+    if (vnode)
+        vnode_increase_refcount(vnode);
+
+    return 0;
+}
+
+int pagingstruct_rm_areas(ptr start, ptr end, PagingStruct* ps)
+{
+    PageArea** link = &ps->areas;
+    while (*link)
     {
-        ptr vaddr = ps->allocated_pages[idx].vaddr;
+        PageArea* area = *link;
+        if (start >= area->end || end <= area->start)
+        {
+            link = &area->next;
+            continue;
+        }
 
-        if (vaddr == page->vaddr)
-            panic("paging: Tried to track a page twice (0x%p).", (void*)vaddr);
+        if (start > area->start && end < area->end)
+        {
+            /* Right in the middle, split it. */
+            PageArea* upper = kmalloc_cache_alloc(&g_area_cache);
+            if (!upper)
+                return -ENOMEM;
 
-        if (vaddr > page->vaddr)
-            break;
+            *upper = *area;
+            upper->start = end;
+            upper->off += end - area->start;
+            area->end = start;
+            area->next = upper;
+
+            if (upper->vnode)
+                vnode_increase_refcount(upper->vnode);
+
+            return 0;
+        }
+
+        if (start > area->start)
+        {
+            area->end = start;
+            link = &area->next;
+        }
+        else if (end < area->end)
+        {
+            area->off += end - area->start;
+            area->start = end;
+            link = &area->next;
+        }
+        else
+        {
+            /* All of it. */
+            *link = area->next;
+            if (area->vnode)
+                vnode_decrease_refcount(area->vnode);
+
+            kmalloc_cache_free(area, &g_area_cache);
+        }
     }
 
-    for (size_t i = ps->allocated_pages_size; i > idx; --i)
-        ps->allocated_pages[i] = ps->allocated_pages[i - 1];
+    return 0;
+}
+
+ptr pagingstruct_find_free_range(
+    size_t size, ptr low, ptr high, const PagingStruct* ps)
+{
+    while (high >= low && high - low >= size)
+    {
+        const ptr start = high - size;
+
+        /* Move below whatever is in the way, and try again. */
+        ptr blocker = 0;
+        for (PageArea* area = ps->areas; area; area = area->next)
+        {
+            if (start < area->end && high > area->start)
+            {
+                blocker = area->start;
+                break;
+            }
+        }
 
-    ps->allocated_pages[idx] = *page;
-    ps->allocated_pages_size++;
+        if (!blocker)
+            pagingstruct_next_tracked_page(start, high, ps, &blocker);
+
+        if (!blocker)
+            return start;
+
+        high = blocker;
+    }
 
     return 0;
 }
+
+PageArea* pagingstruct_find_area(ptr vaddr, const PagingStruct* ps)
+{
+    for (PageArea* area = ps->areas; area; area = area->next)
+    {
+        if (vaddr >= area->start && vaddr < area->end)
+            return area;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/errno.h>
+#include <dxgmx/mem/falloc.h>
+#include <dxgmx/mem/shrinker.h>
+#include <dxgmx/proc/procm.h>
+
+/* How many page frames a call to shrinker_balance() frees at most, so that it
+ * doesn't hold on to the CPU for too long. */
+#define SHRINKER_BALANCE_BATCH 16
+
+/* Sorted by cost, cheapest first. */
+static Shrinker* g_shrinkers;
+/* Shrinkers may end up back in falloc or kmalloc, don't go in circles. */
+static bool g_shrinking;
+/* Set once free page frames drop below SHRINKER_LOW_WATERMARK, until they're
+ * back at SHRINKER_HIGH_WATERMARK. */
+static bool g_balancing;
+
+int shrinker_register(Shrinker* shrinker)
+{
+    if (!shrinker->count || !shrinker->scan || !shrinker->kind)
+        return -EINVAL;
+
+    Shrinker** link = &g_shrinkers;
+    for (; *link; link = &(*link)->next)
+    {
+        if (*link == shrinker)
+            return -EEXIST;
+    }
+
+    /* Shrinkers of the same cost are run in the order they were registered. */
+    link = &g_shrinkers;
+    while (*link && (*link)->cost <= shrinker->cost)
+        link = &(*link)->next;
+
+    shrinker->next = *link;
+    *link = shrinker;
+    return 0;
+}
+
+int shrinker_unregister(Shrinker* shrinker)
+{
+    for (Shrinker** link = &g_shrinkers; *link; link = &(*link)->next)
+    {
+        if (*link == shrinker)
+        {
+            *link = shrinker->next;
+            shrinker->next = NULL;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+size_t shrinker_run(u8 kind, size_t n)
+{
+    if (g_shrinking)
+        return 0;
+
+    g_shrinking = true;
+
+    const bool can_sleep = procm_sched_can_block() &&
+                           !procm_sched_current_proc()->shrink_nosleep;
+    size_t freed = 0;
+    for (Shrinker* shrinker = g_shrinkers; shrinker && freed < n;
+         shrinker = shrinker->next)
+    {
+        if (!(shrinker->kind & kind) || (shrinker->sleeps && !can_sleep))
+            continue;
+
+        const size_t count = shrinker->count();
+        if (!count)
+            continue;
+
+        const size_t want = n - freed;
+        const size_t got = shrinker->scan(count < want ? count : want);
+
+        shrinker->freed += got;
+        freed += got;
+    }
+
+    g_shrinking = false;
+    return freed;
+}
+
+bool shrinker_nosleep_save()
+{
+    /* Nothing would be put to sleep anyway. */
+    if (!procm_sched_can_block())
+        return true;
+
+    Process* proc = procm_sched_current_proc();
+    const bool nosleep = proc->shrink_nosleep;
+    proc->shrink_nosleep = true;
+    return nosleep;
+}
+
+void shrinker_nosleep_restore(bool nosleep)
+{
+    if (procm_sched_can_block())
+        procm_sched_current_proc()->shrink_nosleep = nosleep;
+}
+
+bool shrinker_memory_low()
+{
+    return falloc_get_free_frames_count() < SHRINKER_LOW_WATERMARK;
+}
+
+void shrinker_balance()
+{
+    if (shrinker_memory_low())
+        g_balancing = true;
+
+    const size_t free = falloc_get_free_frames_count();
+    if (!g_balancing || free >= SHRINKER_HIGH_WATERMARK)
+    {
+        g_balancing = false;
+        return;
+    }
+
+    size_t n = SHRINKER_HIGH_WATERMARK - free;
+    if (n > SHRINKER_BALANCE_BATCH)
+        n = SHRINKER_BALANCE_BATCH;
+
+    /* Nothing left to shrink, try again once we're low again. */
+    if (!shrinker_run(SHRINK_FRAMES, n))
+        g_balancing = false;
+}
+
+const Shrinker* shrinker_list()
+{
+    return g_shrinkers;
+}
@@ -0,0 +1,526 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/assert.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/klog.h>
+#include <dxgmx/mem/slab.h>
+#include <dxgmx/panic.h>
+#include <dxgmx/string.h>
+#include <dxgmx/utils/bytes.h>
+
+#define KLOGF_PREFIX "slab: "
+
+/* Objects smaller than or equal to 1 << SLAB_MAX_SHIFT are served out of size
+ * classes, everything else gets whole pages. */
+#define SLAB_MIN_SHIFT 4
+#define SLAB_MAX_SHIFT 11
+#define SLAB_CLASS_COUNT (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+#define SLAB_CLASS_SIZE(cls) ((size_t)1 << ((cls) + SLAB_MIN_SHIFT))
+#define SLAB_CLASS_OBJECTS(cls) (PAGESIZE >> ((cls) + SLAB_MIN_SHIFT))
+
+#define SLAB_PAGE_FREE 0
+#define SLAB_PAGE_OBJECTS 1
+#define SLAB_PAGE_LARGE 2
+#define SLAB_PAGE_LARGE_TAIL 3
+
+typedef struct S_SlabPage
+{
+    u8 type;
+    /* Size class of the objects in this page (SLAB_PAGE_OBJECTS). */
+    u8 cls;
+    /* Number of live objects in this page (SLAB_PAGE_OBJECTS). */
+    u16 inuse;
+    /* Objects past this index have never been handed out, so they are not on
+     * the freelist. Saves us from touching the whole page when we first get it.
+     * (SLAB_PAGE_OBJECTS) */
+    u16 carved;
+    /* Free objects, linked through their first word (SLAB_PAGE_OBJECTS). */
+    void* freelist;
+    /* Links in the partial list of our size class (SLAB_PAGE_OBJECTS). */
+    struct S_SlabPage* next;
+    struct S_SlabPage* prev;
+
+    /* Requested size, alignment and number of pages (SLAB_PAGE_LARGE). */
+    size_t size;
+    size_t alignment;
+    size_t pagespan;
+} SlabPage;
+
+typedef struct S_SlabHeapMeta
+{
+#define SLAB_HEAP_SIGNATURE 0x51AB5160
+    u32 signature;
+
+    /* One bit per pool page, set = used. */
+    u32* bitmap;
+    size_t bitmap_words;
+    /* One descriptor per pool page. */
+    SlabPage* pages;
+
+    ptr pool;
+    size_t poolpages;
+
+    /* There are no free pages in any bitmap word before this one. */
+    size_t first_free_word;
+
+    /* Pages of each size class that have at least one free object. */
+    SlabPage* partial[SLAB_CLASS_COUNT];
+} SlabHeapMeta;
+
+static _ATTR_ALWAYS_INLINE SlabHeapMeta* slab_heap_meta(const Heap* heap)
+{
+    SlabHeapMeta* meta = (SlabHeapMeta*)heap->vaddr;
+    return meta->signature == SLAB_HEAP_SIGNATURE ? meta : NULL;
+}
+
+static _ATTR_ALWAYS_INLINE ptr
+slab_page_addr(const SlabPage* sp, const SlabHeapMeta* meta)
+{
+    return meta->pool + (sp - meta->pages) * PAGESIZE;
+}
+
+static SlabPage* slab_page_from_addr(ptr addr, const SlabHeapMeta* meta)
+{
+    if (addr < meta->pool)
+        return NULL;
+
+    size_t idx = (addr - meta->pool) / PAGESIZE;
+    if (idx >= meta->poolpages)
+        return NULL;
+
+    return &meta->pages[idx];
+}
+
+static size_t slab_size_to_class(size_t size)
+{
+    if (size <= SLAB_CLASS_SIZE(0))
+        return 0;
+
+    /* Round up to the next power of two. */
+    return (32 - __builtin_clz((u32)size - 1)) - SLAB_MIN_SHIFT;
+}
+
+static bool slab_page_is_full(const SlabPage* sp)
+{
+    return !sp->freelist && sp->carved == SLAB_CLASS_OBJECTS(sp->cls);
+}
+
+static void slab_partial_push(SlabPage* sp, SlabHeapMeta* meta)
+{
+    SlabPage** head = &meta->partial[sp->cls];
+
+    sp->prev = NULL;
+    sp->next = *head;
+    if (*head)
+        (*head)->prev = sp;
+
+    *head = sp;
+}
+
+static void slab_partial_remove(SlabPage* sp, SlabHeapMeta* meta)
+{
+    if (sp->prev)
+        sp->prev->next = sp->next;
+    else
+        meta->partial[sp->cls] = sp->next;
+
+    if (sp->next)
+        sp->next->prev = sp->prev;
+
+    sp->next = NULL;
+    sp->prev = NULL;
+}
+
+static void
+slab_bitmap_mark(size_t idx, size_t n, bool used, SlabHeapMeta* meta)
+{
+    for (size_t i = idx; i < idx + n; ++i)
+    {
+        if (used)
+            meta->bitmap[i / 32] |= (1u << (i % 32));
+        else
+            meta->bitmap[i / 32] &= ~(1u << (i % 32));
+    }
+
+    if (!used && idx / 32 < meta->first_free_word)
+        meta->first_free_word = idx / 32;
+}
+
+static bool slab_bitmap_is_free(size_t idx, size_t n, const SlabHeapMeta* meta)
+{
+    if (idx + n > meta->bitmap_words * 32)
+        return false;
+
+    for (size_t i = idx; i < idx + n; ++i)
+    {
+        if (meta->bitmap[i / 32] & (1u << (i % 32)))
+            return false;
+    }
+
+    return true;
+}
+
+static ssize_t
+slab_find_free_pages(size_t n, size_t alignment, SlabHeapMeta* meta)
+{
+    size_t run = 0;
+    size_t start = 0;
+    bool seen_free = false;
+
+    for (size_t w = meta->first_free_word; w < meta->bitmap_words; ++w)
+    {
+        const u32 word = meta->bitmap[w];
+        if (word == 0xFFFFFFFF)
+        {
+            run = 0;
+            continue;
+        }
+
+        if (!seen_free)
+        {
+            meta->first_free_word = w;
+            seen_free = true;
+        }
+
+        /* Single page with no special alignment, which is the most common
+         * case (new slabs, page tables). */
+        if (n == 1 && alignment <= PAGESIZE)
+            return w * 32 + __builtin_ctz(~word);
+
+        for (size_t bit = 0; bit < 32; ++bit)
+        {
+            if (word & (1u << bit))
+            {
+                run = 0;
+                continue;
+            }
+
+            const size_t idx = w * 32 + bit;
+            if (!run)
+            {
+                if ((meta->pool + idx * PAGESIZE) % alignment)
+                    continue;
+
+                start = idx;
+            }
+
+            if (++run == n)
+                return start;
+        }
+    }
+
+    if (!seen_free)
+        meta->first_free_word = meta->bitmap_words;
+
+    return -ENOMEM;
+}
+
+static SlabPage*
+slab_alloc_pages(size_t n, size_t alignment, SlabHeapMeta* meta)
+{
+    ssize_t idx = slab_find_free_pages(n, alignment, meta);
+    if (idx < 0)
+        return NULL;
+
+    slab_bitmap_mark(idx, n, true, meta);
+    return &meta->pages[idx];
+}
+
+static void slab_free_pages(SlabPage* sp, size_t n, SlabHeapMeta* meta)
+{
+    for (size_t i = 0; i < n; ++i)
+        sp[i].type = SLAB_PAGE_FREE;
+
+    slab_bitmap_mark(sp - meta->pages, n, false, meta);
+}
+
+static void* slab_alloc_object(size_t cls, SlabHeapMeta* meta)
+{
+    SlabPage* sp = meta->partial[cls];
+    if (!sp)
+    {
+        sp = slab_alloc_pages(1, PAGESIZE, meta);
+        if (!sp)
+            return NULL;
+
+        sp->type = SLAB_PAGE_OBJECTS;
+        sp->cls = cls;
+        sp->inuse = 0;
+        sp->carved = 0;
+        sp->freelist = NULL;
+        slab_partial_push(sp, meta);
+    }
+
+    void* obj;
+    if (sp->freelist)
+    {
+        obj = sp->freelist;
+        sp->freelist = *(void**)obj;
+    }
+    else
+    {
+        obj = (void*)(slab_page_addr(sp, meta) +
+                      sp->carved * SLAB_CLASS_SIZE(cls));
+        ++sp->carved;
+    }
+
+    ++sp->inuse;
+    if (slab_page_is_full(sp))
+        slab_partial_remove(sp, meta);
+
+    return obj;
+}
+
+static void slab_free_object(void* addr, SlabPage* sp, SlabHeapMeta* meta)
+{
+    const bool wasfull = slab_page_is_full(sp);
+
+    *(void**)addr = sp->freelist;
+    sp->freelist = addr;
+    --sp->inuse;
+
+    if (wasfull)
+        slab_partial_push(sp, meta);
+
+    /* Give the page back if it's empty, but keep at least one partial page
+     * around so we don't keep grabbing and releasing the same page. */
+    if (!sp->inuse && (sp->next || sp->prev))
+    {
+        slab_partial_remove(sp, meta);
+        slab_free_pages(sp, 1, meta);
+    }
+}
+
+static void*
+slab_alloc_large(size_t size, size_t alignment, SlabHeapMeta* meta)
+{
+    const size_t pagespan = bytes_align_up64(size, PAGESIZE) / PAGESIZE;
+
+    SlabPage* sp = slab_alloc_pages(
+        pagespan, alignment > PAGESIZE ? alignment : PAGESIZE, meta);
+    if (!sp)
+        return NULL;
+
+    sp->type = SLAB_PAGE_LARGE;
+    sp->size = size;
+    sp->alignment = alignment;
+    sp->pagespan = pagespan;
+    for (size_t i = 1; i < pagespan; ++i)
+        sp[i].type = SLAB_PAGE_LARGE_TAIL;
+
+    return (void*)slab_page_addr(sp, meta);
+}
+
+/* Returns the page descriptor of 'addr' if it's a valid allocation, NULL
+ * otherwise. */
+static SlabPage* slab_lookup_allocation(void* addr, const SlabHeapMeta* meta)
+{
+    SlabPage* sp = slab_page_from_addr((ptr)addr, meta);
+    if (!sp)
+        return NULL;
+
+    const ptr offset = (ptr)addr - slab_page_addr(sp, meta);
+    switch (sp->type)
+    {
+    case SLAB_PAGE_OBJECTS:
+        if (offset % SLAB_CLASS_SIZE(sp->cls) ||
+            offset / SLAB_CLASS_SIZE(sp->cls) >= sp->carved)
+            return NULL;
+        return sp;
+
+    case SLAB_PAGE_LARGE:
+        return offset ? NULL : sp;
+
+    default:
+        return NULL;
+    }
+}
+
+int slab_init()
+{
+    return 0;
+}
+
+int slab_init_heap(const Heap* heap)
+{
+    if (!heap)
+        return -EINVAL;
+
+    const size_t totalpages = heap->pagespan;
+    const size_t bitmap_words = (totalpages + 31) / 32;
+
+    const size_t bitmap_off =
+        bytes_align_up64(sizeof(SlabHeapMeta), _Alignof(u32));
+    const size_t pages_off = bytes_align_up64(
+        bitmap_off + bitmap_words * sizeof(u32), _Alignof(SlabPage));
+    const size_t metasize = pages_off + totalpages * sizeof(SlabPage);
+    const size_t metapages = bytes_align_up64(metasize, PAGESIZE) / PAGESIZE;
+
+    if (metapages >= totalpages)
+        return -ENOMEM;
+
+    SlabHeapMeta* meta = (SlabHeapMeta*)heap->vaddr;
+    memset(meta, 0, sizeof(SlabHeapMeta));
+
+    meta->bitmap = (u32*)(heap->vaddr + bitmap_off);
+    meta->pages = (SlabPage*)(heap->vaddr + pages_off);
+    meta->pool = heap->vaddr + metapages * PAGESIZE;
+    meta->poolpages = totalpages - metapages;
+    meta->bitmap_words = (meta->poolpages + 31) / 32;
+    meta->first_free_word = 0;
+
+    /* The page descriptors are only looked at once their page has been handed
+     * out, and the heap comes in zeroed, so we don't have to touch (and map)
+     * all of them here. The bitmap on the other hand is small enough. */
+    memset(meta->bitmap, 0, meta->bitmap_words * sizeof(u32));
+
+    /* Mark the bits past the end of the pool as used, so we never hand them
+     * out. */
+    slab_bitmap_mark(
+        meta->poolpages,
+        meta->bitmap_words * 32 - meta->poolpages,
+        true,
+        meta);
+
+    meta->signature = SLAB_HEAP_SIGNATURE;
+
+    KLOGF(
+        DEBUG,
+        "pool pages: %zu, metadata pages: %zu",
+        meta->poolpages,
+        metapages);
+
+    return 0;
+}
+
+void* slab_alloc_aligned(size_t size, size_t alignment, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return NULL;
+
+    /* Objects are naturally aligned on their class size, so asking for a
+     * bigger alignment just bumps the class. */
+    const size_t effsize = size > alignment ? size : alignment;
+    if (effsize <= SLAB_CLASS_SIZE(SLAB_CLASS_COUNT - 1))
+        return slab_alloc_object(slab_size_to_class(effsize), meta);
+
+    return slab_alloc_large(size, alignment, meta);
+}
+
+void* slab_realloc(void* addr, size_t newsize, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return NULL;
+
+    SlabPage* sp = slab_lookup_allocation(addr, meta);
+    if (!sp)
+        return NULL;
+
+    size_t oldsize;
+    size_t alignment;
+    if (sp->type == SLAB_PAGE_OBJECTS)
+    {
+        oldsize = SLAB_CLASS_SIZE(sp->cls);
+        alignment = oldsize;
+
+        if (newsize <= oldsize)
+            return addr;
+    }
+    else
+    {
+        oldsize = sp->size;
+        alignment = sp->alignment;
+
+        const size_t pagespan = bytes_align_up64(newsize, PAGESIZE) / PAGESIZE;
+        if (pagespan <= sp->pagespan)
+        {
+            /* Shrinking, give back the tail. */
+            if (pagespan < sp->pagespan)
+                slab_free_pages(sp + pagespan, sp->pagespan - pagespan, meta);
+
+            sp->pagespan = pagespan;
+            sp->size = newsize;
+            return addr;
+        }
+
+        /* Try to grow in place. */
+        const size_t idx = sp - meta->pages;
+        const size_t extra = pagespan - sp->pagespan;
+        if (slab_bitmap_is_free(idx + sp->pagespan, extra, meta))
+        {
+            slab_bitmap_mark(idx + sp->pagespan, extra, true, meta);
+            for (size_t i = sp->pagespan; i < pagespan; ++i)
+                sp[i].type = SLAB_PAGE_LARGE_TAIL;
+
+            sp->pagespan = pagespan;
+            sp->size = newsize;
+            return addr;
+        }
+    }
+
+    void* newaddr = slab_alloc_aligned(newsize, alignment, heap);
+    if (!newaddr)
+        return NULL;
+
+    memcpy(newaddr, addr, oldsize < newsize ? oldsize : newsize);
+    slab_free(addr, heap);
+    return newaddr;
+}
+
+ssize_t slab_allocation_size(void* addr, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return -EINVAL;
+
+    SlabPage* sp = slab_lookup_allocation(addr, meta);
+    if (!sp)
+        return -EINVAL;
+
+    return sp->type == SLAB_PAGE_OBJECTS ? SLAB_CLASS_SIZE(sp->cls) : sp->size;
+}
+
+ssize_t slab_allocation_alignment(void* addr, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return -EINVAL;
+
+    SlabPage* sp = slab_lookup_allocation(addr, meta);
+    if (!sp)
+        return -EINVAL;
+
+    return sp->type == SLAB_PAGE_OBJECTS ? SLAB_CLASS_SIZE(sp->cls)
+                                         : sp->alignment;
+}
+
+bool slab_is_valid_allocation(void* addr, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return false;
+
+    return slab_lookup_allocation(addr, meta) != NULL;
+}
+
+void slab_free(void* addr, const Heap* heap)
+{
+    SlabHeapMeta* meta = slab_heap_meta(heap);
+    if (!meta)
+        return;
+
+    SlabPage* sp = slab_lookup_allocation(addr, meta);
+    if (!sp)
+        panic("slab: Tried to kfree an invalid address 0x%p", addr);
+
+    if (sp->type == SLAB_PAGE_OBJECTS)
+        slab_free_object(addr, sp, meta);
+    else
+        slab_free_pages(sp, sp->pagespan, meta);
+}
@@ -5,7 +5,11 @@ kernel/mem/falloc.c.o \
 kernel/mem/kmalloc.c.o \
 kernel/mem/heap.c.o \
 kernel/mem/gallocator.c.o \
+kernel/mem/slab.c.o \
 kernel/mem/paging.c.o \
 kernel/mem/dma.c.o \
 kernel/mem/pagefault.c.o \
+kernel/mem/shrinker.c.o \
+kernel/mem/swap.c.o \
+kernel/mem/zram.c.o \
 kernel/mem/mm.c.o 
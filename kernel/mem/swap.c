@@ -0,0 +1,260 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/assert.h>
+#include <dxgmx/attrs.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/kboot.h>
+#include <dxgmx/klog.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/mem/pagesize.h>
+#include <dxgmx/mem/swap.h>
+#include <dxgmx/mem/zram.h>
+#include <dxgmx/storage/blkdevm.h>
+#include <dxgmx/storage/mbr.h>
+#include <dxgmx/string.h>
+#include <dxgmx/timer.h>
+#include <dxgmx/utils/bytes.h>
+
+#define KLOGF_PREFIX "swap: "
+
+/* How many references a slot can have, see swap_ref_slot(). */
+#define SWAP_SLOT_MAX_REFS 255
+
+static ssize_t swap_disk_init();
+static int swap_disk_write_page(size_t slot, const void* src);
+static int swap_disk_read_page(size_t slot, void* dest);
+
+/* The first one is the default. */
+static const SwapBackend g_backends[] = {
+    {.name = "disk",
+     .init = swap_disk_init,
+     .write = swap_disk_write_page,
+     .read = swap_disk_read_page},
+    {.name = "zram",
+     .init = zram_init,
+     .write = zram_write_page,
+     .read = zram_read_page,
+     .release = zram_release_slot}};
+
+#define SWAP_BACKEND_COUNT (sizeof(g_backends) / sizeof(g_backends[0]))
+
+static const SwapBackend* g_swap_backend;
+/* One reference count per slot, 0 means the slot is free. */
+static u8* g_swap_slot_refs;
+static size_t g_swap_slots;
+static size_t g_swap_free_slots;
+/* Where swap_alloc_slot() starts looking. */
+static size_t g_swap_next_slot;
+
+static size_t g_swap_swapped_out;
+static size_t g_swap_swapped_in;
+static size_t g_swap_errors;
+static u64 g_swap_in_ns;
+static u64 g_swap_in_max_ns;
+
+/* The "disk" backend, a swap partition. */
+static const MountableBlockDevice* g_swap_blkdev;
+static sectorcnt_t g_swap_sectors_per_slot;
+
+static _INIT ssize_t swap_disk_init()
+{
+    const MountableBlockDevice* blkdev =
+        blkdevm_find_mountable_blkdev_by_type(MBR_SYSTEM_ID_LINUX_SWAP);
+    if (!blkdev)
+        return -ENODEV;
+
+    if (!blkdev->sectorsize || PAGESIZE % blkdev->sectorsize)
+    {
+        KLOGF(
+            ERR,
+            "[%s%s] Unusable sector size %zu.",
+            blkdev->parent->name,
+            blkdev->suffix,
+            blkdev->sectorsize);
+        return -EINVAL;
+    }
+
+    g_swap_blkdev = blkdev;
+    g_swap_sectors_per_slot = PAGESIZE / blkdev->sectorsize;
+
+    char unit[4];
+    const size_t slots = blkdev->sector_count / g_swap_sectors_per_slot;
+    KLOGF(
+        INFO,
+        "Using %s%s, %.2f%s.",
+        blkdev->parent->name,
+        blkdev->suffix,
+        (double)bytes_to_human_readable((u64)slots * PAGESIZE, unit),
+        unit);
+
+    return slots;
+}
+
+static int swap_disk_write_page(size_t slot, const void* src)
+{
+    const MountableBlockDevice* blkdev = g_swap_blkdev;
+    ssize_t st = blkdev->write(
+        blkdev, slot * g_swap_sectors_per_slot, g_swap_sectors_per_slot, src);
+
+    return st < 0 ? st : 0;
+}
+
+static int swap_disk_read_page(size_t slot, void* dest)
+{
+    const MountableBlockDevice* blkdev = g_swap_blkdev;
+    ssize_t st = blkdev->read(
+        blkdev, slot * g_swap_sectors_per_slot, g_swap_sectors_per_slot, dest);
+
+    return st < 0 ? st : 0;
+}
+
+static _INIT const SwapBackend* swap_pick_backend()
+{
+    char name[16];
+    if (kboot_cmdline_get("swap", name, sizeof(name)) >= 0)
+    {
+        for (size_t i = 0; i < SWAP_BACKEND_COUNT; ++i)
+        {
+            if (strcmp(g_backends[i].name, name) == 0)
+                return &g_backends[i];
+        }
+
+        KLOGF(WARN, "Unknown backend \"%s\", ignoring.", name);
+    }
+
+    return &g_backends[0];
+}
+
+_INIT void swap_init()
+{
+    if (kboot_cmdline_get("noswap", NULL, 0) >= 0)
+    {
+        KLOGF(INFO, "Disabled by the command line.");
+        return;
+    }
+
+    const SwapBackend* backend = swap_pick_backend();
+    const ssize_t slots = backend->init();
+
+    /* The first slot is left alone, that's where mkswap puts it's header. */
+    if (slots < 2)
+        return;
+
+    g_swap_slot_refs = kcalloc(slots);
+    if (!g_swap_slot_refs)
+    {
+        KLOGF(ERR, "Failed to allocate slots!");
+        return;
+    }
+
+    g_swap_slot_refs[0] = SWAP_SLOT_MAX_REFS;
+    g_swap_backend = backend;
+    g_swap_slots = slots;
+    g_swap_free_slots = slots - 1;
+    g_swap_next_slot = 1;
+
+    KLOGF(INFO, "Backend: %s, %zu slots.", backend->name, g_swap_free_slots);
+}
+
+bool swap_enabled()
+{
+    return g_swap_backend;
+}
+
+ssize_t swap_alloc_slot()
+{
+    if (!g_swap_backend)
+        return -ENODEV;
+
+    if (!g_swap_free_slots)
+        return -ENOSPC;
+
+    /* Next fit, pages swapped out together end up next to each other. */
+    size_t slot = g_swap_next_slot;
+    while (g_swap_slot_refs[slot])
+        slot = slot + 1 < g_swap_slots ? slot + 1 : 1;
+
+    g_swap_slot_refs[slot] = 1;
+    --g_swap_free_slots;
+    g_swap_next_slot = slot + 1 < g_swap_slots ? slot + 1 : 1;
+    return slot;
+}
+
+int swap_ref_slot(size_t slot)
+{
+    ASSERT(slot && slot < g_swap_slots && g_swap_slot_refs[slot]);
+
+    if (g_swap_slot_refs[slot] == SWAP_SLOT_MAX_REFS)
+        return -EOVERFLOW;
+
+    ++g_swap_slot_refs[slot];
+    return 0;
+}
+
+void swap_free_slot(size_t slot)
+{
+    ASSERT(slot && slot < g_swap_slots && g_swap_slot_refs[slot]);
+
+    if (--g_swap_slot_refs[slot])
+        return;
+
+    ++g_swap_free_slots;
+    if (g_swap_backend->release)
+        g_swap_backend->release(slot);
+}
+
+int swap_write_page(size_t slot, const void* src)
+{
+    ASSERT(slot && slot < g_swap_slots);
+
+    int st = g_swap_backend->write(slot, src);
+    if (st < 0)
+    {
+        ++g_swap_errors;
+        return st;
+    }
+
+    ++g_swap_swapped_out;
+    return 0;
+}
+
+int swap_read_page(size_t slot, void* dest)
+{
+    ASSERT(slot && slot < g_swap_slots);
+
+    Timer t;
+    timer_start(&t);
+
+    int st = g_swap_backend->read(slot, dest);
+    if (st < 0)
+    {
+        ++g_swap_errors;
+        return st;
+    }
+
+    struct timespec ts;
+    timer_elapsed(&ts, &t);
+    const u64 ns = (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    g_swap_in_ns += ns;
+    if (ns > g_swap_in_max_ns)
+        g_swap_in_max_ns = ns;
+
+    ++g_swap_swapped_in;
+    return 0;
+}
+
+void swap_get_stats(SwapStats* stats)
+{
+    stats->backend = g_swap_backend ? g_swap_backend->name : NULL;
+    stats->slots = g_swap_slots ? g_swap_slots - 1 : 0;
+    stats->free_slots = g_swap_free_slots;
+    stats->swapped_out = g_swap_swapped_out;
+    stats->swapped_in = g_swap_swapped_in;
+    stats->errors = g_swap_errors;
+    stats->swap_in_ns = g_swap_in_ns;
+    stats->swap_in_max_ns = g_swap_in_max_ns;
+}
@@ -0,0 +1,278 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/attrs.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/kboot.h>
+#include <dxgmx/klog.h>
+#include <dxgmx/kmalloc.h>
+#include <dxgmx/mem/dma.h>
+#include <dxgmx/mem/falloc.h>
+#include <dxgmx/mem/pagesize.h>
+#include <dxgmx/mem/zram.h>
+#include <dxgmx/stdlib.h>
+#include <dxgmx/string.h>
+#include <dxgmx/units.h>
+#include <dxgmx/utils/bitmap.h>
+#include <dxgmx/utils/bytes.h>
+#include <dxgmx/utils/lz4.h>
+
+#define KLOGF_PREFIX "zram: "
+
+/* The pool is made up of segments, each one physically contiguous. */
+#define ZRAM_SEGMENT_ORDER 6
+#define ZRAM_SEGMENT_SIZE (PAGESIZE << ZRAM_SEGMENT_ORDER)
+/* Compressed pages take up whole chunks of a segment. */
+#define ZRAM_CHUNK_SIZE 64
+#define ZRAM_SEGMENT_CHUNKS (ZRAM_SEGMENT_SIZE / ZRAM_CHUNK_SIZE)
+/* Pages that don't compress below this are stored as they are. */
+#define ZRAM_MAX_COMPRESSED_SIZE (PAGESIZE * 3 / 4)
+/* Pool size if 'zram_size' is not given, as a percentage of free memory. */
+#define ZRAM_DEFAULT_POOL_PERC 25
+/* How many slots there are for each page of the pool. Compression is expected
+ * to be about this good. */
+#define ZRAM_SLOTS_PER_POOL_PAGE 3
+
+typedef struct S_ZramSegment
+{
+    DMABuffer buf;
+    Bitmap chunks;
+} ZramSegment;
+
+typedef struct S_ZramSlot
+{
+    u16 segment;
+    u16 chunk;
+    /* Compressed size, 0 for a page full of zeros, PAGESIZE if the page is
+     * stored as it is. */
+    u16 size;
+    /* Set once the page is in, slots whose write failed are released all the
+     * same. */
+    bool stored;
+} ZramSlot;
+
+static ZramSegment* g_zram_segments;
+static size_t g_zram_segment_count;
+/* Where zram_write_page() starts looking for room. */
+static size_t g_zram_next_segment;
+static ZramSlot* g_zram_slots;
+
+/* Reclaim only ever writes one page at a time. */
+static _ATTR_ALIGNED(sizeof(u16)) u8 g_zram_workspace[LZ4_WORKSPACE_SIZE];
+static u8 g_zram_compressed[ZRAM_MAX_COMPRESSED_SIZE];
+
+static ZramStats g_zram_stats;
+
+static size_t zram_chunks(size_t size)
+{
+    return (size + ZRAM_CHUNK_SIZE - 1) / ZRAM_CHUNK_SIZE;
+}
+
+static bool zram_is_zero_page(const void* page)
+{
+    const u32* words = page;
+    for (size_t i = 0; i < PAGESIZE / sizeof(u32); ++i)
+    {
+        if (words[i])
+            return false;
+    }
+
+    return true;
+}
+
+/* How many segments the pool should have, see 'zram_size'. */
+static _INIT size_t zram_pool_segments()
+{
+    char value[16];
+    unsigned long mib = 0;
+    if (kboot_cmdline_get("zram_size", value, sizeof(value)) > 0 &&
+        strtoul(value, NULL, 10, &mib) == 0 && mib)
+        return mib * MIB / ZRAM_SEGMENT_SIZE;
+
+    const size_t frames =
+        falloc_get_free_frames_count() / 100 * ZRAM_DEFAULT_POOL_PERC;
+    return frames / (ZRAM_SEGMENT_SIZE / PAGESIZE);
+}
+
+_INIT ssize_t zram_init()
+{
+    const size_t count = zram_pool_segments();
+    if (!count)
+        return -EINVAL;
+
+    g_zram_segments = kcalloc(count * sizeof(ZramSegment));
+    if (!g_zram_segments)
+        return -ENOMEM;
+
+    /* The pool is set aside now, when it's needed falloc is out of frames. The
+     * segments are mapped in the kernel's DMA heap, since that's where page
+     * frames get mapped in the kernel. */
+    size_t i = 0;
+    for (; i < count; ++i)
+    {
+        ZramSegment* seg = &g_zram_segments[i];
+        if (dma_alloc_coherent(ZRAM_SEGMENT_SIZE, &seg->buf) < 0)
+            break;
+
+        if (bitmap_init(ZRAM_SEGMENT_CHUNKS, &seg->chunks) < 0)
+        {
+            dma_free_coherent(&seg->buf);
+            break;
+        }
+    }
+
+    if (!i)
+    {
+        kfree(g_zram_segments);
+        g_zram_segments = NULL;
+        return -ENOMEM;
+    }
+
+    if (i < count)
+        KLOGF(WARN, "Only got %zu out of %zu segments.", i, count);
+
+    const size_t slots =
+        i * (ZRAM_SEGMENT_SIZE / PAGESIZE) * ZRAM_SLOTS_PER_POOL_PAGE;
+    g_zram_slots = kcalloc(slots * sizeof(ZramSlot));
+    if (!g_zram_slots)
+    {
+        while (i--)
+        {
+            bitmap_destroy(&g_zram_segments[i].chunks);
+            dma_free_coherent(&g_zram_segments[i].buf);
+        }
+
+        kfree(g_zram_segments);
+        g_zram_segments = NULL;
+        return -ENOMEM;
+    }
+
+    g_zram_segment_count = i;
+    g_zram_stats.pool_size = (u64)i * ZRAM_SEGMENT_SIZE;
+
+    char unit[4];
+    KLOGF(
+        INFO,
+        "Pool of %.2f%s.",
+        (double)bytes_to_human_readable(g_zram_stats.pool_size, unit),
+        unit);
+
+    return slots;
+}
+
+int zram_write_page(size_t slot, const void* src)
+{
+    ZramSlot* zslot = &g_zram_slots[slot];
+
+    if (zram_is_zero_page(src))
+    {
+        zslot->size = 0;
+        zslot->stored = true;
+        ++g_zram_stats.zero_pages;
+        ++g_zram_stats.pages;
+        return 0;
+    }
+
+    const void* data = g_zram_compressed;
+    ssize_t size = lz4_compress(
+        src,
+        PAGESIZE,
+        g_zram_compressed,
+        ZRAM_MAX_COMPRESSED_SIZE,
+        g_zram_workspace);
+    if (size < 0)
+    {
+        data = src;
+        size = PAGESIZE;
+    }
+
+    const size_t chunks = zram_chunks(size);
+    for (size_t i = 0; i < g_zram_segment_count; ++i)
+    {
+        const size_t segidx = (g_zram_next_segment + i) % g_zram_segment_count;
+        ZramSegment* seg = &g_zram_segments[segidx];
+
+        const ssize_t chunk =
+            bitmap_first_n_free_and_mark(chunks, &seg->chunks);
+        if (chunk < 0)
+            continue;
+
+        memcpy((void*)(seg->buf.vaddr + chunk * ZRAM_CHUNK_SIZE), data, size);
+
+        zslot->segment = segidx;
+        zslot->chunk = chunk;
+        zslot->size = size;
+        zslot->stored = true;
+        g_zram_next_segment = segidx;
+
+        ++g_zram_stats.pages;
+        if (size == PAGESIZE)
+            ++g_zram_stats.incompressible_pages;
+
+        g_zram_stats.compressed_bytes += size;
+        g_zram_stats.pool_used += chunks * ZRAM_CHUNK_SIZE;
+        return 0;
+    }
+
+    ++g_zram_stats.pool_full;
+    return -ENOSPC;
+}
+
+int zram_read_page(size_t slot, void* dest)
+{
+    const ZramSlot* zslot = &g_zram_slots[slot];
+    if (!zslot->size)
+    {
+        memset(dest, 0, PAGESIZE);
+        return 0;
+    }
+
+    const ZramSegment* seg = &g_zram_segments[zslot->segment];
+    const void* data = (void*)(seg->buf.vaddr + zslot->chunk * ZRAM_CHUNK_SIZE);
+
+    if (zslot->size == PAGESIZE)
+    {
+        memcpy(dest, data, PAGESIZE);
+        return 0;
+    }
+
+    if (lz4_decompress(data, zslot->size, dest, PAGESIZE) != PAGESIZE)
+    {
+        KLOGF(ERR, "Slot %zu is corrupted!", slot);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+void zram_release_slot(size_t slot)
+{
+    ZramSlot* zslot = &g_zram_slots[slot];
+    if (!zslot->stored)
+        return;
+
+    zslot->stored = false;
+    --g_zram_stats.pages;
+    if (!zslot->size)
+    {
+        --g_zram_stats.zero_pages;
+        return;
+    }
+
+    if (zslot->size == PAGESIZE)
+        --g_zram_stats.incompressible_pages;
+
+    const size_t chunks = zram_chunks(zslot->size);
+    bitmap_unmark(
+        zslot->chunk, chunks, &g_zram_segments[zslot->segment].chunks);
+
+    g_zram_stats.compressed_bytes -= zslot->size;
+    g_zram_stats.pool_used -= chunks * ZRAM_CHUNK_SIZE;
+}
+
+void zram_get_stats(ZramStats* stats)
+{
+    *stats = g_zram_stats;
+}
@@ -5,11 +5,13 @@
 
 #include <dxgmx/assert.h>
 #include <dxgmx/attrs.h>
+#include <dxgmx/cpu.h>
 #include <dxgmx/elf/elfloader.h>
 #include <dxgmx/errno.h>
 #include <dxgmx/fs/vfs.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
+#include <dxgmx/mem/dma.h>
 #include <dxgmx/proc/proc.h>
 #include <dxgmx/proc/proc_limits.h>
 #include <dxgmx/string.h>
@@ -19,6 +21,33 @@
 
 #define KLOGF_PREFIX "proc: "
 
+/* Keep track of how many cycles context switches take, see proc_switch(). */
+#define PROC_SWITCH_STATS 0
+/* Log the average every this many context switches. */
+#define PROC_SWITCH_STATS_INTERVAL 4096
+
+#if PROC_SWITCH_STATS == 1
+/* Cycle counter right before the last task switch. */
+static u64 g_switch_start;
+static u64 g_switch_cycles;
+static size_t g_switch_count;
+
+/* Runs on the stack of the process that was switched to, so the TLB misses
+ * caused by the paging struct reload are counted in as well. */
+static void proc_switch_stats_end()
+{
+    g_switch_cycles += cpu_read_cycle_counter() - g_switch_start;
+    if (++g_switch_count % PROC_SWITCH_STATS_INTERVAL)
+        return;
+
+    KLOGF(
+        DEBUG,
+        "%zu context switches, %llu cycles on average.",
+        g_switch_count,
+        g_switch_cycles / g_switch_count);
+}
+#endif
+
 static void proc_destroy_kernel_stack(Process* targetproc)
 {
     if (!targetproc->kstack_top)
@@ -28,26 +57,23 @@ static void proc_destroy_kernel_stack(Process* targetproc)
     targetproc->kstack_top = 0;
 }
 
-/* Create and map the stack for targetproc */
+/* Create the stack for targetproc. Stack pages are mapped when they're first
+ * touched. */
 static int proc_create_stack(Process* targetproc)
 {
     const ptr stack_top = PROC_HIGH_ADDRESS - PAGESIZE;
     const size_t stack_pages = PROC_STACK_SIZE / PAGESIZE;
 
-    // FIXME: don't explictly map all stack pages here.
-    for (size_t i = 0; i < stack_pages; ++i)
+    int st = pagingstruct_add_area(
+        stack_top - PROC_STACK_SIZE,
+        stack_top,
+        PAGE_RW | PAGE_USER,
+        targetproc->paging_struct);
+
+    if (st < 0)
     {
-        const ptr vaddr = stack_top - (i + 1) * PAGESIZE;
-        int st = mm_new_user_page(vaddr, PAGE_RW, targetproc->paging_struct);
-        if (st < 0)
-        {
-            KLOGF(
-                ERR,
-                "Failed to map a process' stack, (%zu/%zu) succeeded.",
-                i,
-                stack_pages);
-            return st;
-        }
+        KLOGF(ERR, "Failed to create a process' stack!");
+        return st;
     }
 
     targetproc->stack_top = stack_top;
@@ -170,7 +196,7 @@ void proc_free(Process* proc)
         proc->fd_last_free_idx = 0;
     }
 
-    // FIXME: dma bitmap memleak :)
+    dma_destroy(proc);
 
     proc_destroy_kernel_stack(proc);
 }
@@ -202,6 +228,56 @@ int proc_create_address_space(
     return 0;
 }
 
+int proc_fork(Process* proc, Process* newproc)
+{
+    newproc->paging_struct = kmalloc(sizeof(PagingStruct));
+    if (!newproc->paging_struct)
+        return -ENOMEM;
+
+    int st = mm_init_paging_struct(newproc->paging_struct);
+    if (st < 0)
+    {
+        kfree(newproc->paging_struct);
+        newproc->paging_struct = NULL;
+        return st;
+    }
+
+    mm_map_kernel_into_paging_struct(newproc->paging_struct);
+
+    st = mm_fork_paging_struct(proc->paging_struct, newproc->paging_struct);
+    if (st < 0)
+        return st;
+
+    st = dma_fork(proc, newproc);
+    if (st < 0)
+        return st;
+
+    newproc->path = strdup(proc->path);
+    if (!newproc->path)
+        return -ENOMEM;
+
+    newproc->inst_ptr = proc->inst_ptr;
+    newproc->stack_top = proc->stack_top;
+    newproc->stack_pagespan = proc->stack_pagespan;
+    newproc->stack_ptr = proc->stack_ptr;
+
+    while (newproc->fd_count < proc->fd_count)
+    {
+        if (proc_enlarge_fds(newproc) < 0)
+            return -ENOMEM;
+    }
+
+    st = proc_create_kernel_stack(newproc);
+    if (st < 0)
+        return st;
+
+    task_init_forked(newproc->kstack_top, proc->kstack_top, &newproc->task_ctx);
+
+    /* It's been running up to the fork, as far as it's concerned. */
+    newproc->state = PROC_YIELDED;
+    return 0;
+}
+
 void proc_enter_initial(Process* proc)
 {
     /* Note to self: We may want to disable future preemption from happening
@@ -221,7 +297,16 @@ void proc_switch(Process* curproc, Process* nextproc)
         ASSERT_NOT_HIT();
     }
 
+#if PROC_SWITCH_STATS == 1
+    g_switch_start = cpu_read_cycle_counter();
+#endif
+
+    nextproc->state = PROC_RUNNING;
     mm_load_paging_struct(nextproc->paging_struct);
     task_set_impending_stack_top(nextproc->kstack_top);
     task_switch(&curproc->task_ctx, &nextproc->task_ctx);
+
+#if PROC_SWITCH_STATS == 1
+    proc_switch_stats_end();
+#endif
 }
@@ -10,20 +10,36 @@
 #include <dxgmx/errno.h>
 #include <dxgmx/fs/vfs.h>
 #include <dxgmx/interrupts.h>
+#include <dxgmx/kboot.h>
 #include <dxgmx/kimg.h>
 #include <dxgmx/klog.h>
 #include <dxgmx/kmalloc.h>
+#include <dxgmx/mem/mm.h>
+#include <dxgmx/mem/shrinker.h>
 #include <dxgmx/proc/proc.h>
 #include <dxgmx/proc/procm.h>
 #include <dxgmx/proc/sched.h>
+#include <dxgmx/proc/waitqueue.h>
+#include <dxgmx/task/task.h>
+#include <dxgmx/stdlib.h>
 #include <dxgmx/string.h>
+#include <dxgmx/timer.h>
 #include <dxgmx/todo.h>
 #include <dxgmx/user.h>
 #include <dxgmx/utils/bytes.h>
 
 #define KLOGF_PREFIX "procm: "
 
+/* How many slots g_procs grows by at once. */
+#define PROCM_PROCS_ALLOC_STEP 16
+/* How long a process runs before it's preempted, if the command line doesn't
+ * say otherwise with 'sched_quantum=<ms>'. */
+#define PROCM_DEFAULT_QUANTUM_MS 10
+/* How often the idle task logs how much of the time it got. */
+#define PROCM_IDLE_STATS_INTERVAL_NS 10000000000ULL
+
 static Process g_kernel_proc;
+static KMallocCache g_proc_cache = KMALLOC_CACHE_INIT("proc", Process);
 
 static Process** g_procs;
 static size_t g_proc_size;
@@ -35,6 +51,32 @@ static Scheduler** g_schedulers;
 static size_t g_scheduler_count;
 static Scheduler* g_active_sched;
 
+/* Set once pid 1 is running, timer ticks are ignored until then. */
+static bool g_sched_started;
+static u64 g_sched_quantum_ns;
+/* How long the current process has been running for, since it was last
+ * switched to. */
+static u64 g_sched_slice_ns;
+/* The current process is to be preempted the next time it's about to return
+ * to userspace, see procm_sched_preempt(). */
+static bool g_sched_resched;
+/* The last process that died. It's reaped by whoever switches next, since
+ * it's kernel stack can't be freed while it's still being used. */
+static Process* g_sched_dead;
+
+/* Runs when nobody else can, see procm_sched_idle_main(). It's not in the
+ * process pool, and the scheduler doesn't know about it. */
+static Process g_idle_proc;
+/* Set while the idle task is running. */
+static bool g_sched_idling;
+/* Nanoseconds worth of timer ticks since the scheduler started, and how many
+ * of those the idle task got. */
+static u64 g_sched_uptime_ns;
+static u64 g_sched_idle_ns;
+/* Uptime and idle time the last time they were logged. */
+static u64 g_idle_stats_uptime_ns;
+static u64 g_idle_stats_idle_ns;
+
 static pid_t procm_available_pid()
 {
     const size_t start_point = g_last_free_proc_idx;
@@ -53,11 +95,10 @@ static int procm_add_proc_to_pool(Process* proc)
     size_t pid_idx = (size_t)proc->pid - 1;
     ASSERT(pid_idx <= g_proc_size);
 
-#define ALLOC_STEP 16
     if (pid_idx == g_proc_size)
     {
         const size_t prevsize = g_proc_size * sizeof(Process*);
-        const size_t stepsize = ALLOC_STEP * sizeof(Process*);
+        const size_t stepsize = PROCM_PROCS_ALLOC_STEP * sizeof(Process*);
 
         Process** tmp = krealloc(g_procs, prevsize + stepsize);
         if (!tmp)
@@ -65,9 +106,15 @@ static int procm_add_proc_to_pool(Process* proc)
 
         g_procs = tmp;
         memset((void*)g_procs + prevsize, 0, stepsize);
-        g_proc_size += ALLOC_STEP;
+        g_proc_size += PROCM_PROCS_ALLOC_STEP;
+    }
+
+    if (g_active_sched->enqueue)
+    {
+        int st = g_active_sched->enqueue(g_active_sched, proc);
+        if (st < 0)
+            return st;
     }
-#undef ALLOC_STEP
 
     ++g_proc_count;
     g_procs[pid_idx] = proc;
@@ -76,29 +123,71 @@ static int procm_add_proc_to_pool(Process* proc)
 
 static int procm_kill(Process* proc)
 {
-    /* FIXME: We don't shrink the g_procs array at all, we may want to cut
-     * down on it sometimes if it gets too big and/or the system is starved for
-     * memory ? */
+    if (g_active_sched->dequeue)
+        g_active_sched->dequeue(g_active_sched, proc);
+
+    /* g_procs is cut down by it's shrinker, see procm_shrinker_scan(). */
     g_procs[proc->pid - 1] = NULL;
     g_last_free_proc_idx = proc->pid - 1;
     --g_proc_count;
     proc_free(proc);
-    kfree(proc);
+    kmalloc_cache_free(proc, &g_proc_cache);
     return 0;
 }
 
-static int procm_try_kill_proc(Process* targetproc, Process* actingproc)
+/* How many slots at the end of g_procs are not in use. */
+static size_t procm_shrinker_count()
+{
+    size_t used = g_proc_size;
+    while (used > 1 && !g_procs[used - 1])
+        --used;
+
+    return g_proc_size - used;
+}
+
+/* Cut down unused slots at the end of g_procs. */
+static size_t procm_shrinker_scan(size_t n)
+{
+    const size_t count = procm_shrinker_count();
+    if (n > count)
+        n = count;
+
+    if (!n)
+        return 0;
+
+    Process** tmp = krealloc(g_procs, (g_proc_size - n) * sizeof(Process*));
+    if (!tmp)
+        return 0;
+
+    g_procs = tmp;
+    g_proc_size -= n;
+    if (g_last_free_proc_idx > g_proc_size)
+        g_last_free_proc_idx = g_proc_size;
+
+    return n;
+}
+
+static Shrinker g_procs_shrinker = {
+    .name = "procs",
+    .kind = SHRINK_KMALLOC,
+    .cost = 1,
+    .count = procm_shrinker_count,
+    .scan = procm_shrinker_scan};
+
+/* See 'sched_quantum'. */
+static _INIT u64 procm_sched_pick_quantum_ns()
 {
-    if (actingproc == targetproc)
+    char value[16];
+    unsigned long ms = 0;
+    if (kboot_cmdline_get("sched_quantum", value, sizeof(value)) > 0)
     {
-        /* pid 1 has exited. */
-        if (g_proc_count == 1)
-            panic("PID 1 returned %d.", targetproc->exit_status);
+        if (strtoul(value, NULL, 10, &ms) == 0 && ms)
+            return (u64)ms * 1000000;
 
-        return -EINVAL;
+        KLOGF(WARN, "Bad quantum \"%s\", ignoring.", value);
     }
 
-    return procm_kill(targetproc);
+    return (u64)PROCM_DEFAULT_QUANTUM_MS * 1000000;
 }
 
 _INIT int procm_init()
@@ -125,6 +214,9 @@ _INIT int procm_init()
     g_active_sched->procs = &g_procs;
     g_active_sched->proc_count = &g_proc_size;
 
+    g_sched_quantum_ns = procm_sched_pick_quantum_ns();
+    KLOGF(INFO, "Quantum is %llums.", g_sched_quantum_ns / 1000000);
+
     /* Reserve space for pid 1 */
     g_procs = kcalloc(1 * sizeof(Process*));
     if (!g_procs)
@@ -132,7 +224,14 @@ _INIT int procm_init()
 
     g_proc_size = 1;
     g_last_free_proc_idx = 0;
-    return 0;
+
+    if (proc_init(&g_idle_proc) < 0 ||
+        proc_create_kernel_stack(&g_idle_proc) < 0)
+        panic("Failed to create the idle task!");
+
+    g_idle_proc.paging_struct = mm_get_kernel_paging_struct();
+
+    return shrinker_register(&g_procs_shrinker);
 }
 
 pid_t procm_spawn_proc(
@@ -144,14 +243,14 @@ pid_t procm_spawn_proc(
     (void)argv;
     (void)envp;
 
-    Process* newproc = kcalloc(sizeof(Process));
+    Process* newproc = kmalloc_cache_calloc(&g_proc_cache);
     if (!newproc)
         return -ENOMEM;
 
     int st = proc_init(newproc);
     if (st < 0)
     {
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return st;
     }
 
@@ -159,7 +258,7 @@ pid_t procm_spawn_proc(
     if (st < 0)
     {
         proc_free(newproc);
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return st;
     }
 
@@ -167,7 +266,7 @@ pid_t procm_spawn_proc(
     if (st < 0)
     {
         proc_free(newproc);
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return -ENOMEM;
     }
 
@@ -176,7 +275,7 @@ pid_t procm_spawn_proc(
     if (!newproc->path)
     {
         proc_free(newproc);
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return -ENOMEM;
     }
 
@@ -184,7 +283,7 @@ pid_t procm_spawn_proc(
     if (newproc->pid <= 0)
     {
         proc_free(newproc);
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return -ENOSPC;
     }
 
@@ -192,13 +291,77 @@ pid_t procm_spawn_proc(
     if (st < 0)
     {
         proc_free(newproc);
-        kfree(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
         return st;
     }
 
     return newproc->pid;
 }
 
+pid_t procm_fork(Process* proc)
+{
+    Timer t;
+    timer_start(&t);
+
+    Process* newproc = kmalloc_cache_calloc(&g_proc_cache);
+    if (!newproc)
+        return -ENOMEM;
+
+    int st = proc_init(newproc);
+    if (st < 0)
+    {
+        kmalloc_cache_free(newproc, &g_proc_cache);
+        return st;
+    }
+
+    st = proc_fork(proc, newproc);
+    if (st < 0)
+    {
+        proc_free(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
+        return st;
+    }
+
+    newproc->pid = procm_available_pid();
+    if (newproc->pid <= 0)
+    {
+        proc_free(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
+        return -ENOSPC;
+    }
+
+    st = procm_add_proc_to_pool(newproc);
+    if (st < 0)
+    {
+        proc_free(newproc);
+        kmalloc_cache_free(newproc, &g_proc_cache);
+        return st;
+    }
+
+    /* File descriptors are tied to the pid. */
+    st = vfs_fork_fds(proc, newproc);
+    if (st < 0)
+    {
+        procm_kill(newproc);
+        return st;
+    }
+
+    /* Forking only touches the page tables, so this should grow with the
+     * resident set size, not with how much memory is actually in there. No
+     * floating point here, the user's FPU state isn't saved. */
+    struct timespec elapsed;
+    timer_elapsed(&elapsed, &t);
+    KLOGF(
+        DEBUG,
+        "Forked pid %d into %d, %zu resident pages in %lluus.",
+        proc->pid,
+        newproc->pid,
+        proc->paging_struct->tracked_pages_count,
+        (u64)elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000);
+
+    return newproc->pid;
+}
+
 _INIT pid_t procm_spawn_kernel_proc()
 {
     if (proc_init(&g_kernel_proc) < 0)
@@ -280,6 +443,7 @@ void procm_sched_start()
         panic("Failed to preapre scheduler!");
 
     Process* pid1 = g_active_sched->current_proc(g_active_sched);
+    g_sched_started = true;
     proc_enter_initial(pid1);
 }
 
@@ -288,16 +452,192 @@ Process* procm_sched_current_proc()
     return g_active_sched->current_proc(g_active_sched);
 }
 
-void procm_sched_yield()
+/* Use the time nobody wants the CPU for to give back memory if we're running
+ * low, or to get ahead on zeroing page frames. */
+static void procm_sched_idle_work()
 {
+    shrinker_balance();
+    mm_refill_zeroed_frames();
+}
+
+static void procm_sched_reap_dead()
+{
+    if (g_sched_dead)
+    {
+        procm_kill(g_sched_dead);
+        g_sched_dead = NULL;
+    }
+}
+
+static void procm_sched_idle_stats()
+{
+    const u64 uptime = g_sched_uptime_ns - g_idle_stats_uptime_ns;
+    if (uptime < PROCM_IDLE_STATS_INTERVAL_NS)
+        return;
+
+    const u64 idle = g_sched_idle_ns - g_idle_stats_idle_ns;
+    KLOGF(
+        DEBUG,
+        "Idle for %llu%% of the last %llums.",
+        idle * 100 / uptime,
+        uptime / 1000000);
+
+    g_idle_stats_uptime_ns = g_sched_uptime_ns;
+    g_idle_stats_idle_ns = g_sched_idle_ns;
+}
+
+/* The idle task. It keeps nothing on it's stack from one run to the next, so
+ * it starts over from here every time it's switched to, see
+ * procm_sched_switch(). */
+static _ATTR_NORETURN void procm_sched_idle_main()
+{
+    /* Whoever switched to us might have just died, we're off it's kernel
+     * stack now. */
+    procm_sched_reap_dead();
+
+    g_sched_idling = true;
+    while (true)
+    {
+        Process* next = g_active_sched->next_proc(g_active_sched);
+        if (next)
+        {
+            g_sched_idling = false;
+            proc_switch(&g_idle_proc, next);
+            ASSERT_NOT_HIT();
+        }
+
+        procm_sched_idle_work();
+        procm_sched_idle_stats();
+
+        /* Halt until an interrupt comes in, it might wake someone up. */
+        interrupts_wait_irq();
+    }
+}
+
+/* Give the CPU to the next process, leaving the current one in 'state'. */
+static void procm_sched_switch(ProcessState state)
+{
+    /* Wake ups and timer ticks come in from interrupts, and they poke at the
+     * scheduler as well. */
+    const bool irqs = interrupts_disable_irqs_save();
+
     Process* current_proc = g_active_sched->current_proc(g_active_sched);
-    current_proc->state = PROC_YIELDED;
 
-    Process* next;
-    while ((next = g_active_sched->next_proc(g_active_sched))->zombie)
-        procm_try_kill_proc(next, current_proc);
+    procm_sched_reap_dead();
+
+    /* A dead process never runs again, it's reaped once we're off of it. */
+    if (current_proc->zombie)
+    {
+        /* pid 1 has exited. */
+        if (g_proc_count == 1)
+            panic("PID 1 returned %d.", current_proc->exit_status);
+
+        state = PROC_BLOCKED;
+        g_sched_dead = current_proc;
+    }
+
+    current_proc->state = state;
+
+    /* Whoever runs next gets a fresh quantum. */
+    g_sched_slice_ns = 0;
+    g_sched_resched = false;
+
+    Process* next = g_active_sched->next_proc(g_active_sched);
+    if (!next)
+    {
+        /* Everyone is blocked, fall back to the idle task. */
+        task_init_kernel(
+            g_idle_proc.kstack_top,
+            procm_sched_idle_main,
+            &g_idle_proc.task_ctx);
+        g_idle_proc.state = PROC_YIELDED;
+        next = &g_idle_proc;
+    }
 
     proc_switch(current_proc, next);
+
+    interrupts_restore_irqs(irqs);
+}
+
+void procm_sched_yield()
+{
+    procm_sched_switch(PROC_YIELDED);
+}
+
+bool procm_sched_started()
+{
+    return g_sched_started;
+}
+
+bool procm_sched_can_block()
+{
+    return g_sched_started && !g_sched_idling;
+}
+
+void procm_sched_block()
+{
+    procm_sched_switch(PROC_BLOCKED);
+}
+
+void procm_sched_wake(Process* proc)
+{
+    if (proc->state != PROC_BLOCKED)
+        return;
+
+    proc->state = PROC_YIELDED;
+    if (g_active_sched->wake)
+        g_active_sched->wake(g_active_sched, proc);
+}
+
+void procm_sched_tick(u64 ns)
+{
+    if (!g_sched_started)
+        return;
+
+    waitqueue_tick(ns);
+
+    g_sched_uptime_ns += ns;
+    if (g_sched_idling)
+    {
+        /* Nobody to preempt, the idle task checks for work after every
+         * interrupt anyway. */
+        g_sched_idle_ns += ns;
+        return;
+    }
+
+    g_sched_slice_ns += ns;
+
+    bool resched;
+    if (g_active_sched->tick)
+        resched = g_active_sched->tick(g_active_sched, ns);
+    else
+        resched = g_sched_slice_ns >= g_sched_quantum_ns;
+
+    if (resched)
+        g_sched_resched = true;
+}
+
+void procm_sched_preempt()
+{
+    if (!g_sched_resched)
+        return;
+
+    procm_sched_switch(PROC_PREEMPTED);
+}
+
+u64 procm_sched_quantum_ns()
+{
+    return g_sched_quantum_ns;
+}
+
+u64 procm_sched_idle_ns()
+{
+    return g_sched_idle_ns;
+}
+
+pid_t sys_fork()
+{
+    return procm_fork(procm_sched_current_proc());
 }
 
 void sys_exit(int status)
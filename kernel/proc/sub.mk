@@ -2,3 +2,4 @@
 KERNELOBJS += \
 kernel/proc/procm.c.o \
 kernel/proc/proc.c.o \
+kernel/proc/waitqueue.c.o \
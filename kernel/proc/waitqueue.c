@@ -0,0 +1,169 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/errno.h>
+#include <dxgmx/interrupts.h>
+#include <dxgmx/proc/procm.h>
+#include <dxgmx/proc/waitqueue.h>
+
+/* A sleeping process. Lives on the sleeper's kernel stack, which is around
+ * for as long as it's asleep. */
+typedef struct S_WaitQueueEntry
+{
+    Process* proc;
+    /* The queue it's sleeping on, NULL once it's been woken up from it. */
+    WaitQueue* queue;
+    struct S_WaitQueueEntry* next;
+
+    /* When the timeout runs out, 0 if there's none. */
+    u64 deadline_ns;
+    bool timed_out;
+    struct S_WaitQueueEntry* timed_next;
+} WaitQueueEntry;
+
+/* Sleepers with a timeout, soonest deadline first. */
+static WaitQueueEntry* g_timed_sleepers;
+/* Nanoseconds worth of timer ticks since the scheduler started. */
+static u64 g_waitqueue_now_ns;
+
+static void waitqueue_add(WaitQueueEntry* entry, WaitQueue* wq)
+{
+    entry->queue = wq;
+    entry->next = NULL;
+    if (wq->tail)
+        wq->tail->next = entry;
+    else
+        wq->head = entry;
+
+    wq->tail = entry;
+}
+
+static void waitqueue_remove(WaitQueueEntry* entry)
+{
+    WaitQueue* wq = entry->queue;
+    WaitQueueEntry* prev = NULL;
+    for (WaitQueueEntry* e = wq->head; e; prev = e, e = e->next)
+    {
+        if (e != entry)
+            continue;
+
+        if (prev)
+            prev->next = entry->next;
+        else
+            wq->head = entry->next;
+
+        if (wq->tail == entry)
+            wq->tail = prev;
+
+        break;
+    }
+
+    entry->queue = NULL;
+}
+
+static void waitqueue_add_timed(WaitQueueEntry* entry)
+{
+    WaitQueueEntry** link = &g_timed_sleepers;
+    while (*link && (*link)->deadline_ns <= entry->deadline_ns)
+        link = &(*link)->timed_next;
+
+    entry->timed_next = *link;
+    *link = entry;
+}
+
+static void waitqueue_remove_timed(WaitQueueEntry* entry)
+{
+    for (WaitQueueEntry** link = &g_timed_sleepers; *link;
+         link = &(*link)->timed_next)
+    {
+        if (*link == entry)
+        {
+            *link = entry->timed_next;
+            break;
+        }
+    }
+
+    entry->deadline_ns = 0;
+}
+
+static int waitqueue_sleep(WaitQueue* wq, u64 timeout_ns)
+{
+    if (!procm_sched_can_block())
+    {
+        interrupts_wait_irq();
+        return 0;
+    }
+
+    WaitQueueEntry entry = {.proc = procm_sched_current_proc()};
+    if (wq)
+        waitqueue_add(&entry, wq);
+
+    if (timeout_ns)
+    {
+        entry.deadline_ns = g_waitqueue_now_ns + timeout_ns;
+        waitqueue_add_timed(&entry);
+    }
+
+    procm_sched_block();
+
+    /* Whichever of the two didn't wake us up, we're still on. */
+    if (entry.queue)
+        waitqueue_remove(&entry);
+
+    if (entry.deadline_ns)
+        waitqueue_remove_timed(&entry);
+
+    return entry.timed_out ? -ETIMEDOUT : 0;
+}
+
+void waitqueue_wait(WaitQueue* wq)
+{
+    waitqueue_sleep(wq, 0);
+}
+
+int waitqueue_wait_timeout(WaitQueue* wq, u64 ns)
+{
+    /* 0 means no timeout. */
+    return waitqueue_sleep(wq, ns ? ns : 1);
+}
+
+size_t waitqueue_wake_all(WaitQueue* wq)
+{
+    const bool irqs = interrupts_disable_irqs_save();
+
+    size_t woken = 0;
+    for (WaitQueueEntry* entry = wq->head; entry; entry = entry->next)
+    {
+        entry->queue = NULL;
+        /* Woken up in time, the timeout can't run out on us anymore while we
+         * wait to be scheduled. */
+        if (entry->deadline_ns)
+            waitqueue_remove_timed(entry);
+
+        procm_sched_wake(entry->proc);
+        ++woken;
+    }
+
+    wq->head = wq->tail = NULL;
+
+    interrupts_restore_irqs(irqs);
+    return woken;
+}
+
+void waitqueue_tick(u64 ns)
+{
+    g_waitqueue_now_ns += ns;
+
+    while (g_timed_sleepers &&
+           g_timed_sleepers->deadline_ns <= g_waitqueue_now_ns)
+    {
+        WaitQueueEntry* entry = g_timed_sleepers;
+        g_timed_sleepers = entry->timed_next;
+
+        entry->deadline_ns = 0;
+        entry->timed_out = true;
+        procm_sched_wake(entry->proc);
+    }
+}
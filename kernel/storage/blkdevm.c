@@ -111,6 +111,7 @@ int blkdevm_enumerate_partitions(BlockDevice* dev)
             .offset = part->lba,
             .sector_count = part->sector_count,
             .sectorsize = dev->sectorsize,
+            .type = part->type,
             .read = partition_generic_read,
             .write = partition_generic_write,
             .parent = dev};
@@ -206,6 +207,17 @@ blkdevm_find_mountable_blkdev_by_uuid(const char* uuid)
     return NULL;
 }
 
+const MountableBlockDevice* blkdevm_find_mountable_blkdev_by_type(u8 type)
+{
+    FOR_EACH_ENTRY_IN_LL (g_mountable_blkdevs, MountableBlockDevice*, mblkdev)
+    {
+        if (mblkdev->type == type)
+            return mblkdev;
+    }
+
+    return NULL;
+}
+
 const MountableBlockDevice*
 blkdevm_find_mountable_blkdev_by_name(const char* name)
 {
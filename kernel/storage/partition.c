@@ -114,6 +114,7 @@ partitiontable_try_create_mbr(const BlockDevice* dev, PartitionTable* pt)
 
         part->lba = mbrpart->lba_start;
         part->sector_count = mbrpart->sector_count;
+        part->type = mbrpart->system_id;
 
         ++idx;
     }
@@ -20,6 +20,9 @@ static int bitmap_mark_bitmap(size_t byte, u8 bit, size_t n, Bitmap* bm)
             if (--n == 0)
                 return 0;
         }
+
+        /* Only the first byte starts in the middle. */
+        bit = 0;
     }
 
     return -1;
@@ -41,7 +44,19 @@ int bitmap_init(size_t units, Bitmap* bm)
     return 0;
 }
 
-ssize_t bitmap_first_n_free_and_mark(size_t n, Bitmap* bm)
+void bitmap_destroy(Bitmap* bm)
+{
+    if (bm->start)
+        kfree(bm->start);
+
+    bm->start = NULL;
+    bm->size = 0;
+    bm->byte_cursor = 0;
+    bm->bit_cursor = 0;
+}
+
+/* Look for 'n' free units from the cursor onwards. */
+static ssize_t bitmap_first_n_free_and_mark_from_cursor(size_t n, Bitmap* bm)
 {
     size_t found = 0;
     size_t byte_start = 0;
@@ -84,5 +99,72 @@ ssize_t bitmap_first_n_free_and_mark(size_t n, Bitmap* bm)
             bm->bit_cursor = 0;
     }
 
+    /* Next time start from the beginning. */
+    bm->byte_cursor = 0;
+    bm->bit_cursor = 0;
+    return -ENOMEM;
+}
+
+ssize_t bitmap_first_n_free_and_mark(size_t n, Bitmap* bm)
+{
+    const bool from_start = !bm->byte_cursor && !bm->bit_cursor;
+
+    ssize_t st = bitmap_first_n_free_and_mark_from_cursor(n, bm);
+    /* There may be room before the cursor, things could have been unmarked
+     * since we went past them. */
+    if (st < 0 && !from_start)
+        st = bitmap_first_n_free_and_mark_from_cursor(n, bm);
+
+    return st;
+}
+
+int bitmap_unmark(size_t start, size_t n, Bitmap* bm)
+{
+    if (start + n > bm->size * 8 || start + n < start)
+        return -EINVAL;
+
+    for (size_t unit = start; unit < start + n; ++unit)
+        bm->start[unit / 8] &= ~(1 << (unit % 8));
+
+    return 0;
+}
+
+ssize_t bitmap_first_n_free_aligned_and_mark(
+    size_t n, size_t align, size_t off, Bitmap* bm)
+{
+    if (!n || !align)
+        return -EINVAL;
+
+    const size_t units = bm->size * 8;
+    size_t start = off % align;
+    while (start + n <= units)
+    {
+        size_t i = 0;
+        for (; i < n; ++i)
+        {
+            const size_t unit = start + i;
+            if (bm->start[unit / 8] & (1 << (unit % 8)))
+                break;
+        }
+
+        if (i == n)
+        {
+            ASSERT(bitmap_mark_bitmap(start / 8, start % 8, n, bm) == 0);
+            return start;
+        }
+
+        /* Skip to the first aligned unit after the taken one. */
+        start += (i / align + 1) * align;
+    }
+
     return -ENOMEM;
 }
+
+size_t bitmap_count_marked(const Bitmap* bm)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < bm->size; ++i)
+        count += __builtin_popcount(bm->start[i]);
+
+    return count;
+}
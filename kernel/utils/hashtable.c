@@ -12,6 +12,9 @@
 #define INITIAL_HASHTABLE_SLOTS 8
 #define INITIAL_ENLARGE_THRESHOLD 4
 
+static KMallocCache g_entry_cache =
+    KMALLOC_CACHE_INIT("hashtable entry", HashTableEntry);
+
 static int hashtable_maybe_enlarge(HashTable* ht)
 {
     if (ht->biggest_slot_entry_count < ht->slot_entry_count_threshold)
@@ -56,9 +59,8 @@ static ERR_OR(size_t)
 static int hashtable_add_value_to_slot(
     hashtable_key_t key, hashtable_val_t value, HashTableSlot* slot)
 {
-    for (size_t i = 0; i < slot->entry_count; ++i)
+    for (HashTableEntry* entry = slot->entries; entry; entry = entry->next)
     {
-        HashTableEntry* entry = &slot->entries[i];
         if (entry->key == key)
         {
             entry->value = value;
@@ -66,24 +68,23 @@ static int hashtable_add_value_to_slot(
         }
     }
 
-    HashTableEntry* tmp = krealloc(
-        slot->entries, (slot->entry_count + 1) * sizeof(HashTableEntry));
-    if (!tmp)
+    HashTableEntry* entry = kmalloc_cache_alloc(&g_entry_cache);
+    if (!entry)
         return -ENOMEM;
 
-    slot->entries = tmp;
+    entry->key = key;
+    entry->value = value;
+    entry->next = slot->entries;
+    slot->entries = entry;
     ++slot->entry_count;
-    slot->entries[slot->entry_count - 1].key = key;
-    slot->entries[slot->entry_count - 1].value = value;
     return 0;
 }
 
 static HashTableEntry*
 hashtable_find_entry(hashtable_key_t key, const HashTableSlot* slot)
 {
-    for (size_t i = 0; i < slot->entry_count; ++i)
+    for (HashTableEntry* entry = slot->entries; entry; entry = entry->next)
     {
-        HashTableEntry* entry = &slot->entries[i];
         if (entry->key == key)
             return entry;
     }
@@ -142,39 +143,32 @@ int hashtable_remove(hashtable_key_t key, HashTable* ht)
         return hash_res.error;
 
     HashTableSlot* slot = &ht->slots[hash_res.value];
-    HashTableEntry* entry = hashtable_find_entry(key, slot);
-    if (!entry)
-        return -ENOENT;
-
-    for (HashTableEntry* e = entry; e < slot->entries + slot->entry_count - 1;
-         ++e)
-        *e = *(e + 1);
-
-    if (slot->entry_count == 1)
-    {
-        kfree(slot->entries);
-        slot->entries = NULL;
-    }
-    else
+    for (HashTableEntry** link = &slot->entries; *link; link = &(*link)->next)
     {
-        slot->entries = krealloc(
-            slot->entries, (slot->entry_count - 1) * sizeof(HashTableEntry));
-        ASSERT(slot->entries);
+        HashTableEntry* entry = *link;
+        if (entry->key != key)
+            continue;
+
+        *link = entry->next;
+        kmalloc_cache_free(entry, &g_entry_cache);
+        --slot->entry_count;
+        return 0;
     }
 
-    --slot->entry_count;
-    return 0;
+    return -ENOENT;
 }
 
 void hashtable_destroy(HashTable* ht)
 {
     FOR_EACH_ELEM_IN_DARR (ht->slots, ht->slot_capacity, slot)
     {
-        if (!slot->entries)
-            continue;
+        while (slot->entries)
+        {
+            HashTableEntry* entry = slot->entries;
+            slot->entries = entry->next;
+            kmalloc_cache_free(entry, &g_entry_cache);
+        }
 
-        kfree(slot->entries);
-        slot->entries = NULL;
         slot->entry_count = 0;
     }
 
@@ -8,6 +8,9 @@
 #include <dxgmx/string.h>
 #include <dxgmx/utils/linkedlist.h>
 
+static KMallocCache g_node_cache =
+    KMALLOC_CACHE_INIT("linkedlist node", LinkedListNode);
+
 int linkedlist_init(LinkedList* ll)
 {
     memset(ll, 0, sizeof(LinkedList));
@@ -20,7 +23,7 @@ int linkedlist_add(void* data, LinkedList* ll)
     if (node)
     {
         /* Allocate next node */
-        node->next = kmalloc(sizeof(LinkedListNode));
+        node->next = kmalloc_cache_alloc(&g_node_cache);
         if (!node->next)
             return -ENOMEM;
 
@@ -28,7 +31,7 @@ int linkedlist_add(void* data, LinkedList* ll)
     }
     else
     {
-        ll->root = kmalloc(sizeof(LinkedListNode));
+        ll->root = kmalloc_cache_alloc(&g_node_cache);
         if (!ll->root)
             return -ENOMEM;
 
@@ -60,7 +63,7 @@ int linkedlist_remove_by_data(void* data, LinkedList* ll)
             else
                 ll->root = n->next;
 
-            kfree(n);
+            kmalloc_cache_free(n, &g_node_cache);
             return 0;
         }
 
@@ -93,7 +96,7 @@ int linkedlist_remove_by_position(size_t pos, LinkedList* ll)
         else
             ll->root = n->next;
 
-        kfree(n);
+        kmalloc_cache_free(n, &g_node_cache);
         return 0;
     }
 
@@ -0,0 +1,225 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/assert.h>
+#include <dxgmx/errno.h>
+#include <dxgmx/string.h>
+#include <dxgmx/utils/lz4.h>
+
+/* A block is a list of sequences. Each one starts with a token, whose high
+ * nibble is the literal count and low nibble the match length - 4. A nibble
+ * of 15 means more length bytes follow, which are added up until one is not
+ * 255. Then come the literals, and a little endian u16 offset back to where
+ * the match is copied from. The last sequence only has literals. */
+
+#define LZ4_MIN_MATCH 4
+/* The last 5 bytes are always literals. */
+#define LZ4_LAST_LITERALS 5
+/* A match can't start in the last 12 bytes. */
+#define LZ4_MFLIMIT 12
+#define LZ4_MAX_OFFSET 0xFFFF
+
+static u32 lz4_read32(const u8* p)
+{
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static u32 lz4_hash(u32 seq)
+{
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* How many bytes a length takes up outside of it's token nibble. */
+static size_t lz4_length_bytes(size_t len)
+{
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+/* Put 'len' in the token nibble at 'shift', and whatever doesn't fit in the
+ * bytes at 'op'. Returns where said bytes end. */
+static u8* lz4_put_length(size_t len, u8* token, u8 shift, u8* op)
+{
+    if (len < 15)
+    {
+        *token |= len << shift;
+        return op;
+    }
+
+    *token |= 15 << shift;
+    for (len -= 15; len >= 255; len -= 255)
+        *op++ = 255;
+
+    *op++ = len;
+    return op;
+}
+
+/* Add the length bytes at '*ip' to 'len'. Returns 0 on success. */
+static int lz4_get_length(const u8** ip, const u8* iend, size_t* len)
+{
+    u8 b;
+    do
+    {
+        if (*ip >= iend)
+            return -EINVAL;
+
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+/* Emit a sequence of the literals in [anchor, anchor + litlen), followed by a
+ * match, if 'matchlen' is not 0. Returns where the sequence ends, or NULL if
+ * it doesn't fit. */
+static u8* lz4_put_sequence(
+    const u8* anchor,
+    size_t litlen,
+    size_t off,
+    size_t matchlen,
+    u8* op,
+    const u8* oend)
+{
+    size_t size = 1 + lz4_length_bytes(litlen) + litlen;
+    if (matchlen)
+        size += 2 + lz4_length_bytes(matchlen - LZ4_MIN_MATCH);
+
+    if (size > (size_t)(oend - op))
+        return NULL;
+
+    u8* token = op++;
+    *token = 0;
+
+    op = lz4_put_length(litlen, token, 4, op);
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    if (!matchlen)
+        return op;
+
+    *op++ = off;
+    *op++ = off >> 8;
+    return lz4_put_length(matchlen - LZ4_MIN_MATCH, token, 0, op);
+}
+
+ssize_t lz4_compress(
+    const void* src, size_t n, void* dest, size_t cap, void* workspace)
+{
+    ASSERT(n <= LZ4_MAX_INPUT_SIZE);
+
+    const u8* const base = src;
+    const u8* const iend = base + n;
+    u8* op = dest;
+    const u8* const oend = op + cap;
+    u16* table = workspace;
+
+    const u8* ip = base;
+    const u8* anchor = base;
+
+    if (n >= LZ4_MFLIMIT)
+    {
+        const u8* const mflimit = iend - LZ4_MFLIMIT;
+        const u8* const matchlimit = iend - LZ4_LAST_LITERALS;
+
+        /* Empty entries point at the start, matches against it are checked
+         * like any other. */
+        memset(table, 0, LZ4_WORKSPACE_SIZE);
+
+        while (ip < mflimit)
+        {
+            const u32 seq = lz4_read32(ip);
+            const u32 h = lz4_hash(seq);
+            const u8* ref = base + table[h];
+            table[h] = ip - base;
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET ||
+                lz4_read32(ref) != seq)
+            {
+                ++ip;
+                continue;
+            }
+
+            size_t matchlen = LZ4_MIN_MATCH;
+            while (ip + matchlen < matchlimit && ip[matchlen] == ref[matchlen])
+                ++matchlen;
+
+            /* The match might have started earlier. */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                --ip;
+                --ref;
+                ++matchlen;
+            }
+
+            op = lz4_put_sequence(
+                anchor, ip - anchor, ip - ref, matchlen, op, oend);
+            if (!op)
+                return -ENOSPC;
+
+            ip += matchlen;
+            anchor = ip;
+        }
+    }
+
+    op = lz4_put_sequence(anchor, iend - anchor, 0, 0, op, oend);
+    if (!op)
+        return -ENOSPC;
+
+    return op - (u8*)dest;
+}
+
+ssize_t lz4_decompress(const void* src, size_t n, void* dest, size_t cap)
+{
+    const u8* ip = src;
+    const u8* const iend = ip + n;
+    u8* const start = dest;
+    u8* op = start;
+    const u8* const oend = op + cap;
+
+    while (ip < iend)
+    {
+        const u8 token = *ip++;
+
+        size_t litlen = token >> 4;
+        if (litlen == 15 && lz4_get_length(&ip, iend, &litlen) < 0)
+            return -EINVAL;
+
+        if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+            return -EINVAL;
+
+        memcpy(op, ip, litlen);
+        ip += litlen;
+        op += litlen;
+
+        /* The last sequence only has literals. */
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -EINVAL;
+
+        const size_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!off || off > (size_t)(op - start))
+            return -EINVAL;
+
+        size_t matchlen = token & 15;
+        if (matchlen == 15 && lz4_get_length(&ip, iend, &matchlen) < 0)
+            return -EINVAL;
+
+        matchlen += LZ4_MIN_MATCH;
+        if (matchlen > (size_t)(oend - op))
+            return -EINVAL;
+
+        /* The match can overlap what it's producing, so byte by byte. */
+        const u8* ref = op - off;
+        while (matchlen--)
+            *op++ = *ref++;
+    }
+
+    return op - start;
+}
@@ -0,0 +1,299 @@
+/**
+ * Copyright 2023 Alexandru Olaru.
+ * Distributed under the MIT license.
+ */
+
+#include <dxgmx/utils/rbtree.h>
+
+/* Leaves are NULL, and NULL is black. */
+static bool rbtree_is_red(const RBNode* node)
+{
+    return node && node->red;
+}
+
+/* Put 'new' where 'old' is under 'parent'. */
+static void
+rbtree_replace_child(RBNode* parent, RBNode* old, RBNode* new, RBTree* tree)
+{
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rbtree_rotate_left(RBNode* node, RBTree* tree)
+{
+    RBNode* right = node->right;
+
+    node->right = right->left;
+    if (right->left)
+        right->left->parent = node;
+
+    right->parent = node->parent;
+    rbtree_replace_child(node->parent, node, right, tree);
+
+    right->left = node;
+    node->parent = right;
+}
+
+static void rbtree_rotate_right(RBNode* node, RBTree* tree)
+{
+    RBNode* left = node->left;
+
+    node->left = left->right;
+    if (left->right)
+        left->right->parent = node;
+
+    left->parent = node->parent;
+    rbtree_replace_child(node->parent, node, left, tree);
+
+    left->right = node;
+    node->parent = left;
+}
+
+void rbtree_insert(RBNode* node, rbtree_less_t less, RBTree* tree)
+{
+    RBNode* parent = NULL;
+    RBNode** link = &tree->root;
+    bool leftmost = true;
+
+    while (*link)
+    {
+        parent = *link;
+        if (less(node, parent))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    *link = node;
+
+    if (leftmost)
+        tree->leftmost = node;
+
+    /* The only thing that can be wrong now is a red node with a red parent. */
+    while (rbtree_is_red(node->parent))
+    {
+        parent = node->parent;
+        /* A red node is never the root, so there's a grandparent. */
+        RBNode* gparent = parent->parent;
+
+        if (parent == gparent->left)
+        {
+            RBNode* uncle = gparent->right;
+            if (rbtree_is_red(uncle))
+            {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right)
+            {
+                rbtree_rotate_left(parent, tree);
+                parent = node;
+            }
+
+            parent->red = false;
+            gparent->red = true;
+            rbtree_rotate_right(gparent, tree);
+            break;
+        }
+        else
+        {
+            RBNode* uncle = gparent->left;
+            if (rbtree_is_red(uncle))
+            {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left)
+            {
+                rbtree_rotate_right(parent, tree);
+                parent = node;
+            }
+
+            parent->red = false;
+            gparent->red = true;
+            rbtree_rotate_left(gparent, tree);
+            break;
+        }
+    }
+
+    tree->root->red = false;
+}
+
+/* A black node has been taken out from above 'node', which sits under
+ * 'parent'. 'node' may be NULL, which is why 'parent' is passed in. */
+static void rbtree_remove_fixup(RBNode* node, RBNode* parent, RBTree* tree)
+{
+    while (node != tree->root && !rbtree_is_red(node))
+    {
+        if (node == parent->left)
+        {
+            RBNode* sibling = parent->right;
+            if (sibling->red)
+            {
+                sibling->red = false;
+                parent->red = true;
+                rbtree_rotate_left(parent, tree);
+                sibling = parent->right;
+            }
+
+            if (!rbtree_is_red(sibling->left) &&
+                !rbtree_is_red(sibling->right))
+            {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!rbtree_is_red(sibling->right))
+            {
+                sibling->left->red = false;
+                sibling->red = true;
+                rbtree_rotate_right(sibling, tree);
+                sibling = parent->right;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rbtree_rotate_left(parent, tree);
+        }
+        else
+        {
+            RBNode* sibling = parent->left;
+            if (sibling->red)
+            {
+                sibling->red = false;
+                parent->red = true;
+                rbtree_rotate_right(parent, tree);
+                sibling = parent->left;
+            }
+
+            if (!rbtree_is_red(sibling->left) &&
+                !rbtree_is_red(sibling->right))
+            {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!rbtree_is_red(sibling->left))
+            {
+                sibling->right->red = false;
+                sibling->red = true;
+                rbtree_rotate_left(sibling, tree);
+                sibling = parent->left;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rbtree_rotate_right(parent, tree);
+        }
+
+        node = tree->root;
+        break;
+    }
+
+    if (node)
+        node->red = false;
+}
+
+void rbtree_remove(RBNode* node, RBTree* tree)
+{
+    if (tree->leftmost == node)
+        tree->leftmost = rbtree_next(node);
+
+    RBNode* child;
+    RBNode* parent;
+    bool red;
+
+    if (node->left && node->right)
+    {
+        /* Put the next node in it's place, it has no left child. */
+        RBNode* next = node->right;
+        while (next->left)
+            next = next->left;
+
+        child = next->right;
+        parent = next->parent;
+        red = next->red;
+
+        if (parent == node)
+        {
+            parent = next;
+        }
+        else
+        {
+            if (child)
+                child->parent = parent;
+
+            parent->left = child;
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+        next->parent = node->parent;
+        next->red = node->red;
+        rbtree_replace_child(node->parent, node, next, tree);
+    }
+    else
+    {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        red = node->red;
+
+        if (child)
+            child->parent = parent;
+
+        rbtree_replace_child(parent, node, child, tree);
+    }
+
+    if (!red)
+        rbtree_remove_fixup(child, parent, tree);
+}
+
+RBNode* rbtree_first(const RBTree* tree)
+{
+    return tree->leftmost;
+}
+
+RBNode* rbtree_next(const RBNode* node)
+{
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+
+        return (RBNode*)node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+
+    return node->parent;
+}
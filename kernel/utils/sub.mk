@@ -5,4 +5,6 @@ kernel/utils/hashtable.c.o \
 kernel/utils/bitwise.c.o \
 kernel/utils/uuid.c.o \
 kernel/utils/linkedlist.c.o \
-kernel/utils/bitmap.c.o 
+kernel/utils/bitmap.c.o \
+kernel/utils/lz4.c.o \
+kernel/utils/rbtree.c.o 